@@ -0,0 +1,243 @@
+/*
+Adaptive concurrency controller (--adaptive)
+- -t runners are started, but only the first `limit` of them take urls; the others
+  park on frontier_empty, like runners waiting for the frontier
+- every runner reports the wall-clock and thread CPU time of each url it processes;
+  every ADAPTIVE_WINDOW_MS the controller turns them into throughput (urls/s), mean
+  time per url and cores busy, and moves the limit within [min, -t] by AIMD:
+  - congested (the mean time per url passed ADAPTIVE_LATENCY_FACTOR times its baseline,
+    i.e. the hosts queue our requests; or the runners keep ADAPTIVE_CPU_BUSY of the cores
+    busy): multiplicative decrease to 3/4 of the limit
+  - not congested, and every active runner had a url: additive increase by 1
+    (doubling in slow start, until congestion or until doubling stops paying off)
+  - runners waiting for urls: hold, more runners would only wait too
+- the baseline time per url is the lowest seen, drifting up slowly so that a crawl
+  moving on to slower hosts is not taken for congestion forever
+*/
+
+#include <time.h>
+#include <unistd.h>
+#include "adaptive.h"
+
+// whether adaptive_enable was called
+static bool enabled = false;
+static int min_limit = 1;
+static int max_limit = 1;
+// number of runners allowed to take urls
+static int limit = 1;
+static ADAPTIVE_HOOKS hooks;
+static pthread_t controller_thread;
+static bool stopping = false;
+static ADAPTIVE_STATS stats;
+static double sum_limit = 0;
+
+// totals of the current window, reset by the controller
+static uint64_t window_urls = 0;
+static uint64_t window_wall_us = 0;
+static uint64_t window_cpu_us = 0;
+
+/**
+ * @brief current time of a clock
+ * @param clock clockid_t: the clock
+ * @return us
+ */
+static uint64_t clock_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief set the limit, waking parked runners if it went up
+ * @param new_limit int: the new limit (within [min_limit, max_limit])
+ */
+static void set_limit(int new_limit)
+{
+    int old = __atomic_exchange_n(&limit, new_limit, __ATOMIC_ACQ_REL);
+    if (new_limit > old)
+    {
+        ++stats.increases;
+        hooks.wake();
+    }
+    else if (new_limit < old)
+    {
+        ++stats.decreases;
+    }
+    if (new_limit > stats.max_limit)
+    {
+        stats.max_limit = new_limit;
+    }
+}
+
+/**
+ * @brief controller thread: moves the limit once per window
+ * @param _ void*: not used
+ * @return NULL
+ */
+static void *controller_main(void *_)
+{
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+    {
+        cores = 1;
+    }
+    bool slow_start = true;
+    bool increased = false;
+    double base_latency_us = 0;
+    double last_throughput = 0;
+    uint64_t window_start = clock_us(CLOCK_MONOTONIC);
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        usleep(ADAPTIVE_WINDOW_MS * 1000);
+
+        /* -- Measure the window -- */
+        uint64_t now = clock_us(CLOCK_MONOTONIC);
+        double elapsed_us = now - window_start;
+        window_start = now;
+        uint64_t urls = __atomic_exchange_n(&window_urls, 0, __ATOMIC_ACQ_REL);
+        uint64_t wall_us = __atomic_exchange_n(&window_wall_us, 0, __ATOMIC_ACQ_REL);
+        uint64_t cpu_us = __atomic_exchange_n(&window_cpu_us, 0, __ATOMIC_ACQ_REL);
+        int cur = __atomic_load_n(&limit, __ATOMIC_ACQUIRE);
+        ++stats.windows;
+        sum_limit += cur;
+        if (urls == 0)
+        {
+            // nothing finished (e.g. a few slow fetches): nothing to judge by
+            continue;
+        }
+        double throughput = urls * 1000000. / elapsed_us;
+        double latency_us = (double)wall_us / urls;
+        double cores_busy = cpu_us / elapsed_us;
+        if (throughput > stats.max_throughput)
+        {
+            stats.max_throughput = throughput;
+        }
+        if (base_latency_us == 0 || latency_us < base_latency_us)
+        {
+            base_latency_us = latency_us;
+        }
+        else
+        {
+            base_latency_us += (latency_us - base_latency_us) / 32;
+        }
+        /* ----------------- */
+
+        /* -- Decide -- */
+        bool congested = latency_us > ADAPTIVE_LATENCY_FACTOR * base_latency_us || cores_busy >= ADAPTIVE_CPU_BUSY * cores;
+        if (increased && throughput < last_throughput * (1 + ADAPTIVE_MIN_GAIN))
+        {
+            // the last doubling didn't pay off: probe one runner at a time from here
+            slow_start = false;
+        }
+        increased = false;
+        if (congested)
+        {
+            slow_start = false;
+            int next = cur * 3 / 4;
+            set_limit(next < min_limit ? min_limit : next);
+        }
+        else if (hooks.starved() == 0 && cur < max_limit)
+        {
+            int next = slow_start ? cur * 2 : cur + 1;
+            set_limit(next > max_limit ? max_limit : next);
+            increased = true;
+        }
+        last_throughput = throughput;
+        /* ----------------- */
+    }
+    return NULL;
+}
+
+/**
+ * @brief start the controller
+ * @param min_runners int: fewest runners to keep active (>= 1)
+ * @param max_runners int: number of runners started (-t)
+ * @param hook_fns const ADAPTIVE_HOOKS*: (pointer to) what the controller needs from the crawl
+ * @return 0 on success; 1 otherwise
+ * @details
+ * The crawl starts with min_runners active.
+ */
+int adaptive_enable(int min_runners, int max_runners, const ADAPTIVE_HOOKS *hook_fns)
+{
+    if (min_runners < 1 || min_runners > max_runners)
+    {
+        return 1;
+    }
+    min_limit = min_runners;
+    max_limit = max_runners;
+    limit = min_runners;
+    hooks = *hook_fns;
+    memset(&stats, 0, sizeof(stats));
+    stats.max_limit = limit;
+    sum_limit = 0;
+    stopping = false;
+    if (pthread_create(&controller_thread, NULL, controller_main, NULL) != 0)
+    {
+        return 1;
+    }
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief whether a runner is parked by the controller
+ * @param id size_t: index of the runner (0 to -t - 1)
+ * @return true if the runner should not take urls (never, if the controller is off)
+ */
+bool adaptive_parked(size_t id)
+{
+    return enabled && id >= (size_t)__atomic_load_n(&limit, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief note the start of processing a url
+ * @param sample ADAPTIVE_SAMPLE*: (pointer to) the sample to start
+ */
+void adaptive_url_start(ADAPTIVE_SAMPLE *sample)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    sample->wall_us = clock_us(CLOCK_MONOTONIC);
+    sample->cpu_us = clock_us(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/**
+ * @brief note the end of processing a url, adding its times to the window
+ * @param sample ADAPTIVE_SAMPLE*: (pointer to) the sample started by adaptive_url_start
+ */
+void adaptive_url_done(ADAPTIVE_SAMPLE *sample)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    __atomic_add_fetch(&window_wall_us, clock_us(CLOCK_MONOTONIC) - sample->wall_us, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&window_cpu_us, clock_us(CLOCK_THREAD_CPUTIME_ID) - sample->cpu_us, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&window_urls, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief stop the controller
+ * @param stats_out ADAPTIVE_STATS*: (pointer to) where to put the statistics (may be NULL)
+ */
+void adaptive_stop(ADAPTIVE_STATS *stats_out)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_join(controller_thread, NULL);
+    enabled = false;
+
+    stats.final_limit = limit;
+    stats.mean_limit = stats.windows > 0 ? sum_limit / stats.windows : limit;
+    if (stats_out != NULL)
+    {
+        *stats_out = stats;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+Adaptive concurrency: a controller thread that sizes the number of active runners from observed latency, CPU time and throughput
+*/
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define ADAPTIVE_WINDOW_MS 250       /* the controller decides once per window */
+#define ADAPTIVE_LATENCY_FACTOR 2.0  /* congested once the mean time per url is this many times the baseline */
+#define ADAPTIVE_CPU_BUSY 0.9        /* congested once this fraction of the cores is busy in the runners */
+#define ADAPTIVE_MIN_GAIN 0.05       /* an increase that raised throughput by less than this ends slow start */
+
+// what the controller needs from the crawl
+typedef struct adaptive_hooks
+{
+    // wake parked runners (the limit went up)
+    void (*wake)(void);
+    // number of active (not parked) runners waiting for a url
+    size_t (*starved)(void);
+} ADAPTIVE_HOOKS;
+
+// one url processed by a runner
+typedef struct adaptive_sample
+{
+    uint64_t wall_us;
+    uint64_t cpu_us;
+} ADAPTIVE_SAMPLE;
+
+typedef struct adaptive_stats
+{
+    // windows decided, and how often the limit went up and down
+    size_t windows;
+    size_t increases;
+    size_t decreases;
+    // limit at the end, the highest limit, and the mean limit over the windows
+    int final_limit;
+    int max_limit;
+    double mean_limit;
+    // highest throughput seen in a window (urls/s)
+    double max_throughput;
+} ADAPTIVE_STATS;
+
+int adaptive_enable(int min_runners, int max_runners, const ADAPTIVE_HOOKS *hooks);
+bool adaptive_parked(size_t id);
+void adaptive_url_start(ADAPTIVE_SAMPLE *sample);
+void adaptive_url_done(ADAPTIVE_SAMPLE *sample);
+void adaptive_stop(ADAPTIVE_STATS *stats);
+
+#endif
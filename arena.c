@@ -0,0 +1,422 @@
+/*
+A thread-local bump arena used as libxml2's allocator while pages are parsed
+- arena_install routes every libxml2 allocation through this file
+- between arena_begin and arena_end, allocations made by the calling thread are
+  bumped out of that thread's arena; arena_end resets the arena wholesale, so a
+  page's document tree costs a handful of pointer bumps instead of thousands of
+  malloc/free calls on a shared heap
+- small blocks freed during a page go on per-size free lists and are reused within
+  the page, so temporaries (e.g. from xmlBuildURI on every link) do not pile up
+- outside of that window allocations go to malloc as usual
+- every block carries a small header saying where it came from, so memory allocated
+  outside a page (e.g. by xmlInitParser) can still be freed after the arena is installed
+*/
+
+#include <stdint.h>
+#include <libxml/xmlmemory.h>
+#include <libxml/xmlerror.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_SMALL_MAX 512 /* blocks up to this size are recycled through free lists */
+#define ARENA_NUM_CLASSES (ARENA_SMALL_MAX / ARENA_ALIGN)
+#define KIND_HEAP 0x68656170UL  /* "heap" */
+#define KIND_ARENA 0x6172656eUL /* "aren" */
+
+typedef struct arena_header
+{
+    // requested size of the block
+    size_t size;
+    // KIND_HEAP or KIND_ARENA
+    size_t kind;
+} ARENA_HEADER;
+
+typedef struct arena_chunk
+{
+    // next chunk in the arena
+    struct arena_chunk *next;
+    // usable bytes in the chunk
+    size_t size;
+    // bytes handed out from the chunk since the last reset
+    size_t used;
+    // padding so the data that follows is aligned
+    size_t pad;
+} ARENA_CHUNK;
+
+typedef struct arena
+{
+    // first chunk of the arena
+    ARENA_CHUNK *head;
+    // chunk allocations are currently bumped out of
+    ARENA_CHUNK *cur;
+    // most recent block, which realloc can grow in place
+    ARENA_HEADER *last;
+    // freed small blocks by size class (class i holds blocks of (i + 1) * ARENA_ALIGN bytes)
+    ARENA_HEADER *free_lists[ARENA_NUM_CLASSES];
+    // bytes handed out since the last reset, including headers
+    size_t used;
+    // whether allocations go to the arena
+    bool active;
+} ARENA;
+
+// the calling thread's arena
+static __thread ARENA thread_arena;
+// whether arena_install was called
+static bool installed = false;
+// per-page high-water marks of all threads
+static ARENA_STATS stats;
+
+/**
+ * @brief round a size up to the arena alignment
+ * @param n size_t: size to round
+ * @return n rounded up to a multiple of ARENA_ALIGN
+ */
+static size_t align_up(size_t n)
+{
+    return (n + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+}
+
+/**
+ * @brief get the header of a block handed to libxml2
+ * @param ptr void*: block
+ * @return (pointer to) the block's header
+ */
+static ARENA_HEADER *header_of(void *ptr)
+{
+    return (ARENA_HEADER *)((char *)ptr - sizeof(ARENA_HEADER));
+}
+
+/**
+ * @brief bump a block out of the calling thread's arena
+ * @param size size_t: requested size
+ * @return (pointer to) the header of the block; NULL if out of memory
+ */
+static ARENA_HEADER *bump(size_t size)
+{
+    ARENA *a = &thread_arena;
+    size_t total = align_up(sizeof(ARENA_HEADER) + size);
+
+    // reuse a freed block of the same size class
+    if (size > 0 && size <= ARENA_SMALL_MAX)
+    {
+        size_t cls = align_up(size) / ARENA_ALIGN - 1;
+        ARENA_HEADER *hdr = a->free_lists[cls];
+        if (hdr != NULL)
+        {
+            a->free_lists[cls] = *(ARENA_HEADER **)(hdr + 1);
+            hdr->size = size;
+            return hdr;
+        }
+    }
+
+    // move on to the next retained chunk, or add one, until the block fits
+    while (a->cur == NULL || a->cur->size - a->cur->used < total)
+    {
+        if (a->cur != NULL && a->cur->next != NULL)
+        {
+            a->cur = a->cur->next;
+            continue;
+        }
+        size_t chunk_size = total > ARENA_CHUNK_SIZE ? total : ARENA_CHUNK_SIZE;
+        ARENA_CHUNK *chunk = malloc(sizeof(ARENA_CHUNK) + chunk_size);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        chunk->next = NULL;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        if (a->cur == NULL)
+        {
+            a->head = chunk;
+        }
+        else
+        {
+            a->cur->next = chunk;
+        }
+        a->cur = chunk;
+    }
+
+    ARENA_HEADER *hdr = (ARENA_HEADER *)((char *)(a->cur + 1) + a->cur->used);
+    a->cur->used += total;
+    a->used += total;
+    hdr->size = size;
+    hdr->kind = KIND_ARENA;
+    a->last = hdr;
+    return hdr;
+}
+
+/**
+ * @brief libxml2 malloc function
+ * @param size size_t: requested size
+ * @return block on success; NULL otherwise
+ */
+static void *arena_malloc(size_t size)
+{
+    ARENA_HEADER *hdr;
+
+    if (thread_arena.active)
+    {
+        hdr = bump(size);
+    }
+    else
+    {
+        hdr = malloc(sizeof(ARENA_HEADER) + size);
+        if (hdr != NULL)
+        {
+            hdr->size = size;
+            hdr->kind = KIND_HEAP;
+        }
+    }
+    return hdr == NULL ? NULL : hdr + 1;
+}
+
+/**
+ * @brief libxml2 free function
+ * @param ptr void*: block to free
+ * @details
+ * Small arena blocks go on their size class's free list; large ones are only
+ *  released when the arena is reset.
+ */
+static void arena_free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    ARENA_HEADER *hdr = header_of(ptr);
+    if (hdr->kind == KIND_HEAP)
+    {
+        free(hdr);
+        return;
+    }
+
+    ARENA *a = &thread_arena;
+    if (a->active && hdr->size > 0 && hdr->size <= ARENA_SMALL_MAX)
+    {
+        size_t cls = align_up(hdr->size) / ARENA_ALIGN - 1;
+        // the block is now sized by its class, so it can no longer be grown in place
+        hdr->size = (cls + 1) * ARENA_ALIGN;
+        if (hdr == a->last)
+        {
+            a->last = NULL;
+        }
+        *(ARENA_HEADER **)ptr = a->free_lists[cls];
+        a->free_lists[cls] = hdr;
+    }
+}
+
+/**
+ * @brief libxml2 realloc function
+ * @param ptr void*: block to resize
+ * @param size size_t: new size
+ * @return resized block on success; NULL otherwise
+ * @details
+ * Heap blocks stay on the heap (they may outlive the page). Arena blocks are grown
+ *  in place if they are the most recent block of their chunk, and copied otherwise.
+ */
+static void *arena_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return arena_malloc(size);
+    }
+
+    ARENA_HEADER *hdr = header_of(ptr);
+    if (hdr->kind == KIND_HEAP)
+    {
+        ARENA_HEADER *q = realloc(hdr, sizeof(ARENA_HEADER) + size);
+        if (q == NULL)
+        {
+            return NULL;
+        }
+        q->size = size;
+        return q + 1;
+    }
+
+    ARENA *a = &thread_arena;
+    if (a->active && hdr == a->last)
+    {
+        size_t old_total = align_up(sizeof(ARENA_HEADER) + hdr->size);
+        size_t new_total = align_up(sizeof(ARENA_HEADER) + size);
+        if (new_total <= old_total || a->cur->size - a->cur->used >= new_total - old_total)
+        {
+            if (new_total > old_total)
+            {
+                a->cur->used += new_total - old_total;
+                a->used += new_total - old_total;
+            }
+            hdr->size = size;
+            return ptr;
+        }
+    }
+
+    void *q = arena_malloc(size);
+    if (q == NULL)
+    {
+        return NULL;
+    }
+    memcpy(q, ptr, hdr->size < size ? hdr->size : size);
+    return q;
+}
+
+/**
+ * @brief libxml2 strdup function
+ * @param str const char*: string to copy
+ * @return copy on success; NULL otherwise
+ */
+static char *arena_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arena_malloc(len);
+    if (copy != NULL)
+    {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+/**
+ * @brief make the arena libxml2's allocator
+ * @return 0 on success; non-zero otherwise
+ * @note must be called before any other libxml2 function (including xmlInitParser)
+ */
+int arena_install()
+{
+    if (xmlGcMemSetup(arena_free, arena_malloc, arena_malloc, arena_realloc, arena_strdup) != 0)
+    {
+        return 1;
+    }
+    installed = true;
+    return 0;
+}
+
+/**
+ * @brief returns whether arena_install was called
+ * @return true if libxml2 allocates through the arena
+ */
+bool arena_installed()
+{
+    return installed;
+}
+
+/**
+ * @brief start allocating libxml2 memory from the calling thread's arena
+ * @details does nothing if the arena is not installed
+ */
+void arena_begin()
+{
+    if (!installed)
+    {
+        return;
+    }
+    thread_arena.active = true;
+}
+
+/**
+ * @brief stop allocating from the calling thread's arena and reset it
+ * @return number of bytes the arena handed out since arena_begin (the page's high-water mark)
+ * @details
+ * Nothing allocated since arena_begin may be used after this call. libxml2 keeps
+ *  a copy of the last parse error in thread-local state, so that is reset first.
+ * Chunks are kept for the next page, up to ARENA_RETAIN_SIZE bytes. That includes
+ *  the first chunk: one sized for a huge block is freed too, and the next page
+ *  starts with a fresh ARENA_CHUNK_SIZE chunk.
+ */
+size_t arena_end()
+{
+    ARENA *a = &thread_arena;
+
+    if (!installed || !a->active)
+    {
+        return 0;
+    }
+
+    xmlResetLastError();
+    a->active = false;
+
+    size_t high_water = a->used;
+    size_t retained = 0;
+    ARENA_CHUNK *prev = NULL;
+    ARENA_CHUNK *chunk = a->head;
+    while (chunk != NULL)
+    {
+        ARENA_CHUNK *next = chunk->next;
+        if (retained + chunk->size > ARENA_RETAIN_SIZE)
+        {
+            if (prev == NULL)
+            {
+                a->head = NULL;
+            }
+            else
+            {
+                prev->next = NULL;
+            }
+            while (chunk != NULL)
+            {
+                next = chunk->next;
+                free(chunk);
+                chunk = next;
+            }
+            break;
+        }
+        retained += chunk->size;
+        chunk->used = 0;
+        prev = chunk;
+        chunk = next;
+    }
+    a->cur = a->head;
+    a->last = NULL;
+    a->used = 0;
+    memset(a->free_lists, 0, sizeof(a->free_lists));
+
+    // record the page's high-water mark
+    size_t bucket = 0;
+    while (bucket + 1 < ARENA_HIST_BUCKETS && (high_water >> 10) >= ((size_t)1 << bucket))
+    {
+        ++bucket;
+    }
+    __atomic_add_fetch(&stats.pages, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.total_bytes, high_water, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.hist[bucket], 1, __ATOMIC_RELAXED);
+    size_t max = __atomic_load_n(&stats.max_bytes, __ATOMIC_RELAXED);
+    while (high_water > max &&
+           !__atomic_compare_exchange_n(&stats.max_bytes, &max, high_water, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+
+    return high_water;
+}
+
+/**
+ * @brief free the calling thread's arena; call before the thread exits
+ */
+void arena_thread_cleanup()
+{
+    ARENA *a = &thread_arena;
+    ARENA_CHUNK *chunk = a->head;
+
+    while (chunk != NULL)
+    {
+        ARENA_CHUNK *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    memset(a, 0, sizeof(ARENA));
+}
+
+/**
+ * @brief get the per-page high-water marks recorded so far
+ * @param out ARENA_STATS*: (pointer to) stats to be populated
+ */
+void arena_get_stats(ARENA_STATS *out)
+{
+    out->pages = __atomic_load_n(&stats.pages, __ATOMIC_RELAXED);
+    out->total_bytes = __atomic_load_n(&stats.total_bytes, __ATOMIC_RELAXED);
+    out->max_bytes = __atomic_load_n(&stats.max_bytes, __ATOMIC_RELAXED);
+    for (int i = 0; i < ARENA_HIST_BUCKETS; ++i)
+    {
+        out->hist[i] = __atomic_load_n(&stats.hist[i], __ATOMIC_RELAXED);
+    }
+}
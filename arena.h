@@ -0,0 +1,37 @@
+/*
+A thread-local bump arena used as libxml2's allocator while pages are parsed
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define ARENA_CHUNK_SIZE 262144   /* 256K */
+#define ARENA_RETAIN_SIZE 4194304 /* 4M: chunks beyond this are freed on reset */
+#define ARENA_HIST_BUCKETS 16     /* high-water marks from <1K to >=16M in powers of 2 */
+
+typedef struct arena_stats
+{
+    // number of pages parsed in an arena
+    size_t pages;
+    // sum of the per-page high-water marks in bytes
+    size_t total_bytes;
+    // largest per-page high-water mark in bytes
+    size_t max_bytes;
+    // per-page high-water marks: bucket i > 0 counts pages that used [2^(i-1) K, 2^i K) bytes;
+    //  bucket 0 counts pages under 1K and the last bucket everything above its lower bound
+    size_t hist[ARENA_HIST_BUCKETS];
+} ARENA_STATS;
+
+int arena_install();
+bool arena_installed();
+void arena_begin();
+size_t arena_end();
+void arena_thread_cleanup();
+void arena_get_stats(ARENA_STATS *stats);
+
+#endif
@@ -0,0 +1,78 @@
+#!/bin/sh
+# End-to-end crawl benchmark against a local synthetic site (bench/websim)
+# - starts websim, crawls it with findpng2 once per thread count, and stops it
+# - reports urls crawled, throughput (urls/s) and time to find -m pngs
+# - extra arguments are passed to findpng2 (e.g. `bench/bench.sh -e scan -P 1`)
+#
+# Environment (defaults in brackets):
+#   BENCH_THREADS  thread counts to run [1 4 16]
+#   BENCH_M        pngs to find (-m) [200]
+#   BENCH_SITE     websim options [-s 1 -n 5000 -f 8 -r 10 -i 10 -b 4096 -l 2 -j 2 -e 1]
+#   BENCH_PORT     port websim listens on [8099]
+#   BENCH_SERVER   websim, or nghttpd to write the site with `websim -w` and serve it over
+#                  cleartext http/2 (h2c, e.g. `make bench-h2c`); nghttpd adds no latency [websim]
+
+set -e
+
+cd "$(dirname "$0")/.."
+ROOT=$(pwd)
+THREADS=${BENCH_THREADS:-"1 4 16"}
+M=${BENCH_M:-200}
+SITE=${BENCH_SITE:-"-s 1 -n 5000 -f 8 -r 10 -i 10 -b 4096 -l 2 -j 2 -e 1"}
+PORT=${BENCH_PORT:-8099}
+SERVER=${BENCH_SERVER:-websim}
+
+if [ ! -x "$ROOT/findpng2" ] || [ ! -x "$ROOT/bench/websim" ]; then
+    echo "bench: build first (make bench)" >&2
+    exit 1
+fi
+
+# findpng2 writes its output files to the working directory
+WORK=$(mktemp -d)
+if [ "$SERVER" = nghttpd ]; then
+    if ! command -v nghttpd > /dev/null; then
+        echo "bench: nghttpd not found" >&2
+        exit 1
+    fi
+    "$ROOT/bench/websim" -w "$WORK/site" $SITE > "$WORK/websim.log"
+    nghttpd --no-tls -d "$WORK/site" "$PORT" > "$WORK/server.log" 2>&1 &
+else
+    "$ROOT/bench/websim" -p "$PORT" $SITE > "$WORK/server.log" 2>&1 &
+fi
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2> /dev/null; rm -rf "$WORK"' EXIT INT TERM
+
+# wait for the server to listen
+READY=
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    if [ "$SERVER" = nghttpd ]; then
+        curl -s -o /dev/null --http2-prior-knowledge "http://127.0.0.1:$PORT/" && READY=1
+    else
+        grep -q serving "$WORK/server.log" && READY=1
+    fi
+    if [ -n "$READY" ]; then
+        break
+    fi
+    sleep 0.1
+done
+if [ -z "$READY" ]; then
+    cat "$WORK/server.log" >&2
+    exit 1
+fi
+
+echo "bench: $SERVER $SITE, -m $M, findpng2 options: $*"
+printf "%8s %8s %8s %10s %12s\n" threads urls pngs "urls/s" "time-to-m"
+for T in $THREADS; do
+    (cd "$WORK" && "$ROOT/findpng2" -t "$T" -m "$M" "$@" "http://127.0.0.1:$PORT/" > out.txt)
+    URLS=$(grep -c '^URL: ' "$WORK/out.txt" || true)
+    PNGS=$(wc -l < "$WORK/png_urls.txt")
+    SECONDS_TAKEN=$(sed -n 's/^findpng2 execution time: \([0-9.]*\) seconds$/\1/p' "$WORK/out.txt")
+    # a crawl that runs out of urls before -m pngs has no time-to-m
+    if [ "$PNGS" -ge "$M" ]; then
+        TIME_TO_M="${SECONDS_TAKEN}s"
+    else
+        TIME_TO_M="-"
+    fi
+    printf "%8s %8s %8s %10.1f %12s\n" "$T" "$URLS" "$PNGS" \
+        "$(echo "$URLS $SECONDS_TAKEN" | awk '{ print ($2 > 0) ? $1 / $2 : 0 }')" "$TIME_TO_M"
+done
@@ -0,0 +1,138 @@
+/*
+Differential test of the link scanner (-e scan) against libxml2 (-e xml) over html fixtures
+- every file named on the command line is extracted by find_http and by scan_http, with the
+  same base url, and the page and image stacks must hold the same urls in the same order
+- a page scan_http gives up on (SCAN_MALFORMED) is a fallback, not a mismatch: the crawler
+  parses it with find_http then, so only the pages the scanner accepts must match
+- exits 1 if any page mismatched (or could not be read), so `make linkdiff` fails
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../curl_xml.h"
+#include "../link_scan.h"
+
+#define BASE_URL "http://fixture.test/dir/page.html"
+
+/**
+ * @brief read a whole file
+ * @param path const char*: path of the file
+ * @param size_p size_t*: (pointer to) number to be set with the size of the file
+ * @return the contents (free with free); NULL if the file could not be read
+ */
+static char *read_file(const char *path, size_t *size_p)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    char *buf = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t n;
+    do
+    {
+        if (size == capacity)
+        {
+            capacity = capacity == 0 ? 4096 : 2 * capacity;
+            char *p = realloc(buf, capacity);
+            if (p == NULL)
+            {
+                free(buf);
+                fclose(f);
+                return NULL;
+            }
+            buf = p;
+        }
+        n = fread(buf + size, 1, capacity - size, f);
+        size += n;
+    } while (n > 0);
+    fclose(f);
+    *size_p = size;
+    return buf;
+}
+
+/**
+ * @brief print the differences between the urls the two extractors found
+ * @param path const char*: the fixture
+ * @param kind const char*: "page" or "image"
+ * @param xml STACK*: (pointer to) the urls find_http found
+ * @param scan STACK*: (pointer to) the urls scan_http found
+ * @return number of positions where the stacks differ
+ */
+static size_t diff_stacks(const char *path, const char *kind, STACK *xml, STACK *scan)
+{
+    size_t n_xml = num_elements_stack(xml);
+    size_t n_scan = num_elements_stack(scan);
+    size_t n = n_xml > n_scan ? n_xml : n_scan;
+    size_t differences = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const char *x = i < n_xml ? xml->items[i] : "(none)";
+        const char *s = i < n_scan ? scan->items[i] : "(none)";
+        if (strcmp(x, s) != 0)
+        {
+            printf("  %s: %s link %zu: xml %s, scan %s\n", path, kind, i, x, s);
+            ++differences;
+        }
+    }
+    return differences;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s FILE.html...\n", argv[0]);
+        return 1;
+    }
+
+    size_t matched = 0;
+    size_t fallbacks = 0;
+    size_t failed = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        size_t size;
+        char *buf = read_file(argv[i], &size);
+        if (buf == NULL)
+        {
+            printf("FAIL %s: can't read it\n", argv[i]);
+            ++failed;
+            continue;
+        }
+
+        STACK xml_pages, xml_imgs, scan_pages, scan_imgs;
+        init_stack(&xml_pages, 1);
+        init_stack(&xml_imgs, 1);
+        init_stack(&scan_pages, 1);
+        init_stack(&scan_imgs, 1);
+        find_http(buf, size, 1, BASE_URL, &xml_pages, &xml_imgs);
+        if (scan_http(buf, size, 1, BASE_URL, &scan_pages, &scan_imgs) != SCAN_OK)
+        {
+            printf("ok   %s: scanner falls back to libxml2 (%zu page and %zu image links)\n", argv[i],
+                   num_elements_stack(&xml_pages), num_elements_stack(&xml_imgs));
+            ++fallbacks;
+        }
+        else if (diff_stacks(argv[i], "page", &xml_pages, &scan_pages) + diff_stacks(argv[i], "image", &xml_imgs, &scan_imgs) > 0)
+        {
+            printf("FAIL %s: the extractors disagree\n", argv[i]);
+            ++failed;
+        }
+        else
+        {
+            printf("ok   %s: %zu page and %zu image links\n", argv[i], num_elements_stack(&xml_pages),
+                   num_elements_stack(&xml_imgs));
+            ++matched;
+        }
+        cleanup_stack(&xml_pages);
+        cleanup_stack(&xml_imgs);
+        cleanup_stack(&scan_pages);
+        cleanup_stack(&scan_imgs);
+        free(buf);
+    }
+
+    printf("linkdiff: %zu pages matched, %zu fell back to libxml2, %zu failed\n", matched, fallbacks, failed);
+    return failed > 0 ? 1 : 0;
+}
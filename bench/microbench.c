@@ -0,0 +1,547 @@
+/*
+Microbenchmarks for the STACK, PSTACK and HSET operations on every url's path
+- keys are generated urls whose lengths follow a realistic, long-tailed distribution
+- malloc, calloc, realloc and free are interposed to count allocations and live bytes,
+  including allocations made inside libc (e.g. by hsearch)
+- only the public API (stack.h, p_stack.h, hash.h) is used, so a replacement can be
+  measured by linking it instead of the current implementation (MICROBENCH_IMPL in the Makefile)
+- the contended benchmarks share one structure between threads behind a mutex,
+  the way findpng2 shares the frontier and the visited set
+- before timing anything, content_hash.c's XXH64 is checked against known answers (from the
+  reference xxHash library), fed whole and in pieces; a mismatch fails the run with status 1
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <time.h>
+#include "../stack.h"
+#include "../hash.h"
+#include "../content_hash.h"
+
+#define DEFAULT_NUM_KEYS 10000 /* hsearch ops get slower as the set fills, so larger runs take minutes */
+#define DEFAULT_NUM_THREADS 4
+#define HSET_INITIAL_SIZE 1024 /* same as findpng2's HMAP_SIZE */
+
+/* -- Allocation counting -- */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+// number of allocations (malloc, calloc, and realloc of NULL)
+static uint64_t num_allocs = 0;
+// bytes currently allocated (usable size)
+static int64_t live_bytes = 0;
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    if (ptr != NULL)
+    {
+        __atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&live_bytes, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+    if (ptr != NULL)
+    {
+        __atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&live_bytes, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (new_ptr != NULL || size == 0)
+    {
+        if (ptr == NULL)
+        {
+            __atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&live_bytes, (new_ptr != NULL ? malloc_usable_size(new_ptr) : 0) - old_size,
+                           __ATOMIC_RELAXED);
+    }
+    return new_ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL)
+    {
+        __atomic_sub_fetch(&live_bytes, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    }
+    __libc_free(ptr);
+}
+/* ----------------- */
+
+// a point in time, for measuring a benchmark
+typedef struct mark
+{
+    uint64_t ns;
+    uint64_t allocs;
+    int64_t bytes;
+} MARK;
+
+static char **keys = NULL;
+static char **missing_keys = NULL;
+static size_t num_keys = DEFAULT_NUM_KEYS;
+static int num_threads = DEFAULT_NUM_THREADS;
+
+/**
+ * @brief current time of the monotonic clock
+ * @return time in ns
+ */
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief record the current time, allocation count and live bytes
+ * @return the mark
+ */
+static MARK mark()
+{
+    MARK m = {now_ns(), __atomic_load_n(&num_allocs, __ATOMIC_RELAXED), __atomic_load_n(&live_bytes, __ATOMIC_RELAXED)};
+    return m;
+}
+
+/**
+ * @brief print the cost per operation since a mark
+ * @param name const char*: name of the benchmark
+ * @param start MARK: mark taken before the benchmark
+ * @param ops size_t: number of operations the benchmark made
+ * @param entries size_t: entries held after the benchmark (0: don't print bytes per entry)
+ */
+static void report(const char *name, MARK start, size_t ops, size_t entries)
+{
+    MARK end = mark();
+    printf("%-34s %10.1f ns/op %8.2f allocs/op", name, (double)(end.ns - start.ns) / ops,
+           (double)(end.allocs - start.allocs) / ops);
+    if (entries > 0)
+    {
+        printf(" %10.1f bytes/entry", (double)(end.bytes - start.bytes) / entries);
+    }
+    printf("\n");
+}
+
+/**
+ * @brief xorshift64* pseudo-random generator
+ * @param state uint64_t*: (pointer to) the generator state
+ * @return pseudo-random value
+ */
+static uint64_t next_rand(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * @brief generate a url shaped like the ones a crawl sees
+ * @param state uint64_t*: (pointer to) the generator state
+ * @param i size_t: makes the url unique
+ * @return the url (to be freed by the caller)
+ * @details
+ * Most urls are 40 to 100 bytes, with a long tail of deep paths and queries
+ *  up to several hundred bytes.
+ */
+static char *make_url(uint64_t *state, size_t i)
+{
+    static const char *segments[] = {"img", "static", "assets", "2023", "blog", "posts", "products", "category",
+                                     "media", "uploads", "thumbnails", "en", "docs", "archive", "gallery", "lab4"};
+    char url[1024];
+    int len = sprintf(url, "http://www%d.example%d.com", (int)(next_rand(state) % 4), (int)(next_rand(state) % 50));
+
+    // 1 to 3 segments usually, up to 12 in the tail
+    int depth = 1 + next_rand(state) % 3;
+    if (next_rand(state) % 10 == 0)
+    {
+        depth += next_rand(state) % 10;
+    }
+    for (int d = 0; d < depth; ++d)
+    {
+        len += sprintf(url + len, "/%s", segments[next_rand(state) % 16]);
+    }
+    len += sprintf(url + len, "/page-%zu.%s", i, next_rand(state) % 4 == 0 ? "png" : "html");
+
+    // a query on one url in five, sometimes a long one
+    if (next_rand(state) % 5 == 0)
+    {
+        int params = 1 + (next_rand(state) % 4 == 0 ? next_rand(state) % 12 : 0);
+        for (int q = 0; q < params; ++q)
+        {
+            len += sprintf(url + len, "%cp%d=%lx", q == 0 ? '?' : '&', q, (unsigned long)next_rand(state));
+        }
+    }
+    return strdup(url);
+}
+
+/**
+ * @brief generate the keys used by all benchmarks
+ */
+static void make_keys()
+{
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t total_len = 0, max_len = 0;
+
+    keys = __libc_malloc(num_keys * sizeof(char *));
+    missing_keys = __libc_malloc(num_keys * sizeof(char *));
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        keys[i] = make_url(&state, i);
+        // keys that are never added to a set: same shape, other numbers
+        missing_keys[i] = make_url(&state, num_keys + i);
+        size_t len = strlen(keys[i]);
+        total_len += len;
+        max_len = len > max_len ? len : max_len;
+    }
+    printf("microbench: %zu keys, mean length %.1f bytes, max %zu bytes, %d threads for contention\n\n",
+           num_keys, (double)total_len / num_keys, max_len, num_threads);
+}
+
+/* -- Single-threaded benchmarks -- */
+static void bench_stack()
+{
+    STACK s;
+    char *item;
+
+    init_stack(&s, 1);
+    MARK m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        push_stack(&s, keys[i]);
+    }
+    report("stack push (growing from 1)", m, num_keys, num_keys);
+    m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        pop_stack(&s, &item);
+        free(item);
+    }
+    report("stack pop", m, num_keys, 0);
+    cleanup_stack(&s);
+
+    init_stack(&s, num_keys);
+    m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        push_stack(&s, keys[i]);
+    }
+    report("stack push (presized)", m, num_keys, 0);
+    m = mark();
+    for (int k = 0; k < 4; ++k)
+    {
+        resize_stack(&s);
+    }
+    report("stack resize (per item moved)", m, 4 * num_keys, 0);
+    m = mark();
+    cleanup_stack(&s);
+    report("stack cleanup (per item)", m, num_keys, 0);
+}
+
+static void bench_pstack()
+{
+    PSTACK s;
+    void *item;
+
+    init_pstack(&s, 1);
+    MARK m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        push_pstack(&s, keys[i]);
+    }
+    report("pstack push (growing from 1)", m, num_keys, num_keys);
+    m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        pop_pstack(&s, &item);
+    }
+    report("pstack pop", m, num_keys, 0);
+    m = mark();
+    cleanup_pstack(&s);
+    report("pstack cleanup", m, 1, 0);
+}
+
+static void bench_hset()
+{
+    HSET h;
+
+    init_hset(&h, HSET_INITIAL_SIZE);
+    MARK m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        add_hset(&h, keys[i]);
+    }
+    report("hset add (growing from 1024)", m, num_keys, num_keys);
+    m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        search_hset(&h, keys[i]);
+    }
+    report("hset search hit", m, num_keys, 0);
+    m = mark();
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        search_hset(&h, missing_keys[i]);
+    }
+    report("hset search miss", m, num_keys, 0);
+    cleanup_hset(&h);
+
+    // resize_hset moves every slot over, so it is only called on a full set
+    init_hset(&h, num_keys);
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        add_hset(&h, keys[i]);
+    }
+    m = mark();
+    resize_hset(&h);
+    report("hset resize (per key moved)", m, num_keys, 0);
+    m = mark();
+    cleanup_hset(&h);
+    report("hset cleanup (per key)", m, num_keys, 0);
+}
+/* ----------------- */
+
+/* -- Contended benchmarks -- */
+static STACK shared_stack;
+static HSET shared_hset;
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+// operations made by all threads of a contended benchmark
+static size_t contended_ops = 0;
+
+/**
+ * @brief push a thread's share of the keys onto the shared stack and pop as many
+ * @param arg void*: index of the thread (as an intptr_t)
+ * @return NULL
+ */
+static void *stack_worker(void *arg)
+{
+    size_t t = (size_t)(intptr_t)arg;
+    char *item;
+    size_t ops = 0;
+    for (size_t i = t; i < num_keys; i += num_threads, ops += 2)
+    {
+        pthread_mutex_lock(&shared_mutex);
+        push_stack(&shared_stack, keys[i]);
+        pthread_mutex_unlock(&shared_mutex);
+
+        pthread_mutex_lock(&shared_mutex);
+        if (pop_stack(&shared_stack, &item) == 0)
+        {
+            free(item);
+        }
+        pthread_mutex_unlock(&shared_mutex);
+    }
+    __atomic_add_fetch(&contended_ops, ops, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * @brief check-then-add a thread's share of the keys in the shared set, like a runner claiming urls
+ * @param arg void*: index of the thread (as an intptr_t)
+ * @return NULL
+ */
+static void *hset_worker(void *arg)
+{
+    size_t t = (size_t)(intptr_t)arg;
+    size_t ops = 0;
+    // threads 2k and 2k + 1 claim the same keys, so about half of the searches hit
+    for (size_t i = t / 2; i < num_keys; i += (num_threads + 1) / 2, ++ops)
+    {
+        pthread_mutex_lock(&shared_mutex);
+        if (search_hset(&shared_hset, keys[i]) == 0)
+        {
+            add_hset(&shared_hset, keys[i]);
+        }
+        pthread_mutex_unlock(&shared_mutex);
+    }
+    __atomic_add_fetch(&contended_ops, ops, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * @brief run a worker on num_threads threads and report the cost per operation
+ * @param name const char*: name of the benchmark
+ * @param worker void *(*)(void *): the worker; adds the operations it made to contended_ops
+ */
+static void run_contended(const char *name, void *(*worker)(void *))
+{
+    pthread_t *threads = __libc_malloc(num_threads * sizeof(pthread_t));
+    contended_ops = 0;
+    MARK m = mark();
+    for (int t = 0; t < num_threads; ++t)
+    {
+        pthread_create(&threads[t], NULL, worker, (void *)(intptr_t)t);
+    }
+    for (int t = 0; t < num_threads; ++t)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    report(name, m, contended_ops, 0);
+    __libc_free(threads);
+}
+
+static void bench_contended()
+{
+    char name[64];
+
+    init_stack(&shared_stack, 1);
+    snprintf(name, sizeof(name), "stack push+pop, %d threads", num_threads);
+    run_contended(name, stack_worker);
+    cleanup_stack(&shared_stack);
+
+    init_hset(&shared_hset, HSET_INITIAL_SIZE);
+    snprintf(name, sizeof(name), "hset search/add, %d threads", num_threads);
+    run_contended(name, hset_worker);
+    cleanup_hset(&shared_hset);
+}
+/* ----------------- */
+
+/* -- XXH64 known answers -- */
+// an input and its XXH64 from the reference implementation
+typedef struct xxh64_vector
+{
+    // the input, or NULL for the first len bytes of the generated buffer
+    const char *input;
+    size_t len;
+    uint64_t seed;
+    uint64_t hash;
+} XXH64_VECTOR;
+
+#define XXH64_GEN_LEN 100
+
+static const XXH64_VECTOR xxh64_vectors[] = {
+    {"", 0, 0, 0xef46db3751d8e999ULL},
+    {"a", 1, 0, 0xd24ec4f1a98c6e5bULL},
+    {"abc", 3, 0, 0x44bc2cf5ad770999ULL},
+    {"xxhash", 6, 20141025, 0xb559b98d844e0635ULL},
+    {"The quick brown fox jumps over the lazy dog", 43, 0, 0x0b242d361fda71bcULL},
+    // one stripe exactly, then one stripe plus 1-, 4- and 7-byte tails and an 8-byte word
+    {NULL, 32, 0, 0x23c3c17ef790fd97ULL},
+    {NULL, 33, 0, 0x50a7cfc7ba588784ULL},
+    {NULL, 36, 0, 0xc0b52b0dcc5e3f7fULL},
+    {NULL, 64, 0, 0x0eb64b3ef6eeb01fULL},
+    {NULL, 71, 0, 0xfdb8dfc5700141a7ULL},
+    {NULL, 100, 0, 0xa61f8d4c170fe531ULL},
+    {NULL, 100, 0x9e3779b185ebca87ULL, 0x9869d9ef85051be9ULL},
+};
+
+/**
+ * @brief check one XXH64 result against its known answer
+ * @param v const XXH64_VECTOR*: (pointer to) the vector
+ * @param how const char*: how the input was fed
+ * @param got uint64_t: the hash computed
+ * @return 1 if it mismatched; 0 otherwise
+ */
+static int check_xxh64_result(const XXH64_VECTOR *v, const char *how, uint64_t got)
+{
+    if (got == v->hash)
+    {
+        return 0;
+    }
+    fprintf(stderr, "xxh64 FAIL: %zu bytes, seed %llu, %s: got %016llx, expected %016llx\n", v->len,
+            (unsigned long long)v->seed, how, (unsigned long long)got, (unsigned long long)v->hash);
+    return 1;
+}
+
+/**
+ * @brief check xxh64 against known answers, fed in one call, byte by byte and in two pieces
+ * @return number of mismatches
+ */
+static int check_xxh64()
+{
+    unsigned char gen[XXH64_GEN_LEN];
+    for (size_t i = 0; i < XXH64_GEN_LEN; ++i)
+    {
+        gen[i] = (unsigned char)(i * 7 + 3);
+    }
+
+    int failures = 0;
+    size_t num_vectors = sizeof(xxh64_vectors) / sizeof(xxh64_vectors[0]);
+    for (size_t i = 0; i < num_vectors; ++i)
+    {
+        const XXH64_VECTOR *v = &xxh64_vectors[i];
+        const unsigned char *input = v->input != NULL ? (const unsigned char *)v->input : gen;
+        failures += check_xxh64_result(v, "one-shot", xxh64(input, v->len, v->seed));
+
+        XXH64_STATE state;
+        xxh64_reset(&state, v->seed);
+        for (size_t j = 0; j < v->len; ++j)
+        {
+            xxh64_update(&state, input + j, 1);
+        }
+        failures += check_xxh64_result(v, "byte by byte", xxh64_digest(&state));
+
+        // a split inside the first stripe, so the rest starts with a partly filled buffer
+        size_t split = v->len < 13 ? v->len / 2 : 13;
+        xxh64_reset(&state, v->seed);
+        xxh64_update(&state, input, split);
+        xxh64_update(&state, input + split, v->len - split);
+        failures += check_xxh64_result(v, "in two pieces", xxh64_digest(&state));
+    }
+    printf("xxh64: %zu known answers, %d mismatches\n", num_vectors, failures);
+    return failures;
+}
+/* ----------------- */
+
+int main(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "n:t:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            num_keys = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n KEYS] [-t THREADS]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_keys == 0 || num_threads < 1)
+    {
+        fprintf(stderr, "%s: need KEYS > 0 and THREADS > 0\n", argv[0]);
+        return 1;
+    }
+
+    if (check_xxh64() != 0)
+    {
+        return 1;
+    }
+
+    make_keys();
+    bench_stack();
+    bench_pstack();
+    bench_hset();
+    bench_contended();
+
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        free(keys[i]);
+        free(missing_keys[i]);
+    }
+    __libc_free(keys);
+    __libc_free(missing_keys);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+Check of the near-duplicate detection (-T) over html fixtures
+- every pair of files named on the command line is fingerprinted with simhash and compared
+  the way trap_is_near_duplicate does (both pages have at least SIMHASH_MIN_TOKENS words and
+  the fingerprints differ in at most SIMHASH_MAX_DISTANCE bits)
+- a file named NAME.dup.html is a mirror of NAME.html and must be a near-duplicate of it;
+  every other pair must not be, in particular distinct pages that only share a template
+- exits 1 if any pair is misclassified (or a file could not be read), so `make neardup` fails
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../trap.h"
+
+/**
+ * @brief read a whole file
+ * @param path const char*: path of the file
+ * @param size_p size_t*: (pointer to) number to be set with the size of the file
+ * @return the contents (free with free); NULL if the file could not be read
+ */
+static char *read_file(const char *path, size_t *size_p)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    char *buf = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t n;
+    do
+    {
+        if (size == capacity)
+        {
+            capacity = capacity == 0 ? 4096 : 2 * capacity;
+            char *p = realloc(buf, capacity);
+            if (p == NULL)
+            {
+                free(buf);
+                fclose(f);
+                return NULL;
+            }
+            buf = p;
+        }
+        n = fread(buf + size, 1, capacity - size, f);
+        size += n;
+    } while (n > 0);
+    fclose(f);
+    *size_p = size;
+    return buf;
+}
+
+/**
+ * @brief tell whether one fixture is named as the mirror of the other
+ * @param a const char*: path of a fixture
+ * @param b const char*: path of another fixture
+ * @return true if a is NAME.html and b is NAME.dup.html, or the other way round
+ */
+static bool is_mirror(const char *a, const char *b)
+{
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    if (len_a > len_b)
+    {
+        const char *t = a;
+        a = b;
+        b = t;
+        size_t len_t = len_a;
+        len_a = len_b;
+        len_b = len_t;
+    }
+    // a = NAME.html, b = NAME.dup.html
+    return len_a > 5 && len_b == len_a + 4 && strncmp(a, b, len_a - 5) == 0 &&
+           strcmp(a + len_a - 5, ".html") == 0 && strcmp(b + len_a - 5, ".dup.html") == 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s FILE.html...\n", argv[0]);
+        return 1;
+    }
+
+    int n = argc - 1;
+    uint64_t *hashes = malloc(n * sizeof(uint64_t));
+    size_t *tokens = malloc(n * sizeof(size_t));
+    if (hashes == NULL || tokens == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    size_t failed = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        size_t size;
+        char *buf = read_file(argv[i + 1], &size);
+        if (buf == NULL)
+        {
+            printf("FAIL %s: can't read it\n", argv[i + 1]);
+            ++failed;
+            tokens[i] = 0;
+            continue;
+        }
+        hashes[i] = simhash(buf, size, &tokens[i]);
+        free(buf);
+    }
+
+    size_t pairs = 0;
+    size_t mirrors = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = i + 1; j < n; ++j)
+        {
+            int distance = __builtin_popcountll(hashes[i] ^ hashes[j]);
+            bool near = tokens[i] >= SIMHASH_MIN_TOKENS && tokens[j] >= SIMHASH_MIN_TOKENS &&
+                        distance <= SIMHASH_MAX_DISTANCE;
+            bool mirror = is_mirror(argv[i + 1], argv[j + 1]);
+            if (near != mirror)
+            {
+                printf("FAIL %s, %s: %d bits apart (%zu and %zu words), %s\n", argv[i + 1], argv[j + 1], distance,
+                       tokens[i], tokens[j], mirror ? "a mirror not detected" : "distinct pages taken for mirrors");
+                ++failed;
+            }
+            else if (mirror)
+            {
+                printf("ok   %s, %s: %d bits apart\n", argv[i + 1], argv[j + 1], distance);
+                ++mirrors;
+            }
+            ++pairs;
+        }
+    }
+
+    printf("neardup: %zu pairs compared, %zu mirrors detected, %zu failed\n", pairs, mirrors, failed);
+    free(hashes);
+    free(tokens);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""
+Thread-scaling sweep and regression check for findpng2 against local synthetic sites (bench/websim)
+- crawls every site shape with every engine and thread count, and records urls/s,
+  cpu utilization, peak rss and the p50/p99 total time per url (from findpng2 -L)
+- writes the results as csv and json, and prints the speedup over the smallest
+  thread count so the point where scaling flattens is easy to spot
+- with --baseline, compares urls/s against an earlier results json and exits with
+  status 1 if any run is slower than the baseline by more than --threshold
+"""
+
+import argparse
+import csv
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+FINDPNG2 = os.path.join(ROOT, "findpng2")
+WEBSIM = os.path.join(ROOT, "bench", "websim")
+
+# name -> websim options
+DEFAULT_SHAPES = [
+    "wide=-s 1 -n 5000 -f 16 -r 10 -b 4096 -l 2 -j 2",
+    "deep=-s 2 -n 5000 -f 3 -r 10 -b 4096 -l 2 -j 2",
+    "slow=-s 3 -n 5000 -f 8 -r 10 -b 4096 -l 20 -j 20 -e 1",
+]
+
+FIELDS = ["shape", "engine", "threads", "urls", "pngs", "seconds", "urls_per_s", "speedup",
+          "cpu_util", "peak_rss_kb", "p50_ms", "p99_ms"]
+
+
+def start_websim(options, port, log):
+    """start websim and wait until it listens; returns the process"""
+    proc = subprocess.Popen([WEBSIM, "-p", str(port)] + options.split(), stdout=log, stderr=subprocess.STDOUT)
+    for _ in range(50):
+        log.flush()
+        with open(log.name) as f:
+            if "serving" in f.read():
+                return proc
+        if proc.poll() is not None:
+            break
+        time.sleep(0.1)
+    proc.kill()
+    with open(log.name) as f:
+        sys.exit("sweep: websim did not start: " + f.read())
+
+
+def run_crawl(work, threads, engine, m, port, extra):
+    """crawl once; returns the measurements of the run"""
+    latency_file = os.path.join(work, "latency.json")
+    args = [FINDPNG2, "-t", str(threads), "-m", str(m), "-e", engine, "-L", latency_file] + extra
+    args.append("http://127.0.0.1:%d/" % port)
+
+    with open(os.path.join(work, "out.txt"), "w") as out:
+        start = time.monotonic()
+        proc = subprocess.Popen(args, cwd=work, stdout=out, stderr=subprocess.DEVNULL)
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall = time.monotonic() - start
+    if status != 0:
+        sys.exit("sweep: %s exited with status %d" % (" ".join(args), status))
+
+    with open(os.path.join(work, "out.txt")) as f:
+        out = f.read()
+    urls = len(re.findall(r"^URL: ", out, re.M))
+    seconds = float(re.search(r"^findpng2 execution time: ([0-9.]+) seconds$", out, re.M).group(1))
+    with open(os.path.join(work, "png_urls.txt")) as f:
+        pngs = sum(1 for _ in f)
+    with open(latency_file) as f:
+        total = json.load(f)["metrics"]["total"]
+
+    return {
+        "urls": urls,
+        "pngs": pngs,
+        "seconds": round(seconds, 6),
+        "urls_per_s": round(urls / seconds, 1) if seconds > 0 else 0.,
+        # cores kept busy on average over the whole process
+        "cpu_util": round((usage.ru_utime + usage.ru_stime) / wall, 3) if wall > 0 else 0.,
+        "peak_rss_kb": usage.ru_maxrss,
+        "p50_ms": round(total["p50"] / 1000., 3),
+        "p99_ms": round(total["p99"] / 1000., 3),
+    }
+
+
+def best_of(runs):
+    """the fastest of repeated runs (the least disturbed by noise)"""
+    return max(runs, key=lambda r: r["urls_per_s"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--threads", default="1,2,4,8,16", help="comma-separated -t values [%(default)s]")
+    parser.add_argument("--engines", default="xml,scan", help="comma-separated -e values [%(default)s]")
+    parser.add_argument("--shape", action="append", metavar="NAME=WEBSIM_OPTIONS",
+                        help="site shape to crawl; may be repeated [wide, deep and slow]")
+    parser.add_argument("-m", type=int, default=200, help="pngs to find per crawl [%(default)s]")
+    parser.add_argument("--repeat", type=int, default=1, help="runs per point; the fastest is kept [%(default)s]")
+    parser.add_argument("--port", type=int, default=8099, help="port websim listens on [%(default)s]")
+    parser.add_argument("--out", default="sweep", help="write results to OUT.csv and OUT.json [%(default)s]")
+    parser.add_argument("--baseline", help="results json of an earlier sweep to compare against")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="fail if urls/s drops below the baseline by more than this fraction [%(default)s]")
+    parser.add_argument("extra", nargs="*", help="more findpng2 options (after --)")
+    args = parser.parse_args()
+
+    for path in (FINDPNG2, WEBSIM):
+        if not os.access(path, os.X_OK):
+            sys.exit("sweep: %s is missing; run make findpng2 bench/websim first" % path)
+
+    threads = [int(t) for t in args.threads.split(",")]
+    engines = args.engines.split(",")
+    shapes = [s.split("=", 1) for s in (args.shape or DEFAULT_SHAPES)]
+
+    results = []
+    work = tempfile.mkdtemp(prefix="findpng2-sweep-")
+    try:
+        for name, options in shapes:
+            with open(os.path.join(work, "websim.log"), "w") as log:
+                websim = start_websim(options, args.port, log)
+                try:
+                    for engine in engines:
+                        base = None
+                        for t in threads:
+                            run = best_of([run_crawl(work, t, engine, args.m, args.port, args.extra)
+                                           for _ in range(args.repeat)])
+                            run = dict(shape=name, engine=engine, threads=t, **run)
+                            base = base or run["urls_per_s"]
+                            run["speedup"] = round(run["urls_per_s"] / base, 2) if base > 0 else 0.
+                            results.append(run)
+                            print("%-6s %-5s t=%-3d %6d urls %8.1f urls/s  speedup %5.2f  cpu %5.2f  "
+                                  "rss %7d KB  p50 %7.3f ms  p99 %7.3f ms" %
+                                  (name, engine, t, run["urls"], run["urls_per_s"], run["speedup"],
+                                   run["cpu_util"], run["peak_rss_kb"], run["p50_ms"], run["p99_ms"]))
+                            sys.stdout.flush()
+                finally:
+                    websim.kill()
+                    websim.wait()
+    finally:
+        shutil.rmtree(work)
+
+    with open(args.out + ".csv", "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        writer.writeheader()
+        writer.writerows(results)
+    with open(args.out + ".json", "w") as f:
+        json.dump({"m": args.m, "extra": args.extra, "shapes": dict(shapes), "results": results}, f, indent=2)
+    print("sweep: wrote %s.csv and %s.json" % (args.out, args.out))
+
+    if args.baseline is None:
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = {(r["shape"], r["engine"], r["threads"]): r for r in json.load(f)["results"]}
+    regressions = 0
+    for run in results:
+        old = baseline.get((run["shape"], run["engine"], run["threads"]))
+        if old is None or old["urls_per_s"] <= 0:
+            continue
+        change = run["urls_per_s"] / old["urls_per_s"] - 1
+        if change < -args.threshold:
+            regressions += 1
+            print("sweep: REGRESSION %s %s t=%d: %.1f urls/s, baseline %.1f (%+.1f%%)" %
+                  (run["shape"], run["engine"], run["threads"], run["urls_per_s"], old["urls_per_s"], 100 * change))
+    if regressions > 0:
+        print("sweep: %d of %d runs regressed by more than %.0f%%" % (regressions, len(results), 100 * args.threshold))
+        return 1
+    print("sweep: no run regressed by more than %.0f%% against %s" % (100 * args.threshold, args.baseline))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
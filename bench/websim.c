@@ -0,0 +1,738 @@
+/*
+websim: a local HTTP server that serves a synthetic, deterministic web site for benchmarking findpng2
+- the site is generated from a seed: the same options always give the same pages,
+  links and pngs, so crawls are reproducible without network access
+- /page/<N>.html is page N (/ is page 0); each page has FANOUT links, each of which
+  is an image (<img src="/img/<K>.png">) with probability PNG_PERCENT, otherwise a page
+- a png is invalid (not a png at all, but served as image/png) with probability INVALID_PERCENT;
+  valid pngs are real 1x1 pngs, each with different content
+- pages are padded with text up to PAGE_BYTES, every response can be delayed, and
+  urls can be made to fail with a 500
+- with more than one host, page N and image K live on hosts 127.0.0.(1 + N % HOSTS) and
+  127.0.0.(1 + K % HOSTS), and links to them are absolute, so a crawl crosses hosts
+- with -N FILE, links name host 127.0.0.H as hH.websim.test instead, and FILE gets a
+  "hH.websim.test 127.0.0.H DELAY_MS" line per host, for findpng2 --dns-hosts
+- every response has an ETag and a Last-Modified, and a request whose If-None-Match (or else
+  If-Modified-Since) matches them is answered 304 Not Modified without a body
+- the site can be served at generation G (-g): between generations, each page changes (its
+  text, not its links) with its own probability, from 0 to twice CHANGE_PERCENT (-c), so
+  crawls of successive generations see a few pages change often and most rarely; images
+  never change
+- every connection is served by its own thread and kept alive until the client closes it
+- with -w DIR, the site is written to DIR instead of served (index.html, page/<N>.html and
+  img/<K>.png, one host only), for a static server such as nghttpd (bench.sh BENCH_SERVER=nghttpd);
+  latency and injected errors are then up to that server
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define REQUEST_SIZE 8192
+#define HEADER_SIZE 512
+#define MAX_PAGE_BYTES (16 * 1024 * 1024)
+#define MAX_HOSTS 254 /* 127.0.0.1 to 127.0.0.254 */
+#define EPOCH 1704067200  /* Last-Modified of generation 0: 2024-01-01; each generation is a day later */
+
+// the site served
+typedef struct site
+{
+    uint64_t seed;
+    // number of pages
+    uint64_t num_pages;
+    // number of distinct images linked to
+    uint64_t num_images;
+    // links per page
+    int fanout;
+    // percent of links that are images
+    int png_percent;
+    // percent of images that are not valid pngs
+    int invalid_percent;
+    // size pages are padded to (bytes)
+    size_t page_bytes;
+    // delay before every response (ms), plus up to jitter_ms more
+    int latency_ms;
+    int jitter_ms;
+    // percent of urls that fail with a 500
+    int error_percent;
+    // number of loopback hosts the site is spread over, and the port they listen on
+    int num_hosts;
+    int port;
+    // whether links name hosts (hH.websim.test) rather than give their addresses
+    bool host_names;
+    // average percent of pages that change from one generation to the next, and the generation served
+    int change_percent;
+    uint64_t generation;
+} SITE;
+
+static SITE site;
+
+static const char *words[] = {"png", "crawler", "frontier", "thread", "mutex", "socket", "page", "link",
+                              "image", "parse", "queue", "stack", "hash", "seed", "graph", "latency"};
+
+/**
+ * @brief mix bits of a 64-bit value (splitmix64 finalizer)
+ * @param x uint64_t: value to mix
+ * @return mixed value
+ */
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * @brief deterministic pseudo-random value for a (kind, a, b) triple of the site
+ * @return pseudo-random value
+ */
+static uint64_t site_rand(uint64_t kind, uint64_t a, uint64_t b)
+{
+    return mix64(site.seed ^ mix64(kind * 0x9e3779b97f4a7c15ULL ^ mix64(a * 0x632be59bd9b4e019ULL + b)));
+}
+
+/**
+ * @brief crc32 of a byte string (as used in png chunks)
+ * @param crc uint32_t: crc to continue from (0 to start)
+ * @param p const unsigned char*: bytes
+ * @param len size_t: number of bytes
+ * @return crc
+ */
+static uint32_t crc32(uint32_t crc, const unsigned char *p, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= p[i];
+        for (int k = 0; k < 8; ++k)
+        {
+            crc = (crc >> 1) ^ (0xedb88320U & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief append a png chunk
+ * @param out unsigned char*: buffer to append to
+ * @param len size_t: bytes in the buffer so far
+ * @param type const char*: 4-letter chunk type
+ * @param data const unsigned char*: chunk data
+ * @param data_len size_t: bytes of chunk data
+ * @return bytes in the buffer after the chunk
+ */
+static size_t put_chunk(unsigned char *out, size_t len, const char *type, const unsigned char *data, size_t data_len)
+{
+    unsigned char *p = out + len;
+    p[0] = data_len >> 24;
+    p[1] = data_len >> 16;
+    p[2] = data_len >> 8;
+    p[3] = data_len;
+    memcpy(p + 4, type, 4);
+    memcpy(p + 8, data, data_len);
+    uint32_t crc = crc32(0, p + 4, 4 + data_len);
+    p[8 + data_len] = crc >> 24;
+    p[9 + data_len] = crc >> 16;
+    p[10 + data_len] = crc >> 8;
+    p[11 + data_len] = crc;
+    return len + 12 + data_len;
+}
+
+/**
+ * @brief generate image `id`: a 1x1 png carrying the id in a text chunk, or an invalid png
+ * @param id uint64_t: image id
+ * @param out unsigned char*: buffer of at least 128 bytes
+ * @return size of the image
+ */
+static size_t make_image(uint64_t id, unsigned char *out)
+{
+    if ((int)(site_rand(3, id, 0) % 100) < site.invalid_percent)
+    {
+        return sprintf((char *)out, "not a png: image %lu", (unsigned long)id);
+    }
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a};
+    // 1x1, 8-bit greyscale
+    static const unsigned char ihdr[13] = {0, 0, 0, 1, 0, 0, 0, 1, 8, 0, 0, 0, 0};
+    // zlib stream of one scanline: filter byte 0, pixel 0
+    static const unsigned char idat[10] = {0x78, 0x9c, 0x63, 0x60, 0x00, 0x00, 0x00, 0x02, 0x00, 0x01};
+    unsigned char text[64];
+    int text_len = sprintf((char *)text, "Comment") + 1;
+    text_len += sprintf((char *)text + text_len, "websim image %lu", (unsigned long)id);
+
+    memcpy(out, signature, 8);
+    size_t len = put_chunk(out, 8, "IHDR", ihdr, sizeof(ihdr));
+    len = put_chunk(out, len, "tEXt", text, text_len);
+    len = put_chunk(out, len, "IDAT", idat, sizeof(idat));
+    len = put_chunk(out, len, "IEND", NULL, 0);
+    return len;
+}
+
+/**
+ * @brief write the origin (scheme, host and port) of a host of the site
+ * @param out char*: buffer of at least 64 bytes
+ * @param host int: the host (1 to site.num_hosts)
+ */
+static void host_origin(char *out, int host)
+{
+    if (site.host_names)
+    {
+        sprintf(out, "http://h%d.websim.test:%d", host, site.port);
+    }
+    else
+    {
+        sprintf(out, "http://127.0.0.%d:%d", host, site.port);
+    }
+}
+
+/**
+ * @brief how many times page `id` changed up to the generation served, and the generation it last changed in
+ * @param id uint64_t: page id
+ * @param last_changed uint64_t*: (pointer to) number to be set with the generation of the last change (0 if none)
+ * @return number of changes (the page's version)
+ */
+static uint64_t page_version(uint64_t id, uint64_t *last_changed)
+{
+    // each page has its own change rate, from 0 to twice the average (in hundredths of a percent)
+    uint64_t rate = site.change_percent > 0 ? site_rand(6, id, 0) % (200 * site.change_percent + 1) : 0;
+    uint64_t version = 0;
+    *last_changed = 0;
+    for (uint64_t g = 1; g <= site.generation && rate > 0; ++g)
+    {
+        if (site_rand(7, id, g) % 10000 < rate)
+        {
+            ++version;
+            *last_changed = g;
+        }
+    }
+    return version;
+}
+
+/**
+ * @brief generate page `id`
+ * @param id uint64_t: page id
+ * @param version uint64_t: version of the page (its text differs from version to version)
+ * @param out char*: buffer of at least site.page_bytes + 128 * (fanout + 2) bytes
+ * @return size of the page
+ */
+static size_t make_page(uint64_t id, uint64_t version, char *out)
+{
+    size_t len = sprintf(out, "<html><head><title>websim page %lu (version %lu)</title></head><body>\n",
+                         (unsigned long)id, (unsigned long)version);
+    for (int k = 0; k < site.fanout; ++k)
+    {
+        uint64_t r = site_rand(1, id, k);
+        // absolute links if the target may be on another host
+        char origin[64] = "";
+        if ((int)(r % 100) < site.png_percent)
+        {
+            uint64_t target = (r >> 8) % site.num_images;
+            if (site.num_hosts > 1)
+            {
+                host_origin(origin, 1 + (int)(target % site.num_hosts));
+            }
+            len += sprintf(out + len, "<img src=\"%s/img/%lu.png\">\n", origin, (unsigned long)target);
+        }
+        else
+        {
+            uint64_t target = (r >> 8) % site.num_pages;
+            if (site.num_hosts > 1)
+            {
+                host_origin(origin, 1 + (int)(target % site.num_hosts));
+            }
+            len += sprintf(out + len, "<a href=\"%s/page/%lu.html\">page %lu</a>\n", origin, (unsigned long)target,
+                           (unsigned long)target);
+        }
+    }
+
+    // pad with text that differs from page to page
+    len += sprintf(out + len, "<p>");
+    for (uint64_t w = 0; len + 16 < site.page_bytes; ++w)
+    {
+        uint64_t r = site_rand(2, id, w + (version << 32));
+        len += sprintf(out + len, "%s%lu ", words[r % 16], (unsigned long)((r >> 4) % 1000));
+    }
+    len += sprintf(out + len, "</p></body></html>\n");
+    return len;
+}
+
+/**
+ * @brief write all of a buffer to a socket
+ * @return 0 on success; 1 otherwise
+ */
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+        {
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief copy the value of a request header
+ * @param request const char*: the request line and headers
+ * @param name const char*: "\r\n" followed by the header name and ": "
+ * @param out char*: buffer of HEADER_SIZE bytes, set to the value ("" if the header is missing)
+ */
+static void request_header(const char *request, const char *name, char *out)
+{
+    out[0] = '\0';
+    const char *p = strcasestr(request, name);
+    if (p != NULL)
+    {
+        p += strlen(name);
+        size_t len = strcspn(p, "\r\n");
+        if (len < HEADER_SIZE)
+        {
+            memcpy(out, p, len);
+            out[len] = '\0';
+        }
+    }
+}
+
+/**
+ * @brief answer one request
+ * @param fd int: socket of the connection
+ * @param path const char*: path requested
+ * @param request const char*: the request line and headers (for the conditional ones)
+ * @param body char*: buffer large enough for any response body
+ * @param keep_alive bool: whether the connection stays open after the response
+ * @return 0 on success; 1 if the connection failed
+ */
+static int respond(int fd, const char *path, const char *request, char *body, bool keep_alive)
+{
+    uint64_t path_hash = 14695981039346656037ULL;
+    for (const char *p = path; *p != '\0'; ++p)
+    {
+        path_hash = (path_hash ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+
+    if (site.latency_ms > 0 || site.jitter_ms > 0)
+    {
+        int delay = site.latency_ms + (site.jitter_ms > 0 ? site_rand(4, path_hash, 0) % (site.jitter_ms + 1) : 0);
+        usleep(delay * 1000);
+    }
+
+    int status = 200;
+    const char *content_type = "text/html";
+    size_t len = 0;
+    unsigned long id;
+    char ext[8];
+    // validators of the response: a hash of the content, and the day it last changed
+    uint64_t etag = 0;
+    uint64_t last_changed = 0;
+
+    if ((int)(site_rand(5, path_hash, 0) % 100) < site.error_percent)
+    {
+        status = 500;
+        len = sprintf(body, "injected error\n");
+        content_type = "text/plain";
+    }
+    else if (strcmp(path, "/") == 0 ||
+             (sscanf(path, "/page/%lu.%7s", &id, ext) == 2 && strcmp(ext, "html") == 0 && id < site.num_pages))
+    {
+        id = strcmp(path, "/") == 0 ? 0 : id;
+        uint64_t version = page_version(id, &last_changed);
+        len = make_page(id, version, body);
+        etag = site_rand(8, id, version);
+    }
+    else if (sscanf(path, "/img/%lu.%7s", &id, ext) == 2 && strcmp(ext, "png") == 0 && id < site.num_images)
+    {
+        len = make_image(id, (unsigned char *)body);
+        content_type = "image/png";
+        etag = site_rand(9, id, 0);
+    }
+    else
+    {
+        status = 404;
+        len = sprintf(body, "not found\n");
+        content_type = "text/plain";
+    }
+
+    char header[HEADER_SIZE];
+    char validators[HEADER_SIZE] = "";
+    if (status == 200)
+    {
+        char etag_value[32];
+        char last_modified[64];
+        char if_none_match[HEADER_SIZE];
+        char if_modified_since[HEADER_SIZE];
+        time_t t = EPOCH + last_changed * 86400;
+        struct tm tm;
+        snprintf(etag_value, sizeof(etag_value), "\"%016lx\"", (unsigned long)etag);
+        strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm));
+        snprintf(validators, HEADER_SIZE, "ETag: %s\r\nLast-Modified: %s\r\n", etag_value, last_modified);
+
+        // the client's copy is current: answer without the body
+        request_header(request, "\r\nIf-None-Match: ", if_none_match);
+        request_header(request, "\r\nIf-Modified-Since: ", if_modified_since);
+        if (if_none_match[0] != '\0' ? strcmp(if_none_match, etag_value) == 0 : strcmp(if_modified_since, last_modified) == 0)
+        {
+            int header_len = snprintf(header, HEADER_SIZE, "HTTP/1.1 304 Not Modified\r\n%sConnection: %s\r\n\r\n",
+                                      validators, keep_alive ? "keep-alive" : "close");
+            return write_all(fd, header, header_len);
+        }
+    }
+    int header_len = snprintf(header, HEADER_SIZE,
+                              "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%sConnection: %s\r\n\r\n",
+                              status, status == 200 ? "OK" : (status == 404 ? "Not Found" : "Internal Server Error"),
+                              content_type, len, validators, keep_alive ? "keep-alive" : "close");
+    if (write_all(fd, header, header_len) != 0 || write_all(fd, body, len) != 0)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief write a file of the site
+ * @param dir const char*: directory the site is written to
+ * @param path const char*: path of the file in the site
+ * @param data const char*: the contents
+ * @param len size_t: size of the contents
+ * @return 0 on success; 1 otherwise
+ */
+static int write_site_file(const char *dir, const char *path, const char *data, size_t len)
+{
+    char file[1024];
+    snprintf(file, sizeof(file), "%s%s", dir, path);
+    FILE *fp = fopen(file, "wb");
+    if (fp == NULL || fwrite(data, 1, len, fp) != len)
+    {
+        perror(file);
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        return 1;
+    }
+    return fclose(fp) == 0 ? 0 : 1;
+}
+
+/**
+ * @brief write the site, at the generation served, to a directory (-w)
+ * @param dir const char*: the directory (created if needed, with page/ and img/ in it)
+ * @return 0 on success; 1 otherwise
+ */
+static int write_site(const char *dir)
+{
+    char sub[1024];
+    mkdir(dir, 0755);
+    snprintf(sub, sizeof(sub), "%s/page", dir);
+    mkdir(sub, 0755);
+    snprintf(sub, sizeof(sub), "%s/img", dir);
+    mkdir(sub, 0755);
+
+    char *body = malloc(site.page_bytes + 128 * (site.fanout + 2));
+    if (body == NULL)
+    {
+        return 1;
+    }
+    int ret = 0;
+    char path[64];
+    for (uint64_t id = 0; id < site.num_pages && ret == 0; ++id)
+    {
+        uint64_t last_changed;
+        size_t len = make_page(id, page_version(id, &last_changed), body);
+        snprintf(path, sizeof(path), "/page/%lu.html", (unsigned long)id);
+        ret = write_site_file(dir, path, body, len) || (id == 0 && write_site_file(dir, "/index.html", body, len));
+    }
+    for (uint64_t id = 0; id < site.num_images && ret == 0; ++id)
+    {
+        size_t len = make_image(id, (unsigned char *)body);
+        snprintf(path, sizeof(path), "/img/%lu.png", (unsigned long)id);
+        ret = write_site_file(dir, path, body, len);
+    }
+    free(body);
+    return ret;
+}
+
+/**
+ * @brief serve the requests of one connection until it is closed
+ * @param arg void*: the socket of the connection (as an intptr_t)
+ * @return NULL
+ */
+static void *serve_connection(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    char *request = malloc(REQUEST_SIZE);
+    char *body = malloc(site.page_bytes + 128 * (site.fanout + 2));
+    size_t used = 0;
+
+    while (request != NULL && body != NULL)
+    {
+        // read until the end of the request headers
+        char *end;
+        request[used] = '\0';
+        while ((end = strstr(request, "\r\n\r\n")) == NULL)
+        {
+            if (used + 1 >= REQUEST_SIZE)
+            {
+                goto close_connection;
+            }
+            ssize_t n = read(fd, request + used, REQUEST_SIZE - 1 - used);
+            if (n <= 0)
+            {
+                goto close_connection;
+            }
+            used += n;
+            request[used] = '\0';
+        }
+        *end = '\0';
+
+        char method[16], path[1024], version[16];
+        if (sscanf(request, "%15s %1023s %15s", method, path, version) != 3)
+        {
+            break;
+        }
+        bool keep_alive = strcmp(version, "HTTP/1.1") == 0 && strcasestr(request, "\r\nConnection: close") == NULL;
+        if (respond(fd, path, request, body, keep_alive) != 0 || !keep_alive)
+        {
+            break;
+        }
+
+        // keep what was read past this request (pipelined requests)
+        size_t consumed = end + 4 - request;
+        memmove(request, request + consumed, used - consumed);
+        used -= consumed;
+    }
+
+close_connection:
+    free(request);
+    free(body);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief accept connections on a listening socket, serving every connection on its own thread
+ * @param arg void*: the listening socket (intptr_t)
+ * @return never returns
+ */
+static void *accept_connections(void *arg)
+{
+    int listen_fd = (int)(intptr_t)arg;
+    int one = 1;
+    while (true)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, (void *)(intptr_t)fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    /* -- command line inputs -- */
+    int port = 8099;
+    site.seed = 1;
+    site.num_pages = 1000;
+    site.num_images = 0;
+    site.fanout = 8;
+    site.png_percent = 10;
+    site.invalid_percent = 10;
+    site.page_bytes = 2048;
+    site.latency_ms = 0;
+    site.jitter_ms = 0;
+    site.error_percent = 0;
+    site.num_hosts = 1;
+    site.change_percent = 0;
+    site.generation = 0;
+
+    int c;
+    // file to write the host names to (-N), and how long a lookup of each should take
+    char *hosts_file = NULL;
+    int dns_delay_ms = 0;
+    // directory to write the site to instead of serving it (-w)
+    char *site_dir = NULL;
+    while ((c = getopt(argc, argv, "p:s:n:I:f:r:i:b:l:j:e:H:N:d:c:g:w:")) != -1)
+    {
+        switch (c)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            site.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            site.num_pages = strtoull(optarg, NULL, 10);
+            break;
+        case 'I':
+            site.num_images = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            site.fanout = atoi(optarg);
+            break;
+        case 'r':
+            site.png_percent = atoi(optarg);
+            break;
+        case 'i':
+            site.invalid_percent = atoi(optarg);
+            break;
+        case 'b':
+            site.page_bytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            site.latency_ms = atoi(optarg);
+            break;
+        case 'j':
+            site.jitter_ms = atoi(optarg);
+            break;
+        case 'e':
+            site.error_percent = atoi(optarg);
+            break;
+        case 'H':
+            site.num_hosts = atoi(optarg);
+            break;
+        case 'N':
+            hosts_file = optarg;
+            site.host_names = true;
+            break;
+        case 'd':
+            dns_delay_ms = atoi(optarg);
+            break;
+        case 'c':
+            site.change_percent = atoi(optarg);
+            break;
+        case 'g':
+            site.generation = strtoull(optarg, NULL, 10);
+            break;
+        case 'w':
+            site_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p PORT] [-s SEED] [-n PAGES] [-I IMAGES] [-f FANOUT] [-r PNG_PERCENT] "
+                            "[-i INVALID_PERCENT] [-b PAGE_BYTES] [-l LATENCY_MS] [-j JITTER_MS] [-e ERROR_PERCENT] [-H HOSTS] "
+                            "[-N HOSTS_FILE] [-d DNS_DELAY_MS] [-c CHANGE_PERCENT] [-g GENERATION] [-w DIR]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (site.num_pages == 0 || site.fanout < 0 || site.page_bytes > MAX_PAGE_BYTES || site.num_hosts < 1 ||
+        site.num_hosts > MAX_HOSTS)
+    {
+        fprintf(stderr, "%s: need PAGES > 0, FANOUT >= 0, PAGE_BYTES <= %d and 1 <= HOSTS <= %d\n", argv[0], MAX_PAGE_BYTES,
+                MAX_HOSTS);
+        return 1;
+    }
+    site.port = port;
+    // by default there are as many distinct images as pages
+    if (site.num_images == 0)
+    {
+        site.num_images = site.num_pages;
+    }
+    // write the site for another server instead of serving it
+    if (site_dir != NULL)
+    {
+        if (site.num_hosts > 1)
+        {
+            fprintf(stderr, "%s: -w writes one host only\n", argv[0]);
+            return 1;
+        }
+        if (write_site(site_dir) != 0)
+        {
+            return 1;
+        }
+        printf("websim: wrote %lu pages and %lu images to %s\n", (unsigned long)site.num_pages,
+               (unsigned long)site.num_images, site_dir);
+        return 0;
+    }
+    // name the hosts for the crawler's stand-in resolver
+    if (hosts_file != NULL)
+    {
+        FILE *fp = fopen(hosts_file, "w");
+        if (fp == NULL)
+        {
+            perror("websim: fopen");
+            return 1;
+        }
+        for (int h = 1; h <= site.num_hosts; ++h)
+        {
+            fprintf(fp, "h%d.websim.test 127.0.0.%d %d\n", h, h, dns_delay_ms);
+        }
+        fclose(fp);
+    }
+    /* ----------------- */
+
+    /* -- Listen on the loopback interface (127.0.0.1, and 127.0.0.2 onward for more hosts) -- */
+    signal(SIGPIPE, SIG_IGN);
+    int listen_fds[MAX_HOSTS];
+    for (int h = 0; h < site.num_hosts; ++h)
+    {
+        listen_fds[h] = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fds[h], SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + h);
+        if (bind(listen_fds[h], (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fds[h], 128) != 0)
+        {
+            perror("websim: bind");
+            return 1;
+        }
+    }
+    if (site.num_hosts > 1)
+    {
+        printf("websim: serving %lu pages on http://127.0.0.1:%d/ to http://127.0.0.%d:%d/\n", (unsigned long)site.num_pages,
+               port, site.num_hosts, port);
+    }
+    else
+    {
+        printf("websim: serving %lu pages on http://127.0.0.1:%d/\n", (unsigned long)site.num_pages, port);
+    }
+    fflush(stdout);
+    /* ----------------- */
+
+    /* -- Accept on every host; this thread accepts on the first -- */
+    for (int h = 1; h < site.num_hosts; ++h)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, accept_connections, (void *)(intptr_t)listen_fds[h]) != 0)
+        {
+            perror("websim: pthread_create");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    accept_connections((void *)(intptr_t)listen_fds[0]);
+    /* ----------------- */
+
+    return 0;
+}
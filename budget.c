@@ -0,0 +1,381 @@
+/*
+Memory budget (--mem-budget, --mem-policy)
+- the frontier, the visited set and the receive buffers report the bytes they hold into
+  one account each (nothing is counted unless the budget is on)
+- below BUDGET_SOFT_PERCENT of the budget every url found is kept
+- from the soft mark, the policy applies backpressure on the frontier:
+  - pause: park every url found in an unlinked temporary file (so it holds no memory);
+    the crawl stops expanding and drains the frontier, and once admission is below the
+    soft mark again, parked urls are pushed back, BUDGET_UNPARK_BATCH at a time; the visited
+    set never shrinks, so the urls still parked when the crawl runs out of room are dropped
+  - pages: drop links to pages, keep embedded images (which are fetched and done,
+    and are the urls that can be pngs)
+  - deep: drop links to pages with more path segments than the page they were found on
+- past the budget, every url the policy keeps is dropped (pause parks them all, so it drops none)
+- the visited set never shrinks, and every url on the frontier ends up in it: admission
+  counts the frontier BUDGET_VISITED_FACTOR more times, for the visited bytes it will become,
+  so that draining the frontier doesn't carry the crawl past the budget
+- the receive buffers are counted by bytes received (the rest of their capacity is never
+  touched, so it isn't resident), the stacks by slots allocated, and the visited set by
+  key bytes plus its table; malloc's own overhead isn't
+- the budget only decides which urls to keep: the visited table grows by doubling, so one
+  doubling can still carry the crawl past it
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+#include "budget.h"
+#include "frontier.h"
+
+static bool enabled = false;
+static size_t budget = 0;
+static size_t soft = 0;
+static int policy = BUDGET_POLICY_PAUSE;
+// bytes held, by account
+static size_t accounts[NUM_BUDGET_ACCOUNTS];
+static size_t drops[NUM_BUDGET_DROPS];
+// highest total, and the accounts then; guarded by high_water_mutex
+static size_t high_water = 0;
+static size_t high_water_accounts[NUM_BUDGET_ACCOUNTS];
+static pthread_mutex_t high_water_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* -- Parked urls (pause): "P url\n" (page lane) and "I url\n" (image lane) lines in a temporary file -- */
+static FILE *park_file = NULL;
+static int park_fd = -1;
+// bytes written to the file, and read back from it
+static off_t park_written = 0;
+static off_t park_read = 0;
+// lines not yet written to the file
+static char park_buf[BUDGET_PARK_BUFFER];
+static size_t park_buf_len = 0;
+// block read back from the file
+static char unpark_buf[BUDGET_PARK_BUFFER];
+// urls parked and not yet pushed back, and urls pushed back
+static size_t num_parked = 0;
+static size_t num_unparked = 0;
+// lock for the file, the buffers and the offsets
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* ----------------- */
+
+/**
+ * @brief bytes held by all accounts
+ * @return bytes
+ */
+static size_t budget_used()
+{
+    size_t used = 0;
+    for (int i = 0; i < NUM_BUDGET_ACCOUNTS; ++i)
+    {
+        used += __atomic_load_n(&accounts[i], __ATOMIC_RELAXED);
+    }
+    return used;
+}
+
+/**
+ * @brief bytes admission compares with the marks: every account, and the frontier again for the visited bytes it will become
+ * @return bytes
+ */
+static size_t admission_used()
+{
+    return budget_used() + BUDGET_VISITED_FACTOR * __atomic_load_n(&accounts[BUDGET_FRONTIER], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief raise the high-water mark if the accounts hold more than ever before
+ */
+static void update_high_water()
+{
+    size_t used = budget_used();
+    if (used <= __atomic_load_n(&high_water, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    pthread_mutex_lock(&high_water_mutex);
+    if (used > high_water)
+    {
+        for (int i = 0; i < NUM_BUDGET_ACCOUNTS; ++i)
+        {
+            high_water_accounts[i] = __atomic_load_n(&accounts[i], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&high_water, used, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&high_water_mutex);
+}
+
+/**
+ * @brief number of path segments of a url (e.g. 2 for http://host/a/b.html?x=/y)
+ * @param url const char*: the url
+ * @return number of segments
+ */
+static size_t path_depth(const char *url)
+{
+    const char *p = strstr(url, "://");
+    p = p != NULL ? p + 3 : url;
+    // skip the host
+    p = strchr(p, '/');
+    if (p == NULL)
+    {
+        return 0;
+    }
+    size_t depth = 0;
+    for (; *p != '\0' && *p != '?' && *p != '#'; ++p)
+    {
+        if (*p == '/' && p[1] != '\0' && p[1] != '/' && p[1] != '?' && p[1] != '#')
+        {
+            ++depth;
+        }
+    }
+    return depth;
+}
+
+/**
+ * @brief write the parked lines buffered to the parking file
+ * @return 0 on success; 1 otherwise
+ * @note call with park_mutex held
+ */
+static int flush_parked()
+{
+    size_t done = 0;
+    while (done < park_buf_len)
+    {
+        ssize_t n = pwrite(park_fd, park_buf + done, park_buf_len - done, park_written + done);
+        if (n <= 0)
+        {
+            return 1;
+        }
+        done += n;
+    }
+    park_written += park_buf_len;
+    park_buf_len = 0;
+    return 0;
+}
+
+/**
+ * @brief park a url until the accounts are below the soft mark again
+ * @param url const char*: the url
+ * @param lane int: LANE_PAGE or LANE_IMAGE
+ * @return true if it was parked; false if the parking file could not be written
+ */
+static bool park(const char *url, int lane)
+{
+    size_t len = strlen(url) + 3;
+    bool parked = false;
+    pthread_mutex_lock(&park_mutex);
+    {
+        // a line is never split between the buffer and the file (nor longer than a block read back)
+        if ((park_buf_len + len <= BUDGET_PARK_BUFFER || flush_parked() == 0) && len <= BUDGET_PARK_BUFFER)
+        {
+            park_buf[park_buf_len] = lane == LANE_IMAGE ? 'I' : 'P';
+            park_buf[park_buf_len + 1] = ' ';
+            memcpy(park_buf + park_buf_len + 2, url, len - 3);
+            park_buf[park_buf_len + len - 1] = '\n';
+            park_buf_len += len;
+            __atomic_add_fetch(&num_parked, 1, __ATOMIC_RELAXED);
+            parked = true;
+        }
+    }
+    pthread_mutex_unlock(&park_mutex);
+    return parked;
+}
+
+/**
+ * @brief turn on the budget
+ * @param bytes size_t: the budget (> 0)
+ * @param drop_policy int: BUDGET_POLICY_PAUSE, BUDGET_POLICY_PAGES or BUDGET_POLICY_DEEP
+ * @return 0 on success; 1 if the parking file (pause) could not be created
+ */
+int budget_enable(size_t bytes, int drop_policy)
+{
+    if (drop_policy == BUDGET_POLICY_PAUSE)
+    {
+        park_file = tmpfile();
+        if (park_file == NULL)
+        {
+            return 1;
+        }
+        park_fd = fileno(park_file);
+    }
+    budget = bytes;
+    soft = bytes / 100 * BUDGET_SOFT_PERCENT;
+    policy = drop_policy;
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief whether the budget is on
+ * @return true if budget_enable was called
+ */
+bool budget_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief set the bytes an account holds
+ * @param account int: BUDGET_FRONTIER, BUDGET_VISITED or BUDGET_RECV
+ * @param bytes size_t: bytes held
+ */
+void budget_set(int account, size_t bytes)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    __atomic_store_n(&accounts[account], bytes, __ATOMIC_RELAXED);
+    update_high_water();
+}
+
+/**
+ * @brief add to the bytes an account holds
+ * @param account int: BUDGET_FRONTIER, BUDGET_VISITED or BUDGET_RECV
+ * @param bytes size_t: bytes allocated
+ */
+void budget_add(int account, size_t bytes)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    __atomic_add_fetch(&accounts[account], bytes, __ATOMIC_RELAXED);
+    update_high_water();
+}
+
+/**
+ * @brief take from the bytes an account holds
+ * @param account int: BUDGET_FRONTIER, BUDGET_VISITED or BUDGET_RECV
+ * @param bytes size_t: bytes freed
+ */
+void budget_sub(int account, size_t bytes)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    __atomic_sub_fetch(&accounts[account], bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief decide whether a url found on a page may be pushed onto the frontier
+ * @param page_url const char*: url of the page it was found on (NULL if unknown, e.g. forwarded by another instance)
+ * @param url const char*: the url found
+ * @param lane int: LANE_PAGE or LANE_IMAGE
+ * @return BUDGET_KEEP, BUDGET_PARKED (it will be pushed back by budget_unpark), or the reason
+ *  the url is dropped (BUDGET_DROP_*); the reason is counted
+ * @details
+ * The policy decides first, so a url it drops is counted as dropped by the policy even past the budget.
+ */
+int budget_admit(const char *page_url, const char *url, int lane)
+{
+    if (!enabled)
+    {
+        return BUDGET_KEEP;
+    }
+    size_t used = admission_used();
+    int reason = BUDGET_KEEP;
+    if (used >= soft)
+    {
+        if (policy == BUDGET_POLICY_PAUSE)
+        {
+            // a url the parking file can't take is treated as the other policies treat a url they keep
+            reason = park(url, lane) ? BUDGET_PARKED : BUDGET_KEEP;
+        }
+        else if (policy == BUDGET_POLICY_PAGES && lane == LANE_PAGE)
+        {
+            reason = BUDGET_DROP_PAGE;
+        }
+        else if (policy == BUDGET_POLICY_DEEP && lane == LANE_PAGE && page_url != NULL &&
+                 path_depth(url) > path_depth(page_url))
+        {
+            reason = BUDGET_DROP_DEEP;
+        }
+        if (reason == BUDGET_KEEP && used >= budget)
+        {
+            reason = BUDGET_DROP_FULL;
+        }
+    }
+    if (reason != BUDGET_KEEP)
+    {
+        __atomic_add_fetch(&drops[reason], 1, __ATOMIC_RELAXED);
+    }
+    return reason;
+}
+
+/**
+ * @brief number of urls parked and not yet pushed back
+ * @return number of urls (0 unless the policy is pause)
+ */
+size_t budget_num_parked()
+{
+    return __atomic_load_n(&num_parked, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief take parked urls back, oldest first, if admission is below the soft mark again
+ * @param urls STACK*: (pointer to) stack to push the urls for the page lane onto
+ * @param imgs STACK*: (pointer to) stack to push the urls for the image lane onto
+ * @param max size_t: most urls to take
+ * @return number of urls taken
+ */
+size_t budget_unpark(STACK *urls, STACK *imgs, size_t max)
+{
+    if (budget_num_parked() == 0 || admission_used() >= soft)
+    {
+        return 0;
+    }
+    size_t taken = 0;
+    pthread_mutex_lock(&park_mutex);
+    {
+        if (park_buf_len > 0 && flush_parked() != 0)
+        {
+            pthread_mutex_unlock(&park_mutex);
+            return 0;
+        }
+        // (past park_written, the file holds lines of before it was last written over from the start)
+        size_t left = park_written - park_read;
+        ssize_t n = pread(park_fd, unpark_buf, left < sizeof(unpark_buf) ? left : sizeof(unpark_buf), park_read);
+        char *line = unpark_buf;
+        char *newline;
+        while (taken < max && n > 0 && (newline = memchr(line, '\n', unpark_buf + n - line)) != NULL)
+        {
+            *newline = '\0';
+            push_stack(line[0] == 'I' ? imgs : urls, line + 2);
+            ++taken;
+            line = newline + 1;
+        }
+        park_read += line - unpark_buf;
+        // every parked url is back: write the file over from the start
+        if (park_read == park_written)
+        {
+            park_read = 0;
+            park_written = 0;
+        }
+        __atomic_sub_fetch(&num_parked, taken, __ATOMIC_RELAXED);
+        num_unparked += taken;
+    }
+    pthread_mutex_unlock(&park_mutex);
+    return taken;
+}
+
+/**
+ * @brief get the budget, its high-water mark and the urls dropped
+ * @param stats BUDGET_STATS*: (pointer to) where to put the statistics
+ */
+void budget_get_stats(BUDGET_STATS *stats)
+{
+    memset(stats, 0, sizeof(BUDGET_STATS));
+    stats->budget = budget;
+    stats->soft = soft;
+    pthread_mutex_lock(&high_water_mutex);
+    stats->high_water = high_water;
+    memcpy(stats->high_water_accounts, high_water_accounts, sizeof(high_water_accounts));
+    pthread_mutex_unlock(&high_water_mutex);
+    for (int i = 0; i < NUM_BUDGET_DROPS; ++i)
+    {
+        stats->drops[i] = __atomic_load_n(&drops[i], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_lock(&park_mutex);
+    stats->unparked = num_unparked;
+    stats->still_parked = num_parked;
+    pthread_mutex_unlock(&park_mutex);
+}
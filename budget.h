@@ -0,0 +1,65 @@
+/*
+Memory budget: tracks the bytes held by the frontier, the visited set and the receive buffers,
+and decides which newly found urls to drop (or park until there is room) as the crawl nears its budget
+*/
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "stack.h"
+
+#define BUDGET_SOFT_PERCENT 80 /* backpressure (the policy) starts at this percentage of the budget */
+#define BUDGET_VISITED_FACTOR 2 /* bytes a frontier byte becomes in the visited set once its url is crawled */
+#define BUDGET_PARK_BUFFER 65536 /* parked urls are written to the parking file in blocks of this many bytes */
+#define BUDGET_UNPARK_BATCH 64   /* most parked urls pushed back at a time */
+
+// what the bytes are held by
+#define BUDGET_FRONTIER 0 /* urls waiting on the frontier, and its lanes' slots */
+#define BUDGET_VISITED 1  /* the visited set's keys and table */
+#define BUDGET_RECV 2     /* receive buffers of downloads (and of pages waiting for the parse pool) */
+#define NUM_BUDGET_ACCOUNTS 3
+
+// what to do between the soft mark and the budget (past the budget, every new url is dropped, or parked with pause)
+#define BUDGET_POLICY_PAUSE 0 /* stop expanding: park every url found in a file, and push them back once below the soft mark */
+#define BUDGET_POLICY_PAGES 1 /* drop links to pages, keep embedded images (which don't expand the crawl) */
+#define BUDGET_POLICY_DEEP 2  /* drop links to pages deeper (more path segments) than the page they were found on */
+
+// why a url was not pushed
+#define BUDGET_KEEP -1
+#define BUDGET_PARKED 0 /* not dropped: pushed back later */
+#define BUDGET_DROP_PAGE 1
+#define BUDGET_DROP_DEEP 2
+#define BUDGET_DROP_FULL 3
+#define NUM_BUDGET_DROPS 4
+
+typedef struct budget_stats
+{
+    // the budget and the soft mark (bytes)
+    size_t budget;
+    size_t soft;
+    // bytes held, by account, when the total was highest
+    size_t high_water;
+    size_t high_water_accounts[NUM_BUDGET_ACCOUNTS];
+    // urls not pushed, by reason (drops[BUDGET_PARKED]: urls parked)
+    size_t drops[NUM_BUDGET_DROPS];
+    // parked urls pushed back, and those still parked at the end
+    size_t unparked;
+    size_t still_parked;
+} BUDGET_STATS;
+
+int budget_enable(size_t bytes, int policy);
+bool budget_enabled();
+void budget_set(int account, size_t bytes);
+void budget_add(int account, size_t bytes);
+void budget_sub(int account, size_t bytes);
+int budget_admit(const char *page_url, const char *url, int lane);
+size_t budget_num_parked();
+size_t budget_unpark(STACK *urls, STACK *imgs, size_t max);
+void budget_get_stats(BUDGET_STATS *stats);
+
+#endif
@@ -0,0 +1,473 @@
+/*
+Content hashing (XXH64) and exact duplicate detection for downloaded pages and pngs
+- XXH64 is computed incrementally as data arrives, so the hash is ready as soon
+  as the download finishes, at a cost far below that of the download itself
+- the table of seen hashes is split into CONTENT_SHARDS shards with one lock each,
+  so threads finishing different pages rarely contend
+- each entry remembers the first url the content was seen at, so a duplicate png
+  can be recorded as an alias of the original instead of as a new find
+*/
+
+#include <pthread.h>
+#include "curl_xml.h"
+#include "content_hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct content_shard
+{
+    // capacity of the shard (a power of 2)
+    size_t size;
+    // number of hashes in the shard
+    size_t used;
+    // hashes seen (0 marks an empty slot)
+    uint64_t *keys;
+    // first url each hash was seen at
+    char **urls;
+    // lock for the shard
+    pthread_mutex_t mutex;
+} CONTENT_SHARD;
+
+// whether content_dedup_enable was called
+static bool enabled = false;
+static CONTENT_SHARD shards[CONTENT_SHARDS];
+// "alias original" lines for duplicate pngs
+static STACK *aliases = NULL;
+// lock for aliases
+static pthread_mutex_t aliases_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CONTENT_STATS stats;
+
+/**
+ * @brief rotate a 64-bit value left
+ * @param x uint64_t: value to rotate
+ * @param r int: number of bits
+ * @return rotated value
+ */
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * @brief read 8 little-endian bytes
+ * @param p const unsigned char*: bytes to read
+ * @return value read
+ */
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief read 4 little-endian bytes
+ * @param p const unsigned char*: bytes to read
+ * @return value read
+ */
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief mix 8 bytes of input into one lane
+ * @param acc uint64_t: lane
+ * @param input uint64_t: input
+ * @return new lane value
+ */
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    acc *= PRIME64_1;
+    return acc;
+}
+
+/**
+ * @brief merge a lane into the final hash
+ * @param acc uint64_t: hash so far
+ * @param val uint64_t: lane
+ * @return new hash value
+ */
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+    val = xxh64_round(0, val);
+    acc ^= val;
+    acc = acc * PRIME64_1 + PRIME64_4;
+    return acc;
+}
+
+/**
+ * @brief start a new incremental hash
+ * @param state XXH64_STATE*: (pointer to) state to reset
+ * @param seed uint64_t: seed
+ */
+void xxh64_reset(XXH64_STATE *state, uint64_t seed)
+{
+    memset(state, 0, sizeof(XXH64_STATE));
+    state->seed = seed;
+    state->v[0] = seed + PRIME64_1 + PRIME64_2;
+    state->v[1] = seed + PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME64_1;
+}
+
+/**
+ * @brief add bytes to an incremental hash
+ * @param state XXH64_STATE*: (pointer to) state of the hash
+ * @param input const void*: bytes to add
+ * @param len size_t: number of bytes
+ */
+void xxh64_update(XXH64_STATE *state, const void *input, size_t len)
+{
+    const unsigned char *p = input;
+    const unsigned char *end = p + len;
+
+    state->total_len += len;
+
+    // not enough for a full stripe yet
+    if (state->memsize + len < 32)
+    {
+        memcpy(state->mem + state->memsize, p, len);
+        state->memsize += len;
+        return;
+    }
+
+    // complete the buffered stripe
+    if (state->memsize > 0)
+    {
+        size_t fill = 32 - state->memsize;
+        memcpy(state->mem + state->memsize, p, fill);
+        for (int i = 0; i < 4; ++i)
+        {
+            state->v[i] = xxh64_round(state->v[i], read64(state->mem + 8 * i));
+        }
+        p += fill;
+        state->memsize = 0;
+    }
+
+    // full stripes straight from the input
+    while (end - p >= 32)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            state->v[i] = xxh64_round(state->v[i], read64(p + 8 * i));
+        }
+        p += 32;
+    }
+
+    // keep the rest for later
+    if (p < end)
+    {
+        memcpy(state->mem, p, end - p);
+        state->memsize = end - p;
+    }
+}
+
+/**
+ * @brief get the hash of everything added so far
+ * @param state const XXH64_STATE*: (pointer to) state of the hash
+ * @return hash value (the state may be updated further afterwards)
+ */
+uint64_t xxh64_digest(const XXH64_STATE *state)
+{
+    uint64_t h;
+    const unsigned char *p = state->mem;
+    const unsigned char *end = p + state->memsize;
+
+    if (state->total_len >= 32)
+    {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        for (int i = 0; i < 4; ++i)
+        {
+            h = xxh64_merge_round(h, state->v[i]);
+        }
+    }
+    else
+    {
+        h = state->seed + PRIME64_5;
+    }
+    h += state->total_len;
+
+    while (end - p >= 8)
+    {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (end - p >= 4)
+    {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * @brief hash a buffer in one go
+ * @param input const void*: bytes to hash
+ * @param len size_t: number of bytes
+ * @param seed uint64_t: seed
+ * @return hash value
+ */
+uint64_t xxh64(const void *input, size_t len, uint64_t seed)
+{
+    XXH64_STATE state;
+    xxh64_reset(&state, seed);
+    xxh64_update(&state, input, len);
+    return xxh64_digest(&state);
+}
+
+/**
+ * @brief turn on exact duplicate detection
+ * @return 0 on success; non-zero otherwise
+ */
+int content_dedup_enable()
+{
+    for (int i = 0; i < CONTENT_SHARDS; ++i)
+    {
+        shards[i].size = CONTENT_SHARD_INITIAL_SIZE;
+        shards[i].used = 0;
+        shards[i].keys = calloc(CONTENT_SHARD_INITIAL_SIZE, sizeof(uint64_t));
+        shards[i].urls = calloc(CONTENT_SHARD_INITIAL_SIZE, sizeof(char *));
+        if (shards[i].keys == NULL || shards[i].urls == NULL)
+        {
+            return 1;
+        }
+        pthread_mutex_init(&shards[i].mutex, NULL);
+    }
+
+    aliases = malloc(sizeof(STACK));
+    memset(aliases, 0, sizeof(STACK));
+    init_stack(aliases, 1);
+
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief returns whether content_dedup_enable was called
+ * @return true if exact duplicate detection is on
+ */
+bool content_dedup_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief double the capacity of a shard
+ * @param shard CONTENT_SHARD*: (pointer to) the shard; the caller holds its lock
+ */
+static void resize_shard(CONTENT_SHARD *shard)
+{
+    size_t old_size = shard->size;
+    uint64_t *old_keys = shard->keys;
+    char **old_urls = shard->urls;
+
+    shard->size *= 2;
+    shard->keys = calloc(shard->size, sizeof(uint64_t));
+    shard->urls = calloc(shard->size, sizeof(char *));
+    for (size_t i = 0; i < old_size; ++i)
+    {
+        if (old_keys[i] != 0)
+        {
+            size_t j = (old_keys[i] / CONTENT_SHARDS) & (shard->size - 1);
+            while (shard->keys[j] != 0)
+            {
+                j = (j + 1) & (shard->size - 1);
+            }
+            shard->keys[j] = old_keys[i];
+            shard->urls[j] = old_urls[i];
+        }
+    }
+    free(old_keys);
+    free(old_urls);
+}
+
+/**
+ * @brief check whether content was seen before; remember it if not
+ * @param hash uint64_t: XXH64 of the content
+ * @param content_type int: content type code (content of different types never matches)
+ * @param url const char*: url the content was downloaded from
+ * @return NULL if the content is new; otherwise a copy of the first url it was seen at (caller frees)
+ */
+char *content_seen(uint64_t hash, int content_type, const char *url)
+{
+    uint64_t key = hash ^ ((uint64_t)(content_type + 1) * PRIME64_3);
+    if (key == 0)
+    {
+        key = 1;
+    }
+
+    CONTENT_SHARD *shard = &shards[key % CONTENT_SHARDS];
+    char *original = NULL;
+    pthread_mutex_lock(&shard->mutex);
+    {
+        if (2 * (shard->used + 1) > shard->size)
+        {
+            resize_shard(shard);
+        }
+        size_t i = (key / CONTENT_SHARDS) & (shard->size - 1);
+        while (shard->keys[i] != 0 && shard->keys[i] != key)
+        {
+            i = (i + 1) & (shard->size - 1);
+        }
+        if (shard->keys[i] == key)
+        {
+            original = strdup(shard->urls[i]);
+        }
+        else
+        {
+            shard->keys[i] = key;
+            shard->urls[i] = strdup(url);
+            ++shard->used;
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    return original;
+}
+
+/**
+ * @brief check whether a html page is identical to one parsed before
+ * @param hash uint64_t: XXH64 of the page
+ * @param url const char*: url of the page
+ * @return true if the page should not be parsed; always false if dedup is off
+ */
+bool content_is_duplicate_page(uint64_t hash, const char *url)
+{
+    if (!enabled)
+    {
+        return false;
+    }
+
+    char *original = content_seen(hash, HTML, url);
+    if (original == NULL)
+    {
+        return false;
+    }
+    free(original);
+    __atomic_add_fetch(&stats.duplicate_pages, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * @brief check whether a valid png is identical to one found before; if so, record it as an alias
+ * @param hash uint64_t: XXH64 of the png
+ * @param url const char*: url of the png
+ * @return true if the png should not count as a new find; always false if dedup is off
+ */
+bool content_is_duplicate_png(uint64_t hash, const char *url)
+{
+    if (!enabled)
+    {
+        return false;
+    }
+
+    char *original = content_seen(hash, VALID_PNG, url);
+    if (original == NULL)
+    {
+        return false;
+    }
+
+    char *line = malloc(strlen(url) + strlen(original) + 2);
+    sprintf(line, "%s %s", url, original);
+    pthread_mutex_lock(&aliases_mutex);
+    {
+        push_stack(aliases, line);
+    }
+    pthread_mutex_unlock(&aliases_mutex);
+    free(line);
+    free(original);
+
+    __atomic_add_fetch(&stats.duplicate_pngs, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * @brief write the png aliases recorded so far, one "alias original" pair per line
+ * @param path const char*: file to write
+ * @return 0 on success; non-zero otherwise
+ */
+int write_png_aliases(const char *path)
+{
+    FILE *f = fopen(path, "w+");
+    if (f == NULL)
+    {
+        return 1;
+    }
+
+    char *line = NULL;
+    pthread_mutex_lock(&aliases_mutex);
+    {
+        while (pop_stack(aliases, &line) == 0)
+        {
+            fprintf(f, "%s\n", line);
+            free(line);
+            line = NULL;
+        }
+    }
+    pthread_mutex_unlock(&aliases_mutex);
+
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief get the number of duplicates found so far
+ * @param out CONTENT_STATS*: (pointer to) stats to be populated
+ */
+void content_get_stats(CONTENT_STATS *out)
+{
+    out->duplicate_pages = __atomic_load_n(&stats.duplicate_pages, __ATOMIC_RELAXED);
+    out->duplicate_pngs = __atomic_load_n(&stats.duplicate_pngs, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief free all memory used for duplicate detection
+ */
+void content_dedup_cleanup()
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    for (int i = 0; i < CONTENT_SHARDS; ++i)
+    {
+        for (size_t j = 0; j < shards[i].size; ++j)
+        {
+            free(shards[i].urls[j]);
+        }
+        free(shards[i].keys);
+        free(shards[i].urls);
+        shards[i].keys = NULL;
+        shards[i].urls = NULL;
+        pthread_mutex_destroy(&shards[i].mutex);
+    }
+
+    cleanup_stack(aliases);
+    free(aliases);
+    aliases = NULL;
+    enabled = false;
+}
@@ -0,0 +1,55 @@
+/*
+Content hashing (XXH64) and exact duplicate detection for downloaded pages and pngs
+*/
+
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONTENT_SHARDS 64         /* the table of seen hashes is split into this many locked shards */
+#define CONTENT_SHARD_INITIAL_SIZE 256
+#define PNG_ALIASES_FILE "./png_aliases.txt"
+
+// state of an incrementally computed XXH64 hash
+typedef struct xxh64_state
+{
+    // number of bytes hashed so far
+    uint64_t total_len;
+    // the four lanes of the hash
+    uint64_t v[4];
+    // bytes not yet consumed by a full 32-byte stripe
+    unsigned char mem[32];
+    // number of bytes in mem
+    size_t memsize;
+    // seed the hash was started with
+    uint64_t seed;
+} XXH64_STATE;
+
+typedef struct content_stats
+{
+    // html pages not parsed because an identical page was parsed before
+    size_t duplicate_pages;
+    // valid pngs recorded as aliases of an identical png found before
+    size_t duplicate_pngs;
+} CONTENT_STATS;
+
+void xxh64_reset(XXH64_STATE *state, uint64_t seed);
+void xxh64_update(XXH64_STATE *state, const void *input, size_t len);
+uint64_t xxh64_digest(const XXH64_STATE *state);
+uint64_t xxh64(const void *input, size_t len, uint64_t seed);
+
+int content_dedup_enable();
+bool content_dedup_enabled();
+char *content_seen(uint64_t hash, int content_type, const char *url);
+bool content_is_duplicate_page(uint64_t hash, const char *url);
+bool content_is_duplicate_png(uint64_t hash, const char *url);
+int write_png_aliases(const char *path);
+void content_get_stats(CONTENT_STATS *stats);
+void content_dedup_cleanup();
+
+#endif
@@ -0,0 +1,461 @@
+/*
+Record/replay of fetched responses in a memory-mapped corpus archive
+- while recording, every completed fetch is appended to the archive as one record:
+  url, effective url, response code, content type, header lines, body and libcurl's
+  timings; each thread reserves its record's place with an atomic add and writes it
+  with one pwritev, so recording takes no lock
+- while replaying, the archive is mapped read-only and indexed by url once, and fetches
+  are answered with pointers into the mapping instead of going to the network
+- replayed fetches can wait for their recorded total time (scaled), so the crawl sees
+  the same latency it saw when the archive was recorded
+- the archive is in the byte order of the machine that recorded it; a record cut short
+  (e.g. by a crash) ends the archive
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "corpus.h"
+#include "content_hash.h"
+
+// padding after the body (its terminating 0 is written from here too)
+static const char zeros[CORPUS_ALIGN] = {0};
+
+/* -- Recording -- */
+// archive being recorded to (-1 if not recording)
+static int record_fd = -1;
+// end of the archive: where the next record goes; only accessed atomically
+static uint64_t record_end = 0;
+static size_t records_written = 0;
+// whether a write to the archive failed (reported once)
+static bool record_failed = false;
+// the calling thread's header lines (NULL until it receives a header)
+static __thread CORPUS_HEADERS *thread_headers = NULL;
+// header buffers of every thread, freed at cleanup
+static CORPUS_HEADERS *all_headers = NULL;
+static pthread_mutex_t headers_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* ----------------- */
+
+/* -- Replaying -- */
+// mapped archive (NULL if not replaying)
+static const char *map = NULL;
+static size_t map_size = 0;
+// records in the archive
+static size_t map_records = 0;
+// open addressing table of records by url; read-only once built
+static CORPUS_SLOT *slots = NULL;
+static size_t slots_size = 0;
+static size_t slots_used = 0;
+// recorded times are multiplied by this
+static double replay_latency_scale = 0;
+static size_t replay_hits = 0;
+static size_t replay_misses = 0;
+/* ----------------- */
+
+/**
+ * @brief start recording fetched responses to an archive
+ * @param path const char*: path of the archive (overwritten)
+ * @return 0 on success; 1 otherwise
+ */
+int corpus_record_open(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    if (write(fd, CORPUS_MAGIC, CORPUS_MAGIC_LEN) != CORPUS_MAGIC_LEN)
+    {
+        close(fd);
+        return 1;
+    }
+
+    record_end = CORPUS_MAGIC_LEN;
+    record_fd = fd;
+    return 0;
+}
+
+/**
+ * @brief check if responses are being recorded
+ * @return true if recording; false otherwise
+ */
+bool corpus_recording()
+{
+    return record_fd >= 0;
+}
+
+/**
+ * @brief keep a header line of the response the calling thread is receiving
+ * @param line const char*: header line as delivered by libcurl (not 0 terminated)
+ * @param len size_t: bytes of the line
+ * @details
+ * A status line starts a new response, so after redirects only the header lines
+ *  of the final response are kept.
+ * Does nothing unless recording.
+ */
+void corpus_record_header(const char *line, size_t len)
+{
+    if (record_fd < 0)
+    {
+        return;
+    }
+
+    CORPUS_HEADERS *h = thread_headers;
+    if (h == NULL)
+    {
+        h = calloc(1, sizeof(CORPUS_HEADERS));
+        if (h == NULL)
+        {
+            return;
+        }
+        pthread_mutex_lock(&headers_mutex);
+        {
+            h->next = all_headers;
+            all_headers = h;
+        }
+        pthread_mutex_unlock(&headers_mutex);
+        thread_headers = h;
+    }
+
+    if (len >= 5 && strncmp(line, "HTTP/", 5) == 0)
+    {
+        h->len = 0;
+    }
+    if (h->len + len + 1 > h->size)
+    {
+        size_t new_size = h->size == 0 ? CORPUS_HEADERS_INITIAL_SIZE : h->size;
+        while (h->len + len + 1 > new_size)
+        {
+            new_size *= 2;
+        }
+        char *buf = realloc(h->buf, new_size);
+        if (buf == NULL)
+        {
+            return;
+        }
+        h->buf = buf;
+        h->size = new_size;
+    }
+    memcpy(h->buf + h->len, line, len);
+    h->len += len;
+    h->buf[h->len] = '\0';
+}
+
+/**
+ * @brief append a completed fetch to the archive
+ * @param curl_handle CURL*: the easy handle the fetch was performed with
+ * @param url const char*: url that was requested
+ * @param eurl const char*: effective url of the fetch (after redirects)
+ * @param response_code long: http response code
+ * @param body const char*: the downloaded data
+ * @param body_len size_t: bytes of the downloaded data
+ * @note does nothing unless recording; the header lines are the ones the calling thread
+ *  kept with corpus_record_header during the fetch
+ */
+void corpus_record(CURL *curl_handle, const char *url, const char *eurl, long response_code, const char *body, size_t body_len)
+{
+    if (record_fd < 0)
+    {
+        return;
+    }
+
+    char *content_type = NULL;
+    curl_easy_getinfo(curl_handle, CURLINFO_CONTENT_TYPE, &content_type);
+    if (content_type == NULL)
+    {
+        content_type = "";
+    }
+    const char *headers = "";
+    size_t headers_len = 0;
+    if (thread_headers != NULL && thread_headers->buf != NULL)
+    {
+        headers = thread_headers->buf;
+        headers_len = thread_headers->len;
+    }
+
+    CORPUS_RECORD record;
+    memset(&record, 0, sizeof(CORPUS_RECORD));
+    record.body_len = body_len;
+    record.response_code = response_code;
+    record.url_len = strlen(url);
+    record.eurl_len = strlen(eurl);
+    record.content_type_len = strlen(content_type);
+    record.headers_len = headers_len;
+    latency_get_timings(curl_handle, &record.timings);
+
+    // every string and the body are followed by a 0
+    size_t len = sizeof(CORPUS_RECORD) + record.url_len + record.eurl_len + record.content_type_len +
+                 record.headers_len + body_len + 5;
+    record.size = (len + CORPUS_ALIGN - 1) / CORPUS_ALIGN * CORPUS_ALIGN;
+
+    struct iovec iov[7] = {
+        {&record, sizeof(CORPUS_RECORD)},
+        {(void *)url, record.url_len + 1},
+        {(void *)eurl, record.eurl_len + 1},
+        {content_type, record.content_type_len + 1},
+        {(void *)headers, record.headers_len + 1},
+        {(void *)body, body_len},
+        {(void *)zeros, 1 + record.size - len}};
+
+    off_t offset = __atomic_fetch_add(&record_end, record.size, __ATOMIC_RELAXED);
+    ssize_t written = pwritev(record_fd, iov, 7, offset);
+    if (written != (ssize_t)record.size)
+    {
+        // the gap left by the failed write ends the archive when it is replayed
+        if (!__atomic_exchange_n(&record_failed, true, __ATOMIC_RELAXED))
+        {
+            fprintf(stderr, "corpus: writing a record failed: %s\n", written < 0 ? strerror(errno) : "short write");
+        }
+        return;
+    }
+    __atomic_add_fetch(&records_written, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief add a record to the replay index; a later record of the same url replaces an earlier one
+ * @param record const CORPUS_RECORD*: record in the mapped archive
+ * @return 0 on success; 1 otherwise
+ */
+static int index_record(const CORPUS_RECORD *record)
+{
+    // keep the table at most half full
+    if (2 * (slots_used + 1) > slots_size)
+    {
+        size_t new_size = slots_size == 0 ? 1024 : 2 * slots_size;
+        CORPUS_SLOT *new_slots = calloc(new_size, sizeof(CORPUS_SLOT));
+        if (new_slots == NULL)
+        {
+            return 1;
+        }
+        for (size_t i = 0; i < slots_size; ++i)
+        {
+            if (slots[i].record == NULL)
+            {
+                continue;
+            }
+            size_t j = slots[i].hash & (new_size - 1);
+            while (new_slots[j].record != NULL)
+            {
+                j = (j + 1) & (new_size - 1);
+            }
+            new_slots[j] = slots[i];
+        }
+        free(slots);
+        slots = new_slots;
+        slots_size = new_size;
+    }
+
+    const char *url = (const char *)(record + 1);
+    uint64_t hash = xxh64(url, record->url_len, 0);
+    size_t i = hash & (slots_size - 1);
+    while (slots[i].record != NULL)
+    {
+        if (slots[i].hash == hash && strcmp((const char *)(slots[i].record + 1), url) == 0)
+        {
+            slots[i].record = record;
+            return 0;
+        }
+        i = (i + 1) & (slots_size - 1);
+    }
+    slots[i].hash = hash;
+    slots[i].record = record;
+    ++slots_used;
+    return 0;
+}
+
+/**
+ * @brief start answering fetches from an archive instead of the network
+ * @param path const char*: path of an archive written by recording
+ * @param latency_scale double: replayed fetches wait for their recorded total time
+ *  multiplied by this (0: don't wait)
+ * @return 0 on success; 1 otherwise
+ */
+int corpus_replay_open(const char *path, double latency_scale)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < CORPUS_MAGIC_LEN)
+    {
+        close(fd);
+        return 1;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        return 1;
+    }
+    map = p;
+    map_size = st.st_size;
+    if (memcmp(map, CORPUS_MAGIC, CORPUS_MAGIC_LEN) != 0)
+    {
+        corpus_cleanup();
+        return 1;
+    }
+
+    size_t offset = CORPUS_MAGIC_LEN;
+    while (offset + sizeof(CORPUS_RECORD) <= map_size)
+    {
+        const CORPUS_RECORD *record = (const CORPUS_RECORD *)(map + offset);
+        uint64_t len = sizeof(CORPUS_RECORD) + (uint64_t)record->url_len + record->eurl_len +
+                       record->content_type_len + record->headers_len + 5;
+        // a record that was cut short or never written ends the archive
+        if (record->size < len || record->body_len > record->size - len ||
+            record->size % CORPUS_ALIGN != 0 || record->size > map_size - offset)
+        {
+            break;
+        }
+        if (index_record(record) != 0)
+        {
+            corpus_cleanup();
+            return 1;
+        }
+        ++map_records;
+        offset += record->size;
+    }
+
+    replay_latency_scale = latency_scale;
+    return 0;
+}
+
+/**
+ * @brief check if fetches are answered from an archive
+ * @return true if replaying; false otherwise
+ */
+bool corpus_replaying()
+{
+    return map != NULL;
+}
+
+/**
+ * @brief look up the recorded response of a url
+ * @param url const char*: url that is fetched
+ * @param entry CORPUS_ENTRY*: populated with the recorded response if it is found
+ * @return true if the url is in the archive; false otherwise
+ */
+bool corpus_find(const char *url, CORPUS_ENTRY *entry)
+{
+    uint64_t hash = xxh64(url, strlen(url), 0);
+    const CORPUS_RECORD *record = NULL;
+    for (size_t i = hash & (slots_size - 1); slots_size > 0 && slots[i].record != NULL; i = (i + 1) & (slots_size - 1))
+    {
+        if (slots[i].hash == hash && strcmp((const char *)(slots[i].record + 1), url) == 0)
+        {
+            record = slots[i].record;
+            break;
+        }
+    }
+    if (record == NULL)
+    {
+        __atomic_add_fetch(&replay_misses, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    __atomic_add_fetch(&replay_hits, 1, __ATOMIC_RELAXED);
+
+    const char *s = (const char *)(record + 1);
+    entry->url = s;
+    s += record->url_len + 1;
+    entry->eurl = s;
+    s += record->eurl_len + 1;
+    entry->content_type = record->content_type_len > 0 ? s : NULL;
+    s += record->content_type_len + 1;
+    entry->headers = s;
+    entry->headers_len = record->headers_len;
+    s += record->headers_len + 1;
+    entry->body = s;
+    entry->body_len = record->body_len;
+    entry->response_code = record->response_code;
+
+    const LAT_TIMINGS *t = &record->timings;
+    double k = replay_latency_scale;
+    entry->timings.namelookup = t->namelookup * k;
+    entry->timings.connect = t->connect * k;
+    entry->timings.appconnect = t->appconnect * k;
+    entry->timings.pretransfer = t->pretransfer * k;
+    entry->timings.starttransfer = t->starttransfer * k;
+    entry->timings.total = t->total * k;
+    entry->timings.bytes = t->bytes;
+    return true;
+}
+
+/**
+ * @brief wait as long as the recorded fetch took (scaled by the latency emulation factor)
+ * @param entry const CORPUS_ENTRY*: the recorded response, as found by corpus_find
+ */
+void corpus_emulate_latency(const CORPUS_ENTRY *entry)
+{
+    uint64_t us = entry->timings.total;
+    if (us == 0)
+    {
+        return;
+    }
+
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+/**
+ * @brief get the numbers of recorded or replayed responses
+ * @param stats CORPUS_STATS*: populated with the statistics
+ */
+void corpus_get_stats(CORPUS_STATS *stats)
+{
+    memset(stats, 0, sizeof(CORPUS_STATS));
+    if (record_fd >= 0)
+    {
+        stats->records = __atomic_load_n(&records_written, __ATOMIC_RELAXED);
+        stats->bytes = __atomic_load_n(&record_end, __ATOMIC_RELAXED);
+    }
+    else if (map != NULL)
+    {
+        stats->records = map_records;
+        stats->bytes = map_size;
+        stats->hits = __atomic_load_n(&replay_hits, __ATOMIC_RELAXED);
+        stats->misses = __atomic_load_n(&replay_misses, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief close the archive and free the header buffers and the replay index
+ * @note only call once the recording or replaying threads have exited
+ */
+void corpus_cleanup()
+{
+    if (record_fd >= 0)
+    {
+        close(record_fd);
+        record_fd = -1;
+    }
+    CORPUS_HEADERS *h = all_headers;
+    while (h != NULL)
+    {
+        CORPUS_HEADERS *next = h->next;
+        free(h->buf);
+        free(h);
+        h = next;
+    }
+    all_headers = NULL;
+
+    if (map != NULL)
+    {
+        munmap((void *)map, map_size);
+        map = NULL;
+        map_size = 0;
+    }
+    free(slots);
+    slots = NULL;
+    slots_size = 0;
+    slots_used = 0;
+    map_records = 0;
+}
@@ -0,0 +1,102 @@
+/*
+Record/replay of fetched responses in a memory-mapped corpus archive
+*/
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <curl/curl.h>
+#include "latency.h"
+
+#define CORPUS_MAGIC "FPNGCRP1" /* first 8 bytes of every archive */
+#define CORPUS_MAGIC_LEN 8
+#define CORPUS_ALIGN 8 /* records start at multiples of this */
+#define CORPUS_HEADERS_INITIAL_SIZE 1024
+
+// one recorded response; followed in the archive by its url, effective url, content type
+//  and headers (each 0 terminated), then its body (also 0 terminated), padded to CORPUS_ALIGN
+typedef struct corpus_record
+{
+    // bytes of the whole record, padding included
+    uint64_t size;
+    // bytes of the body (without the terminating 0)
+    uint64_t body_len;
+    // http response code
+    int64_t response_code;
+    // bytes of the strings following the record (without their terminating 0s)
+    uint32_t url_len;
+    uint32_t eurl_len;
+    uint32_t content_type_len;
+    uint32_t headers_len;
+    // libcurl's timings of the fetch when it was recorded
+    LAT_TIMINGS timings;
+} CORPUS_RECORD;
+
+// a recorded response found in the archive; the strings point into the mapped archive
+typedef struct corpus_entry
+{
+    // url that was requested
+    const char *url;
+    // url the response came from (after redirects)
+    const char *eurl;
+    // Content-Type of the response; NULL if it had none
+    const char *content_type;
+    // header lines of the final response, as received ("\r\n" terminated)
+    const char *headers;
+    size_t headers_len;
+    const char *body;
+    size_t body_len;
+    long response_code;
+    // recorded timings, scaled by the latency emulation factor
+    LAT_TIMINGS timings;
+} CORPUS_ENTRY;
+
+// header lines of the response a thread is receiving (while recording)
+typedef struct corpus_headers
+{
+    char *buf;
+    // bytes in buf (buf is 0 terminated after them)
+    size_t len;
+    // capacity of buf
+    size_t size;
+    // next thread's header lines
+    struct corpus_headers *next;
+} CORPUS_HEADERS;
+
+// slot of the replay index
+typedef struct corpus_slot
+{
+    // hash of the record's url
+    uint64_t hash;
+    // NULL if the slot is empty
+    const CORPUS_RECORD *record;
+} CORPUS_SLOT;
+
+typedef struct corpus_stats
+{
+    // responses written to (or found in) the archive
+    size_t records;
+    // bytes of the archive
+    size_t bytes;
+    // replayed urls found in the archive, and urls that were not
+    size_t hits;
+    size_t misses;
+} CORPUS_STATS;
+
+int corpus_record_open(const char *path);
+bool corpus_recording();
+void corpus_record_header(const char *line, size_t len);
+void corpus_record(CURL *curl_handle, const char *url, const char *eurl, long response_code, const char *body, size_t body_len);
+int corpus_replay_open(const char *path, double latency_scale);
+bool corpus_replaying();
+bool corpus_find(const char *url, CORPUS_ENTRY *entry);
+void corpus_emulate_latency(const CORPUS_ENTRY *entry);
+void corpus_get_stats(CORPUS_STATS *stats);
+void corpus_cleanup();
+
+#endif
@@ -0,0 +1,479 @@
+/*
+Per-url crawl records (url, parent, depth, status, content type, size, timings, png validity),
+written as JSONL or as a compact length-prefixed binary stream
+- every fetch (including fetches that got no response) produces one record, which is
+  handed to the writer thread, so writing records never waits on the disk
+- the parent and depth of a url are taken from the page it was first found on; they
+  are kept in a table of discovered urls split into RECORDS_SHARDS locked shards,
+  keyed by the url's XXH64 hash
+- a binary records file is read back (e.g. as JSONL) with read_records
+*/
+
+#include <time.h>
+#include <curl/curl.h>
+#include "curl_xml.h"
+#include "crawl_records.h"
+#include "content_hash.h"
+#include "writer.h"
+
+static bool enabled = false;
+static int records_format = RECORDS_JSONL;
+// when the records were enabled (us of the monotonic clock)
+static uint64_t start_us = 0;
+static RECORDS_SHARD shards[RECORDS_SHARDS];
+// copies of parent urls; pushed with a compare-and-swap, freed at cleanup
+static RECORDS_PARENT *parents = NULL;
+
+static const char *kind_names[NUM_RECORD_KINDS] = {"error", "html", "png", "invalid_png", "duplicate_png", "other"};
+
+/**
+ * @brief current time of the monotonic clock
+ * @return time in us
+ */
+static uint64_t clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief hash a url for the table of discovered urls
+ * @param url const char*: the url
+ * @return the hash (never 0, which marks an empty slot)
+ */
+static uint64_t url_key(const char *url)
+{
+    uint64_t key = xxh64(url, strlen(url), 0);
+    return key == 0 ? 1 : key;
+}
+
+/**
+ * @brief double the capacity of a shard
+ * @param shard RECORDS_SHARD*: (pointer to) the shard; the caller holds its lock
+ */
+static void resize_shard(RECORDS_SHARD *shard)
+{
+    size_t new_size = 2 * shard->size;
+    RECORDS_SLOT *new_slots = calloc(new_size, sizeof(RECORDS_SLOT));
+    if (new_slots == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < shard->size; ++i)
+    {
+        if (shard->slots[i].key == 0)
+        {
+            continue;
+        }
+        size_t j = (shard->slots[i].key / RECORDS_SHARDS) & (new_size - 1);
+        while (new_slots[j].key != 0)
+        {
+            j = (j + 1) & (new_size - 1);
+        }
+        new_slots[j] = shard->slots[i];
+    }
+    free(shard->slots);
+    shard->slots = new_slots;
+    shard->size = new_size;
+}
+
+/**
+ * @brief record where a url was found, unless it was found before
+ * @param key uint64_t: hash of the url
+ * @param parent const char*: url of the page it was found on (NULL for the seed url)
+ * @param depth int32_t: number of links followed from the seed url
+ */
+static void discover(uint64_t key, const char *parent, int32_t depth)
+{
+    RECORDS_SHARD *shard = &shards[key % RECORDS_SHARDS];
+    pthread_mutex_lock(&shard->mutex);
+    {
+        if (2 * (shard->used + 1) > shard->size)
+        {
+            resize_shard(shard);
+        }
+        size_t i = (key / RECORDS_SHARDS) & (shard->size - 1);
+        while (shard->slots[i].key != 0 && shard->slots[i].key != key)
+        {
+            i = (i + 1) & (shard->size - 1);
+        }
+        if (shard->slots[i].key == 0 && 2 * (shard->used + 1) <= shard->size)
+        {
+            shard->slots[i].key = key;
+            shard->slots[i].parent = parent;
+            shard->slots[i].depth = depth;
+            ++shard->used;
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+/**
+ * @brief look up where a url was found
+ * @param key uint64_t: hash of the url
+ * @param parent const char**: set to the url of the page it was first found on (NULL if none)
+ * @return depth of the url; -1 if it was never discovered
+ */
+static int32_t lookup(uint64_t key, const char **parent)
+{
+    RECORDS_SHARD *shard = &shards[key % RECORDS_SHARDS];
+    int32_t depth = -1;
+    *parent = NULL;
+    pthread_mutex_lock(&shard->mutex);
+    {
+        size_t i = (key / RECORDS_SHARDS) & (shard->size - 1);
+        while (shard->slots[i].key != 0 && shard->slots[i].key != key)
+        {
+            i = (i + 1) & (shard->size - 1);
+        }
+        if (shard->slots[i].key == key)
+        {
+            *parent = shard->slots[i].parent;
+            depth = shard->slots[i].depth;
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return depth;
+}
+
+/**
+ * @brief turn on crawl records; they are written to the writer's WRITER_RECORDS file
+ * @param seed_url const char*: the url the crawl starts from (depth 0, no parent)
+ * @param format int: RECORDS_JSONL or RECORDS_BINARY
+ * @return 0 on success; 1 otherwise
+ * @note call after writer_start and before the crawl starts
+ */
+int crawl_records_enable(const char *seed_url, int format)
+{
+    for (int i = 0; i < RECORDS_SHARDS; ++i)
+    {
+        shards[i].size = RECORDS_SHARD_INITIAL_SIZE;
+        shards[i].used = 0;
+        shards[i].slots = calloc(RECORDS_SHARD_INITIAL_SIZE, sizeof(RECORDS_SLOT));
+        if (shards[i].slots == NULL)
+        {
+            return 1;
+        }
+        pthread_mutex_init(&shards[i].mutex, NULL);
+    }
+
+    records_format = format;
+    if (format == RECORDS_BINARY)
+    {
+        writer_append_data(WRITER_RECORDS, RECORDS_MAGIC, RECORDS_MAGIC_LEN);
+    }
+    discover(url_key(seed_url), NULL, 0);
+    start_us = clock_us();
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief check if crawl records are turned on
+ * @return true if on; false otherwise
+ */
+bool crawl_records_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief record the parent and depth of urls found on a page (urls found before keep theirs)
+ * @param parent const char*: url of the page
+ * @param urls STACK*: (pointer to) urls found on the page
+ * @note does nothing unless crawl records are turned on
+ */
+void crawl_records_discovered(const char *parent, STACK *urls)
+{
+    if (!enabled || num_elements_stack(urls) == 0)
+    {
+        return;
+    }
+
+    const char *grandparent;
+    int32_t depth = lookup(url_key(parent), &grandparent);
+
+    // one copy of the parent url is shared by all urls found on the page
+    size_t len = strlen(parent);
+    RECORDS_PARENT *copy = malloc(sizeof(RECORDS_PARENT) + len + 1);
+    if (copy == NULL)
+    {
+        return;
+    }
+    memcpy(copy->url, parent, len + 1);
+    copy->next = __atomic_load_n(&parents, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&parents, &copy->next, copy, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+
+    for (size_t i = 0; i < num_elements_stack(urls); ++i)
+    {
+        discover(url_key(urls->items[i]), copy->url, depth < 0 ? -1 : depth + 1);
+    }
+}
+
+/**
+ * @brief name of a kind of record, as written in JSONL
+ * @param kind uint32_t: RECORD_*
+ * @return the name
+ */
+const char *crawl_record_kind_name(uint32_t kind)
+{
+    return kind < NUM_RECORD_KINDS ? kind_names[kind] : "unknown";
+}
+
+/**
+ * @brief write a json string, escaped
+ * @param f FILE*: file to write to
+ * @param str const char*: string to write
+ * @param len size_t: bytes of the string
+ */
+static void write_json_string(FILE *f, const char *str, size_t len)
+{
+    fputc('"', f);
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\')
+        {
+            fprintf(f, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(f, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/**
+ * @brief write a record as one line of json
+ * @param f FILE*: file to write to
+ * @param r const CRAWL_RECORD*: the record
+ * @param url const char*: its url (r->url_len bytes)
+ * @param parent const char*: its parent (r->parent_len bytes; null in json when empty)
+ * @param content_type const char*: its content type (r->content_type_len bytes; null in json when empty)
+ */
+void crawl_record_print_json(FILE *f, const CRAWL_RECORD *r, const char *url, const char *parent, const char *content_type)
+{
+    fprintf(f, "{\"url\": ");
+    write_json_string(f, url, r->url_len);
+    fprintf(f, ", \"parent\": ");
+    if (r->parent_len > 0)
+    {
+        write_json_string(f, parent, r->parent_len);
+    }
+    else
+    {
+        fprintf(f, "null");
+    }
+    fprintf(f, ", \"depth\": %d, \"status\": %d, \"content_type\": ", r->depth, r->status);
+    if (r->content_type_len > 0)
+    {
+        write_json_string(f, content_type, r->content_type_len);
+    }
+    else
+    {
+        fprintf(f, "null");
+    }
+    fprintf(f, ", \"kind\": \"%s\"", crawl_record_kind_name(r->kind));
+    if (r->kind == RECORD_PNG || r->kind == RECORD_INVALID_PNG || r->kind == RECORD_DUPLICATE_PNG)
+    {
+        fprintf(f, ", \"png_valid\": %s", r->kind == RECORD_INVALID_PNG ? "false" : "true");
+    }
+    if (r->kind == RECORD_ERROR)
+    {
+        fprintf(f, ", \"error\": \"%s\"", curl_easy_strerror(r->curl_error));
+    }
+    fprintf(f, ", \"bytes\": %lu, \"time_ms\": %.3f, \"dns_ms\": %.3f, \"connect_ms\": %.3f, \"tls_ms\": %.3f, "
+               "\"ttfb_ms\": %.3f, \"total_ms\": %.3f}\n",
+            (unsigned long)r->bytes, r->time_us / 1000., r->dns_us / 1000., r->connect_us / 1000., r->tls_us / 1000.,
+            r->ttfb_us / 1000., r->total_us / 1000.);
+}
+
+/**
+ * @brief record a fetch
+ * @param url const char*: url that was requested
+ * @param eurl const char*: effective url (after redirects); NULL if there was no response
+ * @param response_code long: http status
+ * @param content_type_str const char*: Content-Type of the response; may be NULL
+ * @param content_type int: what the response was classified as (e.g. HTML, VALID_PNG)
+ * @param timings const LAT_TIMINGS*: timings and size of the fetch
+ * @param curl_error int: curl error of a fetch without response; CURLE_OK otherwise
+ * @note does nothing unless crawl records are turned on
+ */
+void crawl_records_fetch(const char *url, const char *eurl, long response_code, const char *content_type_str,
+                         int content_type, const LAT_TIMINGS *timings, int curl_error)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    const char *parent;
+    int32_t depth = lookup(url_key(url), &parent);
+    // links on a redirected page are found on (and parented to) the effective url
+    if (eurl != NULL && strcmp(eurl, url) != 0)
+    {
+        discover(url_key(eurl), parent, depth);
+    }
+    if (content_type_str == NULL)
+    {
+        content_type_str = "";
+    }
+    if (parent == NULL)
+    {
+        parent = "";
+    }
+
+    CRAWL_RECORD r;
+    memset(&r, 0, sizeof(CRAWL_RECORD));
+    r.time_us = clock_us() - start_us;
+    r.bytes = timings->bytes;
+    r.dns_us = timings->namelookup;
+    r.connect_us = timings->connect > timings->namelookup ? timings->connect - timings->namelookup : 0;
+    r.tls_us = timings->appconnect > timings->connect ? timings->appconnect - timings->connect : 0;
+    r.ttfb_us = timings->starttransfer > timings->pretransfer ? timings->starttransfer - timings->pretransfer : 0;
+    r.total_us = timings->total;
+    r.status = curl_error == CURLE_OK ? response_code : 0;
+    r.depth = depth;
+    r.curl_error = curl_error;
+    r.url_len = strlen(url);
+    r.parent_len = strlen(parent);
+    r.content_type_len = strlen(content_type_str);
+    if (curl_error != CURLE_OK)
+    {
+        r.kind = RECORD_ERROR;
+    }
+    else if (content_type == HTML)
+    {
+        r.kind = RECORD_HTML;
+    }
+    else if (content_type == VALID_PNG)
+    {
+        r.kind = RECORD_PNG;
+    }
+    else if (content_type == INVALID_PNG)
+    {
+        r.kind = RECORD_INVALID_PNG;
+    }
+    else if (content_type == DUPLICATE_PNG)
+    {
+        r.kind = RECORD_DUPLICATE_PNG;
+    }
+    else
+    {
+        r.kind = RECORD_OTHER;
+    }
+
+    if (records_format == RECORDS_JSONL)
+    {
+        char *line = NULL;
+        size_t len = 0;
+        FILE *f = open_memstream(&line, &len);
+        if (f == NULL)
+        {
+            return;
+        }
+        crawl_record_print_json(f, &r, url, parent, content_type_str);
+        fclose(f);
+        writer_append_data(WRITER_RECORDS, line, len);
+        free(line);
+        return;
+    }
+
+    uint32_t record_len = sizeof(CRAWL_RECORD) + r.url_len + r.parent_len + r.content_type_len;
+    char *buf = malloc(sizeof(uint32_t) + record_len);
+    if (buf == NULL)
+    {
+        return;
+    }
+    char *p = buf;
+    memcpy(p, &record_len, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    memcpy(p, &r, sizeof(CRAWL_RECORD));
+    p += sizeof(CRAWL_RECORD);
+    memcpy(p, url, r.url_len);
+    p += r.url_len;
+    memcpy(p, parent, r.parent_len);
+    p += r.parent_len;
+    memcpy(p, content_type_str, r.content_type_len);
+    writer_append_data(WRITER_RECORDS, buf, sizeof(uint32_t) + record_len);
+    free(buf);
+}
+
+/**
+ * @brief read the next record of a binary records file (after its RECORDS_MAGIC)
+ * @param f FILE*: the file
+ * @param r CRAWL_RECORD*: populated with the record
+ * @param strings char**: (pointer to) a buffer populated with the record's url, parent and
+ *  content type, one after the other; grown as needed (free it when done)
+ * @param strings_size size_t*: (pointer to) the capacity of *strings
+ * @return 0 on success; 1 at the end of the file; 2 if the record is cut short or malformed
+ */
+int crawl_record_read(FILE *f, CRAWL_RECORD *r, char **strings, size_t *strings_size)
+{
+    uint32_t record_len;
+    size_t n = fread(&record_len, 1, sizeof(uint32_t), f);
+    if (n == 0)
+    {
+        return 1;
+    }
+    if (n < sizeof(uint32_t) || record_len < sizeof(CRAWL_RECORD) ||
+        fread(r, sizeof(CRAWL_RECORD), 1, f) != 1)
+    {
+        return 2;
+    }
+
+    size_t len = record_len - sizeof(CRAWL_RECORD);
+    if ((uint64_t)r->url_len + r->parent_len + r->content_type_len != len)
+    {
+        return 2;
+    }
+    if (len + 1 > *strings_size)
+    {
+        char *p = realloc(*strings, len + 1);
+        if (p == NULL)
+        {
+            return 2;
+        }
+        *strings = p;
+        *strings_size = len + 1;
+    }
+    if (fread(*strings, 1, len, f) != len)
+    {
+        return 2;
+    }
+    (*strings)[len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief free the table of discovered urls
+ * @note only call once the recording threads have exited
+ */
+void crawl_records_cleanup()
+{
+    if (!enabled)
+    {
+        return;
+    }
+    for (int i = 0; i < RECORDS_SHARDS; ++i)
+    {
+        free(shards[i].slots);
+        shards[i].slots = NULL;
+        pthread_mutex_destroy(&shards[i].mutex);
+    }
+    while (parents != NULL)
+    {
+        RECORDS_PARENT *next = parents->next;
+        free(parents);
+        parents = next;
+    }
+    enabled = false;
+}
@@ -0,0 +1,102 @@
+/*
+Per-url crawl records (url, parent, depth, status, content type, size, timings, png validity),
+written as JSONL or as a compact length-prefixed binary stream
+*/
+
+#ifndef CRAWL_RECORDS_H
+#define CRAWL_RECORDS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "stack.h"
+#include "latency.h"
+
+#define RECORDS_JSONL 0
+#define RECORDS_BINARY 1
+
+#define RECORDS_MAGIC "FPNGREC1" /* first 8 bytes of a binary records file */
+#define RECORDS_MAGIC_LEN 8
+#define RECORDS_SHARDS 64 /* the table of discovered urls is split into this many locked shards */
+#define RECORDS_SHARD_INITIAL_SIZE 256
+
+// what a fetched url turned out to be
+#define RECORD_ERROR 0         /* no response (e.g. connection refused) */
+#define RECORD_HTML 1
+#define RECORD_PNG 2           /* a valid png */
+#define RECORD_INVALID_PNG 3   /* served as image/png, but not a png */
+#define RECORD_DUPLICATE_PNG 4 /* a valid png identical to one found before (-D) */
+#define RECORD_OTHER 5
+#define NUM_RECORD_KINDS 6
+
+// one fetched url; in the binary format, each record is a uint32_t length (of the record
+//  and its strings) followed by the record and then its url, parent and content type
+//  (not 0 terminated); all in the byte order of the machine that wrote them
+typedef struct crawl_record
+{
+    // when the fetch finished (us since the crawl started)
+    uint64_t time_us;
+    // bytes downloaded
+    uint64_t bytes;
+    // how long each phase of the fetch took (us)
+    uint32_t dns_us;
+    uint32_t connect_us;
+    uint32_t tls_us;
+    uint32_t ttfb_us;
+    uint32_t total_us;
+    // http status (0 if there was no response)
+    int32_t status;
+    // number of links followed from the seed url (-1 if unknown)
+    int32_t depth;
+    // curl error of a fetch without response (CURLE_OK otherwise)
+    uint32_t curl_error;
+    // RECORD_*
+    uint32_t kind;
+    // bytes of the strings following the record
+    uint32_t url_len;
+    uint32_t parent_len;
+    uint32_t content_type_len;
+} CRAWL_RECORD;
+
+// a discovered url: who linked to it first, and how deep
+typedef struct records_slot
+{
+    // hash of the url (0 marks an empty slot)
+    uint64_t key;
+    // url of the page it was first found on (NULL for the seed url)
+    const char *parent;
+    int32_t depth;
+} RECORDS_SLOT;
+
+typedef struct records_shard
+{
+    // capacity of the shard (a power of 2)
+    size_t size;
+    // number of urls in the shard
+    size_t used;
+    RECORDS_SLOT *slots;
+    // lock for the shard
+    pthread_mutex_t mutex;
+} RECORDS_SHARD;
+
+// a copy of a parent url, kept until cleanup
+typedef struct records_parent
+{
+    struct records_parent *next;
+    char url[];
+} RECORDS_PARENT;
+
+int crawl_records_enable(const char *seed_url, int format);
+bool crawl_records_enabled();
+void crawl_records_discovered(const char *parent, STACK *urls);
+void crawl_records_fetch(const char *url, const char *eurl, long response_code, const char *content_type_str,
+                         int content_type, const LAT_TIMINGS *timings, int curl_error);
+const char *crawl_record_kind_name(uint32_t kind);
+void crawl_record_print_json(FILE *f, const CRAWL_RECORD *r, const char *url, const char *parent, const char *content_type);
+int crawl_record_read(FILE *f, CRAWL_RECORD *r, char **strings, size_t *strings_size);
+void crawl_records_cleanup();
+
+#endif
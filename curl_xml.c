@@ -1,4 +1,61 @@
 #include "curl_xml.h"
+#include "link_scan.h"
+#include "arena.h"
+#include "trap.h"
+
+// link extraction engine used by extract_links (EXTRACT_XML, EXTRACT_SCAN or EXTRACT_DIFF)
+static int extract_engine = EXTRACT_XML;
+// number of pages compared in EXTRACT_DIFF mode, and how many of them differed
+static size_t diff_pages = 0;
+static size_t diff_mismatches = 0;
+// number of pages the scanner extracted in EXTRACT_SCAN or EXTRACT_DIFF mode, and how many it gave up on
+static size_t scan_pages = 0;
+static size_t scan_fallbacks = 0;
+// HTTP version requested by every fetch (CURL_HTTP_VERSION_NONE: libcurl's default)
+static long http_version = CURL_HTTP_VERSION_NONE;
+
+/**
+ * @brief select the engine extract_links uses to extract links from pages
+ * @param engine int: EXTRACT_XML, EXTRACT_SCAN or EXTRACT_DIFF
+ */
+void set_extract_engine(int engine)
+{
+    extract_engine = engine;
+}
+
+/**
+ * @brief have every fetch ask for HTTP/2, and wait to share a connection that can multiplex (--http2)
+ * @param prior_knowledge bool: speak HTTP/2 to http:// urls right away (h2c) instead of asking to upgrade
+ * @details
+ * https:// urls negotiate HTTP/2 with ALPN either way. Servers that only speak HTTP/1.1
+ *  ignore the upgrade, unless prior_knowledge is set.
+ */
+void set_http2(bool prior_knowledge)
+{
+    http_version = prior_knowledge ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2_0;
+}
+
+/**
+ * @brief report how the scanner compared against libxml2 in EXTRACT_DIFF mode
+ * @param pages size_t*: (pointer to) number to be set with the pages compared
+ * @param mismatches size_t*: (pointer to) number to be set with the pages whose links differed
+ */
+void get_extract_diff(size_t *pages, size_t *mismatches)
+{
+    *pages = __atomic_load_n(&diff_pages, __ATOMIC_RELAXED);
+    *mismatches = __atomic_load_n(&diff_mismatches, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief report how often the scanner gave up on a page in EXTRACT_SCAN or EXTRACT_DIFF mode
+ * @param scanned size_t*: (pointer to) number to be set with the pages the scanner extracted
+ * @param fallbacks size_t*: (pointer to) number to be set with the pages left to libxml2
+ */
+void get_extract_scan(size_t *scanned, size_t *fallbacks)
+{
+    *scanned = __atomic_load_n(&scan_pages, __ATOMIC_RELAXED);
+    *fallbacks = __atomic_load_n(&scan_fallbacks, __ATOMIC_RELAXED);
+}
 
 /**
  * @brief set options of curl easy handle
@@ -23,6 +80,10 @@ CURL *easy_handle_config(CURL *curl_handle, RECV_BUF *ptr, const char *url)
 
     // specify URL to get
     curl_easy_setopt(curl_handle, CURLOPT_URL, url);
+    // connect to the host's cached address (if --dns-prefetch or --dns-hosts)
+    dns_apply(curl_handle, url);
+    // ask whether the url changed since its cached response (if --cache)
+    ptr->cache = http_cache_begin(curl_handle, url);
 
     // register write call back function to process received data
     curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_cb_curl);
@@ -53,27 +114,168 @@ CURL *easy_handle_config(CURL *curl_handle, RECV_BUF *ptr, const char *url)
     // allow whatever auth the server speaks
     curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
 
+    // ask for HTTP/2, and wait for a connection on the host to multiplex on rather than open another (if --http2)
+    if (http_version != CURL_HTTP_VERSION_NONE)
+    {
+        curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, http_version);
+        curl_easy_setopt(curl_handle, CURLOPT_PIPEWAIT, 1L);
+    }
+
     return curl_handle;
 }
 
+/**
+ * @brief compare the top entries of two stacks as multisets and print the differences
+ * @param url const char*: url of the page the links were found on
+ * @param what const char*: which kind of links are compared (for the report)
+ * @param xml STACK*: (pointer to) links found by find_http
+ * @param xml_start size_t: number of entries in xml before find_http ran
+ * @param scan STACK*: (pointer to) links found by scan_http
+ * @return number of links found by only one of the engines
+ */
+static size_t diff_links(const char *url, const char *what, STACK *xml, size_t xml_start, STACK *scan)
+{
+    size_t n_xml = num_elements_stack(xml) - xml_start;
+    size_t n_scan = num_elements_stack(scan);
+    char **a = xml->items + xml_start;
+    char **b = scan->items;
+    bool *matched = calloc(n_scan + 1, sizeof(bool));
+    size_t differences = 0;
+
+    for (size_t i = 0; i < n_xml; ++i)
+    {
+        size_t j = 0;
+        while (j < n_scan && (matched[j] || strcmp(a[i], b[j]) != 0))
+        {
+            ++j;
+        }
+        if (j < n_scan)
+        {
+            matched[j] = true;
+            continue;
+        }
+        fprintf(stderr, "extract diff: %s: %s only found by libxml2: %s\n", url, what, a[i]);
+        ++differences;
+    }
+    for (size_t j = 0; j < n_scan; ++j)
+    {
+        if (!matched[j])
+        {
+            fprintf(stderr, "extract diff: %s: %s only found by scanner: %s\n", url, what, b[j]);
+            ++differences;
+        }
+    }
+
+    free(matched);
+    return differences;
+}
+
+/**
+ * @brief extract the urls on a html page with the selected engine
+ * @param buf char*: (pointer to) buffer that contains the HTML web page
+ * @param size int: size of the buffer
+ * @param follow_relative_links int: 1 if we're following relative links and 0 otherwise
+ * @param base_url const char*: base url of the page
+ * @param stack STACK*: (pointer to) stack that will be populated with further pages to crawl
+ * @param img_stack STACK*: (pointer to) stack that will be populated with images embedded on the page
+ * @return 0 on success; non-zero otherwise
+ * @details
+ * EXTRACT_XML parses the page with libxml2 (find_http).
+ * EXTRACT_SCAN scans the raw page (scan_http) and falls back to libxml2 when the scanner gives up.
+ * EXTRACT_DIFF runs both, reports every link only one of them found on stderr,
+ *  and crawls with the libxml2 result.
+ */
+int extract_links(char *buf, int size, int follow_relative_links, const char *base_url, STACK *stack, STACK *img_stack)
+{
+    if (extract_engine == EXTRACT_SCAN)
+    {
+        if (scan_http(buf, size, follow_relative_links, base_url, stack, img_stack) == SCAN_OK)
+        {
+            __atomic_add_fetch(&scan_pages, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        __atomic_add_fetch(&scan_fallbacks, 1, __ATOMIC_RELAXED);
+        return find_http(buf, size, follow_relative_links, base_url, stack, img_stack);
+    }
+
+    if (extract_engine == EXTRACT_DIFF)
+    {
+        size_t stack_start = num_elements_stack(stack);
+        size_t img_stack_start = num_elements_stack(img_stack);
+        int ret = find_http(buf, size, follow_relative_links, base_url, stack, img_stack);
+
+        STACK scan_stack, scan_img_stack;
+        init_stack(&scan_stack, 1);
+        init_stack(&scan_img_stack, 1);
+        if (scan_http(buf, size, follow_relative_links, base_url, &scan_stack, &scan_img_stack) == SCAN_OK)
+        {
+            size_t differences = diff_links(base_url, "page", stack, stack_start, &scan_stack) +
+                                 diff_links(base_url, "image", img_stack, img_stack_start, &scan_img_stack);
+            __atomic_add_fetch(&scan_pages, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&diff_pages, 1, __ATOMIC_RELAXED);
+            if (differences > 0)
+            {
+                __atomic_add_fetch(&diff_mismatches, 1, __ATOMIC_RELAXED);
+            }
+        }
+        else
+        {
+            __atomic_add_fetch(&scan_fallbacks, 1, __ATOMIC_RELAXED);
+        }
+        cleanup_stack(&scan_stack);
+        cleanup_stack(&scan_img_stack);
+        return ret;
+    }
+
+    return find_http(buf, size, follow_relative_links, base_url, stack, img_stack);
+}
+
 /**
  * @brief process a downloaded html page: get all urls from the page and push it onto stack
- * @param curl_handle CURL*: (pointer to) curl handler that was used to access the url
  * @param p_recv_buf RECV_BUF*: (pointer to) buffer that contains the received data
- * @param content_type int*: (pointer to) int to be set with content type code
+ * @param url const char*: effective url of the page; relative links are resolved against it
  * @param stack STACK*: (pointer to) stack that will be populated with further urls to crawl
+ * @param img_stack STACK*: (pointer to) stack that will be populated with images embedded on the page
  * @return 0 on success; non-zero otherwise
+ * @note the urls pushed onto the stacks are plain heap copies, so they outlive the arena reset
  */
-int process_html(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type, STACK *stack)
+int process_html(RECV_BUF *p_recv_buf, const char *url, STACK *stack, STACK *img_stack)
 {
-    *content_type = HTML;
-
     int follow_relative_link = 1;
-    char *url = NULL;
 
-    curl_easy_getinfo(curl_handle, CURLINFO_EFFECTIVE_URL, &url);
-    find_http(p_recv_buf->buf, p_recv_buf->size, follow_relative_link, url, stack);
-    return 0;
+    // a page that didn't change since it was cached isn't downloaded: push its cached links (if --cache)
+    if (http_cache_push_links(p_recv_buf->cache, stack, img_stack))
+    {
+        return 0;
+    }
+
+    // don't parse a page identical to one parsed before (only checked if dedup is enabled)
+    if (content_is_duplicate_page(xxh64_digest(&p_recv_buf->hash_state), url))
+    {
+        return 0;
+    }
+
+    // don't expand the links of a page that nearly duplicates an earlier page
+    //  (only checked if trap detection is enabled)
+    if (trap_is_near_duplicate(p_recv_buf->buf, p_recv_buf->size))
+    {
+        return 0;
+    }
+
+    // everything libxml2 allocates for the page comes from (and is reset with) the
+    //  thread's arena, if it is installed
+    arena_begin();
+    uint64_t parse_start = trace_begin();
+    size_t stack_start = num_elements_stack(stack);
+    size_t img_start = num_elements_stack(img_stack);
+    int ret = extract_links(p_recv_buf->buf, p_recv_buf->size, follow_relative_link, url, stack, img_stack);
+    trace_end("parse", parse_start, url);
+    arena_end();
+
+    // keep the page's validators and links for the next crawl (if --cache)
+    http_cache_store(p_recv_buf->cache, HTML, xxh64_digest(&p_recv_buf->hash_state), stack, stack_start, img_stack, img_start);
+
+    return ret;
 }
 
 /**
@@ -107,21 +309,23 @@ bool is_png(uint8_t *buf, size_t n)
 }
 
 /**
- * @brief process a downloaded png: check if it's a valid png
- * @param curl_handle CURL*: (pointer to) curl handler that was used to access the url
+ * @brief process a downloaded png: check if it's a valid png, and if it duplicates a png found before
  * @param p_recv_buf RECV_BUF*: (pointer to) buffer that contains the received data
+ * @param url const char*: effective url of the png
  * @param content_type int*: (pointer to) int to be set with content type code
  * @return 0 on success; non-zero otherwise
  */
-int process_png(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type)
+int process_png(RECV_BUF *p_recv_buf, const char *url, int *content_type)
 {
-    // effective url
-    char *eurl = NULL;
-    curl_easy_getinfo(curl_handle, CURLINFO_EFFECTIVE_URL, &eurl);
-
     if (is_png((uint8_t *)p_recv_buf->buf, p_recv_buf->size))
     {
         *content_type = VALID_PNG;
+        // an identical png was found before (only checked if dedup is enabled):
+        //  record this url as an alias instead of a new find
+        if (content_is_duplicate_png(xxh64_digest(&p_recv_buf->hash_state), url))
+        {
+            *content_type = DUPLICATE_PNG;
+        }
     }
     else
     {
@@ -132,97 +336,333 @@ int process_png(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type)
 }
 
 /**
- * @brief process the downloaded content data
- * @param curl_handle CURL*: (pointer to) curl handler that was used to access the url
+ * @brief classify downloaded (or replayed) content data by its response code and content type
  * @param p_recv_buf RECV_BUF*: (pointer to) buffer that contains the received data
+ * @param url const char*: effective url of the data
+ * @param ct const char*: Content-Type of the response; may be NULL
+ * @param response_code long: http response code
  * @param content_type int*: (pointer to) int to be set with content type code
- * @param stack STACK*: (pointer to) stack that will be populated with further urls to crawl
  * @param response_code_p long*: (pointer to) int to be set with the response code
  * @return 0 on success; non-zero otherwise
  * @details
- * if url points to a HTML page, populate stack with urls linked on the page
+ * if url points to a HTML page, set the content type to HTML (the page is parsed by process_html)
  * if url points to a png, check if it's a valid png
  * set the content type and response code via the appropriate pointers
  */
-int process_data(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type, STACK *stack, long *response_code_p)
+int classify_data(RECV_BUF *p_recv_buf, const char *url, const char *ct, long response_code, int *content_type, long *response_code_p)
 {
-    CURLcode res;
-
-    // get response code, and return if it's a fail
-    long response_code;
-    res = curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
+    // return if the response code is a fail
     *response_code_p = response_code;
     if (response_code >= BAD_REQUESTS)
     {
         return 1;
     }
 
-    // get content, and handle differently depending on content type
-    char *ct = NULL;
-    res = curl_easy_getinfo(curl_handle, CURLINFO_CONTENT_TYPE, &ct);
-    if (res != CURLE_OK || ct == NULL)
+    // handle differently depending on content type
+    if (ct == NULL)
     {
         return 2;
     }
     if (strstr(ct, CT_HTML))
     {
-        return process_html(curl_handle, p_recv_buf, content_type, stack);
+        *content_type = HTML;
+        return 0;
     }
     else if (strstr(ct, CT_PNG))
     {
-        return process_png(curl_handle, p_recv_buf, content_type);
+        return process_png(p_recv_buf, url, content_type);
     }
 
     return 0;
 }
 
 /**
- * @brief crawl specified url and process the downloaded data
- * @param curl_handle CURL*: (pointer to) the curl handler that will be used to process the url
- * @param seed_url char*: string containing the url to crawl
+ * @brief classify the downloaded content data
+ * @param curl_handle CURL*: (pointer to) curl handler that was used to access the url
+ * @param p_recv_buf RECV_BUF*: (pointer to) buffer that contains the received data
  * @param content_type int*: (pointer to) int to be set with content type code
- * @param stack STACK*: (pointer to) stack that will be populated with further urls to crawl
  * @param response_code_p long*: (pointer to) int to be set with the response code
  * @return 0 on success; non-zero otherwise
+ * @details see classify_data
+ * With --cache, a 304 answer to a conditional request is a cache hit: it is classified
+ *  as its cached response was.
+ */
+int process_data(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type, long *response_code_p)
+{
+    long response_code = INTERNAL_SERVER_ERRORS;
+    char *ct = NULL;
+    char *eurl = NULL;
+    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
+    if (curl_easy_getinfo(curl_handle, CURLINFO_CONTENT_TYPE, &ct) != CURLE_OK)
+    {
+        ct = NULL;
+    }
+    curl_easy_getinfo(curl_handle, CURLINFO_EFFECTIVE_URL, &eurl);
+
+    http_cache_response(p_recv_buf->cache, curl_handle, response_code);
+    if (http_cache_hit(p_recv_buf->cache, content_type))
+    {
+        *response_code_p = response_code;
+        return 0;
+    }
+
+    int ret = classify_data(p_recv_buf, eurl, ct, response_code, content_type, response_code_p);
+    // pages are cached once they are parsed; anything else is cached now (if --cache)
+    if (*content_type != HTML)
+    {
+        http_cache_store(p_recv_buf->cache, *content_type, xxh64_digest(&p_recv_buf->hash_state), NULL, 0, NULL, 0);
+    }
+    return ret;
+}
+
+/**
+ * @brief answer a fetch from the replayed corpus archive instead of the network
+ * @param seed_url char*: string containing the url to crawl
+ * @param p_recv_buf RECV_BUF*: (pointer to) uninitialized buffer to be populated with the recorded data
+ * @param eurl_p char**: (pointer to) string to be set with a copy of the recorded effective url
+ * @param content_type int*: (pointer to) int to be set with content type code
+ * @param response_code_p long*: (pointer to) int to be set with the recorded response code
+ * @return 0 on success; non-zero if the url is not in the archive (like a failed download)
  * @details
- * if url points to a HTML page, populate stack with urls linked on the page
- * if url points to a png, check if it's a valid png
- * set the content type and response code via the appropriate pointers
+ * The recorded header lines and body go through the same curl callbacks as a download,
+ *  so the buffer (and its content hash) are exactly what a download would have produced.
+ * @note on success the caller is responsible for cleaning p_recv_buf with recv_buf_cleanup
+ *  and for deallocating *eurl_p
+ */
+int replay_url(char *seed_url, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p)
+{
+    CORPUS_ENTRY entry;
+    uint64_t replay_start = trace_begin();
+    bool found = corpus_find(seed_url, &entry);
+    if (found)
+    {
+        corpus_emulate_latency(&entry);
+    }
+    trace_end("replay", replay_start, seed_url);
+    if (!found)
+    {
+        // a url that is not in the archive fails like a download that got no response
+        LAT_TIMINGS no_timings;
+        memset(&no_timings, 0, sizeof(LAT_TIMINGS));
+        latency_record_failure();
+        live_stats_record_failure();
+        crawl_records_fetch(seed_url, NULL, 0, NULL, DEFAULT_TYPE, &no_timings, CURLE_COULDNT_CONNECT);
+        return 1;
+    }
+
+    if (recv_buf_init(p_recv_buf, max((size_t)BUF_SIZE, entry.body_len + 1)) != 0)
+    {
+        fprintf(stderr, "Allocating the receive buffer failed. Exiting...\n");
+        abort();
+    }
+    const char *line = entry.headers;
+    const char *headers_end = entry.headers + entry.headers_len;
+    while (line < headers_end)
+    {
+        const char *eol = memchr(line, '\n', headers_end - line);
+        size_t len = eol == NULL ? (size_t)(headers_end - line) : (size_t)(eol - line) + 1;
+        header_cb_curl((char *)line, 1, len, p_recv_buf);
+        line += len;
+    }
+    write_cb_curl((char *)entry.body, 1, entry.body_len, p_recv_buf);
+
+    // classify the data from the url
+    classify_data(p_recv_buf, entry.eurl, entry.content_type, entry.response_code, content_type, response_code_p);
+    *eurl_p = strdup(entry.eurl);
+
+    // record the (scaled) recorded timings of the fetch (if enabled)
+    latency_record_timings(&entry.timings, *eurl_p, *content_type);
+    live_stats_record_fetch(p_recv_buf->size, *response_code_p);
+    crawl_records_fetch(seed_url, *eurl_p, *response_code_p, entry.content_type, *content_type, &entry.timings, CURLE_OK);
+    return 0;
+}
+
+/**
+ * @brief download the data at url and classify it, leaving html pages unparsed
+ * @param curl_handle CURL*: (pointer to) the curl handler that will be used to download the url
+ * @param seed_url char*: string containing the url to crawl
+ * @param p_recv_buf RECV_BUF*: (pointer to) uninitialized buffer to be populated with the downloaded data
+ * @param eurl_p char**: (pointer to) string to be set with a copy of the effective url (after redirects)
+ * @param content_type int*: (pointer to) int to be set with content type code
+ * @param response_code_p long*: (pointer to) int to be set with the response code
+ * @return 0 on success; non-zero otherwise
+ * @note on success the caller is responsible for cleaning p_recv_buf with recv_buf_cleanup
+ *  and for deallocating *eurl_p
  */
-int process_url(CURL *curl_handle, char *seed_url, int *content_type, STACK *stack, long *response_code_p)
+int fetch_url(CURL *curl_handle, char *seed_url, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p)
 {
     // set default response code to failure (if nothing fails, the code will be set later)
     *response_code_p = INTERNAL_SERVER_ERRORS;
+    *content_type = DEFAULT_TYPE;
+    *eurl_p = NULL;
+
+    if (corpus_replaying())
+    {
+        return replay_url(seed_url, p_recv_buf, eurl_p, content_type, response_code_p);
+    }
 
     // configure the easy curl handle
-    char url[URL_LENGTH];
-    RECV_BUF recv_buf;
-    strcpy(url, seed_url);
-    curl_handle = easy_handle_config(curl_handle, &recv_buf, url);
+    fetch_begin(curl_handle, seed_url, p_recv_buf);
+
+    // download the url
+    CURLcode res;
+    uint64_t perform_start = trace_begin();
+    res = curl_easy_perform(curl_handle);
+    trace_end("curl_easy_perform", perform_start, seed_url);
+    return fetch_end(curl_handle, seed_url, res, p_recv_buf, eurl_p, content_type, response_code_p);
+}
+
+/**
+ * @brief configure a curl handle to download a url (into a buffer it initializes)
+ * @param curl_handle CURL*: (pointer to) the curl handler that will download the url
+ * @param seed_url char*: string containing the url to crawl
+ * @param p_recv_buf RECV_BUF*: (pointer to) uninitialized buffer to be populated with the downloaded data
+ * @details
+ * The transfer is then run with curl_easy_perform, or on a multi handle, and finished with fetch_end.
+ */
+void fetch_begin(CURL *curl_handle, char *seed_url, RECV_BUF *p_recv_buf)
+{
+    // (libcurl keeps its own copy of the url, so urls longer than URL_LENGTH are fine)
+    curl_handle = easy_handle_config(curl_handle, p_recv_buf, seed_url);
     if (curl_handle == NULL)
     {
         fprintf(stderr, "Curl configuration failed. Exiting...\n");
         curl_global_cleanup();
         abort();
     }
+}
 
-    // process the url
-    CURLcode res;
-    res = curl_easy_perform(curl_handle);
+/**
+ * @brief have a fetch configured by fetch_begin not share its connection with other streams (--http2)
+ * @param curl_handle CURL*: (pointer to) the curl handler that will download the url
+ * @details
+ * Used to retry fetches that failed in the HTTP/2 framing layer. The fetch speaks HTTP/1.1,
+ *  unless --h2c: servers spoken to with prior knowledge may only speak HTTP/2, so the fetch
+ *  keeps h2c on a connection of its own instead (libcurl 7.88.1 fails every stream after the
+ *  first on an h2c connection).
+ */
+void fetch_without_multiplexing(CURL *curl_handle)
+{
+    if (http_version == CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE)
+    {
+        curl_easy_setopt(curl_handle, CURLOPT_FRESH_CONNECT, 1L);
+        curl_easy_setopt(curl_handle, CURLOPT_FORBID_REUSE, 1L);
+    }
+    else
+    {
+        curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
+    }
+    curl_easy_setopt(curl_handle, CURLOPT_PIPEWAIT, 0L);
+}
+
+/**
+ * @brief classify and account for a finished download (started with fetch_begin), leaving html pages unparsed
+ * @param curl_handle CURL*: (pointer to) the curl handler that downloaded the url
+ * @param seed_url char*: string containing the url crawled
+ * @param res CURLcode: result of the transfer
+ * @param p_recv_buf RECV_BUF*: (pointer to) buffer populated with the downloaded data
+ * @param eurl_p char**: (pointer to) string to be set with a copy of the effective url (after redirects)
+ * @param content_type int*: (pointer to) int to be set with content type code
+ * @param response_code_p long*: (pointer to) int to be set with the response code
+ * @return 0 on success; non-zero otherwise (p_recv_buf is then cleaned)
+ * @note on success the caller is responsible for cleaning p_recv_buf with recv_buf_cleanup
+ *  and for deallocating *eurl_p
+ */
+int fetch_end(CURL *curl_handle, char *seed_url, CURLcode res, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p)
+{
+    *response_code_p = INTERNAL_SERVER_ERRORS;
+    *content_type = DEFAULT_TYPE;
+    *eurl_p = NULL;
     if (res != CURLE_OK)
     {
-        recv_buf_cleanup(&recv_buf);
+        latency_record_failure();
+        live_stats_record_failure();
+        if (crawl_records_enabled())
+        {
+            LAT_TIMINGS timings;
+            latency_get_timings(curl_handle, &timings);
+            crawl_records_fetch(seed_url, NULL, 0, NULL, DEFAULT_TYPE, &timings, res);
+        }
+        recv_buf_cleanup(p_recv_buf);
         return 1;
     }
 
-    // process the data from the url
-    process_data(curl_handle, &recv_buf, content_type, stack, response_code_p);
+    // classify the data from the url
+    process_data(curl_handle, p_recv_buf, content_type, response_code_p);
 
-    // clean up data buffer
-    recv_buf_cleanup(&recv_buf);
+    char *eurl = NULL;
+    curl_easy_getinfo(curl_handle, CURLINFO_EFFECTIVE_URL, &eurl);
+    *eurl_p = strdup(eurl != NULL ? eurl : seed_url);
+
+    // keep the response for replaying later (if recording)
+    corpus_record(curl_handle, seed_url, *eurl_p, *response_code_p, p_recv_buf->buf, p_recv_buf->size);
+
+    // record how long each phase of the fetch took (if enabled)
+    latency_record(curl_handle, *eurl_p, *content_type);
+    live_stats_record_fetch(p_recv_buf->size, *response_code_p);
+
+    // write the fetch's crawl record (if enabled)
+    if (crawl_records_enabled())
+    {
+        LAT_TIMINGS timings;
+        char *ct = NULL;
+        latency_get_timings(curl_handle, &timings);
+        curl_easy_getinfo(curl_handle, CURLINFO_CONTENT_TYPE, &ct);
+        crawl_records_fetch(seed_url, *eurl_p, *response_code_p, ct, *content_type, &timings, CURLE_OK);
+    }
     return 0;
 }
 
+/**
+ * @brief crawl specified url and process the downloaded data
+ * @param curl_handle CURL*: (pointer to) the curl handler that will be used to process the url
+ * @param seed_url char*: string containing the url to crawl
+ * @param content_type int*: (pointer to) int to be set with content type code
+ * @param stack STACK*: (pointer to) stack that will be populated with further urls to crawl
+ * @param img_stack STACK*: (pointer to) stack that will be populated with images embedded on the page
+ * @param response_code_p long*: (pointer to) int to be set with the response code
+ * @return 0 on success; non-zero otherwise
+ * @details
+ * if url points to a HTML page, populate stack with urls linked on the page
+ *  and img_stack with images embedded on the page
+ * if url points to a png, check if it's a valid png
+ * set the content type and response code via the appropriate pointers
+ */
+int process_url(CURL *curl_handle, char *seed_url, int *content_type, STACK *stack, STACK *img_stack, long *response_code_p)
+{
+    RECV_BUF recv_buf;
+    char *eurl = NULL;
+
+    if (fetch_url(curl_handle, seed_url, &recv_buf, &eurl, content_type, response_code_p) != 0)
+    {
+        return 1;
+    }
+    parse_fetched(&recv_buf, eurl, *content_type, *response_code_p, stack, img_stack);
+    return 0;
+}
+
+/**
+ * @brief parse a downloaded html page for further urls, then free the download
+ * @param p_recv_buf RECV_BUF*: (pointer to) buffer with the downloaded data; cleaned
+ * @param eurl char*: effective url of the download; deallocated
+ * @param content_type int: content type code of the download
+ * @param response_code long: response code of the download
+ * @param stack STACK*: (pointer to) stack that will be populated with further urls to crawl
+ * @param img_stack STACK*: (pointer to) stack that will be populated with images embedded on the page
+ */
+void parse_fetched(RECV_BUF *p_recv_buf, char *eurl, int content_type, long response_code, STACK *stack, STACK *img_stack)
+{
+    // parse html pages for further urls
+    if (content_type == HTML && is_processable_response(response_code))
+    {
+        process_html(p_recv_buf, eurl, stack, img_stack);
+    }
+
+    // clean up data buffer
+    free(eurl);
+    recv_buf_cleanup(p_recv_buf);
+}
+
 /**
  * @brief returns whether the response code is not an error (i.e. okay or redirect)
  * @param response_code long: response_code in question
@@ -251,6 +691,9 @@ size_t header_cb_curl(char *p_recv, size_t size, size_t nmemb, void *userdata)
     int realsize = size * nmemb;
     RECV_BUF *p = userdata;
 
+    // keep the header lines for replaying later (if recording)
+    corpus_record_header(p_recv, realsize);
+
     if (realsize > strlen(ECE252_HEADER) &&
         strncmp(p_recv, ECE252_HEADER, strlen(ECE252_HEADER)) == 0)
     {
@@ -294,8 +737,12 @@ size_t write_cb_curl(char *p_recv, size_t size, size_t nmemb, void *p_userdata)
     // copy data from libcurl into a buffer we can access later
     memcpy(p->buf + p->size, p_recv, realsize);
     p->size += realsize;
+    budget_add(BUDGET_RECV, realsize);
     p->buf[p->size] = 0;
 
+    // hash the data as it arrives, so the content hash is ready with the download
+    xxh64_update(&p->hash_state, p_recv, realsize);
+
     return realsize;
 }
 
@@ -328,6 +775,8 @@ int recv_buf_init(RECV_BUF *ptr, size_t max_size)
     ptr->max_size = max_size;
     // a valid sequence number should be positive
     ptr->seq = -1;
+    xxh64_reset(&ptr->hash_state, 0);
+    ptr->cache = NULL;
     return 0;
 }
 
@@ -347,7 +796,10 @@ int recv_buf_cleanup(RECV_BUF *ptr)
     {
         free(ptr->buf);
         ptr->buf = NULL;
+        budget_sub(BUDGET_RECV, ptr->size);
     }
+    http_cache_fetch_free(ptr->cache);
+    ptr->cache = NULL;
 
     ptr->size = 0;
     ptr->max_size = 0;
@@ -423,22 +875,146 @@ xmlXPathObjectPtr getnodeset(xmlDocPtr doc, xmlChar *xpath)
 }
 
 /**
- * @brief get all urls on the xml web page and push them onto stack
+ * @brief resolve a link found on a page and push it onto stack if it is crawlable
+ * @param stack STACK*: (pointer to) stack that will be populated with the url
+ * @param link const xmlChar*: link as it appears on the page
+ * @param follow_relative_links int: 1 if we're following relative links and 0 otherwise
+ * @param base_url const xmlChar*: url that relative links are resolved against
+ */
+void push_link(STACK *stack, const xmlChar *link, int follow_relative_links, const xmlChar *base_url)
+{
+    xmlChar *href = NULL;
+
+    if (link == NULL)
+    {
+        return;
+    }
+
+    if (follow_relative_links)
+    {
+        href = xmlBuildURI(link, base_url);
+    }
+    else
+    {
+        href = xmlStrdup(link);
+    }
+
+    if (href != NULL && !strncmp((const char *)href, "http", 4))
+    {
+        push_stack(stack, (char *)href);
+    }
+    xmlFree(href);
+}
+
+/**
+ * @brief push every candidate url of a srcset attribute onto stack
+ * @param stack STACK*: (pointer to) stack that will be populated with the urls
+ * @param srcset const xmlChar*: value of the srcset attribute
+ * @param follow_relative_links int: 1 if we're following relative links and 0 otherwise
+ * @param base_url const xmlChar*: url that relative links are resolved against
+ * @details
+ * A srcset is a comma separated list of candidates; each candidate is a url
+ *  (which itself may contain commas) followed by optional descriptors,
+ *  e.g. "a.png 1x, b.png 2x" or "a.png 480w,b.png 800w".
+ */
+void push_srcset(STACK *stack, const xmlChar *srcset, int follow_relative_links, const xmlChar *base_url)
+{
+    const char *p = (const char *)srcset;
+
+    while (p != NULL && *p != '\0')
+    {
+        // skip whitespace and commas between candidates
+        while (*p == ',' || *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f')
+        {
+            ++p;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        // the url runs until whitespace; a trailing comma ends the candidate
+        const char *end = p;
+        while (*end != '\0' && *end != ' ' && *end != '\t' && *end != '\n' && *end != '\r' && *end != '\f')
+        {
+            ++end;
+        }
+        size_t len = end - p;
+        bool ends_candidate = (len > 0 && p[len - 1] == ',');
+        while (len > 0 && p[len - 1] == ',')
+        {
+            --len;
+        }
+        if (len > 0)
+        {
+            xmlChar *link = xmlStrndup((const xmlChar *)p, len);
+            push_link(stack, link, follow_relative_links, base_url);
+            xmlFree(link);
+        }
+
+        // skip the descriptors up to the next candidate
+        p = end;
+        if (!ends_candidate)
+        {
+            while (*p != '\0' && *p != ',')
+            {
+                ++p;
+            }
+        }
+    }
+}
+
+/**
+ * @brief check whether a <link rel="..."> value names an icon
+ * @param rel const xmlChar*: value of the rel attribute
+ * @return true if one of the space separated rel tokens is (or ends in) "icon"
+ */
+bool is_icon_rel(const xmlChar *rel)
+{
+    const char *p = (const char *)rel;
+
+    while (p != NULL && *p != '\0')
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\n')
+        {
+            ++p;
+        }
+        const char *end = p;
+        while (*end != '\0' && *end != ' ' && *end != '\t' && *end != '\n')
+        {
+            ++end;
+        }
+        // matches "icon", "shortcut icon", "apple-touch-icon", ...
+        if (end - p >= 4 && strncasecmp(end - 4, "icon", 4) == 0)
+        {
+            return true;
+        }
+        p = end;
+    }
+    return false;
+}
+
+/**
+ * @brief get all urls on the html web page and push them onto stacks
  * @param buf char*: (pointer to) buffer that contains the HTML web page
  * @param size int: size of the buffer
  * @param follow_relative_links int: 1 if we're following relative links and 0 otherwise
  * @param base_url const char*: base url of the page
- * @param stack STACK*: (pointer to) stack that will be populated with further urls to crawl
+ * @param stack STACK*: (pointer to) stack that will be populated with further pages to crawl
+ * @param img_stack STACK*: (pointer to) stack that will be populated with images embedded on the page
  * @return 0 on success; non-zero otherwise
+ * @details
+ * The document tree is walked once and every resource-bearing attribute is collected:
+ * - <a href> and <area href> go onto stack
+ * - <img src>, <img srcset>, <source src>, <source srcset> and <link rel=icon href> go onto img_stack
+ * - the first <base href> changes the url that relative links are resolved against
  */
-int find_http(char *buf, int size, int follow_relative_links, const char *base_url, STACK *stack)
+int find_http(char *buf, int size, int follow_relative_links, const char *base_url, STACK *stack, STACK *img_stack)
 {
-    int i;
     htmlDocPtr doc;
-    xmlChar *xpath = (xmlChar *)"//a/@href";
-    xmlNodeSetPtr nodeset;
-    xmlXPathObjectPtr result;
-    xmlChar *href;
+    xmlNodePtr cur;
+    xmlChar *base = NULL;
+    bool seen_base = false;
 
     if (buf == NULL)
     {
@@ -446,35 +1022,87 @@ int find_http(char *buf, int size, int follow_relative_links, const char *base_u
     }
 
     doc = mem_getdoc(buf, size, base_url);
+    if (doc == NULL)
+    {
+        return 2;
+    }
+
+    base = xmlStrdup((const xmlChar *)base_url);
 
-    result = getnodeset(doc, xpath);
-    if (result)
+    // iterative pre-order walk over the element tree
+    cur = xmlDocGetRootElement(doc);
+    while (cur != NULL)
     {
-        nodeset = result->nodesetval;
-        for (i = 0; i < nodeset->nodeNr; i++)
+        if (cur->type == XML_ELEMENT_NODE)
         {
-            href = xmlNodeListGetString(doc, nodeset->nodeTab[i]->xmlChildrenNode, 1);
-            if (follow_relative_links)
+            const char *name = (const char *)cur->name;
+            if (!strcmp(name, "a") || !strcmp(name, "area"))
+            {
+                xmlChar *href = xmlGetProp(cur, (const xmlChar *)"href");
+                push_link(stack, href, follow_relative_links, base);
+                xmlFree(href);
+            }
+            else if (!strcmp(name, "img") || !strcmp(name, "source"))
             {
-                xmlChar *old = href;
-                href = xmlBuildURI(href, (xmlChar *)base_url);
-                xmlFree(old);
+                xmlChar *src = xmlGetProp(cur, (const xmlChar *)"src");
+                push_link(img_stack, src, follow_relative_links, base);
+                xmlFree(src);
+                xmlChar *srcset = xmlGetProp(cur, (const xmlChar *)"srcset");
+                push_srcset(img_stack, srcset, follow_relative_links, base);
+                xmlFree(srcset);
             }
-            if (href != NULL && !strncmp((const char *)href, "http", 4))
+            else if (!strcmp(name, "link"))
+            {
+                xmlChar *rel = xmlGetProp(cur, (const xmlChar *)"rel");
+                if (rel != NULL && is_icon_rel(rel))
+                {
+                    xmlChar *href = xmlGetProp(cur, (const xmlChar *)"href");
+                    push_link(img_stack, href, follow_relative_links, base);
+                    xmlFree(href);
+                }
+                xmlFree(rel);
+            }
+            else if (!strcmp(name, "base") && !seen_base)
+            {
+                xmlChar *href = xmlGetProp(cur, (const xmlChar *)"href");
+                if (href != NULL)
+                {
+                    xmlChar *new_base = xmlBuildURI(href, base);
+                    if (new_base != NULL)
+                    {
+                        xmlFree(base);
+                        base = new_base;
+                    }
+                    seen_base = true;
+                }
+                xmlFree(href);
+            }
+
+            // descend into children
+            if (cur->children != NULL)
             {
-                char *temp = malloc((strlen((char *)href) + 1) * sizeof(char));
-                memset(temp, 0, (strlen((char *)href) + 1) * sizeof(char));
-                sprintf(temp, "%s", href);
-                push_stack(stack, (char *)temp);
-                free(temp);
-                temp = NULL;
+                cur = cur->children;
+                continue;
             }
-            xmlFree(href);
         }
-        xmlXPathFreeObject(result);
+
+        // move to the next sibling, climbing back up as subtrees are finished
+        while (cur != NULL && cur->next == NULL)
+        {
+            cur = cur->parent;
+            if (cur != NULL && cur->type == XML_HTML_DOCUMENT_NODE)
+            {
+                cur = NULL;
+            }
+        }
+        if (cur != NULL)
+        {
+            cur = cur->next;
+        }
     }
 
+    xmlFree(base);
     xmlFreeDoc(doc);
 
     return 0;
-}
\ No newline at end of file
+}
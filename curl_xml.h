@@ -1,3 +1,6 @@
+#ifndef CURL_XML_H
+#define CURL_XML_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -10,6 +13,15 @@
 #include <libxml/xpath.h>
 #include <libxml/uri.h>
 #include "stack.h"
+#include "content_hash.h"
+#include "latency.h"
+#include "live_stats.h"
+#include "trace.h"
+#include "corpus.h"
+#include "crawl_records.h"
+#include "budget.h"
+#include "dns.h"
+#include "http_cache.h"
 
 #define SEED_URL "http://ece252-1.uwaterloo.ca/lab4/"
 #define ECE252_HEADER "X-Ece252-Fragment: "
@@ -29,10 +41,15 @@
 #define INTERNAL_SERVER_ERRORS 500
 #define CODE_RANGE 99
 
+#define EXTRACT_XML 0
+#define EXTRACT_SCAN 1
+#define EXTRACT_DIFF 2
+
 #define DEFAULT_TYPE -1
 #define HTML 0
 #define VALID_PNG 1
 #define INVALID_PNG 2
+#define DUPLICATE_PNG 3
 
 #define max(a, b) \
   ({ __typeof__ (a) _a = (a); \
@@ -46,19 +63,39 @@ typedef struct recv_buf2
   size_t max_size; // max capacity of buf in bytes
   int seq;         // >=0 sequence number extracted from http header
                    // <0 indicates an invalid seq number
+  XXH64_STATE hash_state; // hash of the data received so far
+  HTTP_CACHE_FETCH *cache; // conditional-GET state of the fetch (NULL unless --cache)
 } RECV_BUF;
 
 htmlDocPtr mem_getdoc(char *buf, int size, const char *url);
 xmlXPathObjectPtr getnodeset(xmlDocPtr doc, xmlChar *xpath);
-int find_http(char *fname, int size, int follow_relative_links, const char *base_url, STACK *stack);
+void push_link(STACK *stack, const xmlChar *link, int follow_relative_links, const xmlChar *base_url);
+void push_srcset(STACK *stack, const xmlChar *srcset, int follow_relative_links, const xmlChar *base_url);
+bool is_icon_rel(const xmlChar *rel);
+void set_extract_engine(int engine);
+void set_http2(bool prior_knowledge);
+void get_extract_diff(size_t *pages, size_t *mismatches);
+void get_extract_scan(size_t *scanned, size_t *fallbacks);
+int extract_links(char *buf, int size, int follow_relative_links, const char *base_url, STACK *stack, STACK *img_stack);
+int find_http(char *fname, int size, int follow_relative_links, const char *base_url, STACK *stack, STACK *img_stack);
 size_t header_cb_curl(char *p_recv, size_t size, size_t nmemb, void *userdata);
 size_t write_cb_curl(char *p_recv, size_t size, size_t nmemb, void *p_userdata);
 int recv_buf_init(RECV_BUF *ptr, size_t max_size);
 int recv_buf_cleanup(RECV_BUF *ptr);
 void cleanup(CURL *curl, RECV_BUF *ptr);
 CURL *easy_handle_config(CURL *curl_handle, RECV_BUF *ptr, const char *url);
-int process_data(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type, STACK *stack, long *response_code_p);
-int process_png(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type);
+int process_html(RECV_BUF *p_recv_buf, const char *url, STACK *stack, STACK *img_stack);
+int classify_data(RECV_BUF *p_recv_buf, const char *url, const char *ct, long response_code, int *content_type, long *response_code_p);
+int process_data(CURL *curl_handle, RECV_BUF *p_recv_buf, int *content_type, long *response_code_p);
+int process_png(RECV_BUF *p_recv_buf, const char *url, int *content_type);
 bool is_png(uint8_t *buf, size_t n);
-int process_url(CURL *curl_handle, char *seed_url, int *content_type, STACK *stack, long *response_code_p);
-bool is_processable_response(long response_code);
\ No newline at end of file
+int replay_url(char *seed_url, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p);
+int fetch_url(CURL *curl_handle, char *seed_url, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p);
+void fetch_begin(CURL *curl_handle, char *seed_url, RECV_BUF *p_recv_buf);
+void fetch_without_multiplexing(CURL *curl_handle);
+int fetch_end(CURL *curl_handle, char *seed_url, CURLcode res, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p);
+int process_url(CURL *curl_handle, char *seed_url, int *content_type, STACK *stack, STACK *img_stack, long *response_code_p);
+void parse_fetched(RECV_BUF *p_recv_buf, char *eurl, int content_type, long response_code, STACK *stack, STACK *img_stack);
+bool is_processable_response(long response_code);
+
+#endif
@@ -0,0 +1,495 @@
+/*
+DNS prefetch (--dns-prefetch, --dns-hosts)
+- a url pushed onto the frontier whose host (with port) isn't cached yet is cached as
+  pending and queued; resolver threads look it up (getaddrinfo, which blocks only them)
+  and store the address
+- before a fetch, the fetch's host is looked up in the cache and handed to libcurl as a
+  CURLOPT_RESOLVE entry, so curl_easy_perform connects without resolving:
+  - resolved: the lookup was taken off the fetch's critical path
+  - being looked up: the fetch waits for that lookup rather than starting another
+  - not cached (the seed url, a queue that was full), or still queued: the fetch looks it
+    up itself (a resolver thread that gets to it later skips it), so a fetch never waits
+    behind the queue
+  - failed: nothing is handed to libcurl, which resolves (and fails) as without prefetch
+- hosts that are ip addresses are never looked up
+- with --dns-hosts=FILE, names are looked up in FILE ("NAME ADDRESS [DELAY_MS]" lines)
+  instead of the system resolver, each lookup taking DELAY_MS: a stand-in for a slow DNS
+  server, so prefetching can be measured offline (e.g. against bench/websim -N)
+- answers are kept for the whole crawl (no TTL), and the first address is used
+*/
+
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "dns.h"
+#include "content_hash.h"
+
+static bool enabled = false;
+// host cache; guarded by dns_mutex
+static DNS_ENTRY *table[DNS_TABLE_SIZE];
+// hosts waiting for a resolver thread; guarded by dns_mutex
+static DNS_ENTRY *queue[DNS_QUEUE_SIZE];
+static size_t queue_head = 0;
+static size_t queue_count = 0;
+static bool stopping = false;
+static pthread_mutex_t dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a host is queued, and when a lookup finishes
+static pthread_cond_t dns_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t dns_resolved = PTHREAD_COND_INITIALIZER;
+static pthread_t threads[DNS_MAX_THREADS];
+static int num_threads = 0;
+// the --dns-hosts file (NULL: the system resolver)
+static DNS_HOST *hosts = NULL;
+static size_t num_hosts = 0;
+// guarded by dns_mutex
+static DNS_STATS stats;
+// entries handed to libcurl by the calling thread's last fetch
+static __thread struct curl_slist *resolve_list = NULL;
+
+/**
+ * @brief current time
+ * @return us since an arbitrary point
+ */
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief get the host and port a url is fetched from
+ * @param url const char*: the url
+ * @param host char*: (pointer to) DNS_NAME_SIZE bytes to be set with the host (lower case)
+ * @param port char*: (pointer to) 8 bytes to be set with the port
+ * @return 0 if the host is a name to look up; 1 otherwise (no host, or an ip address)
+ */
+static int host_of(const char *url, char *host, char *port)
+{
+    const char *p = strstr(url, "://");
+    if (p == NULL)
+    {
+        return 1;
+    }
+    bool https = p - url == 5 && strncasecmp(url, "https", 5) == 0;
+    p += 3;
+    size_t len = strcspn(p, "/?#");
+    // skip user info
+    const char *at = memchr(p, '@', len);
+    if (at != NULL)
+    {
+        len -= at + 1 - p;
+        p = at + 1;
+    }
+    // an ipv6 address
+    if (len == 0 || p[0] == '[')
+    {
+        return 1;
+    }
+    const char *colon = memchr(p, ':', len);
+    size_t host_len = colon != NULL ? (size_t)(colon - p) : len;
+    size_t port_len = colon != NULL ? len - host_len - 1 : 0;
+    if (host_len == 0 || host_len >= DNS_NAME_SIZE - 8 || port_len > 5)
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < host_len; ++i)
+    {
+        host[i] = tolower((unsigned char)p[i]);
+    }
+    host[host_len] = '\0';
+    if (port_len > 0)
+    {
+        memcpy(port, colon + 1, port_len);
+        port[port_len] = '\0';
+    }
+    else
+    {
+        strcpy(port, https ? "443" : "80");
+    }
+    // an ipv4 address
+    struct in_addr addr;
+    if (inet_pton(AF_INET, host, &addr) == 1)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief look a host up (in the --dns-hosts file, or with the system resolver)
+ * @param host const char*: the host name
+ * @param port const char*: the port
+ * @param addr char*: (pointer to) DNS_ADDR_SIZE bytes to be set with the address
+ *  (in brackets if ipv6, as CURLOPT_RESOLVE wants it)
+ * @return 0 on success; 1 otherwise
+ */
+static int resolve(const char *host, const char *port, char *addr)
+{
+    if (hosts != NULL)
+    {
+        for (size_t i = 0; i < num_hosts; ++i)
+        {
+            if (strcasecmp(hosts[i].name, host) == 0)
+            {
+                usleep(hosts[i].delay_ms * 1000);
+                strcpy(addr, hosts[i].addr);
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+    {
+        return 1;
+    }
+    int ret = 1;
+    char text[INET6_ADDRSTRLEN];
+    if (res->ai_family == AF_INET &&
+        inet_ntop(AF_INET, &((struct sockaddr_in *)res->ai_addr)->sin_addr, text, sizeof(text)) != NULL)
+    {
+        snprintf(addr, DNS_ADDR_SIZE, "%s", text);
+        ret = 0;
+    }
+    else if (res->ai_family == AF_INET6 &&
+             inet_ntop(AF_INET6, &((struct sockaddr_in6 *)res->ai_addr)->sin6_addr, text, sizeof(text)) != NULL)
+    {
+        snprintf(addr, DNS_ADDR_SIZE, "[%s]", text);
+        ret = 0;
+    }
+    freeaddrinfo(res);
+    return ret;
+}
+
+/**
+ * @brief find a host in the cache, adding it as pending if it isn't there
+ * @param key const char*: "host:port"
+ * @param added bool*: (pointer to) bool to be set with whether the host was added
+ * @return the host's entry
+ * @note the caller must hold dns_mutex
+ */
+static DNS_ENTRY *find_entry(const char *key, bool *added)
+{
+    size_t bucket = xxh64(key, strlen(key), 0) % DNS_TABLE_SIZE;
+    for (DNS_ENTRY *e = table[bucket]; e != NULL; e = e->next)
+    {
+        if (strcmp(e->key, key) == 0)
+        {
+            *added = false;
+            return e;
+        }
+    }
+    DNS_ENTRY *e = malloc(sizeof(DNS_ENTRY));
+    memset(e, 0, sizeof(DNS_ENTRY));
+    e->key = strdup(key);
+    e->state = DNS_PENDING;
+    e->next = table[bucket];
+    table[bucket] = e;
+    ++stats.hosts;
+    *added = true;
+    return e;
+}
+
+/**
+ * @brief look up a pending host and store the answer in its entry
+ * @param e DNS_ENTRY*: (pointer to) the entry, claimed by the caller
+ * @note the caller must not hold dns_mutex
+ */
+static void resolve_entry(DNS_ENTRY *e)
+{
+    char host[DNS_NAME_SIZE];
+    char addr[DNS_ADDR_SIZE];
+    const char *port = strrchr(e->key, ':') + 1;
+    memcpy(host, e->key, port - 1 - e->key);
+    host[port - 1 - e->key] = '\0';
+
+    char *entry = NULL;
+    if (resolve(host, port, addr) == 0)
+    {
+        entry = malloc(strlen(e->key) + strlen(addr) + 2);
+        sprintf(entry, "%s:%s", e->key, addr);
+    }
+
+    pthread_mutex_lock(&dns_mutex);
+    e->resolve = entry;
+    e->state = entry != NULL ? DNS_RESOLVED : DNS_FAILED;
+    pthread_cond_broadcast(&dns_resolved);
+    pthread_mutex_unlock(&dns_mutex);
+}
+
+/**
+ * @brief resolver thread: looks up queued hosts until dns_stop
+ * @param _ void*: not used
+ * @return NULL
+ */
+static void *resolver(void *_)
+{
+    while (true)
+    {
+        pthread_mutex_lock(&dns_mutex);
+        while (queue_count == 0 && !stopping)
+        {
+            pthread_cond_wait(&dns_queued, &dns_mutex);
+        }
+        if (stopping)
+        {
+            pthread_mutex_unlock(&dns_mutex);
+            break;
+        }
+        DNS_ENTRY *e = queue[queue_head];
+        queue_head = (queue_head + 1) % DNS_QUEUE_SIZE;
+        --queue_count;
+        // a fetch may have taken the lookup over
+        if (e->state != DNS_QUEUED)
+        {
+            pthread_mutex_unlock(&dns_mutex);
+            continue;
+        }
+        e->state = DNS_PENDING;
+        pthread_mutex_unlock(&dns_mutex);
+
+        uint64_t start = now_us();
+        resolve_entry(e);
+        __atomic_add_fetch(&stats.resolver_us, now_us() - start, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * @brief read the --dns-hosts file
+ * @param path const char*: path of the file
+ * @return 0 on success; 1 otherwise
+ */
+static int read_hosts(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return 1;
+    }
+    size_t size = 16;
+    hosts = malloc(size * sizeof(DNS_HOST));
+    char line[512];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        DNS_HOST h;
+        memset(&h, 0, sizeof(h));
+        if (line[0] == '#' || sscanf(line, "%255s %63s %d", h.name, h.addr, &h.delay_ms) < 2)
+        {
+            continue;
+        }
+        if (num_hosts == size)
+        {
+            size *= 2;
+            hosts = realloc(hosts, size * sizeof(DNS_HOST));
+        }
+        hosts[num_hosts++] = h;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * @brief turn on the host cache, and start the resolver threads
+ * @param resolvers int: number of resolver threads (0: no prefetch; fetches fill the cache)
+ * @param hosts_file const char*: file to look names up in instead of the system resolver (may be NULL)
+ * @return 0 on success; 1 otherwise
+ */
+int dns_enable(int resolvers, const char *hosts_file)
+{
+    if (resolvers < 0 || resolvers > DNS_MAX_THREADS)
+    {
+        return 1;
+    }
+    if (hosts_file != NULL && read_hosts(hosts_file) != 0)
+    {
+        return 1;
+    }
+    memset(&stats, 0, sizeof(stats));
+    for (num_threads = 0; num_threads < resolvers; ++num_threads)
+    {
+        if (pthread_create(&threads[num_threads], NULL, resolver, NULL) != 0)
+        {
+            return 1;
+        }
+    }
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief whether the host cache is on
+ * @return true if dns_enable was called
+ */
+bool dns_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief queue the host of a url for a resolver thread, unless it is cached
+ * @param url const char*: a url entering the frontier
+ */
+void dns_prefetch(const char *url)
+{
+    char host[DNS_NAME_SIZE];
+    char port[8];
+    if (!enabled || num_threads == 0 || host_of(url, host, port) != 0)
+    {
+        return;
+    }
+    char key[DNS_NAME_SIZE + 8];
+    snprintf(key, sizeof(key), "%s:%s", host, port);
+
+    pthread_mutex_lock(&dns_mutex);
+    {
+        size_t bucket = xxh64(key, strlen(key), 0) % DNS_TABLE_SIZE;
+        bool cached = false;
+        for (DNS_ENTRY *e = table[bucket]; e != NULL && !cached; e = e->next)
+        {
+            cached = strcmp(e->key, key) == 0;
+        }
+        if (!cached)
+        {
+            if (queue_count == DNS_QUEUE_SIZE)
+            {
+                // left to the first fetch of the host
+                ++stats.queue_full;
+            }
+            else
+            {
+                bool added;
+                DNS_ENTRY *e = find_entry(key, &added);
+                e->state = DNS_QUEUED;
+                queue[(queue_head + queue_count) % DNS_QUEUE_SIZE] = e;
+                ++queue_count;
+                ++stats.prefetched;
+                pthread_cond_signal(&dns_queued);
+            }
+        }
+    }
+    pthread_mutex_unlock(&dns_mutex);
+}
+
+/**
+ * @brief hand the cached address of a url's host to a curl handle before it fetches the url
+ * @param curl_handle CURL*: (pointer to) the handle that will fetch the url
+ * @param url const char*: the url
+ * @details
+ * Waits for a lookup of the host in progress, or looks the host up if nobody has.
+ * The entry stays valid until the calling thread's next dns_apply (or dns_thread_cleanup).
+ */
+void dns_apply(CURL *curl_handle, const char *url)
+{
+    char host[DNS_NAME_SIZE];
+    char port[8];
+    if (!enabled || host_of(url, host, port) != 0)
+    {
+        return;
+    }
+    char key[DNS_NAME_SIZE + 8];
+    snprintf(key, sizeof(key), "%s:%s", host, port);
+
+    uint64_t start = now_us();
+    bool added;
+    pthread_mutex_lock(&dns_mutex);
+    DNS_ENTRY *e = find_entry(key, &added);
+    if (added || e->state == DNS_QUEUED)
+    {
+        // nobody is looking the host up: do it here
+        e->state = DNS_PENDING;
+        ++stats.misses;
+        pthread_mutex_unlock(&dns_mutex);
+        resolve_entry(e);
+        pthread_mutex_lock(&dns_mutex);
+    }
+    else if (e->state == DNS_PENDING)
+    {
+        ++stats.waits;
+        while (e->state == DNS_PENDING)
+        {
+            pthread_cond_wait(&dns_resolved, &dns_mutex);
+        }
+    }
+    else
+    {
+        ++stats.hits;
+    }
+    stats.fetch_wait_us += now_us() - start;
+
+    struct curl_slist *list = NULL;
+    if (e->state == DNS_RESOLVED)
+    {
+        list = curl_slist_append(NULL, e->resolve);
+    }
+    else
+    {
+        ++stats.failures;
+    }
+    pthread_mutex_unlock(&dns_mutex);
+
+    // libcurl reads the list when the transfer starts; the previous one is no longer used
+    curl_easy_setopt(curl_handle, CURLOPT_RESOLVE, list);
+    curl_slist_free_all(resolve_list);
+    resolve_list = list;
+}
+
+/**
+ * @brief free the entries the calling thread handed to libcurl
+ * @note call after the thread's curl handle is cleaned up
+ */
+void dns_thread_cleanup()
+{
+    curl_slist_free_all(resolve_list);
+    resolve_list = NULL;
+}
+
+/**
+ * @brief stop the resolver threads and free the host cache
+ * @param stats_out DNS_STATS*: (pointer to) where to put the statistics (may be NULL)
+ */
+void dns_stop(DNS_STATS *stats_out)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    pthread_mutex_lock(&dns_mutex);
+    stopping = true;
+    pthread_cond_broadcast(&dns_queued);
+    pthread_mutex_unlock(&dns_mutex);
+    for (int i = 0; i < num_threads; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    enabled = false;
+
+    if (stats_out != NULL)
+    {
+        *stats_out = stats;
+    }
+    for (size_t i = 0; i < DNS_TABLE_SIZE; ++i)
+    {
+        DNS_ENTRY *e = table[i];
+        while (e != NULL)
+        {
+            DNS_ENTRY *next = e->next;
+            free(e->key);
+            free(e->resolve);
+            free(e);
+            e = next;
+        }
+        table[i] = NULL;
+    }
+    free(hosts);
+    hosts = NULL;
+    num_hosts = 0;
+}
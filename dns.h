@@ -0,0 +1,75 @@
+/*
+DNS prefetch: resolver threads that look up the hosts of urls as they enter the frontier,
+and a shared cache of the answers that fetches hand to libcurl (CURLOPT_RESOLVE)
+*/
+
+#ifndef DNS_H
+#define DNS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+#define DNS_TABLE_SIZE 4096  /* buckets of the host cache */
+#define DNS_QUEUE_SIZE 4096  /* hosts waiting for a resolver thread; more are left to the fetch */
+#define DNS_MAX_THREADS 64
+#define DNS_NAME_SIZE 256    /* longest host name (and host:port key) */
+#define DNS_ADDR_SIZE 64     /* longest address, as text */
+
+// states of a cached host
+#define DNS_QUEUED 0   /* waiting for a resolver thread */
+#define DNS_PENDING 1  /* being looked up (by a resolver thread or a fetch) */
+#define DNS_RESOLVED 2
+#define DNS_FAILED 3
+
+// a host (with port) and its address
+typedef struct dns_entry
+{
+    struct dns_entry *next;
+    // "host:port" (lower case)
+    char *key;
+    int state;
+    // "host:port:address", for CURLOPT_RESOLVE (NULL unless resolved)
+    char *resolve;
+} DNS_ENTRY;
+
+// a line of the --dns-hosts file
+typedef struct dns_host
+{
+    char name[DNS_NAME_SIZE];
+    char addr[DNS_ADDR_SIZE];
+    // how long a lookup of the name takes (ms)
+    int delay_ms;
+} DNS_HOST;
+
+typedef struct dns_stats
+{
+    // hosts cached, and lookups handed to the resolver threads
+    size_t hosts;
+    size_t prefetched;
+    // lookups not handed to a resolver thread because the queue was full
+    size_t queue_full;
+    // fetches that found their host resolved, waited for a lookup in progress, or looked it up themselves
+    //  (their host not cached, or still queued)
+    size_t hits;
+    size_t waits;
+    size_t misses;
+    // fetches whose host failed to resolve (left to libcurl)
+    size_t failures;
+    // time fetches spent waiting for or doing lookups, and time the resolver threads spent on them (us)
+    uint64_t fetch_wait_us;
+    uint64_t resolver_us;
+} DNS_STATS;
+
+int dns_enable(int resolvers, const char *hosts_file);
+bool dns_enabled();
+void dns_prefetch(const char *url);
+void dns_apply(CURL *curl_handle, const char *url);
+void dns_thread_cleanup();
+void dns_stop(DNS_STATS *stats);
+
+#endif
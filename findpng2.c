@@ -7,7 +7,7 @@
 
 /* -- Global Variables -- */
 // global collection of urls to be crawled by runner threads
-STACK *frontier;
+FRONTIER *frontier;
 // pngs found (png urls)
 STACK *pngs;
 // urls visited
@@ -16,16 +16,24 @@ HSET *visited;
 bool done;
 // number of threads waiting for a non-empty frontier
 size_t num_waiting_on_url;
+// number of those waiting because the adaptive controller parked them (--adaptive)
+size_t num_parked;
 // number of thread runners currently processing a url
 size_t num_running;
 // number of pngs to find before stopping
 int num_pngs_to_find;
+// html pages downloaded by runners, waiting for the parse pool (NULL unless in pipeline mode)
+PQUEUE *parse_queue;
+// speculative fetches each runner may have in flight (0 unless --speculate)
+int speculate_budget;
+// most streams multiplexed on a connection, and urls in a same-host batch (0 unless --http2)
+int http2_streams;
 /* ----------------- */
 
 /* -- Synchronization --*/
 // condition variable for threads to wait on when the frontier is empty
 pthread_cond_t frontier_empty;
-// lock for frontier, done, num_waiting_on_url, and num_running;
+// lock for frontier, done, num_waiting_on_url, num_parked, and num_running;
 //  also used for frontier_empty
 pthread_mutex_t frontier_mutex;
 // lock for pngs stack
@@ -34,14 +42,22 @@ pthread_mutex_t pngs_mutex;
 pthread_mutex_t visited_mutex;
 /* ----------------- */
 
+#ifdef WITH_LOCK_STATS
+/* -- Lock statistics (make LOCK_STATS=1) -- */
+LOCK_STATS frontier_mutex_stats;
+LOCK_STATS pngs_mutex_stats;
+LOCK_STATS visited_mutex_stats;
+/* ----------------- */
+#endif
+
 /**
  * @brief initialize global variables and synchronization variables
  */
 void initialize_global()
 {
-    frontier = malloc(sizeof(STACK));
-    memset(frontier, 0, sizeof(STACK));
-    init_stack(frontier, STACK_SIZE);
+    frontier = malloc(sizeof(FRONTIER));
+    memset(frontier, 0, sizeof(FRONTIER));
+    init_frontier(frontier, STACK_SIZE);
 
     visited = malloc(sizeof(HSET));
     memset(visited, 0, sizeof(HSET));
@@ -53,12 +69,20 @@ void initialize_global()
 
     done = false;
     num_waiting_on_url = 0;
+    num_parked = 0;
     num_running = 0;
+    parse_queue = NULL;
 
     pthread_cond_init(&frontier_empty, NULL);
     pthread_mutex_init(&frontier_mutex, NULL);
     pthread_mutex_init(&visited_mutex, NULL);
     pthread_mutex_init(&pngs_mutex, NULL);
+
+#ifdef WITH_LOCK_STATS
+    init_lock_stats(&frontier_mutex_stats, "frontier_mutex");
+    init_lock_stats(&pngs_mutex_stats, "pngs_mutex");
+    init_lock_stats(&visited_mutex_stats, "visited_mutex");
+#endif
 }
 
 /**
@@ -66,7 +90,7 @@ void initialize_global()
  */
 void cleanup_global()
 {
-    cleanup_stack(frontier);
+    cleanup_frontier(frontier);
     free(frontier);
     frontier = NULL;
 
@@ -85,10 +109,472 @@ void cleanup_global()
 }
 
 /**
- * @brief runner function that crawls urls in the global frontier
+ * @brief sample the state of the crawl (called by the lock sampler thread)
+ * @param sample LOCK_SAMPLE*: (pointer to) the sample to fill in
+ * @details
+ * Takes the locks directly rather than through LOCK_MUTEX,
+ *  so sampling does not show up in the lock statistics.
+ */
+void sample_crawl(LOCK_SAMPLE *sample)
+{
+    pthread_mutex_lock(&frontier_mutex);
+    {
+        sample->frontier = num_elements_frontier(frontier);
+        sample->running = num_running;
+        sample->waiting = num_waiting_on_url;
+    }
+    pthread_mutex_unlock(&frontier_mutex);
+
+    pthread_mutex_lock(&visited_mutex);
+    {
+        sample->visited = visited->cur_size;
+    }
+    pthread_mutex_unlock(&visited_mutex);
+
+    if (parse_queue != NULL)
+    {
+        sample->parse_queue = num_elements_pqueue(parse_queue);
+    }
+}
+
+/**
+ * @brief push urls onto a lane of the frontier and wake threads waiting for urls
+ * @param page_url const char*: url of the page the urls were found on (NULL if forwarded by another instance)
+ * @param urls STACK*: (pointer to) the urls; emptied
+ * @param lane int: LANE_PAGE or LANE_IMAGE
+ * @details
+ * With --mem-budget, the urls the memory budget drops (or parks) are not pushed.
+ */
+void push_lane(const char *page_url, STACK *urls, int lane)
+{
+    char *url_in_html = NULL;
+    while (pop_stack(urls, &url_in_html) == 0)
+    {
+        if (budget_admit(page_url, url_in_html, lane) != BUDGET_KEEP)
+        {
+            free(url_in_html);
+            url_in_html = NULL;
+            continue;
+        }
+        // Look up the url's host while it waits on the frontier (if --dns-prefetch)
+        dns_prefetch(url_in_html);
+        // Add to the frontier and signal sleeping threads
+        //  (that a url is ready in frontier)
+        LOCK_MUTEX(frontier_mutex);
+        {
+            push_frontier(frontier, url_in_html, lane);
+            budget_set(BUDGET_FRONTIER, frontier_bytes(frontier));
+            live_stats_set_frontier(num_elements_frontier(frontier));
+            if (num_waiting_on_url > 0)
+            {
+                pthread_cond_broadcast(&frontier_empty);
+            }
+        }
+        UNLOCK_MUTEX(frontier_mutex);
+        free(url_in_html);
+        url_in_html = NULL;
+    }
+}
+
+/**
+ * @brief push urls the memory budget parked back onto the frontier, if there is room again (--mem-policy=pause)
+ * @details
+ * Call with frontier_mutex held. Wakes the threads waiting for urls if any were pushed.
+ */
+static void unpark_urls()
+{
+    if (budget_num_parked() == 0)
+    {
+        return;
+    }
+    STACK urls, imgs;
+    init_stack(&urls, BUDGET_UNPARK_BATCH);
+    init_stack(&imgs, BUDGET_UNPARK_BATCH);
+    if (budget_unpark(&urls, &imgs, BUDGET_UNPARK_BATCH) > 0)
+    {
+        char *url = NULL;
+        while (pop_stack(&urls, &url) == 0)
+        {
+            push_frontier(frontier, url, LANE_PAGE);
+            free(url);
+        }
+        while (pop_stack(&imgs, &url) == 0)
+        {
+            push_frontier(frontier, url, LANE_IMAGE);
+            free(url);
+        }
+        budget_set(BUDGET_FRONTIER, frontier_bytes(frontier));
+        live_stats_set_frontier(num_elements_frontier(frontier));
+        if (num_waiting_on_url > 0)
+        {
+            pthread_cond_broadcast(&frontier_empty);
+        }
+    }
+    cleanup_stack(&urls);
+    cleanup_stack(&imgs);
+}
+
+/**
+ * @brief start fetching a url the runner claimed on its multi handle, unless it looks like a crawler trap
+ * @param spec SPECULATOR*: (pointer to) the runner's speculator, with room
+ * @param url char*: the url, marked visited and counted as running (the function takes it over)
+ * @param speculative bool: whether the url was claimed from a page's links (rather than in a batch)
+ * @details
+ * The url is logged as visited and checked for traps, as a runner does with a url it pops.
+ */
+static void start_claimed(SPECULATOR *spec, char *url, bool speculative)
+{
+    writer_append(WRITER_VISITED, url);
+    if (trap_check_url(url) != TRAP_NONE)
+    {
+        free(url);
+        finish_url();
+        return;
+    }
+    speculator_start(spec, url, speculative);
+}
+
+/**
+ * @brief take the unvisited urls on a url's host near the top of the frontier (--http2)
+ * @param url const char*: the url
+ * @param batch char**: array to be populated with the urls taken
+ * @param max size_t: most urls to take
+ * @return number of urls taken
+ * @details
+ * The urls taken are marked visited and counted as running. Call with frontier_mutex held.
+ */
+static size_t take_batch(const char *url, char **batch, size_t max)
+{
+    size_t n = take_frontier_host(frontier, url, FRONTIER_HOST_SCAN, batch, max);
+    budget_set(BUDGET_FRONTIER, frontier_bytes(frontier));
+    live_stats_set_frontier(num_elements_frontier(frontier));
+
+    size_t claimed = 0;
+    LOCK_MUTEX(visited_mutex);
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (search_hset(visited, batch[i]) == 1)
+            {
+                free(batch[i]);
+                continue;
+            }
+            add_hset(visited, batch[i]);
+            batch[claimed++] = batch[i];
+        }
+        budget_set(BUDGET_VISITED, hset_bytes(visited));
+    }
+    UNLOCK_MUTEX(visited_mutex);
+    num_running += claimed;
+    return claimed;
+}
+
+/**
+ * @brief start speculative fetches of the first unvisited urls of a stack (--speculate)
+ * @param spec SPECULATOR*: (pointer to) the runner's speculator
+ * @param page_url const char*: url of the page the urls were found on
+ * @param urls STACK*: (pointer to) the urls, in the order they were found; those looked at are removed
+ * @param lane int: LANE_PAGE or LANE_IMAGE
+ * @details
+ * A url started is marked visited and counted as running, as a runner does with a url it pops.
+ *  At most SPECULATE_SCAN urls are looked at.
+ */
+static void speculate_lane(SPECULATOR *spec, const char *page_url, STACK *urls, int lane)
+{
+    char *url = NULL;
+    for (int scanned = 0; scanned < SPECULATE_SCAN && spec->count < speculate_budget && remove_stack(urls, 0, &url) == 0; ++scanned)
+    {
+        if (budget_admit(page_url, url, lane) != BUDGET_KEEP)
+        {
+            free(url);
+            continue;
+        }
+
+        bool is_done;
+        bool is_visited = false;
+        LOCK_MUTEX(frontier_mutex);
+        {
+            // (nor once a recrawl's fetch budget is spent, if --recrawl)
+            is_done = done || recrawl_fetches_left() == 0;
+            if (!is_done)
+            {
+                LOCK_MUTEX(visited_mutex);
+                {
+                    is_visited = search_hset(visited, url) == 1;
+                    if (!is_visited)
+                    {
+                        add_hset(visited, url);
+                    }
+                    budget_set(BUDGET_VISITED, hset_bytes(visited));
+                }
+                UNLOCK_MUTEX(visited_mutex);
+                num_running += !is_visited;
+                recrawl_count_fetches(!is_visited);
+            }
+        }
+        UNLOCK_MUTEX(frontier_mutex);
+
+        if (is_done)
+        {
+            free(url);
+            break;
+        }
+        if (is_visited)
+        {
+            speculator_count_visited();
+            free(url);
+            continue;
+        }
+        start_claimed(spec, url, true);
+    }
+}
+
+/**
+ * @brief push the urls found on a page onto the frontier and wake threads waiting for urls
+ * @param page_url const char*: url of the page
+ * @param urls_found STACK*: (pointer to) urls linked from the page; emptied
+ * @param imgs_found STACK*: (pointer to) images embedded on the page; emptied
+ * @param spec SPECULATOR*: (pointer to) the calling runner's speculator (NULL unless --speculate)
+ * @details
+ * With --speculate, the first unvisited urls (embedded images first) are fetched
+ *  speculatively by the runner instead of being pushed.
+ */
+void push_found_urls(const char *page_url, STACK *urls_found, STACK *imgs_found, SPECULATOR *spec)
+{
+    uint64_t push_start = trace_begin();
+    // remember where the urls were found (if crawl records are enabled)
+    crawl_records_discovered(page_url, urls_found);
+    crawl_records_discovered(page_url, imgs_found);
+
+    // a recrawl follows no links: it fetches the cached urls scheduled by how likely they changed (if --recrawl)
+    recrawl_filter(urls_found);
+    recrawl_filter(imgs_found);
+
+    // urls on hosts other instances own are forwarded to them (if --peers)
+    partition_route(urls_found, LANE_PAGE);
+    partition_route(imgs_found, LANE_IMAGE);
+
+    if (spec != NULL && speculate_budget > 0)
+    {
+        speculate_lane(spec, page_url, imgs_found, LANE_IMAGE);
+        speculate_lane(spec, page_url, urls_found, LANE_PAGE);
+    }
+
+    push_lane(page_url, urls_found, LANE_PAGE);
+    // Embedded images go to the image lane, which is popped before pages
+    push_lane(page_url, imgs_found, LANE_IMAGE);
+    trace_end("frontier push", push_start, NULL);
+}
+
+/* -- Partitioned crawl (--peers): what the partition needs from the crawl -- */
+/**
+ * @brief push urls other instances forwarded onto the frontier
+ * @param urls STACK*: (pointer to) urls for the page lane; emptied
+ * @param imgs STACK*: (pointer to) urls for the image lane; emptied
+ */
+void push_received_urls(STACK *urls, STACK *imgs)
+{
+    push_lane(NULL, urls, LANE_PAGE);
+    push_lane(NULL, imgs, LANE_IMAGE);
+}
+
+/**
+ * @brief whether this instance has nothing left to crawl
+ * @return true if the frontier is empty and no url is being processed, or the crawl is done
+ */
+bool crawl_idle()
+{
+    bool idle;
+    LOCK_MUTEX(frontier_mutex);
+    idle = done || (is_empty_frontier(frontier) && num_running == 0);
+    UNLOCK_MUTEX(frontier_mutex);
+    return idle;
+}
+
+/**
+ * @brief number of pngs found
+ * @return number of pngs found
+ */
+int num_pngs_found()
+{
+    int n;
+    LOCK_MUTEX(pngs_mutex);
+    n = num_elements_stack(pngs);
+    UNLOCK_MUTEX(pngs_mutex);
+    return n;
+}
+
+/**
+ * @brief end the crawl: wake the threads waiting for urls so they can exit
+ */
+void finish_crawl()
+{
+    LOCK_MUTEX(frontier_mutex);
+    {
+        done = true;
+        pthread_cond_broadcast(&frontier_empty);
+    }
+    UNLOCK_MUTEX(frontier_mutex);
+}
+
+/**
+ * @brief cut a file after its first lines (this instance's share of -m in png_urls.txt)
+ * @param path const char*: the file
+ * @param num_lines int64_t: number of lines to keep
+ * @return 0 on success; 1 if the file could not be read or truncated
+ */
+int keep_first_lines(const char *path, int64_t num_lines)
+{
+    FILE *f = fopen(path, "r+");
+    if (f == NULL)
+    {
+        return 1;
+    }
+    int64_t lines = 0;
+    int c;
+    while (lines < num_lines && (c = getc(f)) != EOF)
+    {
+        if (c == '\n')
+        {
+            ++lines;
+        }
+    }
+    int ret = lines < num_lines || ftruncate(fileno(f), ftell(f)) == 0 ? 0 : 1;
+    fclose(f);
+    return ret;
+}
+/* ----------------- */
+
+/* -- Adaptive concurrency (--adaptive): what the controller needs from the crawl -- */
+/**
+ * @brief wake the parked runners so those now allowed to take urls do
+ */
+void wake_parked()
+{
+    LOCK_MUTEX(frontier_mutex);
+    {
+        if (num_parked > 0)
+        {
+            pthread_cond_broadcast(&frontier_empty);
+        }
+    }
+    UNLOCK_MUTEX(frontier_mutex);
+}
+
+/**
+ * @brief number of runners allowed to take urls that are waiting for one
+ * @return number of starved runners
+ */
+size_t num_starved()
+{
+    size_t n;
+    LOCK_MUTEX(frontier_mutex);
+    n = num_waiting_on_url - num_parked;
+    UNLOCK_MUTEX(frontier_mutex);
+    return n;
+}
+/* ----------------- */
+
+/**
+ * @brief whether runners have nothing left to take off the frontier
+ * @return true if the frontier is empty, or a recrawl's fetch budget is spent
+ * @details
+ * Call with frontier_mutex held.
+ */
+static bool nothing_to_pop()
+{
+    return is_empty_frontier(frontier) || recrawl_fetches_left() == 0;
+}
+
+/**
+ * @brief mark that the calling thread is no longer processing a url
+ * @details
+ * If that leaves nothing to crawl and nothing being processed, the crawl is finished:
+ *  wake the threads waiting for urls so they can exit. (A runner would notice this
+ *  at the top of its loop, but a parser finishing the last page would not.)
+ *  In a partitioned crawl, other instances may still forward urls: node 0 decides.
+ */
+void finish_url()
+{
+    LOCK_MUTEX(frontier_mutex);
+    {
+        --num_running;
+        unpark_urls();
+        if (nothing_to_pop() && num_running == 0 && !partition_enabled())
+        {
+            done = true;
+            if (num_waiting_on_url > 0)
+            {
+                pthread_cond_broadcast(&frontier_empty);
+            }
+        }
+    }
+    UNLOCK_MUTEX(frontier_mutex);
+}
+
+/**
+ * @brief parser function that extracts urls from pages in the parse queue
  * @param _ void*: not used; only defined to satisfy thread API
  * @return NULL
  * @details
+ * Only started in pipeline mode (-P), where runners download pages and hand
+ *  html pages to the parse pool through the bounded parse_queue.
+ * A page in the queue still counts in num_running, so the crawl is not
+ *  considered finished until its urls are on the frontier.
+ * The parser stops once the parse queue is closed and drained.
+ */
+void *parser(void *_)
+{
+    PAGE *page = NULL;
+
+    live_stats_register_thread("parser");
+    trace_register_thread("parser");
+    live_stats_set_state(LIVE_WAITING);
+    uint64_t wait_start = trace_begin();
+    while (pop_pqueue(parse_queue, (void **)&page) == 0)
+    {
+        trace_end("wait parse_queue", wait_start, NULL);
+        live_stats_set_state(LIVE_PARSING);
+        STACK urls_found;
+        STACK imgs_found;
+        init_stack(&urls_found, 1);
+        init_stack(&imgs_found, 1);
+
+        // once the crawl is done, remaining pages are only drained
+        bool is_done;
+        LOCK_MUTEX(frontier_mutex);
+        is_done = done;
+        UNLOCK_MUTEX(frontier_mutex);
+
+        if (!is_done)
+        {
+            process_html(&page->recv_buf, page->url, &urls_found, &imgs_found);
+            push_found_urls(page->url, &urls_found, &imgs_found, NULL);
+        }
+
+        cleanup_stack(&urls_found);
+        cleanup_stack(&imgs_found);
+        recv_buf_cleanup(&page->recv_buf);
+        free(page->url);
+        free(page);
+        page = NULL;
+
+        finish_url();
+        live_stats_set_state(LIVE_WAITING);
+        wait_start = trace_begin();
+    }
+
+    live_stats_set_state(LIVE_EXITED);
+    arena_thread_cleanup();
+
+    return NULL;
+}
+
+/**
+ * @brief runner function that crawls urls in the global frontier
+ * @param arg void*: index of the runner (0 to t - 1), cast to a pointer
+ * @return NULL
+ * @details
  * Any number of runner threads can be started.
  * The runner function manages concurrency.
  * The runner function assumes that all global structures and
@@ -96,9 +582,15 @@ void cleanup_global()
  * The runner function will stop once there are no more urls to crawl
  *  or when we've found num_pngs_to_find pngs.
  * The runner function does not clean up global variables.
+ * With --adaptive, runners at or above the controller's limit wait on
+ *  frontier_empty as if the frontier were empty.
  */
-void *runner(void *_)
+void *runner(void *arg)
 {
+    size_t id = (size_t)(uintptr_t)arg;
+    live_stats_register_thread("runner");
+    trace_register_thread("runner");
+
     /* -- Initialize cURL easy handle -- */
     CURL *curl_handle = curl_easy_init();
     if (curl_handle == NULL)
@@ -108,6 +600,19 @@ void *runner(void *_)
     }
     /* ----------------- */
 
+    /* -- Initialize the multi handle for speculative fetches and same-host batches (if --speculate or --http2) -- */
+    SPECULATOR *spec = NULL;
+    if (speculate_budget > 0 || http2_streams > 0)
+    {
+        spec = malloc(sizeof(SPECULATOR));
+        if (speculator_init(spec, speculate_budget > http2_streams ? speculate_budget : http2_streams, http2_streams) != 0)
+        {
+            fprintf(stderr, "speculator_init: failed\n");
+            exit(1);
+        }
+    }
+    /* ----------------- */
+
     /* -- Defining variables used in the loop -- */
     // response code from accessing url
     long response_code;
@@ -117,8 +622,20 @@ void *runner(void *_)
     char *url_to_crawl = NULL;
     // urls found on the web page visited; we will add these to the frontier
     STACK *urls_found = NULL;
-    // if we have cleaned urls_found
+    // images embedded on the web page visited; we will add these to the frontier's image lane
+    STACK *imgs_found = NULL;
+    // if we have cleaned urls_found and imgs_found
     bool cleaned_urls_found = false;
+    // whether the url was fetched speculatively, and (if so) the download
+    bool speculative = false;
+    RECV_BUF spec_buf;
+    char *spec_eurl = NULL;
+    int spec_res = 0;
+    // urls on the same host as the url, fetched with it (if --http2)
+    char *batch[SPECULATE_MAX_STREAMS];
+    size_t batch_size = 0;
+    // time spent on the url, for the adaptive controller
+    ADAPTIVE_SAMPLE sample;
     /* ----------------- */
 
     while (true)
@@ -129,13 +646,18 @@ void *runner(void *_)
             if (!cleaned_urls_found)
             {
                 cleanup_stack(urls_found);
+                cleanup_stack(imgs_found);
                 cleaned_urls_found = true;
             }
             free(urls_found);
+            free(imgs_found);
         }
         urls_found = malloc(sizeof(STACK));
         memset(urls_found, 0, sizeof(STACK));
         init_stack(urls_found, 1);
+        imgs_found = malloc(sizeof(STACK));
+        memset(imgs_found, 0, sizeof(STACK));
+        init_stack(imgs_found, 1);
         cleaned_urls_found = false;
 
         if (url_to_crawl != NULL)
@@ -146,11 +668,18 @@ void *runner(void *_)
         /* ----------------- */
 
         /* -- Check status of frontier and overall crawl -- */
-        pthread_mutex_lock(&frontier_mutex);
+        // start of the span frontier_mutex is held for
+        uint64_t frontier_held;
+        LOCK_MUTEX(frontier_mutex);
+        frontier_held = trace_begin();
         {
+            // Push back urls the memory budget parked, once there is room (if --mem-policy=pause)
+            unpark_urls();
+
             // If the crawl is finished, signal sleeping threads to
-            //  wake up so they can exit
-            if (is_empty_stack(frontier) && num_running == 0)
+            //  wake up so they can exit (a partitioned crawl is ended by node 0;
+            //  a recrawl also once its fetch budget is spent and the fetches made are crawled)
+            if (nothing_to_pop() && num_running == 0 && !partition_enabled())
             {
                 done = true;
                 if (num_waiting_on_url > 0)
@@ -159,46 +688,117 @@ void *runner(void *_)
                 }
             }
 
-            // If there are no urls to crawl and the crawl is not done, wait
-            while (is_empty_stack(frontier) && !done)
+            // If there are no urls to crawl (or the runner is parked) and the crawl is not done, wait
+            //  (unless a speculative fetch is waiting to be crawled)
+            while ((nothing_to_pop() || adaptive_parked(id)) && !speculator_pending(spec) && !done)
             {
+                bool parked = adaptive_parked(id);
                 ++num_waiting_on_url;
-                pthread_cond_wait(&frontier_empty, &frontier_mutex);
+                num_parked += parked;
+                live_stats_set_state(LIVE_WAITING);
+                // the lock is released while waiting
+                trace_end("frontier_mutex held", frontier_held, NULL);
+                uint64_t wait_start = trace_begin();
+                WAIT_COND(frontier_empty, frontier_mutex);
+                trace_end("wait frontier_empty", wait_start, NULL);
+                frontier_held = trace_begin();
+                live_stats_set_state(LIVE_IDLE);
                 --num_waiting_on_url;
+                num_parked -= parked;
             }
 
             // If the crawl is finished, exit the loop
             if (done)
             {
-                pthread_mutex_unlock(&frontier_mutex);
+                trace_end("frontier_mutex held", frontier_held, NULL);
+                UNLOCK_MUTEX(frontier_mutex);
                 break;
             }
 
-            // Take the top url on the frontier
-            pop_stack(frontier, &url_to_crawl);
-
-            // Check if the url has been visited
-            pthread_mutex_lock(&visited_mutex);
+            // Crawl the oldest speculative fetch next (its url is already visited and running);
+            //  otherwise take the next url on the frontier (embedded images first)
+            speculative = speculator_pending(spec);
+            if (!speculative)
             {
-                // If the url has been visited, go back to the top of the loop
-                //  (go to the next url in the frontier or if frontier is empty, wait)
-                if (search_hset(visited, url_to_crawl) == 1)
+                pop_frontier(frontier, &url_to_crawl);
+                budget_set(BUDGET_FRONTIER, frontier_bytes(frontier));
+                live_stats_set_frontier(num_elements_frontier(frontier));
+
+                // Check if the url has been visited
+                LOCK_MUTEX(visited_mutex);
+                uint64_t visited_held = trace_begin();
                 {
-                    pthread_mutex_unlock(&visited_mutex);
-                    pthread_mutex_unlock(&frontier_mutex);
-                    continue;
+                    // If the url has been visited, go back to the top of the loop
+                    //  (go to the next url in the frontier or if frontier is empty, wait)
+                    if (search_hset(visited, url_to_crawl) == 1)
+                    {
+                        budget_set(BUDGET_VISITED, hset_bytes(visited));
+                        trace_end("visited_mutex held", visited_held, NULL);
+                        UNLOCK_MUTEX(visited_mutex);
+                        trace_end("frontier_mutex held", frontier_held, NULL);
+                        UNLOCK_MUTEX(frontier_mutex);
+                        continue;
+                    }
+                    // If the url has not been visited, mark it as visited.
+                    //  The thread will now process the url.
+                    else
+                    {
+                        add_hset(visited, url_to_crawl);
+                        budget_set(BUDGET_VISITED, hset_bytes(visited));
+                    }
                 }
-                // If the url has not been visited, mark it as visited.
-                //  The thread will now process the url.
-                else
+                trace_end("visited_mutex held", visited_held, NULL);
+                UNLOCK_MUTEX(visited_mutex);
+                ++num_running;
+                // Count the fetch against a recrawl's budget before it starts (if --recrawl)
+                recrawl_count_fetches(1);
+
+                // Take the urls on its host near the top of the frontier too, to fetch them
+                //  together as streams of one connection (if --http2), as many as a recrawl's budget has left
+                if (http2_streams > 0)
                 {
-                    add_hset(visited, url_to_crawl);
+                    size_t left = recrawl_fetches_left();
+                    batch_size = take_batch(url_to_crawl, batch, left < (size_t)http2_streams - 1 ? left : (size_t)http2_streams - 1);
+                    recrawl_count_fetches(batch_size);
                 }
             }
-            pthread_mutex_unlock(&visited_mutex);
-            ++num_running;
         }
-        pthread_mutex_unlock(&frontier_mutex);
+        trace_end("frontier_mutex held", frontier_held, url_to_crawl);
+        UNLOCK_MUTEX(frontier_mutex);
+
+        // Start the batch on the multi handle; it is crawled next, like speculative fetches (if --http2)
+        if (!speculative && http2_streams > 0)
+        {
+            speculator_count_batch(batch_size + 1);
+            start_claimed(spec, url_to_crawl, false);
+            url_to_crawl = NULL;
+            for (size_t i = 0; i < batch_size; ++i)
+            {
+                start_claimed(spec, batch[i], false);
+            }
+            continue;
+        }
+
+        if (speculative)
+        {
+            // wait for the download (the url was logged and checked for traps when it was started)
+            adaptive_url_start(&sample);
+            live_stats_set_state(LIVE_FETCHING);
+            spec_res = speculator_take(spec, &url_to_crawl, &spec_buf, &spec_eurl, &content_type, &response_code);
+        }
+        else
+        {
+            // Log the newly visited url (if -v)
+            writer_append(WRITER_VISITED, url_to_crawl);
+        }
+        /* ----------------- */
+
+        /* -- Skip urls that look like crawler traps (if enabled) -- */
+        if (!speculative && trap_check_url(url_to_crawl) != TRAP_NONE)
+        {
+            finish_url();
+            continue;
+        }
         /* ----------------- */
 
 #ifdef DEBUG_URL_PRINT
@@ -206,63 +806,89 @@ void *runner(void *_)
 #endif
 
         /* -- Crawl the url -- */
-        // download the contents at the url and process it
-        process_url(curl_handle, url_to_crawl, &content_type, urls_found, &response_code);
+        // whether the page was handed to the parse pool (which then finishes the url)
+        bool handed_off = false;
+        if (!speculative)
+        {
+            adaptive_url_start(&sample);
+            live_stats_set_state(LIVE_FETCHING);
+        }
+        if (speculative)
+        {
+            // the download finished above: process it
+            if (spec_res == 0)
+            {
+                parse_fetched(&spec_buf, spec_eurl, content_type, response_code, urls_found, imgs_found);
+            }
+        }
+        else if (parse_queue == NULL)
+        {
+            // download the contents at the url and process it
+            process_url(curl_handle, url_to_crawl, &content_type, urls_found, imgs_found, &response_code);
+        }
+        else
+        {
+            // download the contents at the url; html pages are parsed by the parse pool
+            PAGE *page = malloc(sizeof(PAGE));
+            memset(page, 0, sizeof(PAGE));
+            if (fetch_url(curl_handle, url_to_crawl, &page->recv_buf, &page->url, &content_type, &response_code) != 0)
+            {
+                free(page);
+                page = NULL;
+            }
+            else if (content_type == HTML && is_processable_response(response_code))
+            {
+                // blocks while the parse queue is full
+                live_stats_set_state(LIVE_QUEUEING);
+                uint64_t queue_start = trace_begin();
+                handed_off = push_pqueue(parse_queue, page) == 0;
+                trace_end("wait parse_queue", queue_start, NULL);
+            }
+            if (page != NULL && !handed_off)
+            {
+                recv_buf_cleanup(&page->recv_buf);
+                free(page->url);
+                free(page);
+            }
+        }
+        adaptive_url_done(&sample);
         /* ----------------- */
 
         /* -- Process url based on its contents -- */
         if (is_processable_response(response_code))
         {
             // If the url was a HTML page, add all urls on that page to the frontier
+            //  (in pipeline mode the parse pool does this and the stacks are empty)
             if (content_type == HTML)
             {
-                char *url_in_html = NULL;
-                while (pop_stack(urls_found, &url_in_html) == 0)
-                {
-                    // Add to the frontier and signal sleeping threads
-                    //  (that a url is ready in frontier)
-                    pthread_mutex_lock(&frontier_mutex);
-                    {
-                        push_stack(frontier, url_in_html);
-                        if (num_waiting_on_url > 0)
-                        {
-                            pthread_cond_broadcast(&frontier_empty);
-                        }
-                    }
-                    pthread_mutex_unlock(&frontier_mutex);
-                    free(url_in_html);
-                    url_in_html = NULL;
-                }
+                push_found_urls(url_to_crawl, urls_found, imgs_found, spec);
             }
             // If the url was a valid PNG, add it to our collection of found pngs
             else if (content_type == VALID_PNG)
             {
-                pthread_mutex_lock(&pngs_mutex);
+                LOCK_MUTEX(pngs_mutex);
                 {
                     push_stack(pngs, url_to_crawl);
+                    writer_append(WRITER_PNGS, url_to_crawl);
+                    live_stats_set_pngs(num_elements_stack(pngs));
                     // If we've reached the maximum number of PNGs we want to find,
                     //  end the program
                     if (num_elements_stack(pngs) >= num_pngs_to_find)
                     {
-                        pthread_mutex_lock(&frontier_mutex);
-                        {
-                            done = true;
-                            pthread_cond_broadcast(&frontier_empty);
-                        }
-                        pthread_mutex_unlock(&frontier_mutex);
+                        finish_crawl();
                     }
                 }
-                pthread_mutex_unlock(&pngs_mutex);
+                UNLOCK_MUTEX(pngs_mutex);
             }
         }
         /* ----------------- */
 
         /* -- The thread is no longer processing a url -- */
-        pthread_mutex_lock(&frontier_mutex);
+        if (!handed_off)
         {
-            --num_running;
+            finish_url();
         }
-        pthread_mutex_unlock(&frontier_mutex);
+        live_stats_set_state(LIVE_IDLE);
         /* ----------------- */
     }
 
@@ -272,8 +898,10 @@ void *runner(void *_)
         if (!cleaned_urls_found)
         {
             cleanup_stack(urls_found);
+            cleanup_stack(imgs_found);
         }
         free(urls_found);
+        free(imgs_found);
     }
 
     if (url_to_crawl != NULL)
@@ -282,23 +910,175 @@ void *runner(void *_)
         url_to_crawl = NULL;
     }
 
+    // cancel the speculative fetches still in flight
+    if (spec != NULL)
+    {
+        speculator_cleanup(spec);
+        free(spec);
+    }
     curl_easy_cleanup(curl_handle);
+    dns_thread_cleanup();
+    arena_thread_cleanup();
+    live_stats_set_state(LIVE_EXITED);
     /* ----------------- */
 
     return NULL;
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief runner function of a worker process in multi-process mode (-p)
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment holding the frontier and visited set
+ * @param id int: slot of the worker
+ * @details
+ * The same loop as runner, over the shared frontier instead of the global one.
+ *  Urls are marked visited when they are pushed, and found pngs and visited
+ *  urls are appended straight to their files, so a worker holds no state
+ *  a crash could lose beyond the url it is crawling (which the supervisor puts back).
+ * Returns once the crawl is finished.
+ */
+void process_runner(SHM_CRAWL *shm, int id)
 {
-    /* -- command line inputs -- */
-    char *seed_url;
+    /* -- Initialize cURL easy handle -- */
+    CURL *curl_handle = curl_easy_init();
+    if (curl_handle == NULL)
+    {
+        fprintf(stderr, "curl_easy_init: returned NULL\n");
+        exit(1);
+    }
+    /* ----------------- */
+
+    // response code from accessing url
+    long response_code;
+    // content type of data at url (e.g. HTML, PNG)
+    int content_type = DEFAULT_TYPE;
+    // urls and images found on the web page visited
+    STACK urls_found;
+    STACK imgs_found;
+
+    while (true)
+    {
+        /* -- Take the next url, or wait for one -- */
+        const char *url_to_crawl = shm_pop_url(shm, id);
+        if (url_to_crawl == NULL)
+        {
+            if (!shm_wait_for_url(shm))
+            {
+                break;
+            }
+            continue;
+        }
+        shm_write_line(shm, SHM_VISITED, url_to_crawl);
+        /* ----------------- */
+
+#ifdef DEBUG_URL_PRINT
+        printf("URL: %s\n", url_to_crawl);
+#endif
+
+        /* -- Crawl the url and process it based on its contents -- */
+        init_stack(&urls_found, 1);
+        init_stack(&imgs_found, 1);
+        process_url(curl_handle, (char *)url_to_crawl, &content_type, &urls_found, &imgs_found, &response_code);
+        if (is_processable_response(response_code))
+        {
+            char *url_in_html = NULL;
+            if (content_type == HTML)
+            {
+                while (pop_stack(&urls_found, &url_in_html) == 0)
+                {
+                    shm_push_url(shm, url_in_html, SHM_LANE_PAGE);
+                    free(url_in_html);
+                }
+                while (pop_stack(&imgs_found, &url_in_html) == 0)
+                {
+                    shm_push_url(shm, url_in_html, SHM_LANE_IMAGE);
+                    free(url_in_html);
+                }
+            }
+            else if (content_type == VALID_PNG && shm_found_png(shm))
+            {
+                shm_write_line(shm, SHM_PNGS, url_to_crawl);
+            }
+        }
+        cleanup_stack(&urls_found);
+        cleanup_stack(&imgs_found);
+        /* ----------------- */
+
+        shm_finish_url(shm, id);
+    }
+
+    curl_easy_cleanup(curl_handle);
+}
+
+/**
+ * @brief crawl from the seed url with worker processes (-p), supervising them until the crawl is finished
+ * @param seed_url const char*: the seed url
+ * @param num_procs int: number of worker processes
+ * @param logfile_name const char*: path of the log of visited urls (NULL if -v was not given)
+ * @return 0 on success; 1 on error
+ */
+int crawl_processes(const char *seed_url, int num_procs, const char *logfile_name)
+{
+    SHM_CRAWL *shm = shm_crawl_create(num_procs, num_pngs_to_find, PNG_URLS_FILE, logfile_name);
+    if (shm == NULL)
+    {
+        return 1;
+    }
+    shm_push_url(shm, seed_url, SHM_LANE_PAGE);
+
+    int ret = shm_supervise(shm, process_runner);
+    printf("processes: %d workers crawled %lu urls and found %d pngs; %lu worker crashes (%lu urls given up on), %lu urls dropped (shared memory full)\n",
+           num_procs, (unsigned long)shm->crawled, shm->num_pngs < num_pngs_to_find ? shm->num_pngs : num_pngs_to_find,
+           (unsigned long)shm->crashes, (unsigned long)shm->abandoned, (unsigned long)shm->dropped);
+    shm_crawl_destroy(shm);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    /* -- command line inputs -- */
+    char *seed_url;
     char *logfile = NULL;
     size_t t = 1;
+    bool set_threads = false;
+    // number of worker processes (0: crawl with threads)
+    long num_procs = 0;
+    int engine = EXTRACT_XML;
+    // number of parse threads (0: parse inline in the runners)
+    long num_parsers = 0;
+    size_t parse_queue_size = 0;
+    bool use_arena = false;
+    bool use_traps = false;
+    bool use_dedup = false;
+    char *latency_file = NULL;
+    char *stats_socket = NULL;
+    char *trace_file = NULL;
+    char *record_file = NULL;
+    char *replay_file = NULL;
+    double replay_latency = 0;
+    long fsync_policy = WRITER_FSYNC_NEVER;
+    char *records_file = NULL;
+    int records_format = RECORDS_JSONL;
+    char *peers = NULL;
+    int node = -1;
+    // fewest runners the adaptive controller keeps active (0: no controller, all t runners take urls)
+    long min_runners = 0;
+    // memory budget in MB (0: no budget) and what to drop as the crawl nears it
+    long mem_budget = 0;
+    int mem_policy = BUDGET_POLICY_PAUSE;
+    // resolver threads (0: no prefetch) and the file names are looked up in instead of DNS
+    long dns_resolvers = 0;
+    char *dns_hosts = NULL;
+    // speak HTTP/2 to http:// urls without asking to upgrade (--http2)
+    bool h2c = false;
+    // conditional-GET cache file (NULL: no cache)
+    char *cache_file = NULL;
+    // fetch budget of a change-rate-aware recrawl (0: crawl from the seed url)
+    long recrawl_budget = 0;
     num_pngs_to_find = 50;
 
     if (argc == 1)
     {
-        printf("Usage: ./findpng2 OPTION[-t=<NUM> -m=<NUM> -v=<LOGFILE>] SEED_URL\n");
+        printf("Usage: ./findpng2 OPTION[-t=<NUM> -p=<NUM> -m=<NUM> -v=<LOGFILE> -e=<xml|scan|diff> -P=<NUM> -Q=<NUM> -a -T -D -L=<FILE> -S=<SOCKET> --trace=<FILE> --record=<FILE> --replay=<FILE> --replay-latency=<SCALE> --fsync=<never|batch|MS> --records=<FILE> --records-format=<jsonl|binary> --peers=<HOST:PORT,...> --node=<NUM> --adaptive=<MIN> --mem-budget=<MB> --mem-policy=<pause|pages|deep> --dns-prefetch=<NUM> --dns-hosts=<FILE> --speculate=<NUM> --http2=<NUM> --h2c --cache=<FILE> --recrawl=<NUM>] SEED_URL\n");
         return -1;
     }
 
@@ -307,7 +1087,30 @@ int main(int argc, char **argv)
     int c;
     char *str = "option requires an argument";
 
-    while ((c = getopt(argc, argv, "t:m:v:")) != -1)
+    // options that only have a long form
+    static struct option long_options[] = {
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"record", required_argument, NULL, OPT_RECORD},
+        {"replay", required_argument, NULL, OPT_REPLAY},
+        {"replay-latency", required_argument, NULL, OPT_REPLAY_LATENCY},
+        {"fsync", required_argument, NULL, OPT_FSYNC},
+        {"records", required_argument, NULL, OPT_RECORDS},
+        {"records-format", required_argument, NULL, OPT_RECORDS_FORMAT},
+        {"peers", required_argument, NULL, OPT_PEERS},
+        {"node", required_argument, NULL, OPT_NODE},
+        {"adaptive", required_argument, NULL, OPT_ADAPTIVE},
+        {"mem-budget", required_argument, NULL, OPT_MEM_BUDGET},
+        {"mem-policy", required_argument, NULL, OPT_MEM_POLICY},
+        {"dns-prefetch", required_argument, NULL, OPT_DNS_PREFETCH},
+        {"dns-hosts", required_argument, NULL, OPT_DNS_HOSTS},
+        {"speculate", required_argument, NULL, OPT_SPECULATE},
+        {"http2", required_argument, NULL, OPT_HTTP2},
+        {"h2c", no_argument, NULL, OPT_H2C},
+        {"cache", required_argument, NULL, OPT_CACHE},
+        {"recrawl", required_argument, NULL, OPT_RECRAWL},
+        {NULL, 0, NULL, 0}};
+
+    while ((c = getopt_long(argc, argv, "t:p:m:v:e:P:Q:aTDL:S:", long_options, NULL)) != -1)
     {
         switch (c)
         {
@@ -323,6 +1126,15 @@ int main(int argc, char **argv)
                 fprintf(stderr, "%s: %s > 0 -- 't'\n", argv[0], str);
                 return -1;
             }
+            set_threads = true;
+            break;
+        case 'p':
+            num_procs = strtol(optarg, NULL, 10);
+            if (num_procs <= 0 || num_procs > SHM_MAX_WORKERS)
+            {
+                fprintf(stderr, "%s: %s > 0 and <= %d -- 'p'\n", argv[0], str, SHM_MAX_WORKERS);
+                return -1;
+            }
             break;
         case 'm':
             if (optarg == NULL)
@@ -347,8 +1159,271 @@ int main(int argc, char **argv)
             memset(logfile, 0, sizeof(char) * FILE_PATH_SIZE);
             strcpy(logfile, optarg);
             break;
+        case 'e':
+            if (strcmp(optarg, "xml") == 0)
+            {
+                engine = EXTRACT_XML;
+            }
+            else if (strcmp(optarg, "scan") == 0)
+            {
+                engine = EXTRACT_SCAN;
+            }
+            else if (strcmp(optarg, "diff") == 0)
+            {
+                engine = EXTRACT_DIFF;
+            }
+            else
+            {
+                fprintf(stderr, "%s: %s xml, scan or diff -- 'e'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case 'P':
+            num_parsers = strtol(optarg, NULL, 10);
+            if (num_parsers < 0)
+            {
+                fprintf(stderr, "%s: %s >= 0 -- 'P'\n", argv[0], str);
+                return -1;
+            }
+            // -P 0: one parse thread per core
+            if (num_parsers == 0)
+            {
+                num_parsers = sysconf(_SC_NPROCESSORS_ONLN);
+                if (num_parsers < 1)
+                {
+                    num_parsers = 1;
+                }
+            }
+            break;
+        case 'Q':
+            parse_queue_size = strtoul(optarg, NULL, 10);
+            if (parse_queue_size <= 0)
+            {
+                fprintf(stderr, "%s: %s > 0 -- 'Q'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case 'a':
+            use_arena = true;
+            break;
+        case 'T':
+            use_traps = true;
+            break;
+        case 'D':
+            use_dedup = true;
+            break;
+        case 'L':
+            latency_file = optarg;
+            break;
+        case 'S':
+            stats_socket = optarg;
+            break;
+        case OPT_TRACE:
+            trace_file = optarg;
+            break;
+        case OPT_RECORD:
+            record_file = optarg;
+            break;
+        case OPT_REPLAY:
+            replay_file = optarg;
+            break;
+        case OPT_REPLAY_LATENCY:
+            replay_latency = strtod(optarg, NULL);
+            if (replay_latency < 0)
+            {
+                fprintf(stderr, "%s: %s >= 0 -- 'replay-latency'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case OPT_FSYNC:
+            if (strcmp(optarg, "never") == 0)
+            {
+                fsync_policy = WRITER_FSYNC_NEVER;
+            }
+            else if (strcmp(optarg, "batch") == 0)
+            {
+                fsync_policy = WRITER_FSYNC_BATCH;
+            }
+            else
+            {
+                fsync_policy = strtol(optarg, NULL, 10);
+                if (fsync_policy <= 0)
+                {
+                    fprintf(stderr, "%s: %s never, batch or ms > 0 -- 'fsync'\n", argv[0], str);
+                    return -1;
+                }
+            }
+            break;
+        case OPT_RECORDS:
+            records_file = optarg;
+            break;
+        case OPT_RECORDS_FORMAT:
+            if (strcmp(optarg, "jsonl") == 0)
+            {
+                records_format = RECORDS_JSONL;
+            }
+            else if (strcmp(optarg, "binary") == 0)
+            {
+                records_format = RECORDS_BINARY;
+            }
+            else
+            {
+                fprintf(stderr, "%s: %s jsonl or binary -- 'records-format'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case OPT_PEERS:
+            peers = optarg;
+            break;
+        case OPT_NODE:
+            node = atoi(optarg);
+            if (node < 0)
+            {
+                fprintf(stderr, "%s: %s >= 0 -- 'node'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case OPT_ADAPTIVE:
+            min_runners = strtol(optarg, NULL, 10);
+            if (min_runners <= 0)
+            {
+                fprintf(stderr, "%s: %s > 0 -- 'adaptive'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case OPT_MEM_BUDGET:
+            mem_budget = strtol(optarg, NULL, 10);
+            if (mem_budget <= 0)
+            {
+                fprintf(stderr, "%s: %s > 0 -- 'mem-budget'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case OPT_MEM_POLICY:
+            if (strcmp(optarg, "pause") == 0)
+            {
+                mem_policy = BUDGET_POLICY_PAUSE;
+            }
+            else if (strcmp(optarg, "pages") == 0)
+            {
+                mem_policy = BUDGET_POLICY_PAGES;
+            }
+            else if (strcmp(optarg, "deep") == 0)
+            {
+                mem_policy = BUDGET_POLICY_DEEP;
+            }
+            else
+            {
+                fprintf(stderr, "%s: %s pause, pages or deep -- 'mem-policy'\n", argv[0], str);
+                return -1;
+            }
+            break;
+        case OPT_DNS_PREFETCH:
+            dns_resolvers = strtol(optarg, NULL, 10);
+            if (dns_resolvers <= 0 || dns_resolvers > DNS_MAX_THREADS)
+            {
+                fprintf(stderr, "%s: %s > 0 and <= %d -- 'dns-prefetch'\n", argv[0], str, DNS_MAX_THREADS);
+                return -1;
+            }
+            break;
+        case OPT_DNS_HOSTS:
+            dns_hosts = optarg;
+            break;
+        case OPT_SPECULATE:
+            speculate_budget = strtol(optarg, NULL, 10);
+            if (speculate_budget <= 0 || speculate_budget > SPECULATE_MAX)
+            {
+                fprintf(stderr, "%s: %s > 0 and <= %d -- 'speculate'\n", argv[0], str, SPECULATE_MAX);
+                return -1;
+            }
+            break;
+        case OPT_HTTP2:
+            http2_streams = strtol(optarg, NULL, 10);
+            if (http2_streams <= 0 || http2_streams > SPECULATE_MAX_STREAMS)
+            {
+                fprintf(stderr, "%s: %s > 0 and <= %d -- 'http2'\n", argv[0], str, SPECULATE_MAX_STREAMS);
+                return -1;
+            }
+            break;
+        case OPT_H2C:
+            h2c = true;
+            break;
+        case OPT_CACHE:
+            cache_file = optarg;
+            break;
+        case OPT_RECRAWL:
+            recrawl_budget = strtol(optarg, NULL, 10);
+            if (recrawl_budget <= 0)
+            {
+                fprintf(stderr, "%s: %s > 0 -- 'recrawl'\n", argv[0], str);
+                return -1;
+            }
+            break;
         }
     }
+    if (record_file != NULL && replay_file != NULL)
+    {
+        fprintf(stderr, "%s: --record and --replay can't be used together\n", argv[0]);
+        return -1;
+    }
+    if ((peers == NULL) != (node < 0))
+    {
+        fprintf(stderr, "%s: --peers and --node must be used together\n", argv[0]);
+        return -1;
+    }
+    if (min_runners > 0 && (size_t)min_runners > t)
+    {
+        fprintf(stderr, "%s: --adaptive minimum can't be more than -t\n", argv[0]);
+        return -1;
+    }
+    // speculative fetches are started and crawled by the runner that parsed the page
+    if (speculate_budget > 0 && (num_parsers > 0 || replay_file != NULL))
+    {
+        fprintf(stderr, "%s: --speculate can't be used with -P or --replay\n", argv[0]);
+        return -1;
+    }
+    if (http2_streams > 0 && (num_parsers > 0 || replay_file != NULL))
+    {
+        fprintf(stderr, "%s: --http2 can't be used with -P or --replay\n", argv[0]);
+        return -1;
+    }
+    // a recorded 304 has no body to replay
+    if (cache_file != NULL && (record_file != NULL || replay_file != NULL))
+    {
+        fprintf(stderr, "%s: --cache can't be used with --record or --replay\n", argv[0]);
+        return -1;
+    }
+    // the history the schedule is estimated from is kept in the cache file
+    if (recrawl_budget > 0 && cache_file == NULL)
+    {
+        fprintf(stderr, "%s: --recrawl needs --cache\n", argv[0]);
+        return -1;
+    }
+    if (recrawl_budget > 0 && peers != NULL)
+    {
+        fprintf(stderr, "%s: --recrawl can't be used with --peers\n", argv[0]);
+        return -1;
+    }
+    if (h2c && http2_streams == 0)
+    {
+        fprintf(stderr, "%s: --h2c needs --http2\n", argv[0]);
+        return -1;
+    }
+    if (peers != NULL && num_procs > 0)
+    {
+        fprintf(stderr, "%s: --peers can't be used with -p\n", argv[0]);
+        return -1;
+    }
+    // the workers report nothing back to this process but their pngs and visited urls
+    if (num_procs > 0 && (set_threads || num_parsers > 0 || use_arena || use_traps || use_dedup || latency_file != NULL ||
+                          stats_socket != NULL || trace_file != NULL || record_file != NULL || fsync_policy != WRITER_FSYNC_NEVER ||
+                          records_file != NULL || min_runners > 0 || mem_budget > 0 ||
+                          dns_resolvers > 0 || dns_hosts != NULL || speculate_budget > 0 ||
+                          http2_streams > 0 || cache_file != NULL))
+    {
+        fprintf(stderr, "%s: -p can't be used with -t, -P, -a, -T, -D, -L, -S, --trace, --record, --fsync, --records, --adaptive, --mem-budget, --dns-*, --speculate, --http2 or --cache\n", argv[0]);
+        return -1;
+    }
     /* ----------------- */
 
     /* -- initialize global variables and synchronization variables -- */
@@ -360,11 +1435,148 @@ int main(int argc, char **argv)
     /* ----------------- */
 
     /* -- Initialize XML Parser -- */
+    // the arena must be libxml2's allocator before libxml2 allocates anything
+    if (use_arena && arena_install() != 0)
+    {
+        fprintf(stderr, "Installing the libxml2 arena allocator failed\n");
+        exit(1);
+    }
     xmlInitParser();
+    set_extract_engine(engine);
+    if (http2_streams > 0)
+    {
+        set_http2(h2c);
+    }
     /* ----------------- */
 
-    /* -- Put the seed URL in the frontier -- */
-    push_stack(frontier, seed_url);
+    /* -- Turn on crawler-trap and near-duplicate detection -- */
+    if (use_traps && trap_enable() != 0)
+    {
+        fprintf(stderr, "Allocating trap detection tables failed\n");
+        exit(1);
+    }
+    /* ----------------- */
+
+    /* -- Turn on exact content dedup -- */
+    if (use_dedup && content_dedup_enable() != 0)
+    {
+        fprintf(stderr, "Allocating content dedup tables failed\n");
+        exit(1);
+    }
+    /* ----------------- */
+
+    /* -- Drop (or park) newly found urls as the crawl nears its memory budget -- */
+    if (mem_budget > 0 && budget_enable((size_t)mem_budget * 1024 * 1024, mem_policy) != 0)
+    {
+        fprintf(stderr, "Creating the file for parked urls failed\n");
+        exit(1);
+    }
+    /* ----------------- */
+
+    /* -- Look up hosts ahead of their fetches, and cache the answers -- */
+    if ((dns_resolvers > 0 || dns_hosts != NULL) && dns_enable(dns_resolvers, dns_hosts) != 0)
+    {
+        fprintf(stderr, "Starting the DNS resolver threads (or reading %s) failed\n", dns_hosts != NULL ? dns_hosts : "hosts");
+        exit(1);
+    }
+    /* ----------------- */
+
+    /* -- Turn on per-phase latency recording -- */
+    if (latency_file != NULL)
+    {
+        latency_enable();
+    }
+    /* ----------------- */
+
+    /* -- Record fetched responses, or answer fetches from a recording -- */
+    if (record_file != NULL && corpus_record_open(record_file) != 0)
+    {
+        fprintf(stderr, "Opening corpus archive %s for write failed\n", record_file);
+        exit(1);
+    }
+    if (replay_file != NULL && corpus_replay_open(replay_file, replay_latency) != 0)
+    {
+        fprintf(stderr, "Reading corpus archive %s failed\n", replay_file);
+        exit(1);
+    }
+    /* ----------------- */
+
+    /* -- Open the conditional-GET cache (if --cache) -- */
+    if (cache_file != NULL && http_cache_open(cache_file) != 0)
+    {
+        fprintf(stderr, "Opening cache file %s failed\n", cache_file);
+        exit(1);
+    }
+    /* ----------------- */
+
+    /* -- Set up the parse queue (pipeline mode) -- */
+    if (num_parsers > 0)
+    {
+        if (parse_queue_size == 0)
+        {
+            parse_queue_size = PARSE_QUEUE_PER_PARSER * num_parsers;
+        }
+        parse_queue = malloc(sizeof(PQUEUE));
+        memset(parse_queue, 0, sizeof(PQUEUE));
+        init_pqueue(parse_queue, parse_queue_size);
+    }
+    /* ----------------- */
+
+    /* -- Serve live statistics while the crawl runs -- */
+    if (stats_socket != NULL && live_stats_enable(stats_socket, t + num_parsers, num_pngs_to_find) != 0)
+    {
+        fprintf(stderr, "Serving live statistics on %s failed\n", stats_socket);
+        exit(1);
+    }
+    /* ----------------- */
+
+    /* -- Record per-thread timelines -- */
+    if (trace_file != NULL)
+    {
+        trace_enable();
+    }
+    /* ----------------- */
+
+    /* -- Crawl only the hosts this instance owns, exchanging urls with the other instances -- */
+    if (peers != NULL)
+    {
+        PARTITION_HOOKS hooks = {push_received_urls, crawl_idle, num_pngs_found, finish_crawl};
+        if (partition_enable(peers, node, num_pngs_to_find, &hooks) != 0)
+        {
+            fprintf(stderr, "Starting the partitioned crawl failed\n");
+            exit(1);
+        }
+    }
+    /* ----------------- */
+
+    /* -- Schedule the cached urls most likely to have changed (if --recrawl) -- */
+    if (recrawl_budget > 0)
+    {
+        STACK scheduled;
+        memset(&scheduled, 0, sizeof(STACK));
+        init_stack(&scheduled, STACK_SIZE);
+        if (recrawl_enable(recrawl_budget, &scheduled) != 0)
+        {
+            fprintf(stderr, "Scheduling the recrawl failed\n");
+            exit(1);
+        }
+        // least likely to have changed at the bottom of the page lane, so runners pop the likeliest first
+        for (size_t i = 0; i < num_elements_stack(&scheduled); ++i)
+        {
+            push_frontier(frontier, scheduled.items[i], LANE_PAGE);
+        }
+        live_stats_set_frontier(num_elements_frontier(frontier));
+        cleanup_stack(&scheduled);
+    }
+    /* ----------------- */
+
+    /* -- Put the seed URL in the frontier (only on the instance that owns it, if --peers;
+     *    not in a recrawl with a schedule, which fetches its schedule only) -- */
+    if (partition_owns(seed_url) && recrawl_follows_links())
+    {
+        push_frontier(frontier, seed_url, LANE_PAGE);
+        live_stats_set_frontier(num_elements_frontier(frontier));
+    }
     /* ----------------- */
 
     /* -- Record time to be used for measuring speed -- */
@@ -378,6 +1590,52 @@ int main(int argc, char **argv)
     times[0] = (tv.tv_sec) + tv.tv_usec / 1000000.;
     /* ----------------- */
 
+#ifdef WITH_LOCK_STATS
+    /* -- Sample the crawl state alongside the lock statistics -- */
+    if (start_lock_sampler(sample_crawl) != 0)
+    {
+        fprintf(stderr, "Starting the lock sampler failed\n");
+        exit(1);
+    }
+    /* ----------------- */
+#endif
+
+    char *logfile_name = NULL;
+    if (logfile != NULL)
+    {
+        logfile_name = malloc(sizeof(char) * FILE_PATH_SIZE);
+        memset(logfile_name, 0, sizeof(char) * FILE_PATH_SIZE);
+        snprintf(logfile_name, FILE_PATH_SIZE, "./%s", logfile);
+    }
+
+    /* -- Crawl with worker processes (-p); this process only supervises them -- */
+    if (num_procs > 0)
+    {
+        if (crawl_processes(seed_url, num_procs, logfile_name) != 0)
+        {
+            fprintf(stderr, "Crawling with worker processes failed\n");
+            exit(1);
+        }
+        // no runner threads
+        t = 0;
+    }
+    /* ----------------- */
+
+    /* -- Start streaming png urls (and visited urls, if -v) to their files -- */
+    if (num_procs == 0 && writer_start(PNG_URLS_FILE, logfile_name, records_file, fsync_policy) != 0)
+    {
+        fprintf(stderr, "Opening png, log or records file for write failed\n");
+        exit(1);
+    }
+    free(logfile_name);
+    // a record per fetched url, streamed to the records file
+    if (records_file != NULL && crawl_records_enable(seed_url, records_format) != 0)
+    {
+        fprintf(stderr, "Allocating crawl record tables failed\n");
+        exit(1);
+    }
+    /* ----------------- */
+
     /* -- Create threads -- */
     pthread_t *runners = malloc(t * sizeof(pthread_t));
     memset(runners, 0, sizeof(pthread_t) * t);
@@ -386,9 +1644,29 @@ int main(int argc, char **argv)
         perror("malloc\n");
         exit(-1);
     }
+    // the controller starts with min_runners runners taking urls; the rest start parked
+    ADAPTIVE_HOOKS adaptive_hooks = {wake_parked, num_starved};
+    if (min_runners > 0 && adaptive_enable(min_runners, t, &adaptive_hooks) != 0)
+    {
+        fprintf(stderr, "Starting the adaptive concurrency controller failed\n");
+        exit(1);
+    }
     for (int i = 0; i < t; ++i)
     {
-        pthread_create(&runners[i], NULL, runner, NULL);
+        pthread_create(&runners[i], NULL, runner, (void *)(uintptr_t)i);
+    }
+    /* ----------------- */
+
+    /* -- Create the parse pool (pipeline mode) -- */
+    pthread_t *parsers = NULL;
+    if (num_parsers > 0)
+    {
+        parsers = malloc(num_parsers * sizeof(pthread_t));
+        memset(parsers, 0, num_parsers * sizeof(pthread_t));
+        for (int i = 0; i < num_parsers; ++i)
+        {
+            pthread_create(&parsers[i], NULL, parser, NULL);
+        }
     }
     /* ----------------- */
 
@@ -397,54 +1675,287 @@ int main(int argc, char **argv)
     {
         pthread_join(runners[i], NULL);
     }
+    ADAPTIVE_STATS adaptive_stats;
+    adaptive_stop(&adaptive_stats);
+    DNS_STATS dns_stats;
+    dns_stop(&dns_stats);
+    // runners only exit once no page is left in flight (or enough pngs were found),
+    //  so closing the parse queue lets the parsers drain it and exit
+    if (parse_queue != NULL)
+    {
+        close_pqueue(parse_queue);
+        for (int i = 0; i < num_parsers; ++i)
+        {
+            pthread_join(parsers[i], NULL);
+        }
+    }
+    // the other instances may still be crawling: wait for node 0 to end the crawl
+    int64_t png_share = -1;
+    if (peers != NULL)
+    {
+        PARTITION_STATS partition_stats;
+        if (partition_stop(&partition_stats) != 0)
+        {
+            fprintf(stderr, "Exchanging urls with the other instances failed\n");
+            exit(1);
+        }
+        printf("partition: node %d forwarded %lu urls (%lu duplicates not sent) in %lu batches (%lu bytes, %lu compressed), received %lu urls\n",
+               node, (unsigned long)partition_stats.forwarded, (unsigned long)partition_stats.duplicates,
+               (unsigned long)partition_stats.batches, (unsigned long)partition_stats.raw_bytes,
+               (unsigned long)partition_stats.compressed_bytes, (unsigned long)partition_stats.received);
+        png_share = partition_stats.png_share;
+        if (png_share >= 0 && png_share < num_pngs_found())
+        {
+            printf("partition: node %d keeps %ld of the %d pngs it found (-m counts the pngs of all instances)\n", node,
+                   (long)png_share, num_pngs_found());
+        }
+    }
+#ifdef WITH_LOCK_STATS
+    stop_lock_sampler();
+#endif
+    live_stats_cleanup();
     /* ----------------- */
 
     /* -- Write to files -- */
-    // Write png urls
-    FILE *fpngs = fopen("./png_urls.txt", "w+");
-    if (fpngs == NULL)
+    // Write the png urls (visited urls and crawl records) still queued; the rest were written during the crawl
+    if (writer_stop(NULL) != 0)
     {
-        fprintf(stderr, "Opening png file for write failed\n");
+        fprintf(stderr, "Writing png, log or records file failed\n");
         exit(1);
     }
-    char *temp = NULL;
-    while (pop_stack(pngs, &temp) == 0)
+    crawl_records_cleanup();
+
+    // Keep this instance's share of -m in png_urls.txt (the pngs found while node 0's stop was on its way go)
+    if (png_share >= 0 && keep_first_lines(PNG_URLS_FILE, png_share) != 0)
     {
-        fprintf(fpngs, "%s\n", temp);
-        free(temp);
+        fprintf(stderr, "Trimming png file failed\n");
+        exit(1);
     }
-    fclose(fpngs);
 
-    // Write all urls visited into a log file if user desires
-    if (logfile != NULL)
+    // Write png urls whose content duplicates a png in png_urls.txt
+    if (use_dedup && write_png_aliases(PNG_ALIASES_FILE) != 0)
     {
-        char *logfile_name = malloc(sizeof(char) * FILE_PATH_SIZE);
-        memset(logfile_name, 0, sizeof(char) * FILE_PATH_SIZE);
-        sprintf(logfile_name, "./%s", logfile);
-        FILE *flogs = fopen(logfile_name, "w+");
-        free(logfile_name);
-        if (flogs == NULL)
+        fprintf(stderr, "Opening png aliases file for write failed\n");
+        exit(1);
+    }
+
+    free(logfile);
+    /* ----------------- */
+
+#ifdef WITH_LOCK_STATS
+    /* -- Print how contended the crawl locks were -- */
+    print_lock_stats(&frontier_mutex_stats);
+    print_lock_stats(&visited_mutex_stats);
+    print_lock_stats(&pngs_mutex_stats);
+    print_lock_samples();
+    if (write_lock_samples(LOCK_SAMPLES_FILE) != 0)
+    {
+        fprintf(stderr, "Opening lock samples file for write failed\n");
+        exit(1);
+    }
+    /* ----------------- */
+#endif
+
+    /* -- Cleanup global variables and synchronization variables -- */
+    cleanup_global();
+    /* ----------------- */
+
+    /* -- Write the per-thread timelines -- */
+    if (trace_file != NULL)
+    {
+        size_t num_written, num_dropped;
+        if (trace_write(trace_file, &num_written, &num_dropped) != 0)
         {
-            fprintf(stderr, "Opening log file for write failed\n");
+            fprintf(stderr, "Opening trace file for write failed\n");
             exit(1);
         }
-        temp = NULL;
-        for (size_t i = 0; i < visited->cur_size; ++i)
+        printf("trace: %zu spans written to %s (%zu older spans overwritten)\n", num_written, trace_file, num_dropped);
+        trace_cleanup();
+    }
+    /* ----------------- */
+
+    /* -- Print where the time went on the network -- */
+    if (latency_file != NULL)
+    {
+        latency_print();
+        if (latency_write_summary(latency_file) != 0)
         {
-            fprintf(flogs, "%s\n", visited->elements[i]);
-            free(temp);
+            fprintf(stderr, "Opening latency summary file for write failed\n");
+            exit(1);
         }
-        fclose(flogs);
+        latency_cleanup();
     }
-    free(logfile);
     /* ----------------- */
 
-    /* -- Cleanup global variables and synchronization variables -- */
-    cleanup_global();
+    /* -- Print what was recorded or replayed -- */
+    if (record_file != NULL || replay_file != NULL)
+    {
+        CORPUS_STATS corpus_stats;
+        corpus_get_stats(&corpus_stats);
+        if (record_file != NULL)
+        {
+            printf("corpus: %zu responses recorded to %s (%zu bytes)\n", corpus_stats.records, record_file, corpus_stats.bytes);
+        }
+        else
+        {
+            printf("corpus: %zu urls replayed from %s (%zu responses), %zu urls not in the archive\n",
+                   corpus_stats.hits, replay_file, corpus_stats.records, corpus_stats.misses);
+        }
+        corpus_cleanup();
+    }
+    /* ----------------- */
+
+    /* -- Print the recrawl's schedule and what it fetched -- */
+    if (recrawl_budget > 0)
+    {
+        RECRAWL_STATS recrawl_stats;
+        recrawl_get_stats(&recrawl_stats);
+        printf("recrawl: %zu of %zu cached urls scheduled, %.1f expected to have changed (of %.1f); %zu urls with a history, %.3g changes per crawl\n",
+               recrawl_stats.scheduled, recrawl_stats.known, recrawl_stats.expected, recrawl_stats.expected_all,
+               recrawl_stats.rated, recrawl_stats.mean_rate);
+        printf("recrawl: %zu of %zu fetches made, %zu links not followed\n",
+               recrawl_stats.fetched, recrawl_stats.budget, recrawl_stats.skipped);
+    }
+    /* ----------------- */
+
+    /* -- Print how many fetches the cache saved -- */
+    if (cache_file != NULL)
+    {
+        HTTP_CACHE_STATS cache_stats;
+        http_cache_get_stats(&cache_stats);
+        printf("cache: crawl %u; %zu urls loaded from %s; %zu conditional fetches, %zu not modified (not downloaded)\n",
+               http_cache_crawl(), cache_stats.loaded, cache_file, cache_stats.conditional, cache_stats.hits);
+        printf("cache: %zu new urls, %zu changed and %zu unchanged responses downloaded; %zu records written (%zu bytes in all), %zu without validators\n",
+               cache_stats.added, cache_stats.changed, cache_stats.unchanged, cache_stats.stored, cache_stats.bytes,
+               cache_stats.unvalidated);
+        http_cache_cleanup();
+    }
+    /* ----------------- */
+
+    /* -- Print how the adaptive controller sized the runners -- */
+    if (min_runners > 0)
+    {
+        printf("adaptive: %ld to %zu runners: final %d, max %d, mean %.1f over %zu windows (%zu increases, %zu decreases), peak %.1f urls/s\n",
+               min_runners, t, adaptive_stats.final_limit, adaptive_stats.max_limit, adaptive_stats.mean_limit,
+               adaptive_stats.windows, adaptive_stats.increases, adaptive_stats.decreases, adaptive_stats.max_throughput);
+    }
+    /* ----------------- */
+
+    /* -- Print how close the crawl came to its memory budget, and what it dropped -- */
+    if (mem_budget > 0)
+    {
+        BUDGET_STATS budget_stats;
+        budget_get_stats(&budget_stats);
+        printf("memory: high-water %zu of %zu bytes (frontier %zu, visited %zu, receive buffers %zu)\n",
+               budget_stats.high_water, budget_stats.budget, budget_stats.high_water_accounts[BUDGET_FRONTIER],
+               budget_stats.high_water_accounts[BUDGET_VISITED], budget_stats.high_water_accounts[BUDGET_RECV]);
+        printf("memory: %zu urls dropped (%zu page links, %zu deeper links, %zu over budget)\n",
+               budget_stats.drops[BUDGET_DROP_PAGE] + budget_stats.drops[BUDGET_DROP_DEEP] + budget_stats.drops[BUDGET_DROP_FULL],
+               budget_stats.drops[BUDGET_DROP_PAGE], budget_stats.drops[BUDGET_DROP_DEEP], budget_stats.drops[BUDGET_DROP_FULL]);
+        if (mem_policy == BUDGET_POLICY_PAUSE)
+        {
+            printf("memory: %zu urls parked, %zu pushed back, %zu still parked at the end (no room for them once the frontier drained)\n",
+                   budget_stats.drops[BUDGET_PARKED], budget_stats.unparked, budget_stats.still_parked);
+        }
+    }
+    /* ----------------- */
+
+    /* -- Print how many lookups were taken off the fetches' critical path -- */
+    if (dns_resolvers > 0 || dns_hosts != NULL)
+    {
+        printf("dns: %zu hosts, %zu looked up ahead (%zu not queued), %.1f ms in resolver threads\n",
+               dns_stats.hosts, dns_stats.prefetched, dns_stats.queue_full, dns_stats.resolver_us / 1000.);
+        printf("dns: fetches found %zu hosts resolved, waited for %zu lookups and looked up %zu themselves (%zu failed), %.1f ms waiting\n",
+               dns_stats.hits, dns_stats.waits, dns_stats.misses, dns_stats.failures, dns_stats.fetch_wait_us / 1000.);
+    }
+    /* ----------------- */
+
+    /* -- Print how many urls were fetched speculatively -- */
+    if (speculate_budget > 0)
+    {
+        SPECULATE_STATS speculate_stats;
+        speculate_get_stats(&speculate_stats);
+        printf("speculate: %zu started (%zu links already visited, not started), %zu crawled, %zu cancelled\n",
+               speculate_stats.started, speculate_stats.visited, speculate_stats.used, speculate_stats.cancelled);
+    }
+    /* ----------------- */
+
+    /* -- Print how same-host batches were fetched -- */
+    if (http2_streams > 0)
+    {
+        SPECULATE_STATS batch_stats;
+        speculate_get_stats(&batch_stats);
+        printf("http2: %zu same-host batches of %.1f urls on average\n",
+               batch_stats.batches, batch_stats.batches > 0 ? (double)batch_stats.batched / batch_stats.batches : 0.);
+        printf("http2: %zu of %zu fetches answered over HTTP/2, %zu connections opened\n",
+               batch_stats.http2, batch_stats.fetches, batch_stats.connects);
+        if (batch_stats.retries > 0)
+        {
+            printf("http2: %zu fetches failed in the HTTP/2 framing layer and were retried without multiplexing (%zu runners fell back)\n",
+                   batch_stats.retries, batch_stats.fallbacks);
+        }
+    }
+    /* ----------------- */
+
+    /* -- Print what content dedup skipped -- */
+    if (use_dedup)
+    {
+        CONTENT_STATS content_stats;
+        content_get_stats(&content_stats);
+        printf("dedup: %zu duplicate pages not parsed, %zu duplicate pngs recorded as aliases\n",
+               content_stats.duplicate_pages, content_stats.duplicate_pngs);
+        content_dedup_cleanup();
+    }
+    /* ----------------- */
+
+    /* -- Print what trap detection skipped -- */
+    if (use_traps)
+    {
+        TRAP_STATS trap_stats;
+        trap_get_stats(&trap_stats);
+        printf("traps: %zu urls skipped (path depth %zu, repeated segments %zu, query parameters %zu, query variants %zu)\n",
+               trap_stats.urls[TRAP_PATH_DEPTH] + trap_stats.urls[TRAP_SEGMENT_REPEAT] +
+                   trap_stats.urls[TRAP_QUERY_PARAMS] + trap_stats.urls[TRAP_QUERY_VARIANTS],
+               trap_stats.urls[TRAP_PATH_DEPTH], trap_stats.urls[TRAP_SEGMENT_REPEAT],
+               trap_stats.urls[TRAP_QUERY_PARAMS], trap_stats.urls[TRAP_QUERY_VARIANTS]);
+        printf("traps: %zu of %zu pages were near-duplicates and not expanded\n",
+               trap_stats.near_duplicates, trap_stats.pages);
+        trap_cleanup();
+    }
+    /* ----------------- */
+
+    /* -- Print the per-page arena high-water marks -- */
+    if (use_arena)
+    {
+        ARENA_STATS arena_stats;
+        arena_get_stats(&arena_stats);
+        printf("arena: %zu pages, high-water mean %zu bytes, max %zu bytes\n",
+               arena_stats.pages, arena_stats.pages > 0 ? arena_stats.total_bytes / arena_stats.pages : 0,
+               arena_stats.max_bytes);
+        for (int i = 0; i < ARENA_HIST_BUCKETS; ++i)
+        {
+            if (arena_stats.hist[i] > 0)
+            {
+                printf("arena: >= %zuK: %zu pages\n", i == 0 ? 0 : ((size_t)1 << i) / 2, arena_stats.hist[i]);
+            }
+        }
+    }
+    /* ----------------- */
+
+    /* -- Print how the pipeline stages kept up with each other -- */
+    if (parse_queue != NULL)
+    {
+        printf("parse queue: max depth %zu of %zu, runners blocked %zu times, parsers starved %zu times\n",
+               parse_queue->max_count, parse_queue->size, parse_queue->num_push_waits, parse_queue->num_pop_waits);
+        cleanup_pqueue(parse_queue);
+        free(parse_queue);
+        parse_queue = NULL;
+    }
     /* ----------------- */
 
     /* -- Free threads -- */
     free(runners);
+    free(parsers);
     /* ----------------- */
 
     /* -- Clean up libraries used -- */
@@ -462,5 +1973,20 @@ int main(int argc, char **argv)
     printf("findpng2 execution time: %.6lf seconds\n", times[1] - times[0]);
     /* ----------------- */
 
+    /* -- Print how the link scanner compared against libxml2 -- */
+    if (engine == EXTRACT_SCAN || engine == EXTRACT_DIFF)
+    {
+        size_t scanned, fallbacks;
+        get_extract_scan(&scanned, &fallbacks);
+        printf("extract scan: %zu pages scanned, %zu fell back to libxml2\n", scanned, fallbacks);
+    }
+    if (engine == EXTRACT_DIFF)
+    {
+        size_t diff_pages, diff_mismatches;
+        get_extract_diff(&diff_pages, &diff_mismatches);
+        printf("extract diff: %zu of %zu pages differed\n", diff_mismatches, diff_pages);
+    }
+    /* ----------------- */
+
     return 0;
 }
\ No newline at end of file
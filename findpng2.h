@@ -1,11 +1,67 @@
 #include <stdbool.h>
 #include "curl_xml.h"
 #include "hash.h"
+#include "frontier.h"
+#include "p_queue.h"
+#include "arena.h"
+#include "trap.h"
+#include "lock_stats.h"
+#include "writer.h"
+#include "shm_crawl.h"
+#include "partition.h"
+#include "adaptive.h"
+#include "budget.h"
+#include "speculate.h"
+#include "recrawl.h"
 #include <pthread.h>
+#include <getopt.h>
 
 #define URL_SIZE 512
 #define FILE_PATH_SIZE 512
 #define STACK_SIZE 1024
 #define HMAP_SIZE 1024
+#define PARSE_QUEUE_PER_PARSER 2
+#define OPT_TRACE 256 /* getopt_long value of --trace */
+#define OPT_RECORD 257
+#define OPT_REPLAY 258
+#define OPT_REPLAY_LATENCY 259
+#define OPT_FSYNC 260
+#define OPT_RECORDS 261
+#define OPT_RECORDS_FORMAT 262
+#define OPT_PEERS 263
+#define OPT_NODE 264
+#define OPT_ADAPTIVE 265
+#define OPT_MEM_BUDGET 266
+#define OPT_MEM_POLICY 267
+#define OPT_DNS_PREFETCH 268
+#define OPT_DNS_HOSTS 269
+#define OPT_SPECULATE 270
+#define OPT_HTTP2 271
+#define OPT_H2C 272
+#define OPT_CACHE 273
+#define OPT_RECRAWL 274
 
-void *runner(void *args);
\ No newline at end of file
+// a downloaded html page waiting in the parse queue
+typedef struct page
+{
+    // downloaded page
+    RECV_BUF recv_buf;
+    // effective url of the page
+    char *url;
+} PAGE;
+
+void sample_crawl(LOCK_SAMPLE *sample);
+void push_lane(const char *page_url, STACK *urls, int lane);
+void push_found_urls(const char *page_url, STACK *urls_found, STACK *imgs_found, SPECULATOR *spec);
+void push_received_urls(STACK *urls, STACK *imgs);
+bool crawl_idle();
+int num_pngs_found();
+void finish_crawl();
+int keep_first_lines(const char *path, int64_t num_lines);
+void wake_parked();
+size_t num_starved();
+void finish_url();
+void *parser(void *args);
+void *runner(void *args);
+void process_runner(SHM_CRAWL *shm, int id);
+int crawl_processes(const char *seed_url, int num_procs, const char *logfile_name);
\ No newline at end of file
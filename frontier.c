@@ -0,0 +1,206 @@
+/*
+A frontier of urls to crawl, split into lanes
+- the image lane is popped before the page lane, so images embedded on a page
+  are checked before the crawl moves on to the pages it links to
+- each lane is a STACK, so within a lane the crawl is depth-first
+- take_frontier_host takes urls on one host out of the top of the lanes (for --http2),
+  so they can be fetched together over one connection
+*/
+
+#include <strings.h>
+#include "frontier.h"
+
+/**
+ * @brief length of the scheme, host and port of a url (e.g. "http://host:8080")
+ * @param url const char*: the url
+ * @return number of characters
+ */
+static size_t origin_length(const char *url)
+{
+    const char *host = strstr(url, "://");
+    host = (host == NULL) ? url : host + 3;
+    return (host - url) + strcspn(host, "/?#");
+}
+
+/**
+ * @brief take the urls on a host out of the top of a lane
+ * @param p FRONTIER*: (pointer to) the frontier
+ * @param lane STACK*: (pointer to) the lane
+ * @param url const char*: a url on the host
+ * @param scan size_t: most urls to look at
+ * @param urls char**: array to append the urls taken to
+ * @param taken size_t: number of urls in the array
+ * @param max size_t: most urls the array holds
+ * @return number of urls in the array
+ */
+static size_t take_lane_host(FRONTIER *p, STACK *lane, const char *url, size_t scan, char **urls, size_t taken, size_t max)
+{
+    size_t length = origin_length(url);
+    size_t n = num_elements_stack(lane);
+    for (size_t i = n; i > 0 && n - i < scan && taken < max; --i)
+    {
+        const char *item = lane->items[i - 1];
+        if (origin_length(item) == length && strncasecmp(item, url, length) == 0 &&
+            remove_stack(lane, i - 1, &urls[taken]) == 0)
+        {
+            p->url_bytes -= strlen(urls[taken]) + 1;
+            ++taken;
+        }
+    }
+    return taken;
+}
+
+/**
+ * @brief initialize frontier with an initial size (capacity) per lane
+ * @param p FRONTIER*: a pointer to uninitialized memory
+ * @param frontier_size size_t: initial capacity of each lane
+ * @return 0 on success; 1 otherwise
+ */
+int init_frontier(FRONTIER *p, size_t frontier_size)
+{
+    if (p == NULL || frontier_size == 0)
+    {
+        return 1;
+    }
+
+    p->pages = malloc(sizeof(STACK));
+    memset(p->pages, 0, sizeof(STACK));
+    init_stack(p->pages, frontier_size);
+
+    p->images = malloc(sizeof(STACK));
+    memset(p->images, 0, sizeof(STACK));
+    init_stack(p->images, frontier_size);
+    p->url_bytes = 0;
+
+    return 0;
+}
+
+/**
+ * @brief check if the frontier is empty (both lanes are empty)
+ * @param p FRONTIER*: (pointer to) the frontier to check
+ * @return true if empty; false otherwise
+ */
+bool is_empty_frontier(FRONTIER *p)
+{
+    if (p == NULL)
+    {
+        return 0;
+    }
+    return is_empty_stack(p->images) && is_empty_stack(p->pages);
+}
+
+/**
+ * @brief push a url onto one lane of the frontier
+ * @param p FRONTIER*: (pointer to) the frontier the function will push url onto
+ * @param url char*: url to push
+ * @param lane int: LANE_PAGE or LANE_IMAGE
+ * @return 0 on success; 1 otherwise
+ */
+int push_frontier(FRONTIER *p, char *url, int lane)
+{
+    if (p == NULL)
+    {
+        return 1;
+    }
+
+    p->url_bytes += strlen(url) + 1;
+    if (lane == LANE_IMAGE)
+    {
+        return push_stack(p->images, url);
+    }
+    return push_stack(p->pages, url);
+}
+
+/**
+ * @brief pop the next url to crawl: the image lane first, then the page lane
+ * @param p FRONTIER*: (pointer to) the frontier the function will pop from
+ * @param p_url char**: pointer that will be populated with popped url
+ * @return 0 on success; 1 otherwise
+ * @note the caller is responsible for deallocating memory assigned to p_url
+ */
+int pop_frontier(FRONTIER *p, char **p_url)
+{
+    if ((p == NULL) || is_empty_frontier(p))
+    {
+        return 1;
+    }
+
+    int ret;
+    if (!is_empty_stack(p->images))
+    {
+        ret = pop_stack(p->images, p_url);
+    }
+    else
+    {
+        ret = pop_stack(p->pages, p_url);
+    }
+    if (ret == 0)
+    {
+        p->url_bytes -= strlen(*p_url) + 1;
+    }
+    return ret;
+}
+
+/**
+ * @brief take urls on the same host (scheme, host and port) as a url off the frontier, images first
+ * @param p FRONTIER*: (pointer to) the frontier
+ * @param url const char*: the url whose host to match
+ * @param scan size_t: most urls looked at per lane, from the top (the next to be popped)
+ * @param urls char**: array to be populated with the urls taken
+ * @param max size_t: most urls to take
+ * @return number of urls taken
+ * @note the caller is responsible for deallocating the urls taken
+ */
+size_t take_frontier_host(FRONTIER *p, const char *url, size_t scan, char **urls, size_t max)
+{
+    if (p == NULL)
+    {
+        return 0;
+    }
+    size_t taken = take_lane_host(p, p->images, url, scan, urls, 0, max);
+    return take_lane_host(p, p->pages, url, scan, urls, taken, max);
+}
+
+/**
+ * @brief returns number of urls currently in the frontier (all lanes)
+ * @param p FRONTIER*: (pointer to) the frontier
+ * @return number of urls in the frontier
+ */
+size_t num_elements_frontier(FRONTIER *p)
+{
+    return num_elements_stack(p->images) + num_elements_stack(p->pages);
+}
+
+/**
+ * @brief returns the bytes the frontier holds: its urls, and the slots allocated in its lanes
+ * @param p FRONTIER*: (pointer to) the frontier
+ * @return bytes held by the frontier
+ * @note lanes never shrink, so the slots stay at their high-water mark
+ */
+size_t frontier_bytes(FRONTIER *p)
+{
+    return p->url_bytes + (p->images->size + p->pages->size) * sizeof(char *);
+}
+
+/**
+ * @brief deconstruct frontier: free all allocated memory
+ * @param p FRONTIER*: (pointer to) the frontier to deconstruct
+ * @return 0 on success; 1 otherwise
+ */
+int cleanup_frontier(FRONTIER *p)
+{
+    if (p == NULL)
+    {
+        return 0;
+    }
+
+    cleanup_stack(p->pages);
+    free(p->pages);
+    p->pages = NULL;
+
+    cleanup_stack(p->images);
+    free(p->images);
+    p->images = NULL;
+
+    return 0;
+}
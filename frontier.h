@@ -0,0 +1,35 @@
+/*
+A frontier of urls to crawl, split into lanes
+*/
+
+#ifndef FRONTIER_H
+#define FRONTIER_H
+
+#include "stack.h"
+
+typedef struct frontier
+{
+    // urls linked from pages (<a href>, <area href>)
+    STACK *pages;
+    // urls of images embedded in pages (<img>, <source srcset>, <link rel=icon>);
+    //  this is the fast lane: it is always drained before pages
+    STACK *images;
+    // bytes of the urls held by both lanes
+    size_t url_bytes;
+} FRONTIER;
+
+#define LANE_PAGE 0
+#define LANE_IMAGE 1
+
+#define FRONTIER_HOST_SCAN 256  /* most urls per lane take_frontier_host looks at */
+
+int init_frontier(FRONTIER *p, size_t frontier_size);
+bool is_empty_frontier(FRONTIER *p);
+int push_frontier(FRONTIER *p, char *url, int lane);
+int pop_frontier(FRONTIER *p, char **p_url);
+size_t take_frontier_host(FRONTIER *p, const char *url, size_t scan, char **urls, size_t max);
+size_t num_elements_frontier(FRONTIER *p);
+size_t frontier_bytes(FRONTIER *p);
+int cleanup_frontier(FRONTIER *p);
+
+#endif
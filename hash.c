@@ -31,6 +31,7 @@ int init_hset(HSET *p, size_t set_size)
 
     p->cur_size = 0;
     p->size = set_size;
+    p->key_bytes = 0;
 
     // stack of pointers to strings used as arguments when searching for a string in hsearch;
     //   kept so we can deallocate them at cleanup
@@ -82,6 +83,7 @@ int add_hset(HSET *p, char *key)
     memset(item.key, 0, strlen(key) * (sizeof(char) + 1));
     strncpy(item.key, key, strlen(key));
     item.data = NULL;
+    p->key_bytes += strlen(key) * (sizeof(char) + 1);
     ACTION action = ENTER;
     ENTRY *retval = NULL;
     if (hsearch_r(item, action, &retval, p->hmap) == 0)
@@ -125,6 +127,7 @@ int search_hset(HSET *p, char *key)
         //  we don't want to deallocate now, as hsearch may continue to refer
         //  to the string's memory
         push_pstack(p->ps, item.key);
+        p->key_bytes += strlen(key) * (sizeof(char) + 1);
         return 1;
     }
 
@@ -166,6 +169,7 @@ int resize_hset(HSET *p)
     for (size_t i = 0; i < old_size; ++i)
     {
         add_hset(p, old_elements[i]);
+        p->key_bytes -= strlen(old_elements[i]) * (sizeof(char) + 1);
         free(old_elements[i]);
         old_elements[i] = NULL;
     }
@@ -181,6 +185,18 @@ int resize_hset(HSET *p)
     return 0;
 }
 
+/**
+ * @brief returns the bytes the hash set holds: its key copies, its array of keys,
+ *  hsearch's table and the pointer stack
+ * @param p HSET*: (pointer to) the hash set
+ * @return bytes held by the hash set
+ * @note hsearch's table is counted as one entry (a flag and an ENTRY) per slot
+ */
+size_t hset_bytes(HSET *p)
+{
+    return p->key_bytes + p->size * (sizeof(char *) + HSET_TABLE_ENTRY_SIZE) + p->ps->size * sizeof(char *);
+}
+
 /**
  * @brief deconstruct hash set: free all allocated memory
  * @param p HSET*: (pointer to) the hash set to deconstruct
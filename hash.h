@@ -26,9 +26,12 @@ typedef struct hashmap
     // stack of pointers to strings used for searching in hsearch;
     //  so we can deallocate them at cleanup
     PSTACK *ps;
+    // bytes of the key copies held (in elements and ps)
+    size_t key_bytes;
 } HSET;
 
 #define HSET_RESIZE_FACTOR 2
+#define HSET_TABLE_ENTRY_SIZE (sizeof(unsigned int) + sizeof(ENTRY)) /* bytes per slot of hsearch's table (ignoring padding) */
 
 int init_hset(HSET *p, size_t set_size);
 bool is_full_hset(HSET *p);
@@ -36,4 +39,5 @@ bool is_empty_hset(HSET *p);
 int add_hset(HSET *p, char *key);
 int search_hset(HSET *p, char *key);
 int resize_hset(HSET *p);
+size_t hset_bytes(HSET *p);
 int cleanup_hset(HSET *p);
\ No newline at end of file
@@ -0,0 +1,614 @@
+/*
+Conditional-GET cache (--cache)
+- the cache file holds one record per 200 response: canonical url, ETag, Last-Modified,
+  content type code, a hash of the body and, for html pages, the links extracted from the
+  page (not the page itself)
+- each record also keeps the url's history: the crawls (numbered in the file's header) it
+  was first and last fetched in, how many crawls fetched it and how many of those found it
+  changed (a 200 whose body hash differs from the cached one); a 304, or a 200 with the
+  same body and validators, only updates last_crawl and checks in place
+- at start the file is mapped read-only and indexed by url once; a later record of the
+  same url replaces an earlier one
+- a fetch of a cached url with validators sends If-None-Match and If-Modified-Since; a 304 answer is a hit:
+  the cached content type stands in for the response, and the cached links of a page are
+  pushed instead of downloading and parsing it
+- new and changed responses are appended while crawling: each thread reserves its
+  record's place with an atomic add and writes it with one pwrite, as the corpus archive
+  does; unchanged responses are not written again (a url is fetched once per crawl, so
+  no two threads update the same record)
+- the file only grows (a page that changes every crawl adds a record every crawl); delete
+  it to start over. It is in the byte order of the machine that wrote it; a record cut
+  short (e.g. by a crash) ends the file, and the next crawl writes over it
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "http_cache.h"
+#include "content_hash.h"
+
+// file appended to (-1 if the cache is off); only accessed atomically once open
+static int cache_fd = -1;
+static uint64_t cache_end = 0;
+// whether a write to the file failed (reported once)
+static bool write_failed = false;
+// mapped file as it was at start (NULL if it had no records)
+static const char *map = NULL;
+static size_t map_size = 0;
+// open addressing table of records by url; read-only once built
+static HTTP_CACHE_SLOT *slots = NULL;
+static size_t slots_size = 0;
+static size_t slots_used = 0;
+static HTTP_CACHE_STATS stats;
+// number of the current crawl
+static uint32_t crawl = 0;
+
+/**
+ * @brief canonical form of a url: scheme and host in lower case, without the default port or the fragment
+ * @param url const char*: the url
+ * @return the canonical url (the caller frees it); NULL if out of memory
+ */
+static char *canonical_url(const char *url)
+{
+    size_t len = strcspn(url, "#");
+    char *c = malloc(len + 1);
+    if (c == NULL)
+    {
+        return NULL;
+    }
+    memcpy(c, url, len);
+    c[len] = '\0';
+
+    char *host = strstr(c, "://");
+    host = (host == NULL) ? c : host + 3;
+    char *host_end = host + strcspn(host, "/?");
+    for (char *p = c; p < host_end; ++p)
+    {
+        *p = tolower((unsigned char)*p);
+    }
+    const char *default_port = strncmp(c, "http://", 7) == 0 ? ":80" : (strncmp(c, "https://", 8) == 0 ? ":443" : NULL);
+    if (default_port != NULL && (size_t)(host_end - host) > strlen(default_port) &&
+        strncmp(host_end - strlen(default_port), default_port, strlen(default_port)) == 0)
+    {
+        memmove(host_end - strlen(default_port), host_end, strlen(host_end) + 1);
+    }
+    return c;
+}
+
+/**
+ * @brief url of a record
+ * @param record const HTTP_CACHE_RECORD*: record in the mapped file
+ * @return the url
+ */
+static const char *record_url(const HTTP_CACHE_RECORD *record)
+{
+    return (const char *)(record + 1);
+}
+
+/**
+ * @brief add a record to the index; a later record of the same url replaces an earlier one
+ * @param record const HTTP_CACHE_RECORD*: record in the mapped file
+ * @return 0 on success; 1 otherwise
+ */
+static int index_record(const HTTP_CACHE_RECORD *record)
+{
+    // keep the table at most half full
+    if (2 * (slots_used + 1) > slots_size)
+    {
+        size_t new_size = slots_size == 0 ? 1024 : 2 * slots_size;
+        HTTP_CACHE_SLOT *new_slots = calloc(new_size, sizeof(HTTP_CACHE_SLOT));
+        if (new_slots == NULL)
+        {
+            return 1;
+        }
+        for (size_t i = 0; i < slots_size; ++i)
+        {
+            if (slots[i].record == NULL)
+            {
+                continue;
+            }
+            size_t j = slots[i].hash & (new_size - 1);
+            while (new_slots[j].record != NULL)
+            {
+                j = (j + 1) & (new_size - 1);
+            }
+            new_slots[j] = slots[i];
+        }
+        free(slots);
+        slots = new_slots;
+        slots_size = new_size;
+    }
+
+    const char *url = record_url(record);
+    uint64_t hash = xxh64(url, record->url_len, 0);
+    size_t i = hash & (slots_size - 1);
+    while (slots[i].record != NULL)
+    {
+        if (slots[i].hash == hash && strcmp(record_url(slots[i].record), url) == 0)
+        {
+            slots[i].record = record;
+            return 0;
+        }
+        i = (i + 1) & (slots_size - 1);
+    }
+    slots[i].hash = hash;
+    slots[i].record = record;
+    ++slots_used;
+    return 0;
+}
+
+/**
+ * @brief look up the record of a url
+ * @param url const char*: canonical url
+ * @return the record; NULL if the url is not cached
+ */
+static const HTTP_CACHE_RECORD *find_record(const char *url)
+{
+    uint64_t hash = xxh64(url, strlen(url), 0);
+    for (size_t i = hash & (slots_size - 1); slots_size > 0 && slots[i].record != NULL; i = (i + 1) & (slots_size - 1))
+    {
+        if (slots[i].hash == hash && strcmp(record_url(slots[i].record), url) == 0)
+        {
+            return slots[i].record;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief report a failed write to the cache file (once)
+ * @param written ssize_t: what pwrite returned
+ */
+static void report_write_failed(ssize_t written)
+{
+    if (!__atomic_exchange_n(&write_failed, true, __ATOMIC_RELAXED))
+    {
+        fprintf(stderr, "http_cache: writing a record failed: %s\n", written < 0 ? strerror(errno) : "short write");
+    }
+}
+
+/**
+ * @brief note in a record that this crawl found its url unchanged: update last_crawl and checks in the file
+ * @param record const HTTP_CACHE_RECORD*: record in the mapped file
+ */
+static void touch_record(const HTTP_CACHE_RECORD *record)
+{
+    // last_crawl and checks are next to each other: one pwrite
+    uint32_t seen[2] = {crawl, record->checks + 1};
+    off_t offset = ((const char *)record - map) + offsetof(HTTP_CACHE_RECORD, last_crawl);
+    ssize_t written = pwrite(cache_fd, seen, sizeof(seen), offset);
+    if (written != sizeof(seen))
+    {
+        report_write_failed(written);
+    }
+}
+
+/**
+ * @brief open the cache file (created if missing), load its records and append to it from now on
+ * @param path const char*: path of the cache file
+ * @return 0 on success; 1 otherwise
+ */
+int http_cache_open(const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return 1;
+    }
+
+    // a new (or empty) file gets the header
+    HTTP_CACHE_HEADER header;
+    memcpy(header.magic, HTTP_CACHE_MAGIC, HTTP_CACHE_MAGIC_LEN);
+    header.crawls = 0;
+    size_t end = sizeof(HTTP_CACHE_HEADER);
+    if (st.st_size == 0)
+    {
+        if (write(fd, &header, sizeof(HTTP_CACHE_HEADER)) != sizeof(HTTP_CACHE_HEADER))
+        {
+            close(fd);
+            return 1;
+        }
+    }
+    else
+    {
+        void *p = st.st_size >= (off_t)sizeof(HTTP_CACHE_HEADER) ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            return 1;
+        }
+        map = p;
+        map_size = st.st_size;
+        if (memcmp(map, HTTP_CACHE_MAGIC, HTTP_CACHE_MAGIC_LEN) != 0)
+        {
+            close(fd);
+            http_cache_cleanup();
+            return 1;
+        }
+        header.crawls = ((const HTTP_CACHE_HEADER *)map)->crawls;
+        while (end + sizeof(HTTP_CACHE_RECORD) <= map_size)
+        {
+            const HTTP_CACHE_RECORD *record = (const HTTP_CACHE_RECORD *)(map + end);
+            uint64_t len = sizeof(HTTP_CACHE_RECORD) + (uint64_t)record->url_len + record->etag_len +
+                           record->last_modified_len + 3;
+            // a record that was cut short or never written ends the file
+            if (record->size < len || record->links_len > record->size - len ||
+                record->size % HTTP_CACHE_ALIGN != 0 || record->size > map_size - end)
+            {
+                break;
+            }
+            if (index_record(record) != 0)
+            {
+                close(fd);
+                http_cache_cleanup();
+                return 1;
+            }
+            end += record->size;
+        }
+        stats.loaded = slots_used;
+        // new records go over whatever follows the last whole record
+        if (end < map_size && ftruncate(fd, end) != 0)
+        {
+            close(fd);
+            http_cache_cleanup();
+            return 1;
+        }
+    }
+
+    // this crawl is the next one
+    crawl = header.crawls + 1;
+    header.crawls = crawl;
+    if (pwrite(fd, &header.crawls, sizeof(header.crawls), offsetof(HTTP_CACHE_HEADER, crawls)) != sizeof(header.crawls))
+    {
+        close(fd);
+        http_cache_cleanup();
+        return 1;
+    }
+
+    cache_end = end;
+    cache_fd = fd;
+    return 0;
+}
+
+/**
+ * @brief check if the cache is on
+ * @return true if http_cache_open succeeded
+ */
+bool http_cache_enabled()
+{
+    return cache_fd >= 0;
+}
+
+/**
+ * @brief prepare a fetch: send the validators of the url's cached response with it, if it has one
+ * @param curl_handle CURL*: (pointer to) the handle that will fetch the url
+ * @param url const char*: the url
+ * @return the fetch's cache state (free with http_cache_fetch_free); NULL if the cache is off
+ * @note the request headers stay valid until the state is freed, which must be after the transfer
+ */
+HTTP_CACHE_FETCH *http_cache_begin(CURL *curl_handle, const char *url)
+{
+    if (cache_fd < 0)
+    {
+        return NULL;
+    }
+    HTTP_CACHE_FETCH *f = calloc(1, sizeof(HTTP_CACHE_FETCH));
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    f->url = canonical_url(url);
+    if (f->url == NULL)
+    {
+        free(f);
+        return NULL;
+    }
+
+    f->cached = find_record(f->url);
+    if (f->cached != NULL)
+    {
+        const char *etag = record_url(f->cached) + f->cached->url_len + 1;
+        const char *last_modified = etag + f->cached->etag_len + 1;
+        char header[HTTP_CACHE_VALIDATOR_SIZE + 32];
+        if (f->cached->etag_len > 0)
+        {
+            snprintf(header, sizeof(header), "If-None-Match: %s", etag);
+            f->request_headers = curl_slist_append(f->request_headers, header);
+        }
+        if (f->cached->last_modified_len > 0)
+        {
+            snprintf(header, sizeof(header), "If-Modified-Since: %s", last_modified);
+            f->request_headers = curl_slist_append(f->request_headers, header);
+        }
+        if (f->request_headers != NULL)
+        {
+            __atomic_add_fetch(&stats.conditional, 1, __ATOMIC_RELAXED);
+        }
+    }
+    // (set even if NULL, so the handle drops the headers of its previous fetch)
+    curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, f->request_headers);
+    return f;
+}
+
+/**
+ * @brief note the response to a fetch: whether it is a hit, or else its validators
+ * @param f HTTP_CACHE_FETCH*: the fetch's cache state (may be NULL)
+ * @param curl_handle CURL*: (pointer to) the handle that made the fetch
+ * @param response_code long: response code of the fetch
+ */
+void http_cache_response(HTTP_CACHE_FETCH *f, CURL *curl_handle, long response_code)
+{
+    if (f == NULL)
+    {
+        return;
+    }
+    if (response_code == NOT_MODIFIED && f->cached != NULL)
+    {
+        f->hit = true;
+        __atomic_add_fetch(&stats.hits, 1, __ATOMIC_RELAXED);
+        touch_record(f->cached);
+        return;
+    }
+    if (response_code != 200)
+    {
+        return;
+    }
+    f->ok = true;
+
+    // the headers of the last response, after any redirects
+    struct curl_header *h;
+    if (curl_easy_header(curl_handle, "ETag", 0, CURLH_HEADER, -1, &h) == CURLHE_OK &&
+        strlen(h->value) < HTTP_CACHE_VALIDATOR_SIZE)
+    {
+        strcpy(f->etag, h->value);
+    }
+    if (curl_easy_header(curl_handle, "Last-Modified", 0, CURLH_HEADER, -1, &h) == CURLHE_OK &&
+        strlen(h->value) < HTTP_CACHE_VALIDATOR_SIZE)
+    {
+        strcpy(f->last_modified, h->value);
+    }
+}
+
+/**
+ * @brief check if a fetch is a hit, and if so classify it as its cached response was
+ * @param f HTTP_CACHE_FETCH*: the fetch's cache state (may be NULL)
+ * @param content_type int*: (pointer to) int to be set with the cached content type code
+ * @return true if the fetch is a hit
+ */
+bool http_cache_hit(HTTP_CACHE_FETCH *f, int *content_type)
+{
+    if (f == NULL || !f->hit)
+    {
+        return false;
+    }
+    *content_type = f->cached->content_type;
+    return true;
+}
+
+/**
+ * @brief push the cached links of a page onto the stacks, if its fetch is a hit
+ * @param f HTTP_CACHE_FETCH*: the fetch's cache state (may be NULL)
+ * @param stack STACK*: (pointer to) stack to push the page links onto
+ * @param img_stack STACK*: (pointer to) stack to push the image links onto
+ * @return true if the fetch is a hit (and the links were pushed); false if the page must be parsed
+ */
+bool http_cache_push_links(HTTP_CACHE_FETCH *f, STACK *stack, STACK *img_stack)
+{
+    if (f == NULL || !f->hit)
+    {
+        return false;
+    }
+    const HTTP_CACHE_RECORD *r = f->cached;
+    char *link = (char *)record_url(r) + r->url_len + r->etag_len + r->last_modified_len + 3;
+    for (uint32_t i = 0; i < r->num_links + r->num_imgs; ++i)
+    {
+        push_stack(i < r->num_links ? stack : img_stack, link);
+        link += strlen(link) + 1;
+    }
+    return true;
+}
+
+/**
+ * @brief append a response and its links to the cache file, unless it is unchanged
+ * @param f HTTP_CACHE_FETCH*: the fetch's cache state (may be NULL)
+ * @param content_type int: content type code of the response
+ * @param content_hash uint64_t: hash of the response body
+ * @param stack STACK*: (pointer to) stack holding the page's links above stack_start (NULL if none)
+ * @param stack_start size_t: number of items in stack before the page was parsed
+ * @param img_stack STACK*: (pointer to) stack holding the page's images above img_start (NULL if none)
+ * @param img_start size_t: number of items in img_stack before the page was parsed
+ * @note only 200 responses are written (hits are not written again); a response with the
+ *  cached body and validators only updates the cached record's history
+ */
+void http_cache_store(HTTP_CACHE_FETCH *f, int content_type, uint64_t content_hash, STACK *stack, size_t stack_start,
+                      STACK *img_stack, size_t img_start)
+{
+    if (f == NULL || !f->ok)
+    {
+        return;
+    }
+
+    // carry the url's history over to the new record
+    const HTTP_CACHE_RECORD *c = f->cached;
+    bool changed = c != NULL && c->content_hash != content_hash;
+    if (c == NULL)
+    {
+        __atomic_add_fetch(&stats.added, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_add_fetch(changed ? &stats.changed : &stats.unchanged, 1, __ATOMIC_RELAXED);
+        const char *etag = record_url(c) + c->url_len + 1;
+        const char *last_modified = etag + c->etag_len + 1;
+        if (!changed && strcmp(etag, f->etag) == 0 && strcmp(last_modified, f->last_modified) == 0)
+        {
+            touch_record(c);
+            return;
+        }
+    }
+
+    HTTP_CACHE_RECORD record;
+    memset(&record, 0, sizeof(HTTP_CACHE_RECORD));
+    record.content_type = content_type;
+    record.content_hash = content_hash;
+    record.first_crawl = c != NULL ? c->first_crawl : crawl;
+    record.last_crawl = crawl;
+    record.checks = c != NULL ? c->checks + 1 : 1;
+    record.changes = c != NULL ? c->changes + changed : 0;
+    record.url_len = strlen(f->url);
+    record.etag_len = strlen(f->etag);
+    record.last_modified_len = strlen(f->last_modified);
+    size_t num_links = stack != NULL ? num_elements_stack(stack) : 0;
+    size_t num_imgs = img_stack != NULL ? num_elements_stack(img_stack) : 0;
+    for (size_t i = stack_start; i < num_links; ++i)
+    {
+        record.links_len += strlen(stack->items[i]) + 1;
+    }
+    for (size_t i = img_start; i < num_imgs; ++i)
+    {
+        record.links_len += strlen(img_stack->items[i]) + 1;
+    }
+    record.num_links = num_links > stack_start ? num_links - stack_start : 0;
+    record.num_imgs = num_imgs > img_start ? num_imgs - img_start : 0;
+    size_t len = sizeof(HTTP_CACHE_RECORD) + record.url_len + record.etag_len + record.last_modified_len + 3 +
+                 record.links_len;
+    record.size = (len + HTTP_CACHE_ALIGN - 1) / HTTP_CACHE_ALIGN * HTTP_CACHE_ALIGN;
+
+    // the record is written with one pwrite, so build it in one (zeroed, for the padding) buffer
+    char *buf = calloc(1, record.size);
+    if (buf == NULL)
+    {
+        return;
+    }
+    memcpy(buf, &record, sizeof(HTTP_CACHE_RECORD));
+    char *p = buf + sizeof(HTTP_CACHE_RECORD);
+    p = stpcpy(p, f->url) + 1;
+    p = stpcpy(p, f->etag) + 1;
+    p = stpcpy(p, f->last_modified) + 1;
+    for (size_t i = stack_start; i < num_links; ++i)
+    {
+        p = stpcpy(p, stack->items[i]) + 1;
+    }
+    for (size_t i = img_start; i < num_imgs; ++i)
+    {
+        p = stpcpy(p, img_stack->items[i]) + 1;
+    }
+
+    off_t offset = __atomic_fetch_add(&cache_end, record.size, __ATOMIC_RELAXED);
+    ssize_t written = pwrite(cache_fd, buf, record.size, offset);
+    free(buf);
+    if (written != (ssize_t)record.size)
+    {
+        // the gap left by the failed write ends the file when it is loaded
+        report_write_failed(written);
+        return;
+    }
+    __atomic_add_fetch(&stats.stored, 1, __ATOMIC_RELAXED);
+    if (f->etag[0] == '\0' && f->last_modified[0] == '\0')
+    {
+        __atomic_add_fetch(&stats.unvalidated, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief number of the current crawl (the file's first crawl is 1)
+ * @return the crawl number; 0 if the cache is off
+ */
+uint32_t http_cache_crawl()
+{
+    return crawl;
+}
+
+/**
+ * @brief number of slots of the index, for walking the records loaded at start
+ * @return the number of slots
+ */
+size_t http_cache_num_slots()
+{
+    return slots_size;
+}
+
+/**
+ * @brief record in a slot of the index
+ * @param i size_t: slot (less than http_cache_num_slots())
+ * @return the latest record of a url loaded at start; NULL if the slot is empty
+ */
+const HTTP_CACHE_RECORD *http_cache_slot(size_t i)
+{
+    return slots[i].record;
+}
+
+/**
+ * @brief url of a record
+ * @param record const HTTP_CACHE_RECORD*: record loaded at start
+ * @return the (canonical) url
+ */
+const char *http_cache_record_url(const HTTP_CACHE_RECORD *record)
+{
+    return record_url(record);
+}
+
+/**
+ * @brief free a fetch's cache state
+ * @param f HTTP_CACHE_FETCH*: the state (may be NULL)
+ */
+void http_cache_fetch_free(HTTP_CACHE_FETCH *f)
+{
+    if (f == NULL)
+    {
+        return;
+    }
+    curl_slist_free_all(f->request_headers);
+    free(f->url);
+    free(f);
+}
+
+/**
+ * @brief get the numbers of conditional fetches, hits, changed responses and records written
+ * @param out HTTP_CACHE_STATS*: populated with the statistics
+ */
+void http_cache_get_stats(HTTP_CACHE_STATS *out)
+{
+    out->loaded = stats.loaded;
+    out->conditional = __atomic_load_n(&stats.conditional, __ATOMIC_RELAXED);
+    out->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+    out->changed = __atomic_load_n(&stats.changed, __ATOMIC_RELAXED);
+    out->unchanged = __atomic_load_n(&stats.unchanged, __ATOMIC_RELAXED);
+    out->added = __atomic_load_n(&stats.added, __ATOMIC_RELAXED);
+    out->stored = __atomic_load_n(&stats.stored, __ATOMIC_RELAXED);
+    out->unvalidated = __atomic_load_n(&stats.unvalidated, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&cache_end, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief close the cache file and free the index
+ * @note only call once the fetching threads have exited
+ */
+void http_cache_cleanup()
+{
+    if (cache_fd >= 0)
+    {
+        close(cache_fd);
+        cache_fd = -1;
+    }
+    if (map != NULL)
+    {
+        munmap((void *)map, map_size);
+        map = NULL;
+        map_size = 0;
+    }
+    free(slots);
+    slots = NULL;
+    slots_size = 0;
+    slots_used = 0;
+    crawl = 0;
+}
@@ -0,0 +1,119 @@
+/*
+Conditional-GET cache: validators, out-links and change history of fetched responses in an
+append-only file, so a recrawl asks servers whether pages changed and reuses the links of those that didn't
+*/
+
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <curl/curl.h>
+#include "stack.h"
+
+#define HTTP_CACHE_MAGIC "FPNGHC02" /* first 8 bytes of every cache file */
+#define HTTP_CACHE_MAGIC_LEN 8
+#define HTTP_CACHE_ALIGN 8 /* records start at multiples of this */
+#define HTTP_CACHE_VALIDATOR_SIZE 256 /* longest ETag or Last-Modified value kept */
+#define NOT_MODIFIED 304
+
+// start of the cache file
+typedef struct http_cache_header
+{
+    char magic[HTTP_CACHE_MAGIC_LEN];
+    // crawls that opened the file (the current one included); a crawl's number is its time stamp
+    uint64_t crawls;
+} HTTP_CACHE_HEADER;
+
+// one cached response; followed in the file by its url, ETag and Last-Modified (each 0 terminated),
+//  then its page links and image links (each 0 terminated), padded to HTTP_CACHE_ALIGN
+typedef struct http_cache_record
+{
+    // bytes of the whole record, padding included
+    uint64_t size;
+    // content type code of the response (HTML, VALID_PNG, ...)
+    int32_t content_type;
+    // bytes of the strings following the record (without their terminating 0s)
+    uint32_t url_len;
+    uint32_t etag_len;
+    uint32_t last_modified_len;
+    // number of page links and image links, and bytes of all of them (with their terminating 0s)
+    uint32_t num_links;
+    uint32_t num_imgs;
+    uint64_t links_len;
+    // hash of the response body, telling a changed response from an unchanged one
+    uint64_t content_hash;
+    // crawls the url was first and last fetched in, how many crawls fetched it, and in how many
+    //  of those (after the first) it had changed; last_crawl and checks are updated in place
+    uint32_t first_crawl;
+    uint32_t last_crawl;
+    uint32_t checks;
+    uint32_t changes;
+} HTTP_CACHE_RECORD;
+
+// slot of the index
+typedef struct http_cache_slot
+{
+    // hash of the record's url
+    uint64_t hash;
+    // NULL if the slot is empty
+    const HTTP_CACHE_RECORD *record;
+} HTTP_CACHE_SLOT;
+
+// a fetch made with the cache on; lives in the fetch's receive buffer
+typedef struct http_cache_fetch
+{
+    // canonical url (the cache key)
+    char *url;
+    // record of the url from the last crawl (NULL if none); points into the mapped file
+    const HTTP_CACHE_RECORD *cached;
+    // conditional request headers sent with the fetch
+    struct curl_slist *request_headers;
+    // whether the server answered 304 and the cached record stands in for the response
+    bool hit;
+    // whether the response was a 200 (only those are cached)
+    bool ok;
+    // validators of the response (empty if it had none)
+    char etag[HTTP_CACHE_VALIDATOR_SIZE];
+    char last_modified[HTTP_CACHE_VALIDATOR_SIZE];
+} HTTP_CACHE_FETCH;
+
+typedef struct http_cache_stats
+{
+    // urls with a record in the file when it was opened
+    size_t loaded;
+    // fetches sent with validators, and those answered 304 from the cache
+    size_t conditional;
+    size_t hits;
+    // 200 responses of cached urls whose body had changed, and those whose body had not
+    size_t changed;
+    size_t unchanged;
+    // responses of urls not cached before
+    size_t added;
+    // records written to the file, and responses among them without validators (never answered 304)
+    size_t stored;
+    size_t unvalidated;
+    // bytes of the file
+    size_t bytes;
+} HTTP_CACHE_STATS;
+
+int http_cache_open(const char *path);
+bool http_cache_enabled();
+HTTP_CACHE_FETCH *http_cache_begin(CURL *curl_handle, const char *url);
+void http_cache_response(HTTP_CACHE_FETCH *f, CURL *curl_handle, long response_code);
+bool http_cache_hit(HTTP_CACHE_FETCH *f, int *content_type);
+bool http_cache_push_links(HTTP_CACHE_FETCH *f, STACK *stack, STACK *img_stack);
+void http_cache_store(HTTP_CACHE_FETCH *f, int content_type, uint64_t content_hash, STACK *stack, size_t stack_start,
+                      STACK *img_stack, size_t img_start);
+uint32_t http_cache_crawl();
+size_t http_cache_num_slots();
+const HTTP_CACHE_RECORD *http_cache_slot(size_t i);
+const char *http_cache_record_url(const HTTP_CACHE_RECORD *record);
+void http_cache_fetch_free(HTTP_CACHE_FETCH *f);
+void http_cache_get_stats(HTTP_CACHE_STATS *stats);
+void http_cache_cleanup();
+
+#endif
@@ -0,0 +1,679 @@
+/*
+Per-phase network latency histograms built from libcurl's transfer timings
+- after every fetch, latency_record reads the CURLINFO_*_TIME_T timings (or a replayed
+  fetch passes its recorded timings to latency_record_timings) and splits
+  them into dns, connect, tls, time-to-first-byte and total time, plus bytes
+- values go into log-linear histograms (like HdrHistogram): exact below 16, then
+  16 buckets per power of two, so percentiles are within ~6% at any scale
+- each thread records into its own histograms, so recording takes no lock and
+  shares no cache lines; the threads' histograms are only merged after the crawl
+- besides the overall histograms, fetches are broken down by content type and by host
+*/
+
+#include <pthread.h>
+#include "latency.h"
+#include "curl_xml.h"
+#include "content_hash.h"
+
+// whether latency_enable was called
+static bool enabled = false;
+// the calling thread's histograms (NULL until it records its first fetch)
+static __thread LAT_THREAD *thread_lat = NULL;
+// histograms of every thread that recorded fetches
+static LAT_THREAD *threads = NULL;
+// lock for the list of threads (only taken the first time a thread records)
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+// the threads' histograms merged (built on first use after the crawl)
+static LAT_THREAD *merged = NULL;
+
+static const char *metric_names[NUM_LAT_METRICS] = {"dns", "connect", "tls", "ttfb", "total", "bytes"};
+static const char *type_names[NUM_LAT_TYPES] = {"html", "png", "invalid_png", "duplicate_png", "other"};
+
+/**
+ * @brief bucket a value falls in
+ * @param value uint64_t: value to bucket
+ * @return index of the bucket
+ */
+static size_t bucket_of(uint64_t value)
+{
+    if (value < LAT_SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    int magnitude = 63 - __builtin_clzll(value);
+    if (magnitude > LAT_MAX_MAGNITUDE)
+    {
+        return LAT_BUCKETS - 1;
+    }
+    // the LAT_SUB_BITS bits after the leading one pick the sub-bucket
+    uint64_t sub = (value >> (magnitude - LAT_SUB_BITS)) - LAT_SUB_BUCKETS;
+    return (magnitude - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS + sub;
+}
+
+/**
+ * @brief largest value that falls in a bucket
+ * @param bucket size_t: index of the bucket
+ * @return largest value in the bucket
+ */
+static uint64_t bucket_high(size_t bucket)
+{
+    if (bucket < LAT_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    int magnitude = bucket / LAT_SUB_BUCKETS + LAT_SUB_BITS - 1;
+    uint64_t sub = bucket % LAT_SUB_BUCKETS + LAT_SUB_BUCKETS;
+    return ((sub + 1) << (magnitude - LAT_SUB_BITS)) - 1;
+}
+
+/**
+ * @brief record a value in a histogram
+ * @param h LAT_HIST*: (pointer to) the histogram
+ * @param value uint64_t: value to record
+ */
+void lat_hist_record(LAT_HIST *h, uint64_t value)
+{
+    ++h->counts[bucket_of(value)];
+    ++h->count;
+    h->sum += value;
+    if (value > h->max)
+    {
+        h->max = value;
+    }
+}
+
+/**
+ * @brief add the values of one histogram to another
+ * @param dst LAT_HIST*: (pointer to) the histogram added to
+ * @param src const LAT_HIST*: (pointer to) the histogram to add
+ */
+static void lat_hist_add(LAT_HIST *dst, const LAT_HIST *src)
+{
+    if (src->count == 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < LAT_BUCKETS; ++i)
+    {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * @brief value at a percentile of a histogram
+ * @param h const LAT_HIST*: (pointer to) the histogram
+ * @param q double: percentile as a fraction (e.g. 0.99)
+ * @return largest value of the bucket the percentile falls in (at most the largest value recorded);
+ *         0 if the histogram is empty
+ */
+uint64_t lat_hist_percentile(const LAT_HIST *h, double q)
+{
+    if (h->count == 0)
+    {
+        return 0;
+    }
+
+    // rank of the value at the percentile (1-based, rounded up)
+    uint64_t rank = (uint64_t)(q * h->count);
+    if (rank < q * h->count)
+    {
+        ++rank;
+    }
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LAT_BUCKETS; ++i)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t high = bucket_high(i);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief find the slot of a host in a table of hosts, adding the host if it is not there
+ * @param lat LAT_THREAD*: (pointer to) the histograms holding the table
+ * @param host const char*: start of the host
+ * @param len size_t: length of the host
+ * @param hash uint64_t: hash of the host
+ * @return (pointer to) the host's slot; NULL if memory could not be allocated
+ */
+static LAT_HOST *host_slot(LAT_THREAD *lat, const char *host, size_t len, uint64_t hash)
+{
+    // keep the table at most half full
+    if (2 * (lat->hosts_used + 1) > lat->hosts_size)
+    {
+        size_t new_size = lat->hosts_size == 0 ? LAT_HOSTS_INITIAL_SIZE : 2 * lat->hosts_size;
+        LAT_HOST *new_hosts = calloc(new_size, sizeof(LAT_HOST));
+        if (new_hosts == NULL)
+        {
+            return NULL;
+        }
+        for (size_t i = 0; i < lat->hosts_size; ++i)
+        {
+            if (lat->hosts[i].host == NULL)
+            {
+                continue;
+            }
+            size_t j = lat->hosts[i].hash & (new_size - 1);
+            while (new_hosts[j].host != NULL)
+            {
+                j = (j + 1) & (new_size - 1);
+            }
+            new_hosts[j] = lat->hosts[i];
+        }
+        free(lat->hosts);
+        lat->hosts = new_hosts;
+        lat->hosts_size = new_size;
+    }
+
+    size_t i = hash & (lat->hosts_size - 1);
+    while (lat->hosts[i].host != NULL)
+    {
+        if (lat->hosts[i].hash == hash && strncmp(lat->hosts[i].host, host, len) == 0 &&
+            lat->hosts[i].host[len] == '\0')
+        {
+            return &lat->hosts[i];
+        }
+        i = (i + 1) & (lat->hosts_size - 1);
+    }
+
+    lat->hosts[i].host = strndup(host, len);
+    if (lat->hosts[i].host == NULL)
+    {
+        return NULL;
+    }
+    lat->hosts[i].hash = hash;
+    ++lat->hosts_used;
+    return &lat->hosts[i];
+}
+
+/**
+ * @brief the calling thread's histograms, allocating them on first use
+ * @return (pointer to) the histograms; NULL if memory could not be allocated
+ */
+static LAT_THREAD *get_thread_lat()
+{
+    if (thread_lat != NULL)
+    {
+        return thread_lat;
+    }
+
+    thread_lat = calloc(1, sizeof(LAT_THREAD));
+    if (thread_lat == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&threads_mutex);
+    {
+        thread_lat->next = threads;
+        threads = thread_lat;
+    }
+    pthread_mutex_unlock(&threads_mutex);
+    return thread_lat;
+}
+
+/**
+ * @brief turn on latency recording
+ * @return 0 on success; 1 otherwise
+ */
+int latency_enable()
+{
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief check if latency recording is turned on
+ * @return true if on; false otherwise
+ */
+bool latency_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief read libcurl's timings of a completed fetch
+ * @param curl_handle CURL*: the easy handle the fetch was performed with
+ * @param timings LAT_TIMINGS*: populated with the timings and size of the fetch
+ */
+void latency_get_timings(CURL *curl_handle, LAT_TIMINGS *timings)
+{
+    curl_off_t namelookup = 0, connect = 0, appconnect = 0, pretransfer = 0, starttransfer = 0, total = 0;
+    curl_off_t bytes = 0;
+    curl_easy_getinfo(curl_handle, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+    curl_easy_getinfo(curl_handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl_handle, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+    curl_easy_getinfo(curl_handle, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(curl_handle, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+    curl_easy_getinfo(curl_handle, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+
+    timings->namelookup = namelookup;
+    timings->connect = connect;
+    timings->appconnect = appconnect;
+    timings->pretransfer = pretransfer;
+    timings->starttransfer = starttransfer;
+    timings->total = total;
+    timings->bytes = bytes;
+}
+
+/**
+ * @brief record the timings of a completed fetch
+ * @param curl_handle CURL*: the easy handle the fetch was performed with
+ * @param url const char*: effective url of the fetch
+ * @param content_type int: content type of the fetched data (e.g. HTML, VALID_PNG)
+ * @note does nothing unless latency recording is turned on
+ */
+void latency_record(CURL *curl_handle, const char *url, int content_type)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    LAT_TIMINGS timings;
+    latency_get_timings(curl_handle, &timings);
+    latency_record_timings(&timings, url, content_type);
+}
+
+/**
+ * @brief record the timings of a completed fetch, read before (e.g. from a replayed corpus)
+ * @param timings const LAT_TIMINGS*: timings and size of the fetch
+ * @param url const char*: effective url of the fetch
+ * @param content_type int: content type of the fetched data (e.g. HTML, VALID_PNG)
+ * @details
+ * libcurl reports each timing as the time from the start of the transfer to the
+ *  end of a phase, so each phase is the difference to the phase before it.
+ * On a reused connection the dns, connect and tls phases are (close to) 0,
+ *  and the tls phase is only recorded when a handshake happened.
+ * Does nothing unless latency recording is turned on.
+ */
+void latency_record_timings(const LAT_TIMINGS *timings, const char *url, int content_type)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    LAT_THREAD *lat = get_thread_lat();
+    if (lat == NULL)
+    {
+        return;
+    }
+
+    uint64_t namelookup = timings->namelookup, connect = timings->connect, appconnect = timings->appconnect;
+    uint64_t pretransfer = timings->pretransfer, starttransfer = timings->starttransfer;
+
+    uint64_t values[NUM_LAT_METRICS];
+    values[LAT_DNS] = namelookup;
+    values[LAT_CONNECT] = connect > namelookup ? connect - namelookup : 0;
+    values[LAT_TLS] = appconnect > connect ? appconnect - connect : 0;
+    values[LAT_TTFB] = starttransfer > pretransfer ? starttransfer - pretransfer : 0;
+    values[LAT_TOTAL] = timings->total;
+    values[LAT_BYTES] = timings->bytes;
+
+    for (int m = 0; m < NUM_LAT_METRICS; ++m)
+    {
+        if (m == LAT_TLS && appconnect == 0)
+        {
+            continue;
+        }
+        lat_hist_record(&lat->metrics[m], values[m]);
+    }
+
+    int type;
+    switch (content_type)
+    {
+    case HTML:
+        type = LAT_TYPE_HTML;
+        break;
+    case VALID_PNG:
+        type = LAT_TYPE_PNG;
+        break;
+    case INVALID_PNG:
+        type = LAT_TYPE_INVALID_PNG;
+        break;
+    case DUPLICATE_PNG:
+        type = LAT_TYPE_DUPLICATE_PNG;
+        break;
+    default:
+        type = LAT_TYPE_OTHER;
+        break;
+    }
+    lat_hist_record(&lat->type_total[type], values[LAT_TOTAL]);
+    lat_hist_record(&lat->type_bytes[type], values[LAT_BYTES]);
+
+    // host[:port] of the url
+    const char *host = strstr(url, "://");
+    host = (host == NULL) ? url : host + 3;
+    size_t len = strcspn(host, "/?#");
+    LAT_HOST *slot = host_slot(lat, host, len, xxh64(host, len, 0));
+    if (slot != NULL)
+    {
+        for (int m = 0; m < NUM_LAT_METRICS; ++m)
+        {
+            slot->sums[m] += values[m];
+        }
+        lat_hist_record(&slot->total, values[LAT_TOTAL]);
+    }
+}
+
+/**
+ * @brief record a fetch that failed before a response was received
+ */
+void latency_record_failure()
+{
+    if (!enabled)
+    {
+        return;
+    }
+    LAT_THREAD *lat = get_thread_lat();
+    if (lat != NULL)
+    {
+        ++lat->failures;
+    }
+}
+
+/**
+ * @brief merge the histograms of all threads
+ * @return (pointer to) the merged histograms; NULL if memory could not be allocated
+ * @note only call once the threads that record fetches have exited
+ */
+static LAT_THREAD *merge_threads()
+{
+    if (merged != NULL)
+    {
+        return merged;
+    }
+
+    merged = calloc(1, sizeof(LAT_THREAD));
+    if (merged == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&threads_mutex);
+    for (LAT_THREAD *lat = threads; lat != NULL; lat = lat->next)
+    {
+        for (int m = 0; m < NUM_LAT_METRICS; ++m)
+        {
+            lat_hist_add(&merged->metrics[m], &lat->metrics[m]);
+        }
+        for (int t = 0; t < NUM_LAT_TYPES; ++t)
+        {
+            lat_hist_add(&merged->type_total[t], &lat->type_total[t]);
+            lat_hist_add(&merged->type_bytes[t], &lat->type_bytes[t]);
+        }
+        for (size_t i = 0; i < lat->hosts_size; ++i)
+        {
+            LAT_HOST *src = &lat->hosts[i];
+            if (src->host == NULL)
+            {
+                continue;
+            }
+            LAT_HOST *dst = host_slot(merged, src->host, strlen(src->host), src->hash);
+            if (dst == NULL)
+            {
+                continue;
+            }
+            for (int m = 0; m < NUM_LAT_METRICS; ++m)
+            {
+                dst->sums[m] += src->sums[m];
+            }
+            lat_hist_add(&dst->total, &src->total);
+        }
+        merged->failures += lat->failures;
+    }
+    pthread_mutex_unlock(&threads_mutex);
+
+    return merged;
+}
+
+/**
+ * @brief compare hosts by number of fetches, most first
+ */
+static int compare_hosts(const void *a, const void *b)
+{
+    const LAT_HOST *ha = *(const LAT_HOST **)a;
+    const LAT_HOST *hb = *(const LAT_HOST **)b;
+    if (ha->total.count != hb->total.count)
+    {
+        return ha->total.count < hb->total.count ? 1 : -1;
+    }
+    return strcmp(ha->host, hb->host);
+}
+
+/**
+ * @brief the hosts of the merged histograms, busiest first
+ * @param lat LAT_THREAD*: (pointer to) the merged histograms
+ * @return array of lat->hosts_used host pointers (to be freed by the caller); NULL if there are none
+ */
+static LAT_HOST **sorted_hosts(LAT_THREAD *lat)
+{
+    if (lat->hosts_used == 0)
+    {
+        return NULL;
+    }
+    LAT_HOST **hosts = malloc(lat->hosts_used * sizeof(LAT_HOST *));
+    if (hosts == NULL)
+    {
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < lat->hosts_size; ++i)
+    {
+        if (lat->hosts[i].host != NULL)
+        {
+            hosts[n++] = &lat->hosts[i];
+        }
+    }
+    qsort(hosts, n, sizeof(LAT_HOST *), compare_hosts);
+    return hosts;
+}
+
+/**
+ * @brief print a summary of the recorded latencies
+ * @note only call once the threads that record fetches have exited
+ */
+void latency_print()
+{
+    LAT_THREAD *lat = merge_threads();
+    if (lat == NULL)
+    {
+        return;
+    }
+
+    printf("latency: %lu fetches (%lu failed), %lu bytes\n",
+           (unsigned long)lat->metrics[LAT_TOTAL].count, (unsigned long)lat->failures,
+           (unsigned long)lat->metrics[LAT_BYTES].sum);
+    for (int m = 0; m < NUM_LAT_METRICS; ++m)
+    {
+        const LAT_HIST *h = &lat->metrics[m];
+        if (h->count == 0)
+        {
+            continue;
+        }
+        // times are printed in milliseconds
+        double scale = m == LAT_BYTES ? 1. : 1000.;
+        printf("latency: %-7s %s n %lu, mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+               metric_names[m], m == LAT_BYTES ? "(B) " : "(ms)", (unsigned long)h->count,
+               h->sum / (double)h->count / scale, lat_hist_percentile(h, 0.5) / scale,
+               lat_hist_percentile(h, 0.9) / scale, lat_hist_percentile(h, 0.99) / scale, h->max / scale);
+    }
+
+    for (int t = 0; t < NUM_LAT_TYPES; ++t)
+    {
+        const LAT_HIST *h = &lat->type_total[t];
+        if (h->count == 0)
+        {
+            continue;
+        }
+        printf("latency: type %s: n %lu, total (ms) p50 %.3f, p99 %.3f, mean %lu bytes\n",
+               type_names[t], (unsigned long)h->count, lat_hist_percentile(h, 0.5) / 1000.,
+               lat_hist_percentile(h, 0.99) / 1000., (unsigned long)(lat->type_bytes[t].sum / h->count));
+    }
+
+    LAT_HOST **hosts = sorted_hosts(lat);
+    for (size_t i = 0; hosts != NULL && i < lat->hosts_used && i < LAT_TOP_HOSTS; ++i)
+    {
+        const LAT_HOST *host = hosts[i];
+        double n = host->total.count;
+        printf("latency: host %s: n %lu, mean (ms) dns %.3f, connect %.3f, tls %.3f, ttfb %.3f, total %.3f, p99 total %.3f\n",
+               host->host, (unsigned long)host->total.count, host->sums[LAT_DNS] / n / 1000.,
+               host->sums[LAT_CONNECT] / n / 1000., host->sums[LAT_TLS] / n / 1000.,
+               host->sums[LAT_TTFB] / n / 1000., host->sums[LAT_TOTAL] / n / 1000.,
+               lat_hist_percentile(&host->total, 0.99) / 1000.);
+    }
+    if (lat->hosts_used > LAT_TOP_HOSTS)
+    {
+        printf("latency: %zu more hosts\n", lat->hosts_used - LAT_TOP_HOSTS);
+    }
+    free(hosts);
+}
+
+/**
+ * @brief write a json string, escaped
+ * @param f FILE*: file to write to
+ * @param str const char*: string to write
+ */
+static void write_json_string(FILE *f, const char *str)
+{
+    fputc('"', f);
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; ++p)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            fprintf(f, "\\%c", *p);
+        }
+        else if (*p < 0x20)
+        {
+            fprintf(f, "\\u%04x", *p);
+        }
+        else
+        {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/**
+ * @brief write a histogram as a json object of its count, mean, percentiles and max
+ * @param f FILE*: file to write to
+ * @param h const LAT_HIST*: (pointer to) the histogram
+ */
+static void write_json_hist(FILE *f, const LAT_HIST *h)
+{
+    fprintf(f, "{\"count\": %lu, \"mean\": %.1f, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}",
+            (unsigned long)h->count, h->count > 0 ? h->sum / (double)h->count : 0.,
+            (unsigned long)lat_hist_percentile(h, 0.5), (unsigned long)lat_hist_percentile(h, 0.9),
+            (unsigned long)lat_hist_percentile(h, 0.99), (unsigned long)lat_hist_percentile(h, 0.999),
+            (unsigned long)h->max);
+}
+
+/**
+ * @brief write a machine-readable (json) summary of the recorded latencies
+ * @param path const char*: path of the file to write
+ * @return 0 on success; 1 otherwise
+ * @details
+ * Times are in microseconds and sizes in bytes.
+ * The summary has the overall histograms ("metrics"), total time and bytes by
+ *  content type ("types"), and per-host means and total times ("hosts").
+ * @note only call once the threads that record fetches have exited
+ */
+int latency_write_summary(const char *path)
+{
+    LAT_THREAD *lat = merge_threads();
+    if (lat == NULL)
+    {
+        return 1;
+    }
+    FILE *f = fopen(path, "w+");
+    if (f == NULL)
+    {
+        return 1;
+    }
+
+    fprintf(f, "{\n  \"fetches\": %lu,\n  \"failures\": %lu,\n  \"metrics\": {",
+            (unsigned long)lat->metrics[LAT_TOTAL].count, (unsigned long)lat->failures);
+    for (int m = 0; m < NUM_LAT_METRICS; ++m)
+    {
+        fprintf(f, "%s\n    \"%s\": ", m == 0 ? "" : ",", metric_names[m]);
+        write_json_hist(f, &lat->metrics[m]);
+    }
+
+    fprintf(f, "\n  },\n  \"types\": {");
+    for (int t = 0; t < NUM_LAT_TYPES; ++t)
+    {
+        fprintf(f, "%s\n    \"%s\": {\"total\": ", t == 0 ? "" : ",", type_names[t]);
+        write_json_hist(f, &lat->type_total[t]);
+        fprintf(f, ", \"bytes\": ");
+        write_json_hist(f, &lat->type_bytes[t]);
+        fprintf(f, "}");
+    }
+
+    fprintf(f, "\n  },\n  \"hosts\": [");
+    LAT_HOST **hosts = sorted_hosts(lat);
+    for (size_t i = 0; hosts != NULL && i < lat->hosts_used; ++i)
+    {
+        const LAT_HOST *host = hosts[i];
+        double n = host->total.count;
+        fprintf(f, "%s\n    {\"host\": ", i == 0 ? "" : ",");
+        write_json_string(f, host->host);
+        fprintf(f, ", \"mean\": {");
+        for (int m = 0; m < NUM_LAT_METRICS; ++m)
+        {
+            fprintf(f, "%s\"%s\": %.1f", m == 0 ? "" : ", ", metric_names[m], host->sums[m] / n);
+        }
+        fprintf(f, "}, \"total\": ");
+        write_json_hist(f, &host->total);
+        fprintf(f, "}");
+    }
+    free(hosts);
+    fprintf(f, "\n  ]\n}\n");
+
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief free the histograms of all threads
+ * @note only call once the threads that record fetches have exited
+ */
+void latency_cleanup()
+{
+    LAT_THREAD *lats[2] = {threads, merged};
+    for (int k = 0; k < 2; ++k)
+    {
+        LAT_THREAD *lat = lats[k];
+        while (lat != NULL)
+        {
+            LAT_THREAD *next = k == 0 ? lat->next : NULL;
+            for (size_t i = 0; i < lat->hosts_size; ++i)
+            {
+                free(lat->hosts[i].host);
+            }
+            free(lat->hosts);
+            free(lat);
+            lat = next;
+        }
+    }
+    threads = NULL;
+    merged = NULL;
+    enabled = false;
+}
@@ -0,0 +1,107 @@
+/*
+Per-phase network latency histograms built from libcurl's transfer timings
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <curl/curl.h>
+
+#define LAT_SUB_BITS 4                                            /* 16 sub-buckets per power of two: values are kept within ~6% */
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_MAX_MAGNITUDE 40                                      /* values of 2^40 and above share the last bucket */
+#define LAT_BUCKETS ((LAT_MAX_MAGNITUDE - LAT_SUB_BITS + 2) * LAT_SUB_BUCKETS)
+#define LAT_HOSTS_INITIAL_SIZE 64
+#define LAT_TOP_HOSTS 10                                          /* hosts printed on exit (the summary file has all of them) */
+
+// what is measured for every fetch; times are in microseconds
+#define LAT_DNS 0     /* resolving the host name */
+#define LAT_CONNECT 1 /* tcp connect, after the name was resolved */
+#define LAT_TLS 2     /* tls handshake, after the tcp connect (https only) */
+#define LAT_TTFB 3    /* from the request being sent to the first response byte */
+#define LAT_TOTAL 4   /* the whole transfer, redirects included */
+#define LAT_BYTES 5   /* bytes downloaded */
+#define NUM_LAT_METRICS 6
+
+// content types fetches are broken down by (DEFAULT_TYPE and anything else is LAT_TYPE_OTHER)
+#define LAT_TYPE_HTML 0
+#define LAT_TYPE_PNG 1
+#define LAT_TYPE_INVALID_PNG 2
+#define LAT_TYPE_DUPLICATE_PNG 3
+#define LAT_TYPE_OTHER 4
+#define NUM_LAT_TYPES 5
+
+// libcurl's timings of one fetch: microseconds from the start of the transfer to the end of each phase
+typedef struct lat_timings
+{
+    uint64_t namelookup;
+    uint64_t connect;
+    uint64_t appconnect;
+    uint64_t pretransfer;
+    uint64_t starttransfer;
+    uint64_t total;
+    // bytes downloaded
+    uint64_t bytes;
+} LAT_TIMINGS;
+
+// a log-linear (HDR-style) histogram of non-negative values
+typedef struct lat_hist
+{
+    // number of values per bucket
+    uint64_t counts[LAT_BUCKETS];
+    // number of values recorded
+    uint64_t count;
+    // sum of the values recorded
+    uint64_t sum;
+    // largest value recorded
+    uint64_t max;
+} LAT_HIST;
+
+// fetches from one host
+typedef struct lat_host
+{
+    // host[:port], or NULL for an empty slot
+    char *host;
+    // hash of host
+    uint64_t hash;
+    // sum of each metric over the host's fetches
+    uint64_t sums[NUM_LAT_METRICS];
+    // total times of the host's fetches
+    LAT_HIST total;
+} LAT_HOST;
+
+// everything recorded by one thread (or, once merged, by all threads)
+typedef struct lat_thread
+{
+    LAT_HIST metrics[NUM_LAT_METRICS];
+    // total time and bytes of fetches, by LAT_TYPE_*
+    LAT_HIST type_total[NUM_LAT_TYPES];
+    LAT_HIST type_bytes[NUM_LAT_TYPES];
+    // open addressing table of hosts
+    LAT_HOST *hosts;
+    size_t hosts_size;
+    size_t hosts_used;
+    // fetches that failed before a response was received
+    uint64_t failures;
+    // next thread that recorded fetches
+    struct lat_thread *next;
+} LAT_THREAD;
+
+void lat_hist_record(LAT_HIST *h, uint64_t value);
+uint64_t lat_hist_percentile(const LAT_HIST *h, double q);
+int latency_enable();
+bool latency_enabled();
+void latency_get_timings(CURL *curl_handle, LAT_TIMINGS *timings);
+void latency_record(CURL *curl_handle, const char *url, int content_type);
+void latency_record_timings(const LAT_TIMINGS *timings, const char *url, int content_type);
+void latency_record_failure();
+void latency_print();
+int latency_write_summary(const char *path);
+void latency_cleanup();
+
+#endif
@@ -0,0 +1,728 @@
+/*
+A lightweight link extractor that scans raw HTML without building a document tree
+- markup delimiters are located 16 (SSE2) or 32 (AVX2) bytes at a time
+- collects the same attributes as find_http: <a>/<area> href onto the page stack;
+  <img>/<source> src/srcset and <link rel=icon> href onto the image stack
+- decodes character references in attribute values the way libxml2 does
+- skips comments and the contents of <script> and <style>
+- honours the first <base href>
+- gives up with SCAN_MALFORMED on input it cannot treat exactly like libxml2
+  (unterminated comments, tags or quotes; NUL bytes; non-ASCII link values);
+  nothing is pushed in that case, so the caller can fall back to find_http
+- follows the libxml2 actually linked (xmlParserVersion, not the headers) where versions
+  disagree: before 2.14, <title>, <textarea>, <noscript> and the other text-only elements
+  of html5 hold markup, and an end tag inside <script> or <style> only ends their text if
+  it closes an element that may be open; from 2.14 on, their text ends at their own end tag
+- still gives up on a '/' inside a start tag other than "/>"; before 2.14, on an end tag
+  inside <script> or <style> whose element appeared earlier on the page; and from 2.14 on,
+  on "<!--" inside <script> and any '<' inside <noscript> and <plaintext>, whose html5
+  parse depends on the parser's settings
+- bench/linkdiff checks it against find_http over the fixtures in bench/html (make linkdiff)
+*/
+
+#include <ctype.h>
+#include <libxml/parserInternals.h>
+#include "curl_xml.h"
+#include "link_scan.h"
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define TAG_OTHER 0
+#define TAG_A 1
+#define TAG_IMG 2
+#define TAG_LINK 3
+#define TAG_BASE 4
+#define TAG_RAW 5    /* <script> and <style>: raw text up to their end tag */
+#define TAG_RCDATA 6 /* text-only elements from libxml2 2.14 on, markup before */
+#define TAG_UNSURE 7 /* <noscript> and <plaintext>: like TAG_RCDATA, but left to libxml2 2.14 if they hold markup */
+
+#define ATTR_HREF 0
+#define ATTR_SRC 1
+#define ATTR_SRCSET 2
+#define ATTR_REL 3
+#define NUM_ATTRS 4
+
+typedef struct scan_attr
+{
+    // whether the attribute appeared on the tag (only the first occurrence counts)
+    bool seen;
+    // start of the raw (not yet decoded) value in the page buffer
+    const char *value;
+    // length of the raw value
+    size_t len;
+} SCAN_ATTR;
+
+static const char *attr_names[NUM_ATTRS] = {"href", "src", "srcset", "rel"};
+
+/**
+ * @brief find the first occurrence of a byte
+ * @param p const char*: where to start searching
+ * @param end const char*: one past the last byte to search
+ * @param c char: byte to find
+ * @return pointer to the byte; NULL if it does not occur before end
+ */
+static const char *find_byte(const char *p, const char *end, char c)
+{
+#if defined(__AVX2__)
+    const __m256i needle32 = _mm256_set1_epi8(c);
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i needle16 = _mm_set1_epi8(c);
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end)
+    {
+        if (*p == c)
+        {
+            return p;
+        }
+        ++p;
+    }
+    return NULL;
+}
+
+/**
+ * @brief check for html whitespace
+ * @param c char: character to check
+ * @return true if c is a space, tab, newline, carriage return or form feed
+ */
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/**
+ * @brief classify a tag name
+ * @param name const char*: start of the name (not 0 terminated)
+ * @param len size_t: length of the name
+ * @return one of the TAG_* codes
+ */
+static int classify_tag(const char *name, size_t len)
+{
+    if ((len == 1 && strncasecmp(name, "a", 1) == 0) ||
+        (len == 4 && strncasecmp(name, "area", 4) == 0))
+    {
+        return TAG_A;
+    }
+    if ((len == 3 && strncasecmp(name, "img", 3) == 0) ||
+        (len == 6 && strncasecmp(name, "source", 6) == 0))
+    {
+        return TAG_IMG;
+    }
+    if (len == 4 && strncasecmp(name, "link", 4) == 0)
+    {
+        return TAG_LINK;
+    }
+    if (len == 4 && strncasecmp(name, "base", 4) == 0)
+    {
+        return TAG_BASE;
+    }
+    if ((len == 6 && strncasecmp(name, "script", 6) == 0) ||
+        (len == 5 && strncasecmp(name, "style", 5) == 0))
+    {
+        return TAG_RAW;
+    }
+    if ((len == 8 && strncasecmp(name, "noscript", 8) == 0) ||
+        (len == 9 && strncasecmp(name, "plaintext", 9) == 0))
+    {
+        return TAG_UNSURE;
+    }
+    static const char *rcdata[] = {"title", "textarea", "xmp", "iframe", "noembed", "noframes"};
+    for (size_t i = 0; i < sizeof(rcdata) / sizeof(rcdata[0]); ++i)
+    {
+        if (len == strlen(rcdata[i]) && strncasecmp(name, rcdata[i], len) == 0)
+        {
+            return TAG_RCDATA;
+        }
+    }
+    return TAG_OTHER;
+}
+
+/**
+ * @brief tell whether the linked libxml2 parses text-only elements like html5
+ * @return true from libxml2 2.14 on; false for earlier versions
+ * @note the version of the library loaded at run time decides, not the headers compiled against
+ */
+static bool libxml_html5_text(void)
+{
+    return atoi(xmlParserVersion) >= 21400;
+}
+
+/**
+ * @brief map a tag name to one bit of a set of names
+ * @param name const char*: tag name (not 0 terminated)
+ * @param len size_t: length of the name
+ * @return a 64-bit mask with the bit of the name (case-insensitive) set
+ */
+static uint64_t name_bit(const char *name, size_t len)
+{
+    uint64_t h = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h = h * 31 + tolower((unsigned char)name[i]);
+    }
+    // the top 6 bits of a multiplicative hash
+    return 1ULL << ((h * 0x9E3779B97F4A7C15ULL) >> 58);
+}
+
+/**
+ * @brief check whether text of a <script> or <style> element starts with a tag that closes it
+ * @param p const char*: start of the text (or where it carries on after a dropped end tag)
+ * @param end const char*: one past the last byte of the page
+ * @return true if the text starts with <noscript>, <body> or <frameset>, which end a <script>
+ *  or <style> in libxml2 before 2.14 (its htmlStartClose table)
+ */
+static bool starts_closing_tag(const char *p, const char *end)
+{
+    static const char *closing[] = {"noscript", "body", "frameset"};
+    if (end - p < 2 || p[0] != '<')
+    {
+        return false;
+    }
+    const char *name = p + 1;
+    const char *q = name;
+    while (q < end && (isalnum((unsigned char)*q) || *q == ':' || *q == '-' || *q == '_' || *q == '.'))
+    {
+        ++q;
+    }
+    for (size_t i = 0; i < sizeof(closing) / sizeof(closing[0]); ++i)
+    {
+        if ((size_t)(q - name) == strlen(closing[i]) && strncasecmp(name, closing[i], q - name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief find where libxml2 before 2.14 ends the text of a <script> or <style> element
+ * @param p const char*: first byte after the start tag
+ * @param end const char*: one past the last byte of the page
+ * @param name const char*: name of the element (not 0 terminated)
+ * @param name_len size_t: length of the name
+ * @param started uint64_t: name_bit of every start tag before the element
+ * @return (pointer to) the '<' of the element's end tag; NULL if the element must be left to libxml2
+ * @details
+ * Without HTML_PARSE_RECOVER (mem_getdoc parses without it) the text stops at "</" and a
+ *  letter, whatever the element. The end tag closes the element if it is its own, or
+ *  the end tag of an open element (which closes everything in between); otherwise it is
+ *  dropped and the text carries on. An element can't be open if its start tag does not
+ *  occur before the <script> or <style> (its bit is clear in started), unless libxml2
+ *  implies it (html, head, body, p). The scanner also gives up on an end tag followed by
+ *  a start tag that closes the element (starts_closing_tag).
+ */
+static const char *legacy_raw_text_end(const char *p, const char *end, const char *name, size_t name_len,
+                                       uint64_t started)
+{
+    static const char *implied[] = {"html", "head", "body", "p"};
+    const char *q = p;
+    while ((q = find_byte(q, end, '<')) != NULL)
+    {
+        if (!(end - q >= 3 && q[1] == '/' && isalpha((unsigned char)q[2])))
+        {
+            ++q;
+            continue;
+        }
+        const char *other = q + 2;
+        const char *r = other;
+        while (r < end && (isalnum((unsigned char)*r) || *r == ':' || *r == '-' || *r == '_' || *r == '.'))
+        {
+            ++r;
+        }
+        size_t other_len = r - other;
+        if (other_len == name_len && strncasecmp(other, name, name_len) == 0)
+        {
+            return q;
+        }
+        for (size_t i = 0; i < sizeof(implied) / sizeof(implied[0]); ++i)
+        {
+            if (other_len == strlen(implied[i]) && strncasecmp(other, implied[i], other_len) == 0)
+            {
+                return NULL;
+            }
+        }
+        if (started & name_bit(other, other_len))
+        {
+            return NULL;
+        }
+        // libxml2 2.9 carries on right after the name of an end tag without a '>', later
+        //  versions skip to the next '>': the same, if there is no markup in between
+        const char *close = find_byte(r, end, '>');
+        if (close == NULL || find_byte(r, close, '<') != NULL || starts_closing_tag(close + 1, end))
+        {
+            return NULL;
+        }
+        q = close + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief find where the text of a <script>, <style> or text-only element ends
+ * @param p const char*: first byte after the start tag
+ * @param end const char*: one past the last byte of the page
+ * @param name const char*: name of the element (not 0 terminated)
+ * @param name_len size_t: length of the name
+ * @param tag int: TAG_RAW, TAG_RCDATA or TAG_UNSURE
+ * @param html5 bool: whether the linked libxml2 parses text-only elements like html5
+ * @param started uint64_t: name_bit of every start tag before the element
+ * @return (pointer to) the '<' of the end tag that ends the text; p if the element holds
+ *  markup; NULL if the element must be left to libxml2
+ * @details
+ * Before 2.14, libxml2 parses the contents of the text-only elements other than <script>
+ *  and <style> as markup.
+ */
+static const char *text_end(const char *p, const char *end, const char *name, size_t name_len, int tag, bool html5,
+                            uint64_t started)
+{
+    if (!html5)
+    {
+        if (tag != TAG_RAW)
+        {
+            return p;
+        }
+        if (starts_closing_tag(p, end))
+        {
+            return NULL;
+        }
+        return legacy_raw_text_end(p, end, name, name_len, started);
+    }
+
+    const char *q = p;
+    while ((q = find_byte(q, end, '<')) != NULL)
+    {
+        if ((size_t)(end - q) > name_len + 2 && q[1] == '/' && strncasecmp(q + 2, name, name_len) == 0 &&
+            (is_space(q[name_len + 2]) || q[name_len + 2] == '/' || q[name_len + 2] == '>'))
+        {
+            return q;
+        }
+        // the escape states of html5 script data, and elements whose parse depends on the settings
+        if (tag == TAG_UNSURE || (tag == TAG_RAW && name_len == 6 && end - q >= 4 && strncmp(q, "<!--", 4) == 0))
+        {
+            return NULL;
+        }
+        ++q;
+    }
+    return NULL;
+}
+
+/**
+ * @brief decode the character references in a raw attribute value
+ * @param value const char*: raw value in the page buffer
+ * @param len size_t: length of the raw value
+ * @return decoded value on success (free with xmlFree); NULL if the value must be left to libxml2
+ * @details
+ * Follows htmlParseHTMLAttribute: "&name;" is decoded only if name is a known
+ *  html entity, otherwise the text is kept as is (so query strings like "?a=1&b=2"
+ *  survive); numeric references must be terminated by ';'.
+ */
+static xmlChar *decode_attr(const char *value, size_t len)
+{
+    // a decoded reference is never longer than its source text
+    xmlChar *out = xmlMalloc(len + 1);
+    size_t n = 0;
+    const char *p = value;
+    const char *end = value + len;
+
+    if (out == NULL)
+    {
+        return NULL;
+    }
+
+    while (p < end)
+    {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x80)
+        {
+            // the page encoding decides what these bytes mean
+            xmlFree(out);
+            return NULL;
+        }
+        if (c != '&')
+        {
+            out[n++] = c;
+            ++p;
+            continue;
+        }
+
+        if (p + 1 < end && p[1] == '#')
+        {
+            // numeric character reference
+            const char *q = p + 2;
+            int base = 10;
+            long val = 0;
+            if (q < end && (*q == 'x' || *q == 'X'))
+            {
+                base = 16;
+                ++q;
+            }
+            const char *digits = q;
+            while (q < end && (base == 16 ? isxdigit((unsigned char)*q) : isdigit((unsigned char)*q)) && val <= 0x10FFFF)
+            {
+                val = val * base + (isdigit((unsigned char)*q) ? *q - '0' : (tolower((unsigned char)*q) - 'a' + 10));
+                ++q;
+            }
+            if (q == digits || q >= end || *q != ';' || val <= 0 || val > 0x10FFFF || (val >= 0xD800 && val <= 0xDFFF))
+            {
+                xmlFree(out);
+                return NULL;
+            }
+            n += xmlCopyCharMultiByte(out + n, (int)val);
+            p = q + 1;
+            continue;
+        }
+
+        // named character reference
+        const char *q = p + 1;
+        while (q < end && (isalnum((unsigned char)*q) || *q == '.' || *q == '-' || *q == '_' || *q == ':'))
+        {
+            ++q;
+        }
+        if (q > p + 1 && q < end && *q == ';')
+        {
+            char name[32];
+            size_t name_len = q - (p + 1);
+            if (name_len < sizeof(name))
+            {
+                memcpy(name, p + 1, name_len);
+                name[name_len] = '\0';
+                const htmlEntityDesc *ent = htmlEntityLookup((const xmlChar *)name);
+                if (ent != NULL)
+                {
+                    n += xmlCopyCharMultiByte(out + n, ent->value);
+                    p = q + 1;
+                    continue;
+                }
+            }
+        }
+        // not a known entity: keep the '&' and carry on
+        out[n++] = '&';
+        ++p;
+    }
+
+    out[n] = '\0';
+    return out;
+}
+
+/**
+ * @brief parse the attributes of a start tag
+ * @param p const char*: first byte after the tag name
+ * @param end const char*: one past the last byte of the page
+ * @param attrs SCAN_ATTR*: attributes to capture (NUM_ATTRS entries); NULL to capture none
+ * @return pointer to the first byte after the closing '>'; NULL if the tag is not terminated,
+ *  or has a '/' other than "/>" (libxml2 skips it as a bogus attribute, up to the next space)
+ */
+static const char *parse_attrs(const char *p, const char *end, SCAN_ATTR *attrs)
+{
+    while (true)
+    {
+        while (p < end && is_space(*p))
+        {
+            ++p;
+        }
+        if (p >= end)
+        {
+            return NULL;
+        }
+        if (*p == '/')
+        {
+            if (end - p < 2 || p[1] != '>')
+            {
+                return NULL;
+            }
+            ++p;
+        }
+        if (*p == '>')
+        {
+            return p + 1;
+        }
+
+        // attribute name
+        const char *name = p;
+        while (p < end && !is_space(*p) && *p != '/' && *p != '>' && *p != '=')
+        {
+            ++p;
+        }
+        size_t name_len = p - name;
+        if (name_len == 0)
+        {
+            return NULL;
+        }
+        while (p < end && is_space(*p))
+        {
+            ++p;
+        }
+
+        // attribute value (optional)
+        const char *value = p;
+        size_t len = 0;
+        if (p < end && *p == '=')
+        {
+            ++p;
+            while (p < end && is_space(*p))
+            {
+                ++p;
+            }
+            if (p >= end)
+            {
+                return NULL;
+            }
+            if (*p == '"' || *p == '\'')
+            {
+                const char *close = find_byte(p + 1, end, *p);
+                if (close == NULL)
+                {
+                    return NULL;
+                }
+                value = p + 1;
+                len = close - value;
+                p = close + 1;
+            }
+            else
+            {
+                value = p;
+                while (p < end && !is_space(*p) && *p != '>')
+                {
+                    ++p;
+                }
+                len = p - value;
+            }
+        }
+
+        if (attrs != NULL)
+        {
+            for (int i = 0; i < NUM_ATTRS; ++i)
+            {
+                if (!attrs[i].seen && strlen(attr_names[i]) == name_len && strncasecmp(name, attr_names[i], name_len) == 0)
+                {
+                    attrs[i].seen = true;
+                    attrs[i].value = value;
+                    attrs[i].len = len;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief decode a captured attribute
+ * @param attr SCAN_ATTR*: (pointer to) the captured attribute
+ * @param ok bool*: (pointer to) flag cleared if the value must be left to libxml2
+ * @return decoded value (free with xmlFree); NULL if the attribute is absent or on failure
+ */
+static xmlChar *attr_value(SCAN_ATTR *attr, bool *ok)
+{
+    if (!attr->seen)
+    {
+        return NULL;
+    }
+    xmlChar *value = decode_attr(attr->value, attr->len);
+    if (value == NULL)
+    {
+        *ok = false;
+    }
+    return value;
+}
+
+/**
+ * @brief pop entries off a stack until it is back to a given size
+ * @param stack STACK*: (pointer to) stack to truncate
+ * @param n size_t: number of elements to keep
+ */
+static void truncate_stack(STACK *stack, size_t n)
+{
+    char *item = NULL;
+    while (num_elements_stack(stack) > n && pop_stack(stack, &item) == 0)
+    {
+        free(item);
+        item = NULL;
+    }
+}
+
+/**
+ * @brief get all urls on the html web page and push them onto stacks, without building a document tree
+ * @param buf char*: (pointer to) buffer that contains the HTML web page
+ * @param size int: size of the buffer
+ * @param follow_relative_links int: 1 if we're following relative links and 0 otherwise
+ * @param base_url const char*: base url of the page
+ * @param stack STACK*: (pointer to) stack that will be populated with further pages to crawl
+ * @param img_stack STACK*: (pointer to) stack that will be populated with images embedded on the page
+ * @return SCAN_OK on success; SCAN_MALFORMED if the page should be parsed by find_http instead
+ * @details
+ * The stacks are populated in the same order as find_http would populate them.
+ * On SCAN_MALFORMED both stacks are left as they were on entry.
+ */
+int scan_http(char *buf, int size, int follow_relative_links, const char *base_url, STACK *stack, STACK *img_stack)
+{
+    const char *p = buf;
+    const char *end = buf + size;
+    size_t stack_start = num_elements_stack(stack);
+    size_t img_stack_start = num_elements_stack(img_stack);
+    xmlChar *base = NULL;
+    bool seen_base = false;
+    bool ok = true;
+    bool html5 = libxml_html5_text();
+    // names of the start tags so far (a bit per name): the elements that may be open
+    uint64_t started = 0;
+
+    if (buf == NULL)
+    {
+        return SCAN_MALFORMED;
+    }
+
+    // libxml2 would have to guess the encoding of a page with NUL bytes in it
+    if (find_byte(buf, end, '\0') != NULL)
+    {
+        return SCAN_MALFORMED;
+    }
+
+    base = xmlStrdup((const xmlChar *)base_url);
+
+    while (ok && (p = find_byte(p, end, '<')) != NULL)
+    {
+        ++p;
+        if (p >= end)
+        {
+            break;
+        }
+
+        // comment
+        if (end - p >= 3 && strncmp(p, "!--", 3) == 0)
+        {
+            const char *q = p + 3;
+            while ((q = find_byte(q, end, '-')) != NULL && !(end - q >= 3 && q[1] == '-' && q[2] == '>'))
+            {
+                ++q;
+            }
+            if (q == NULL)
+            {
+                ok = false;
+                break;
+            }
+            p = q + 3;
+            continue;
+        }
+
+        // doctype, processing instruction or end tag
+        if (*p == '!' || *p == '?' || *p == '/')
+        {
+            const char *q = find_byte(p, end, '>');
+            if (q == NULL)
+            {
+                ok = false;
+                break;
+            }
+            p = q + 1;
+            continue;
+        }
+
+        // anything else that does not start with a letter is text
+        if (!isalpha((unsigned char)*p))
+        {
+            continue;
+        }
+
+        // start tag
+        const char *name = p;
+        while (p < end && !is_space(*p) && *p != '/' && *p != '>')
+        {
+            ++p;
+        }
+        size_t name_len = p - name;
+        int tag = classify_tag(name, name_len);
+        started |= name_bit(name, name_len);
+
+        SCAN_ATTR attrs[NUM_ATTRS];
+        memset(attrs, 0, sizeof(attrs));
+        p = parse_attrs(p, end, (tag == TAG_OTHER || tag >= TAG_RAW) ? NULL : attrs);
+        if (p == NULL)
+        {
+            ok = false;
+            break;
+        }
+
+        if (tag == TAG_A)
+        {
+            xmlChar *href = attr_value(&attrs[ATTR_HREF], &ok);
+            push_link(stack, href, follow_relative_links, base);
+            xmlFree(href);
+        }
+        else if (tag == TAG_IMG)
+        {
+            xmlChar *src = attr_value(&attrs[ATTR_SRC], &ok);
+            push_link(img_stack, src, follow_relative_links, base);
+            xmlFree(src);
+            xmlChar *srcset = attr_value(&attrs[ATTR_SRCSET], &ok);
+            push_srcset(img_stack, srcset, follow_relative_links, base);
+            xmlFree(srcset);
+        }
+        else if (tag == TAG_LINK)
+        {
+            xmlChar *rel = attr_value(&attrs[ATTR_REL], &ok);
+            if (rel != NULL && is_icon_rel(rel))
+            {
+                xmlChar *href = attr_value(&attrs[ATTR_HREF], &ok);
+                push_link(img_stack, href, follow_relative_links, base);
+                xmlFree(href);
+            }
+            xmlFree(rel);
+        }
+        else if (tag == TAG_BASE && !seen_base)
+        {
+            xmlChar *href = attr_value(&attrs[ATTR_HREF], &ok);
+            if (href != NULL)
+            {
+                xmlChar *new_base = xmlBuildURI(href, base);
+                if (new_base != NULL)
+                {
+                    xmlFree(base);
+                    base = new_base;
+                }
+                seen_base = true;
+            }
+            xmlFree(href);
+        }
+        else if (tag >= TAG_RAW)
+        {
+            const char *q = text_end(p, end, name, name_len, tag, html5, started);
+            if (q == NULL)
+            {
+                ok = false;
+                break;
+            }
+            p = q;
+        }
+    }
+
+    xmlFree(base);
+
+    if (!ok)
+    {
+        truncate_stack(stack, stack_start);
+        truncate_stack(img_stack, img_stack_start);
+        return SCAN_MALFORMED;
+    }
+    return SCAN_OK;
+}
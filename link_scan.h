@@ -0,0 +1,15 @@
+/*
+A lightweight link extractor that scans raw HTML without building a document tree
+*/
+
+#ifndef LINK_SCAN_H
+#define LINK_SCAN_H
+
+#include "stack.h"
+
+#define SCAN_OK 0
+#define SCAN_MALFORMED 1
+
+int scan_http(char *buf, int size, int follow_relative_links, const char *base_url, STACK *stack, STACK *img_stack);
+
+#endif
@@ -0,0 +1,406 @@
+/*
+Live crawl statistics served on a local Unix-domain socket while the crawl runs
+- the crawl only bumps atomic counters and stores its threads' states, so serving
+  the statistics never takes a crawl lock
+- a stats thread accepts connections on the socket and answers each one with a
+  json snapshot, then closes it (e.g. `nc -U SOCKET` or `socat - UNIX-CONNECT:SOCKET`)
+- the stats thread also records the counters every LIVE_TICK_MS, so the snapshot
+  can report current rates rather than averages over the whole crawl
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "live_stats.h"
+
+// counters recorded at one tick
+typedef struct live_tick
+{
+    uint64_t ms;
+    uint64_t pages;
+    uint64_t bytes;
+} LIVE_TICK;
+
+// whether live_stats_enable was called
+static bool enabled = false;
+// when the stats were enabled (ms of the monotonic clock)
+static uint64_t start_ms = 0;
+
+// crawl counters; only accessed atomically
+static uint64_t pages = 0;
+static uint64_t bytes = 0;
+static uint64_t fetch_errors = 0;
+static uint64_t http_errors = 0;
+static uint64_t frontier_urls = 0;
+static uint64_t pngs = 0;
+static int pngs_target = 0;
+
+// one slot per crawl thread, handed out by live_stats_register_thread
+static LIVE_THREAD *threads = NULL;
+static size_t threads_size = 0;
+static size_t threads_used = 0;
+// the calling thread's slot (-1 if it has none)
+static __thread long thread_slot = -1;
+
+// the last ticks, as a ring (only used by the stats thread)
+static LIVE_TICK ticks[LIVE_RATE_TICKS + 1];
+static size_t num_ticks = 0;
+
+// the socket and the stats thread serving it
+static char *socket_path = NULL;
+static int listen_fd = -1;
+// written to by live_stats_cleanup to wake the stats thread up so it exits
+static int wake_pipe[2] = {-1, -1};
+static pthread_t server_thread;
+
+static const char *state_names[NUM_LIVE_STATES] = {"idle", "waiting", "fetching", "queueing", "parsing", "exited"};
+
+/**
+ * @brief time since the stats were enabled
+ * @return time in ms
+ */
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - start_ms;
+}
+
+/**
+ * @brief record the counters for the current rates
+ */
+static void record_tick()
+{
+    LIVE_TICK *tick = &ticks[num_ticks % (LIVE_RATE_TICKS + 1)];
+    tick->ms = now_ms();
+    tick->pages = __atomic_load_n(&pages, __ATOMIC_RELAXED);
+    tick->bytes = __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+    ++num_ticks;
+}
+
+/**
+ * @brief stats thread: record ticks and answer connections until woken up through wake_pipe
+ * @param _ void*: not used; only defined to satisfy thread API
+ * @return NULL
+ */
+static void *serve(void *_)
+{
+    char *reply = malloc(LIVE_REPLY_SIZE);
+    if (reply == NULL)
+    {
+        return NULL;
+    }
+
+    uint64_t next_tick = now_ms();
+    while (true)
+    {
+        uint64_t now = now_ms();
+        if (now >= next_tick)
+        {
+            record_tick();
+            next_tick = now + LIVE_TICK_MS;
+        }
+
+        struct pollfd fds[2] = {{.fd = listen_fd, .events = POLLIN}, {.fd = wake_pipe[0], .events = POLLIN}};
+        if (poll(fds, 2, (int)(next_tick - now)) < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+        if ((fds[0].revents & POLLIN) == 0)
+        {
+            continue;
+        }
+
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+        int len = live_stats_format(reply, LIVE_REPLY_SIZE);
+        for (int sent = 0; sent < len;)
+        {
+            ssize_t n = write(client, reply + sent, len - sent);
+            if (n <= 0)
+            {
+                break;
+            }
+            sent += n;
+        }
+        close(client);
+    }
+
+    free(reply);
+    return NULL;
+}
+
+/**
+ * @brief start serving live statistics on a Unix-domain socket
+ * @param path const char*: path of the socket (an existing socket at the path is replaced)
+ * @param num_threads size_t: number of crawl threads that will register
+ * @param num_pngs_to_find int: number of pngs the crawl stops at
+ * @return 0 on success; 1 otherwise
+ */
+int live_stats_enable(const char *path, size_t num_threads, int num_pngs_to_find)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    pngs_target = num_pngs_to_find;
+
+    threads = calloc(num_threads, sizeof(LIVE_THREAD));
+    if (threads == NULL)
+    {
+        return 1;
+    }
+    threads_size = num_threads;
+
+    // replace a socket left behind by an earlier crawl (but nothing else)
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        return 1;
+    }
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 8) != 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        return 1;
+    }
+    socket_path = strdup(path);
+
+    if (pipe(wake_pipe) != 0 || pthread_create(&server_thread, NULL, serve, NULL) != 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path);
+        return 1;
+    }
+
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief check if live statistics are being served
+ * @return true if they are; false otherwise
+ */
+bool live_stats_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief give the calling thread a slot for its state
+ * @param role const char*: what the thread is (e.g. "runner")
+ * @note a thread that registers after all slots are taken has no state reported
+ */
+void live_stats_register_thread(const char *role)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    size_t slot = __atomic_fetch_add(&threads_used, 1, __ATOMIC_RELAXED);
+    if (slot >= threads_size)
+    {
+        return;
+    }
+    threads[slot].role = role;
+    __atomic_store_n(&threads[slot].since_ms, now_ms(), __ATOMIC_RELAXED);
+    __atomic_store_n(&threads[slot].state, LIVE_IDLE, __ATOMIC_RELEASE);
+    thread_slot = slot;
+}
+
+/**
+ * @brief set what the calling thread is doing
+ * @param state int: LIVE_* state
+ */
+void live_stats_set_state(int state)
+{
+    if (thread_slot < 0)
+    {
+        return;
+    }
+    __atomic_store_n(&threads[thread_slot].since_ms, now_ms(), __ATOMIC_RELAXED);
+    __atomic_store_n(&threads[thread_slot].state, state, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief count a completed fetch
+ * @param size size_t: bytes downloaded
+ * @param response_code long: http response code
+ */
+void live_stats_record_fetch(size_t size, long response_code)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    __atomic_add_fetch(&pages, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bytes, size, __ATOMIC_RELAXED);
+    if (response_code >= 400)
+    {
+        __atomic_add_fetch(&http_errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief count a fetch that failed before a response was received
+ */
+void live_stats_record_failure()
+{
+    if (enabled)
+    {
+        __atomic_add_fetch(&fetch_errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief publish the number of urls in the frontier
+ * @param num_urls size_t: number of urls in the frontier
+ */
+void live_stats_set_frontier(size_t num_urls)
+{
+    if (enabled)
+    {
+        __atomic_store_n(&frontier_urls, num_urls, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief publish the number of pngs found
+ * @param num_pngs size_t: number of pngs found
+ */
+void live_stats_set_pngs(size_t num_pngs)
+{
+    if (enabled)
+    {
+        __atomic_store_n(&pngs, num_pngs, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief format a json snapshot of the statistics
+ * @param buf char*: buffer to format into
+ * @param size size_t: size of buf
+ * @return length of the snapshot (truncated to fit buf)
+ * @note only called by the stats thread, which owns the ticks the rates are computed from
+ */
+int live_stats_format(char *buf, size_t size)
+{
+    uint64_t now = now_ms();
+    uint64_t cur_pages = __atomic_load_n(&pages, __ATOMIC_RELAXED);
+    uint64_t cur_bytes = __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+
+    // current rates: since the oldest tick kept (or since the start)
+    LIVE_TICK oldest = {0, 0, 0};
+    if (num_ticks > LIVE_RATE_TICKS)
+    {
+        oldest = ticks[num_ticks % (LIVE_RATE_TICKS + 1)];
+    }
+    else if (num_ticks > 0)
+    {
+        oldest = ticks[0];
+    }
+    double window = (now > oldest.ms ? now - oldest.ms : 1) / 1000.;
+
+    size_t len = 0;
+#define APPEND(...)                                                                    \
+    do                                                                                 \
+    {                                                                                  \
+        if (len < size)                                                                \
+        {                                                                              \
+            int n = snprintf(buf + len, size - len, __VA_ARGS__);                      \
+            len += (n > 0) ? (size_t)n : 0;                                            \
+        }                                                                              \
+    } while (0)
+
+    APPEND("{\"uptime_s\": %.1f, \"pages\": %lu, \"pages_per_s\": %.1f, \"bytes\": %lu, \"bytes_per_s\": %.0f, "
+           "\"pngs\": %lu, \"pngs_target\": %d, \"frontier\": %lu, \"errors\": {\"fetch\": %lu, \"http\": %lu}",
+           now / 1000., (unsigned long)cur_pages, (cur_pages - oldest.pages) / window,
+           (unsigned long)cur_bytes, (cur_bytes - oldest.bytes) / window,
+           (unsigned long)__atomic_load_n(&pngs, __ATOMIC_RELAXED), pngs_target,
+           (unsigned long)__atomic_load_n(&frontier_urls, __ATOMIC_RELAXED),
+           (unsigned long)__atomic_load_n(&fetch_errors, __ATOMIC_RELAXED),
+           (unsigned long)__atomic_load_n(&http_errors, __ATOMIC_RELAXED));
+
+    size_t registered = __atomic_load_n(&threads_used, __ATOMIC_RELAXED);
+    if (registered > threads_size)
+    {
+        registered = threads_size;
+    }
+    size_t counts[NUM_LIVE_STATES] = {0};
+    APPEND(", \"threads\": [");
+    for (size_t i = 0; i < registered; ++i)
+    {
+        int state = __atomic_load_n(&threads[i].state, __ATOMIC_ACQUIRE);
+        uint64_t since = __atomic_load_n(&threads[i].since_ms, __ATOMIC_RELAXED);
+        ++counts[state];
+        APPEND("%s{\"role\": \"%s\", \"state\": \"%s\", \"for_ms\": %lu}", i == 0 ? "" : ", ",
+               threads[i].role != NULL ? threads[i].role : "", state_names[state],
+               (unsigned long)(now > since ? now - since : 0));
+    }
+    APPEND("], \"states\": {");
+    for (int s = 0; s < NUM_LIVE_STATES; ++s)
+    {
+        APPEND("%s\"%s\": %zu", s == 0 ? "" : ", ", state_names[s], counts[s]);
+    }
+    APPEND("}}\n");
+#undef APPEND
+
+    return len < size ? len : size - 1;
+}
+
+/**
+ * @brief stop serving live statistics: stop the stats thread and remove the socket
+ * @note only call once the crawl threads have exited
+ */
+void live_stats_cleanup()
+{
+    if (!enabled)
+    {
+        return;
+    }
+    enabled = false;
+
+    if (write(wake_pipe[1], "x", 1) == 1)
+    {
+        pthread_join(server_thread, NULL);
+    }
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    free(socket_path);
+    socket_path = NULL;
+
+    free(threads);
+    threads = NULL;
+    threads_size = 0;
+    threads_used = 0;
+}
@@ -0,0 +1,49 @@
+/*
+Live crawl statistics served on a local Unix-domain socket while the crawl runs
+*/
+
+#ifndef LIVE_STATS_H
+#define LIVE_STATS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LIVE_TICK_MS 1000   /* how often the stats thread records counters for the current rates */
+#define LIVE_RATE_TICKS 5   /* current rates are averaged over this many ticks */
+#define LIVE_REPLY_SIZE 65536
+
+// what a thread is doing
+#define LIVE_IDLE 0     /* between urls */
+#define LIVE_WAITING 1  /* waiting for a url (runners) or a page (parsers) */
+#define LIVE_FETCHING 2 /* downloading a url (and parsing it, unless in pipeline mode) */
+#define LIVE_QUEUEING 3 /* waiting for room in the parse queue */
+#define LIVE_PARSING 4  /* extracting links from a page */
+#define LIVE_EXITED 5
+#define NUM_LIVE_STATES 6
+
+// the state of one thread; written only by that thread
+typedef struct live_thread
+{
+    // "runner" or "parser"
+    const char *role;
+    // LIVE_* state
+    int state;
+    // when the state was entered (ms since the stats were enabled)
+    uint64_t since_ms;
+} LIVE_THREAD;
+
+int live_stats_enable(const char *path, size_t num_threads, int pngs_target);
+bool live_stats_enabled();
+void live_stats_register_thread(const char *role);
+void live_stats_set_state(int state);
+void live_stats_record_fetch(size_t bytes, long response_code);
+void live_stats_record_failure();
+void live_stats_set_frontier(size_t num_urls);
+void live_stats_set_pngs(size_t num_pngs);
+int live_stats_format(char *buf, size_t size);
+void live_stats_cleanup();
+
+#endif
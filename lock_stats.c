@@ -0,0 +1,283 @@
+/*
+Optional lock-contention instrumentation and periodic sampling of the crawl state
+- lock_stats_lock tries the lock first, so an uncontended acquisition costs one
+  clock read; only a contended one is timed while it waits
+- every statistic of a lock is updated by the thread holding that lock, so the
+  statistics need no locking of their own
+- the sampler thread records the crawl state every LOCK_SAMPLE_INTERVAL_MS, so
+  lock contention can be read against how many threads were busy or waiting
+*/
+
+#include <time.h>
+#include "lock_stats.h"
+
+// samples taken so far
+static LOCK_SAMPLE *samples = NULL;
+static size_t samples_size = 0;
+static size_t samples_used = 0;
+// the sampler thread, and the callback it takes samples with
+static pthread_t sampler_thread;
+static void (*sample_fn)(LOCK_SAMPLE *) = NULL;
+// lock for stopping the sampler; also used for sampler_wake
+static pthread_mutex_t sampler_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when the sampler should stop
+static pthread_cond_t sampler_wake = PTHREAD_COND_INITIALIZER;
+static bool sampler_running = false;
+static bool sampler_stopping = false;
+
+/**
+ * @brief current time of the monotonic clock
+ * @return time in ns
+ */
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief initialize the statistics of a lock
+ * @param s LOCK_STATS*: (pointer to) the statistics
+ * @param name const char*: name of the lock to print
+ */
+void init_lock_stats(LOCK_STATS *s, const char *name)
+{
+    memset(s, 0, sizeof(LOCK_STATS));
+    s->name = name;
+}
+
+/**
+ * @brief acquire a lock, recording how long it took
+ * @param m pthread_mutex_t*: (pointer to) the lock
+ * @param s LOCK_STATS*: (pointer to) the statistics of the lock
+ * @return return value of pthread_mutex_lock
+ */
+int lock_stats_lock(pthread_mutex_t *m, LOCK_STATS *s)
+{
+    if (pthread_mutex_trylock(m) == 0)
+    {
+        s->acquired_at = now_ns();
+        ++s->acquisitions;
+        return 0;
+    }
+
+    uint64_t start = now_ns();
+    int ret = pthread_mutex_lock(m);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    s->acquired_at = now_ns();
+    uint64_t wait = s->acquired_at - start;
+    ++s->acquisitions;
+    ++s->contended;
+    s->wait_ns += wait;
+    if (wait > s->max_wait_ns)
+    {
+        s->max_wait_ns = wait;
+    }
+    return 0;
+}
+
+/**
+ * @brief record how long a lock was held
+ * @param s LOCK_STATS*: (pointer to) the statistics of the lock
+ * @param released_at uint64_t: when the lock is released (ns)
+ */
+static void record_hold(LOCK_STATS *s, uint64_t released_at)
+{
+    uint64_t hold = released_at - s->acquired_at;
+    s->hold_ns += hold;
+    if (hold > s->max_hold_ns)
+    {
+        s->max_hold_ns = hold;
+    }
+}
+
+/**
+ * @brief release a lock, recording how long it was held
+ * @param m pthread_mutex_t*: (pointer to) the lock
+ * @param s LOCK_STATS*: (pointer to) the statistics of the lock
+ * @return return value of pthread_mutex_unlock
+ */
+int lock_stats_unlock(pthread_mutex_t *m, LOCK_STATS *s)
+{
+    record_hold(s, now_ns());
+    return pthread_mutex_unlock(m);
+}
+
+/**
+ * @brief wait on a condition variable, recording the wait
+ * @param c pthread_cond_t*: (pointer to) the condition variable
+ * @param m pthread_mutex_t*: (pointer to) the lock, held by the caller
+ * @param s LOCK_STATS*: (pointer to) the statistics of the lock
+ * @return return value of pthread_cond_wait
+ * @details
+ * The lock is released for the wait, so the hold before the wait is recorded,
+ *  and the time until the lock is re-acquired counts as condition wait
+ *  (not as lock wait).
+ */
+int lock_stats_cond_wait(pthread_cond_t *c, pthread_mutex_t *m, LOCK_STATS *s)
+{
+    uint64_t start = now_ns();
+    record_hold(s, start);
+    int ret = pthread_cond_wait(c, m);
+    s->acquired_at = now_ns();
+    ++s->cond_waits;
+    s->cond_wait_ns += s->acquired_at - start;
+    return ret;
+}
+
+/**
+ * @brief print the statistics of a lock
+ * @param s LOCK_STATS*: (pointer to) the statistics
+ * @note only call once no thread uses the lock
+ */
+void print_lock_stats(LOCK_STATS *s)
+{
+    printf("locks: %s: %lu acquisitions, %lu contended (%.1f%%), wait total %.3f ms max %.3f ms, "
+           "hold total %.3f ms mean %.3f us max %.3f ms, %lu condition waits %.3f ms\n",
+           s->name, (unsigned long)s->acquisitions, (unsigned long)s->contended,
+           s->acquisitions > 0 ? 100. * s->contended / s->acquisitions : 0.,
+           s->wait_ns / 1e6, s->max_wait_ns / 1e6,
+           s->hold_ns / 1e6, s->acquisitions > 0 ? s->hold_ns / 1e3 / s->acquisitions : 0.,
+           s->max_hold_ns / 1e6, (unsigned long)s->cond_waits, s->cond_wait_ns / 1e6);
+}
+
+/**
+ * @brief sampler thread: take a sample every LOCK_SAMPLE_INTERVAL_MS until stopped
+ * @param _ void*: not used; only defined to satisfy thread API
+ * @return NULL
+ */
+static void *sampler(void *_)
+{
+    uint64_t start = now_ns();
+
+    pthread_mutex_lock(&sampler_mutex);
+    while (!sampler_stopping)
+    {
+        if (samples_used == samples_size)
+        {
+            size_t new_size = samples_size == 0 ? LOCK_SAMPLES_INITIAL_SIZE : 2 * samples_size;
+            LOCK_SAMPLE *new_samples = realloc(samples, new_size * sizeof(LOCK_SAMPLE));
+            if (new_samples == NULL)
+            {
+                break;
+            }
+            samples = new_samples;
+            samples_size = new_size;
+        }
+        LOCK_SAMPLE *sample = &samples[samples_used++];
+        memset(sample, 0, sizeof(LOCK_SAMPLE));
+        sample->ms = (now_ns() - start) / 1000000;
+        sample_fn(sample);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOCK_SAMPLE_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (!sampler_stopping &&
+               pthread_cond_timedwait(&sampler_wake, &sampler_mutex, &deadline) == 0)
+        {
+        }
+    }
+    pthread_mutex_unlock(&sampler_mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief start the sampler thread
+ * @param sample void (*)(LOCK_SAMPLE *): callback filling in a sample (its ms field is already set)
+ * @return 0 on success; 1 otherwise
+ */
+int start_lock_sampler(void (*sample)(LOCK_SAMPLE *))
+{
+    sample_fn = sample;
+    sampler_stopping = false;
+    if (pthread_create(&sampler_thread, NULL, sampler, NULL) != 0)
+    {
+        return 1;
+    }
+    sampler_running = true;
+    return 0;
+}
+
+/**
+ * @brief stop the sampler thread and wait for it to exit
+ */
+void stop_lock_sampler()
+{
+    if (!sampler_running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&sampler_mutex);
+    {
+        sampler_stopping = true;
+        pthread_cond_signal(&sampler_wake);
+    }
+    pthread_mutex_unlock(&sampler_mutex);
+    pthread_join(sampler_thread, NULL);
+    sampler_running = false;
+}
+
+/**
+ * @brief print the mean and max of each sampled value
+ * @note only call once the sampler is stopped
+ */
+void print_lock_samples()
+{
+    if (samples_used == 0)
+    {
+        return;
+    }
+
+    size_t sum[5] = {0}, max[5] = {0};
+    for (size_t i = 0; i < samples_used; ++i)
+    {
+        size_t values[5] = {samples[i].frontier, samples[i].running, samples[i].waiting,
+                            samples[i].visited, samples[i].parse_queue};
+        for (int k = 0; k < 5; ++k)
+        {
+            sum[k] += values[k];
+            max[k] = values[k] > max[k] ? values[k] : max[k];
+        }
+    }
+    printf("locks: %zu samples every %d ms (mean/max): frontier %.1f/%zu, running %.1f/%zu, "
+           "waiting on url %.1f/%zu, visited %.1f/%zu, parse queue %.1f/%zu\n",
+           samples_used, LOCK_SAMPLE_INTERVAL_MS,
+           (double)sum[0] / samples_used, max[0], (double)sum[1] / samples_used, max[1],
+           (double)sum[2] / samples_used, max[2], (double)sum[3] / samples_used, max[3],
+           (double)sum[4] / samples_used, max[4]);
+}
+
+/**
+ * @brief write the samples, one line per sample, and free them
+ * @param path const char*: path of the file to write
+ * @return 0 on success; 1 otherwise
+ * @note only call once the sampler is stopped
+ */
+int write_lock_samples(const char *path)
+{
+    FILE *f = fopen(path, "w+");
+    if (f == NULL)
+    {
+        return 1;
+    }
+    fprintf(f, "ms frontier running waiting visited parse_queue\n");
+    for (size_t i = 0; i < samples_used; ++i)
+    {
+        fprintf(f, "%lu %zu %zu %zu %zu %zu\n", (unsigned long)samples[i].ms, samples[i].frontier,
+                samples[i].running, samples[i].waiting, samples[i].visited, samples[i].parse_queue);
+    }
+    fclose(f);
+
+    free(samples);
+    samples = NULL;
+    samples_size = 0;
+    samples_used = 0;
+    return 0;
+}
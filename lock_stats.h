@@ -0,0 +1,80 @@
+/*
+Optional lock-contention instrumentation and periodic sampling of the crawl state
+- build with `make LOCK_STATS=1` to route the crawl locks through the wrappers below;
+  otherwise LOCK_MUTEX, UNLOCK_MUTEX and WAIT_COND are plain pthread calls
+*/
+
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define LOCK_SAMPLE_INTERVAL_MS 100 /* how often the crawl state is sampled */
+#define LOCK_SAMPLES_INITIAL_SIZE 1024
+#define LOCK_SAMPLES_FILE "./lock_samples.txt"
+
+// what happened to one lock; only updated by the thread holding the lock
+typedef struct lock_stats
+{
+    // name of the lock
+    const char *name;
+    // number of times the lock was acquired
+    uint64_t acquisitions;
+    // number of acquisitions that found the lock held by another thread
+    uint64_t contended;
+    // time spent waiting to acquire the lock (ns)
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    // time the lock was held (ns)
+    uint64_t hold_ns;
+    uint64_t max_hold_ns;
+    // number of condition waits on the lock, and time spent in them (ns)
+    uint64_t cond_waits;
+    uint64_t cond_wait_ns;
+    // when the lock was last acquired (ns)
+    uint64_t acquired_at;
+} LOCK_STATS;
+
+// the state of the crawl at one point in time
+typedef struct lock_sample
+{
+    // time since the sampler started (ms)
+    uint64_t ms;
+    // urls in the frontier
+    size_t frontier;
+    // threads processing a url
+    size_t running;
+    // threads waiting for a non-empty frontier
+    size_t waiting;
+    // urls visited
+    size_t visited;
+    // pages waiting in the parse queue (pipeline mode)
+    size_t parse_queue;
+} LOCK_SAMPLE;
+
+#ifdef WITH_LOCK_STATS
+#define LOCK_MUTEX(m) lock_stats_lock(&(m), &(m##_stats))
+#define UNLOCK_MUTEX(m) lock_stats_unlock(&(m), &(m##_stats))
+#define WAIT_COND(c, m) lock_stats_cond_wait(&(c), &(m), &(m##_stats))
+#else
+#define LOCK_MUTEX(m) pthread_mutex_lock(&(m))
+#define UNLOCK_MUTEX(m) pthread_mutex_unlock(&(m))
+#define WAIT_COND(c, m) pthread_cond_wait(&(c), &(m))
+#endif
+
+void init_lock_stats(LOCK_STATS *s, const char *name);
+int lock_stats_lock(pthread_mutex_t *m, LOCK_STATS *s);
+int lock_stats_unlock(pthread_mutex_t *m, LOCK_STATS *s);
+int lock_stats_cond_wait(pthread_cond_t *c, pthread_mutex_t *m, LOCK_STATS *s);
+void print_lock_stats(LOCK_STATS *s);
+int start_lock_sampler(void (*sample)(LOCK_SAMPLE *));
+void stop_lock_sampler();
+void print_lock_samples();
+int write_lock_samples(const char *path);
+
+#endif
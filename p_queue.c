@@ -0,0 +1,182 @@
+/*
+A bounded blocking queue holding pointers
+- push blocks while the queue is full, which is how a producer stage is slowed
+  down to the pace of its consumers
+- pop blocks while the queue is empty, until it is closed
+*/
+
+#include "p_queue.h"
+
+/**
+ * @brief initialize queue with a fixed capacity
+ * @param p PQUEUE*: a pointer to uninitialized memory
+ * @param queue_size size_t: capacity of the queue
+ * @return 0 on success; 1 otherwise
+ */
+int init_pqueue(PQUEUE *p, size_t queue_size)
+{
+    if (p == NULL || queue_size == 0)
+    {
+        return 1;
+    }
+
+    p->size = queue_size;
+    p->head = 0;
+    p->count = 0;
+    p->items = (void **)malloc(queue_size * sizeof(void *));
+    memset(p->items, 0, queue_size * sizeof(void *));
+    p->closed = false;
+    p->max_count = 0;
+    p->num_push_waits = 0;
+    p->num_pop_waits = 0;
+
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->not_empty, NULL);
+    pthread_cond_init(&p->not_full, NULL);
+
+    return 0;
+}
+
+/**
+ * @brief push an item onto the back of the queue; wait while the queue is full
+ * @param p PQUEUE*: (pointer to) the queue the function will push item onto
+ * @param item void*: pointer to push
+ * @return 0 on success; 1 otherwise (including if the queue is closed)
+ */
+int push_pqueue(PQUEUE *p, void *item)
+{
+    if (p == NULL)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    {
+        if (p->count == p->size && !p->closed)
+        {
+            ++p->num_push_waits;
+        }
+        while (p->count == p->size && !p->closed)
+        {
+            pthread_cond_wait(&p->not_full, &p->mutex);
+        }
+        if (p->closed)
+        {
+            pthread_mutex_unlock(&p->mutex);
+            return 1;
+        }
+
+        p->items[(p->head + p->count) % p->size] = item;
+        ++p->count;
+        if (p->count > p->max_count)
+        {
+            p->max_count = p->count;
+        }
+        pthread_cond_signal(&p->not_empty);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    return 0;
+}
+
+/**
+ * @brief pop the item at the front of the queue; wait while the queue is empty
+ * @param p PQUEUE*: (pointer to) the queue the function will pop from
+ * @param p_item void**: pointer that will be populated with popped item
+ * @return 0 on success; 1 if the queue is closed and empty
+ */
+int pop_pqueue(PQUEUE *p, void **p_item)
+{
+    if (p == NULL)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    {
+        if (p->count == 0 && !p->closed)
+        {
+            ++p->num_pop_waits;
+        }
+        while (p->count == 0 && !p->closed)
+        {
+            pthread_cond_wait(&p->not_empty, &p->mutex);
+        }
+        if (p->count == 0)
+        {
+            pthread_mutex_unlock(&p->mutex);
+            return 1;
+        }
+
+        *p_item = p->items[p->head];
+        p->items[p->head] = NULL;
+        p->head = (p->head + 1) % p->size;
+        --p->count;
+        pthread_cond_signal(&p->not_full);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    return 0;
+}
+
+/**
+ * @brief close the queue: wake every waiting thread; pops drain the remaining items
+ * @param p PQUEUE*: (pointer to) the queue to close
+ * @return 0 on success; 1 otherwise
+ */
+int close_pqueue(PQUEUE *p)
+{
+    if (p == NULL)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    {
+        p->closed = true;
+        pthread_cond_broadcast(&p->not_empty);
+        pthread_cond_broadcast(&p->not_full);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    return 0;
+}
+
+/**
+ * @brief returns number of items currently in the queue
+ * @param p PQUEUE*: (pointer to) the queue
+ * @return number of items in the queue
+ */
+size_t num_elements_pqueue(PQUEUE *p)
+{
+    size_t count;
+
+    pthread_mutex_lock(&p->mutex);
+    count = p->count;
+    pthread_mutex_unlock(&p->mutex);
+
+    return count;
+}
+
+/**
+ * @brief deconstruct queue: free the ring buffer and synchronization variables
+ * @param p PQUEUE*: (pointer to) the queue to deconstruct
+ * @return 0 on success; 1 otherwise
+ * @note items still in the queue are not deallocated; pop them first
+ */
+int cleanup_pqueue(PQUEUE *p)
+{
+    if (p == NULL || p->items == NULL)
+    {
+        return 0;
+    }
+
+    free(p->items);
+    p->items = NULL;
+
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->not_empty);
+    pthread_cond_destroy(&p->not_full);
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+A bounded blocking queue holding pointers
+*/
+
+#ifndef P_QUEUE_H
+#define P_QUEUE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct p_queue_struct
+{
+    // max number of items held before push blocks
+    size_t size;
+    // position of the oldest item
+    size_t head;
+    // number of items currently in the queue
+    size_t count;
+    // ring buffer of items
+    void **items;
+    // whether the queue was closed (no more items will be pushed)
+    bool closed;
+    // largest number of items the queue has held
+    size_t max_count;
+    // number of pushes that had to wait for space (producer backpressure)
+    size_t num_push_waits;
+    // number of pops that had to wait for an item (consumer starvation)
+    size_t num_pop_waits;
+    // lock for all of the above
+    pthread_mutex_t mutex;
+    // signalled when an item is pushed or the queue is closed
+    pthread_cond_t not_empty;
+    // signalled when an item is popped
+    pthread_cond_t not_full;
+} PQUEUE;
+
+int init_pqueue(PQUEUE *p, size_t queue_size);
+int push_pqueue(PQUEUE *p, void *item);
+int pop_pqueue(PQUEUE *p, void **p_item);
+int close_pqueue(PQUEUE *p);
+size_t num_elements_pqueue(PQUEUE *p);
+int cleanup_pqueue(PQUEUE *p);
+
+#endif
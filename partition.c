@@ -0,0 +1,971 @@
+/*
+Host-partitioned crawling across several findpng2 instances
+- every instance is started with the same list of instance addresses (--peers) and its own
+  index in it (--node); an instance owns the urls whose host hashes (XXH64) to its index
+- urls found on pages that belong to other instances are taken out of the found stacks,
+  deduplicated per peer (each url is forwarded once) and appended to the peer's batch;
+  a sender thread compresses each batch with zlib and sends it every PARTITION_FLUSH_MS
+- a receiver thread accepts the other instances' connections and pushes the urls they
+  forward onto the frontier (the visited set still dedups them against local urls)
+- termination: node 0 probes every instance every PARTITION_PROBE_MS for whether it is idle
+  and how many urls it forwarded and received (a four-counter wave): the crawl is finished
+  once two waves in a row find every instance idle, with as many urls received as forwarded
+  and the same counts in both waves; node 0 then tells every instance to stop
+- -m: every instance sends node 0 its png count whenever it grows (every PARTITION_FLUSH_MS),
+  and node 0 stops every instance as soon as the counts add up to -m. pngs found while the
+  stop is on its way are not kept: with the stop, node 0 sends each instance its share of
+  -m (the counts it summed, cut at -m in node order), and the instance keeps that many
+*/
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <zlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "content_hash.h"
+#include "frontier.h"
+#include "partition.h"
+
+// whether partition_enable was called
+static bool enabled = false;
+static int num_nodes = 0;
+static int self = 0;
+static int pngs_to_find = 0;
+static PARTITION_HOOKS hooks;
+static PARTITION_PEER peers[PARTITION_MAX_NODES];
+static int listen_fd = -1;
+static pthread_t sender_thread;
+static pthread_t receiver_thread;
+// set once every instance is finished (or on a fatal error)
+static bool stopped = false;
+static bool failed = false;
+static PARTITION_STATS stats;
+// urls forwarded to and received from other instances (the counters of the termination waves)
+static uint64_t num_sent = 0;
+static uint64_t num_received = 0;
+// latest probe from node 0 to answer
+static uint32_t probe_round = 0;
+// how many of its pngs this instance keeps (set by node 0's DONE; PARTITION_ALL_PNGS until then)
+static uint64_t png_share = PARTITION_ALL_PNGS;
+
+/* -- Termination waves (node 0) -- */
+// the wave in progress: which instances answered, and what they answered
+static uint32_t wave = 0;
+static int num_answered = 0;
+static bool answered[PARTITION_MAX_NODES];
+static PARTITION_MSG answers[PARTITION_MAX_NODES];
+// totals of the last complete wave (valid if last_idle)
+static bool last_idle = false;
+static uint64_t last_sent = 0;
+static uint64_t last_received = 0;
+// latest png count of every instance (node 0's own is read when summed)
+static uint64_t node_pngs[PARTITION_MAX_NODES];
+// set once a wave found the crawl finished, or the png counts reached -m
+static bool finished = false;
+// lock for the wave state (written by the receiver and the sender thread)
+static pthread_mutex_t wave_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* ----------------- */
+
+/**
+ * @brief current time
+ * @return ms on the monotonic clock
+ */
+static uint64_t clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief instance that owns a url
+ * @param url const char*: the url
+ * @return index of the owner
+ * @details
+ * Hashes the host (with port, lower case); a url without "://" belongs to this instance.
+ */
+static int owner(const char *url)
+{
+    const char *host = strstr(url, "://");
+    if (host == NULL)
+    {
+        return self;
+    }
+    host += 3;
+    size_t len = strcspn(host, "/?#");
+    char lower[256];
+    if (len >= sizeof(lower))
+    {
+        len = sizeof(lower) - 1;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        lower[i] = tolower((unsigned char)host[i]);
+    }
+    return xxh64(lower, len, 0) % num_nodes;
+}
+
+/* -- Socket helpers -- */
+/**
+ * @brief send all of a buffer
+ * @return 0 on success; 1 otherwise
+ */
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        // MSG_NOSIGNAL: an instance that already stopped is an error, not a SIGPIPE
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief receive exactly len bytes
+ * @return 0 on success; 1 on error or if the connection was closed
+ */
+static int recv_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief send a message to a peer
+ * @param node int: the peer
+ * @param msg PARTITION_MSG*: (pointer to) the header; node and len are filled in
+ * @param payload const void*: bytes following the header
+ * @param len size_t: number of bytes following the header
+ * @return 0 on success; 1 otherwise
+ */
+static int send_msg(int node, PARTITION_MSG *msg, const void *payload, size_t len)
+{
+    msg->node = self;
+    msg->len = len;
+    if (send_all(peers[node].fd, msg, sizeof(PARTITION_MSG)) != 0 || (len > 0 && send_all(peers[node].fd, payload, len) != 0))
+    {
+        fprintf(stderr, "partition: sending to node %d failed: %s\n", node, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief try to connect to a peer
+ * @param node int: the peer
+ * @return 0 if connected; 1 otherwise (the peer may not be up yet)
+ */
+static int connect_peer(int node)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(peers[node].host, peers[node].port, &hints, &res) != 0)
+    {
+        return 1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    peers[node].fd = fd;
+    return 0;
+}
+/* ----------------- */
+
+/**
+ * @brief end this instance's crawl
+ * @param error bool: whether it ends because of an error
+ */
+static void stop(bool error)
+{
+    // errors after the end (e.g. a peer that closed its connections first) don't matter
+    if (error && !__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&failed, true, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&stopped, true, __ATOMIC_RELEASE);
+    hooks.finish();
+}
+
+/**
+ * @brief this instance's answer to a probe
+ * @param msg PARTITION_MSG*: (pointer to) the STATUS message to fill in
+ * @param round uint32_t: the probe answered
+ * @details
+ * Whether the instance is idle is read before the counters, so a url received
+ *  after it looked idle is counted (and shows up as work in the next wave).
+ */
+static void get_status(PARTITION_MSG *msg, uint32_t round)
+{
+    memset(msg, 0, sizeof(PARTITION_MSG));
+    msg->type = PARTITION_MSG_STATUS;
+    msg->node = self;
+    msg->round = round;
+    msg->idle = hooks.idle();
+    msg->sent = __atomic_load_n(&num_sent, __ATOMIC_ACQUIRE);
+    msg->received = __atomic_load_n(&num_received, __ATOMIC_ACQUIRE);
+    msg->pngs = hooks.pngs();
+}
+
+/**
+ * @brief record an answer to the wave in progress (node 0)
+ * @param msg const PARTITION_MSG*: (pointer to) the STATUS message
+ * @details
+ * Sets finished once a complete wave shows the crawl is finished.
+ */
+static void record_answer(const PARTITION_MSG *msg)
+{
+    pthread_mutex_lock(&wave_mutex);
+    {
+        if (msg->round == wave && msg->node < num_nodes && !answered[msg->node])
+        {
+            answered[msg->node] = true;
+            answers[msg->node] = *msg;
+            ++num_answered;
+        }
+        if (msg->node < num_nodes && msg->pngs > node_pngs[msg->node])
+        {
+            node_pngs[msg->node] = msg->pngs;
+        }
+        if (num_answered == num_nodes)
+        {
+            bool idle = true;
+            uint64_t sent = 0, received = 0;
+            for (int i = 0; i < num_nodes; ++i)
+            {
+                idle = idle && answers[i].idle;
+                sent += answers[i].sent;
+                received += answers[i].received;
+            }
+            // two idle waves that agree on the counts: no url is in flight and none will be
+            if (idle && sent == received && last_idle && last_sent == sent && last_received == received)
+            {
+                __atomic_store_n(&finished, true, __ATOMIC_RELEASE);
+            }
+            last_idle = idle;
+            last_sent = sent;
+            last_received = received;
+        }
+    }
+    pthread_mutex_unlock(&wave_mutex);
+}
+
+/**
+ * @brief record an instance's png count (node 0)
+ * @param node int: the instance
+ * @param pngs uint64_t: pngs it found so far
+ * @details
+ * Sets finished once the counts of all instances add up to -m.
+ */
+static void record_pngs(int node, uint64_t pngs)
+{
+    pthread_mutex_lock(&wave_mutex);
+    {
+        if (node < num_nodes && pngs > node_pngs[node])
+        {
+            node_pngs[node] = pngs;
+        }
+        uint64_t total = 0;
+        for (int i = 0; i < num_nodes; ++i)
+        {
+            total += node_pngs[i];
+        }
+        if (total >= (uint64_t)pngs_to_find)
+        {
+            __atomic_store_n(&finished, true, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&wave_mutex);
+}
+
+/**
+ * @brief each instance's share of -m, from the latest png counts (node 0)
+ * @param shares uint64_t*: (pointer to) num_nodes shares to fill in
+ * @details
+ * If the counts add up to -m, the first instances keep all their pngs and the one that
+ *  reaches -m keeps the rest (later ones none); otherwise every instance keeps them all.
+ */
+static void get_png_shares(uint64_t *shares)
+{
+    record_pngs(self, hooks.pngs());
+    pthread_mutex_lock(&wave_mutex);
+    {
+        uint64_t left = pngs_to_find;
+        uint64_t total = 0;
+        for (int i = 0; i < num_nodes; ++i)
+        {
+            total += node_pngs[i];
+        }
+        for (int i = 0; i < num_nodes; ++i)
+        {
+            shares[i] = total < (uint64_t)pngs_to_find ? PARTITION_ALL_PNGS
+                                                       : (node_pngs[i] < left ? node_pngs[i] : left);
+            if (shares[i] != PARTITION_ALL_PNGS)
+            {
+                left -= shares[i];
+            }
+        }
+    }
+    pthread_mutex_unlock(&wave_mutex);
+}
+
+/**
+ * @brief start the next wave: probe every instance (node 0)
+ * @details
+ * Only starts a new wave once the last one is complete.
+ */
+static void start_wave()
+{
+    uint32_t round;
+    pthread_mutex_lock(&wave_mutex);
+    {
+        if (wave > 0 && num_answered < num_nodes)
+        {
+            pthread_mutex_unlock(&wave_mutex);
+            return;
+        }
+        round = ++wave;
+        num_answered = 0;
+        memset(answered, 0, sizeof(answered));
+    }
+    pthread_mutex_unlock(&wave_mutex);
+
+    ++stats.probes;
+    for (int i = 0; i < num_nodes; ++i)
+    {
+        if (i == self)
+        {
+            continue;
+        }
+        PARTITION_MSG msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.type = PARTITION_MSG_PROBE;
+        msg.round = round;
+        if (send_msg(i, &msg, NULL, 0) != 0)
+        {
+            stop(true);
+            return;
+        }
+    }
+    PARTITION_MSG own;
+    get_status(&own, round);
+    record_answer(&own);
+}
+
+/**
+ * @brief compress and send a peer's batch, if it has one
+ * @param node int: the peer
+ * @return 0 on success; 1 on error
+ */
+static int flush_batch(int node)
+{
+    PARTITION_PEER *peer = &peers[node];
+    char *batch;
+    size_t len;
+    uint32_t count;
+    pthread_mutex_lock(&peer->mutex);
+    {
+        batch = peer->batch;
+        len = peer->batch_len;
+        count = peer->batch_count;
+        peer->batch = NULL;
+        peer->batch_len = 0;
+        peer->batch_size = 0;
+        peer->batch_count = 0;
+    }
+    pthread_mutex_unlock(&peer->mutex);
+    if (count == 0)
+    {
+        free(batch);
+        return 0;
+    }
+
+    uLongf compressed_len = compressBound(len);
+    Bytef *compressed = malloc(compressed_len);
+    if (compressed == NULL || compress2(compressed, &compressed_len, (Bytef *)batch, len, Z_BEST_SPEED) != Z_OK)
+    {
+        fprintf(stderr, "partition: compressing a batch for node %d failed\n", node);
+        free(compressed);
+        free(batch);
+        return 1;
+    }
+    PARTITION_MSG msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = PARTITION_MSG_URLS;
+    msg.count = count;
+    msg.raw_len = len;
+    int ret = send_msg(node, &msg, compressed, compressed_len);
+    if (ret == 0)
+    {
+        ++stats.batches;
+        stats.raw_bytes += len;
+        stats.compressed_bytes += compressed_len;
+    }
+    free(compressed);
+    free(batch);
+    return ret;
+}
+
+/**
+ * @brief sender thread: connects to the peers, sends batches and status answers, and runs the waves on node 0
+ * @param _ void*: not used
+ * @return NULL
+ */
+static void *sender_main(void *_)
+{
+    uint64_t start = clock_ms();
+    uint64_t last_wave = 0;
+    uint32_t answered_round = 0;
+    uint64_t reported_pngs = 0;
+    while (!__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
+    {
+        usleep(PARTITION_FLUSH_MS * 1000);
+
+        /* -- Connect to the peers not up before -- */
+        bool connected = true;
+        for (int i = 0; i < num_nodes; ++i)
+        {
+            if (i != self && peers[i].fd < 0 && connect_peer(i) != 0)
+            {
+                connected = false;
+            }
+        }
+        if (!connected)
+        {
+            if (clock_ms() - start > PARTITION_CONNECT_TIMEOUT_MS)
+            {
+                fprintf(stderr, "partition: could not connect to every peer in %d ms\n", PARTITION_CONNECT_TIMEOUT_MS);
+                stop(true);
+            }
+            continue;
+        }
+        /* ----------------- */
+
+        /* -- Send the batches -- */
+        for (int i = 0; i < num_nodes; ++i)
+        {
+            if (i != self && flush_batch(i) != 0)
+            {
+                stop(true);
+                break;
+            }
+        }
+        /* ----------------- */
+
+        /* -- Answer node 0's latest probe (after the batches, which it counts) -- */
+        uint32_t round = __atomic_load_n(&probe_round, __ATOMIC_ACQUIRE);
+        if (self != 0 && round != answered_round)
+        {
+            PARTITION_MSG msg;
+            get_status(&msg, round);
+            if (send_msg(0, &msg, NULL, 0) != 0)
+            {
+                stop(true);
+            }
+            answered_round = round;
+        }
+        /* ----------------- */
+
+        /* -- Tell node 0 how many pngs this instance found, as soon as that grows -- */
+        uint64_t pngs = hooks.pngs();
+        if (pngs > reported_pngs)
+        {
+            if (self == 0)
+            {
+                record_pngs(self, pngs);
+            }
+            else
+            {
+                PARTITION_MSG msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.type = PARTITION_MSG_PNGS;
+                msg.node = self;
+                msg.pngs = pngs;
+                if (send_msg(0, &msg, NULL, 0) != 0)
+                {
+                    stop(true);
+                }
+            }
+            reported_pngs = pngs;
+        }
+        /* ----------------- */
+
+        /* -- Node 0: probe every instance; stop them all once finished -- */
+        if (self == 0 && __atomic_load_n(&finished, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        if (self == 0 && clock_ms() - last_wave >= PARTITION_PROBE_MS)
+        {
+            last_wave = clock_ms();
+            start_wave();
+        }
+        /* ----------------- */
+    }
+
+    if (self == 0 && !__atomic_load_n(&failed, __ATOMIC_ACQUIRE))
+    {
+        uint64_t shares[PARTITION_MAX_NODES];
+        get_png_shares(shares);
+        for (int i = 1; i < num_nodes; ++i)
+        {
+            PARTITION_MSG msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.type = PARTITION_MSG_DONE;
+            msg.pngs = shares[i];
+            send_msg(i, &msg, NULL, 0);
+        }
+        png_share = shares[0];
+        stop(false);
+    }
+    return NULL;
+}
+
+/**
+ * @brief handle a batch of urls forwarded by a peer
+ * @param msg const PARTITION_MSG*: (pointer to) the header
+ * @param payload const char*: the compressed batch
+ * @return 0 on success; 1 if the batch is malformed
+ */
+static int receive_batch(const PARTITION_MSG *msg, const char *payload)
+{
+    uLongf raw_len = msg->raw_len;
+    char *raw = malloc(raw_len + 1);
+    if (raw == NULL || uncompress((Bytef *)raw, &raw_len, (const Bytef *)payload, msg->len) != Z_OK)
+    {
+        free(raw);
+        return 1;
+    }
+    raw[raw_len] = '\0';
+
+    STACK urls, imgs;
+    init_stack(&urls, 1);
+    init_stack(&imgs, 1);
+    char *save = NULL;
+    for (char *line = strtok_r(raw, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+    {
+        if (strlen(line) > 2)
+        {
+            push_stack(line[0] == 'I' ? &imgs : &urls, line + 2);
+        }
+    }
+    hooks.push(&urls, &imgs);
+    cleanup_stack(&urls);
+    cleanup_stack(&imgs);
+    free(raw);
+
+    // counted once on the frontier, so the url is never both uncounted and out of sight
+    __atomic_add_fetch(&num_received, msg->count, __ATOMIC_ACQ_REL);
+    return 0;
+}
+
+/**
+ * @brief receiver thread: accepts the peers' connections and handles their messages
+ * @param _ void*: not used
+ * @return NULL
+ * @details
+ * After the end it keeps reading until the peers close their connections (or for at
+ *  most PARTITION_CONNECT_TIMEOUT_MS), so no peer sends into a closed connection.
+ */
+static void *receiver_main(void *_)
+{
+    struct pollfd fds[PARTITION_MAX_NODES + 1];
+    int num_fds = 1;
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+
+    uint64_t stopped_at = 0;
+    while (true)
+    {
+        if (__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
+        {
+            if (stopped_at == 0)
+            {
+                stopped_at = clock_ms();
+            }
+            if (num_fds == 1 || clock_ms() - stopped_at > PARTITION_CONNECT_TIMEOUT_MS)
+            {
+                break;
+            }
+        }
+        if (poll(fds, num_fds, PARTITION_PROBE_MS) <= 0)
+        {
+            continue;
+        }
+
+        /* -- Accept a peer's connection -- */
+        if ((fds[0].revents & POLLIN) && num_fds < PARTITION_MAX_NODES + 1)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0)
+            {
+                fds[num_fds].fd = fd;
+                fds[num_fds].events = POLLIN;
+                fds[num_fds].revents = 0;
+                ++num_fds;
+            }
+        }
+        /* ----------------- */
+
+        /* -- Handle a message from each peer that sent one -- */
+        for (int i = 1; i < num_fds; ++i)
+        {
+            if (fds[i].revents == 0)
+            {
+                continue;
+            }
+            PARTITION_MSG msg;
+            char *payload = NULL;
+            bool ok = recv_all(fds[i].fd, &msg, sizeof(msg)) == 0;
+            if (ok && msg.len > 0)
+            {
+                payload = malloc(msg.len);
+                ok = payload != NULL && recv_all(fds[i].fd, payload, msg.len) == 0;
+            }
+            if (!ok)
+            {
+                // the peer closed its connection (it is done)
+                close(fds[i].fd);
+                fds[i] = fds[--num_fds];
+                --i;
+                free(payload);
+                continue;
+            }
+
+            switch (msg.type)
+            {
+            case PARTITION_MSG_URLS:
+                if (receive_batch(&msg, payload) != 0)
+                {
+                    fprintf(stderr, "partition: malformed batch from node %u\n", msg.node);
+                    stop(true);
+                }
+                break;
+            case PARTITION_MSG_PROBE:
+                __atomic_store_n(&probe_round, msg.round, __ATOMIC_RELEASE);
+                break;
+            case PARTITION_MSG_STATUS:
+                if (self == 0)
+                {
+                    // the sender thread ends the crawl if this completes a finished wave
+                    record_answer(&msg);
+                }
+                break;
+            case PARTITION_MSG_PNGS:
+                if (self == 0)
+                {
+                    // the sender thread ends the crawl if this reaches -m
+                    record_pngs(msg.node, msg.pngs);
+                }
+                break;
+            case PARTITION_MSG_DONE:
+                __atomic_store_n(&png_share, msg.pngs, __ATOMIC_RELEASE);
+                stop(false);
+                break;
+            }
+            free(payload);
+        }
+        /* ----------------- */
+    }
+
+    for (int i = 1; i < num_fds; ++i)
+    {
+        close(fds[i].fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief parse the list of instance addresses
+ * @param list const char*: "HOST:PORT,HOST:PORT,..."
+ * @return 0 on success; 1 if it is malformed
+ */
+static int parse_peers(const char *list)
+{
+    char *copy = strdup(list);
+    char *save = NULL;
+    num_nodes = 0;
+    for (char *addr = strtok_r(copy, ",", &save); addr != NULL; addr = strtok_r(NULL, ",", &save))
+    {
+        char *colon = strrchr(addr, ':');
+        if (colon == NULL || num_nodes == PARTITION_MAX_NODES)
+        {
+            free(copy);
+            return 1;
+        }
+        *colon = '\0';
+        peers[num_nodes].host = strdup(addr);
+        peers[num_nodes].port = strdup(colon + 1);
+        peers[num_nodes].fd = -1;
+        pthread_mutex_init(&peers[num_nodes].mutex, NULL);
+        ++num_nodes;
+    }
+    free(copy);
+    return num_nodes == 0 ? 1 : 0;
+}
+
+/**
+ * @brief start crawling the hosts this instance owns, exchanging urls with the other instances
+ * @param list const char*: addresses of all instances, "HOST:PORT,HOST:PORT,..." (the same on every instance)
+ * @param node int: index of this instance in the list (it listens on that address); node 0 detects termination
+ * @param num_pngs_to_find int: number of pngs all instances together find before stopping
+ * @param hook_fns const PARTITION_HOOKS*: (pointer to) what the partition needs from the crawl
+ * @return 0 on success; 1 otherwise
+ */
+int partition_enable(const char *list, int node, int num_pngs_to_find, const PARTITION_HOOKS *hook_fns)
+{
+    if (parse_peers(list) != 0 || node < 0 || node >= num_nodes)
+    {
+        fprintf(stderr, "partition: --node must index the HOST:PORT list of --peers\n");
+        return 1;
+    }
+    self = node;
+    pngs_to_find = num_pngs_to_find;
+    hooks = *hook_fns;
+    memset(&stats, 0, sizeof(stats));
+    memset(node_pngs, 0, sizeof(node_pngs));
+    png_share = PARTITION_ALL_PNGS;
+
+    /* -- Listen on this instance's address -- */
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(peers[self].host, peers[self].port, &hints, &res) != 0)
+    {
+        fprintf(stderr, "partition: can't resolve %s:%s\n", peers[self].host, peers[self].port);
+        return 1;
+    }
+    listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listen_fd < 0 || bind(listen_fd, res->ai_addr, res->ai_addrlen) != 0 || listen(listen_fd, PARTITION_MAX_NODES) != 0)
+    {
+        fprintf(stderr, "partition: listening on %s:%s failed: %s\n", peers[self].host, peers[self].port, strerror(errno));
+        freeaddrinfo(res);
+        return 1;
+    }
+    freeaddrinfo(res);
+    /* ----------------- */
+
+    enabled = true;
+    if (pthread_create(&receiver_thread, NULL, receiver_main, NULL) != 0 ||
+        pthread_create(&sender_thread, NULL, sender_main, NULL) != 0)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief whether the crawl is partitioned across instances
+ * @return true if partition_enable was called
+ */
+bool partition_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief whether this instance crawls a url
+ * @param url const char*: the url
+ * @return true if this instance owns the url's host (always, if not partitioned)
+ */
+bool partition_owns(const char *url)
+{
+    return !enabled || owner(url) == self;
+}
+
+/**
+ * @brief queue a url for the peer that owns it, unless it was forwarded to the peer before
+ * @param node int: the peer
+ * @param url const char*: the url
+ * @param lane int: LANE_PAGE or LANE_IMAGE
+ */
+static void forward(int node, const char *url, int lane)
+{
+    PARTITION_PEER *peer = &peers[node];
+    size_t len = strlen(url);
+    uint64_t key = xxh64(url, len, 0);
+    if (key == 0)
+    {
+        key = 1;
+    }
+
+    pthread_mutex_lock(&peer->mutex);
+    {
+        /* -- Skip urls forwarded before -- */
+        if (peer->seen_used >= peer->seen_size / 2)
+        {
+            size_t size = peer->seen_size == 0 ? PARTITION_SEEN_INITIAL_SIZE : peer->seen_size * 2;
+            uint64_t *seen = calloc(size, sizeof(uint64_t));
+            for (size_t i = 0; i < peer->seen_size; ++i)
+            {
+                if (peer->seen[i] != 0)
+                {
+                    size_t j = peer->seen[i] & (size - 1);
+                    while (seen[j] != 0)
+                    {
+                        j = (j + 1) & (size - 1);
+                    }
+                    seen[j] = peer->seen[i];
+                }
+            }
+            free(peer->seen);
+            peer->seen = seen;
+            peer->seen_size = size;
+        }
+        size_t i = key & (peer->seen_size - 1);
+        while (peer->seen[i] != 0 && peer->seen[i] != key)
+        {
+            i = (i + 1) & (peer->seen_size - 1);
+        }
+        if (peer->seen[i] == key)
+        {
+            __atomic_add_fetch(&stats.duplicates, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&peer->mutex);
+            return;
+        }
+        peer->seen[i] = key;
+        ++peer->seen_used;
+        /* ----------------- */
+
+        /* -- Append "P url\n" or "I url\n" to the batch -- */
+        if (peer->batch_len + len + 3 > peer->batch_size)
+        {
+            peer->batch_size = (peer->batch_len + len + 3) * 2;
+            peer->batch = realloc(peer->batch, peer->batch_size);
+        }
+        peer->batch[peer->batch_len++] = lane == LANE_IMAGE ? 'I' : 'P';
+        peer->batch[peer->batch_len++] = ' ';
+        memcpy(peer->batch + peer->batch_len, url, len);
+        peer->batch_len += len;
+        peer->batch[peer->batch_len++] = '\n';
+        ++peer->batch_count;
+        __atomic_add_fetch(&stats.forwarded, 1, __ATOMIC_RELAXED);
+        /* ----------------- */
+    }
+    pthread_mutex_unlock(&peer->mutex);
+    // counted before the page that found it finishes, so node 0 sees it in flight until received
+    __atomic_add_fetch(&num_sent, 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * @brief forward the urls other instances own to them, leaving this instance's urls in the stack
+ * @param urls STACK*: (pointer to) urls found on a page
+ * @param lane int: LANE_PAGE or LANE_IMAGE, the lane the urls go to
+ */
+void partition_route(STACK *urls, int lane)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    size_t n = num_elements_stack(urls);
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        int node = owner(urls->items[i]);
+        if (node == self)
+        {
+            char *url = urls->items[i];
+            urls->items[i] = NULL;
+            urls->items[kept++] = url;
+            continue;
+        }
+        forward(node, urls->items[i], lane);
+        free(urls->items[i]);
+        urls->items[i] = NULL;
+    }
+    // (size_t)-1 when none are kept, as for an empty stack
+    urls->pos = kept - 1;
+}
+
+/**
+ * @brief wait until every instance is finished, then close the connections
+ * @param stats_out PARTITION_STATS*: (pointer to) where to put the statistics (may be NULL)
+ * @return 0 on success; 1 if the partition failed (a peer could not be reached, or a send failed)
+ * @details
+ * Called once the runners exited, which they do once node 0 ended the crawl (or this
+ *  instance found -m pngs, after which it answers probes as idle until node 0 ends the crawl).
+ */
+int partition_stop(PARTITION_STATS *stats_out)
+{
+    if (!enabled)
+    {
+        return 0;
+    }
+    // the sender thread returns once the crawl ended
+    pthread_join(sender_thread, NULL);
+    // closing the connections to the peers lets their receiver threads return
+    for (int i = 0; i < num_nodes; ++i)
+    {
+        if (peers[i].fd >= 0)
+        {
+            close(peers[i].fd);
+        }
+    }
+    pthread_join(receiver_thread, NULL);
+
+    close(listen_fd);
+    for (int i = 0; i < num_nodes; ++i)
+    {
+        free(peers[i].host);
+        free(peers[i].port);
+        free(peers[i].batch);
+        free(peers[i].seen);
+        pthread_mutex_destroy(&peers[i].mutex);
+    }
+    memset(peers, 0, sizeof(peers));
+    enabled = false;
+
+    stats.received = num_received;
+    stats.png_share = png_share == PARTITION_ALL_PNGS ? -1 : (int64_t)png_share;
+    if (stats_out != NULL)
+    {
+        *stats_out = stats;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/*
+Host-partitioned crawling across several findpng2 instances: each instance owns the hosts that hash to it
+and forwards the urls it discovers on other instances' hosts to their owners over TCP
+*/
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "stack.h"
+
+#define PARTITION_MAX_NODES 64
+#define PARTITION_FLUSH_MS 20             /* batches of forwarded urls are sent at least this often */
+#define PARTITION_PROBE_MS 100            /* node 0 checks whether every instance is finished this often */
+#define PARTITION_CONNECT_TIMEOUT_MS 10000 /* how long to keep trying to connect to a peer that isn't up yet */
+#define PARTITION_SEEN_INITIAL_SIZE 1024
+
+// message types
+#define PARTITION_MSG_URLS 0   /* a batch of forwarded urls */
+#define PARTITION_MSG_PROBE 1  /* node 0 asks for a status */
+#define PARTITION_MSG_STATUS 2 /* an instance's answer to a probe */
+#define PARTITION_MSG_DONE 3   /* node 0 tells every instance the crawl is finished */
+#define PARTITION_MSG_PNGS 4   /* an instance tells node 0 how many pngs it found so far */
+#define PARTITION_ALL_PNGS UINT64_MAX /* DONE: the instance keeps every png it found */
+
+// header of every message, followed by len bytes; in the byte order of the machine
+//  (all instances are assumed to run on the same architecture)
+typedef struct partition_msg
+{
+    uint32_t type;
+    // instance that sent the message
+    uint32_t node;
+    // PROBE and STATUS: which probe
+    uint32_t round;
+    // STATUS: whether the instance had nothing left to crawl
+    uint32_t idle;
+    // STATUS: urls forwarded to and received from other instances, and pngs found
+    //  (PNGS: pngs found; DONE: how many of its pngs the instance keeps, or PARTITION_ALL_PNGS)
+    uint64_t sent;
+    uint64_t received;
+    uint64_t pngs;
+    // URLS: number of urls, and bytes before compression
+    uint32_t count;
+    uint32_t raw_len;
+    // bytes that follow the header
+    uint32_t len;
+    uint32_t pad;
+} PARTITION_MSG;
+
+// what the partition needs from the crawl
+typedef struct partition_hooks
+{
+    // push urls received from other instances onto the frontier (the stacks are emptied)
+    void (*push)(STACK *urls, STACK *imgs);
+    // whether the instance has nothing left to crawl (or is done)
+    bool (*idle)(void);
+    // number of pngs the instance found
+    int (*pngs)(void);
+    // end the instance's crawl (every instance is finished)
+    void (*finish)(void);
+} PARTITION_HOOKS;
+
+// another instance, and the urls waiting to be forwarded to it
+typedef struct partition_peer
+{
+    char *host;
+    char *port;
+    // connection used to send to the peer (-1 until connected)
+    int fd;
+    // "P url\n" (page lane) and "I url\n" (image lane) lines not yet sent
+    char *batch;
+    size_t batch_len;
+    size_t batch_size;
+    uint32_t batch_count;
+    // hashes of the urls forwarded to the peer (0 marks an empty slot), so each is sent once
+    uint64_t *seen;
+    size_t seen_size;
+    size_t seen_used;
+    // lock for batch and seen
+    pthread_mutex_t mutex;
+} PARTITION_PEER;
+
+typedef struct partition_stats
+{
+    // urls forwarded to other instances, and forwards skipped as already sent
+    uint64_t forwarded;
+    uint64_t duplicates;
+    // urls received from other instances
+    uint64_t received;
+    // batches sent, and their bytes before and after compression
+    uint64_t batches;
+    uint64_t raw_bytes;
+    uint64_t compressed_bytes;
+    // status probes node 0 sent (0 on the other instances)
+    uint64_t probes;
+    // how many of the pngs it found (the first ones) this instance keeps, so that all
+    //  instances together keep -m; -1 to keep them all (the crawl ended short of -m)
+    int64_t png_share;
+} PARTITION_STATS;
+
+int partition_enable(const char *peers, int node, int num_pngs_to_find, const PARTITION_HOOKS *hooks);
+bool partition_enabled();
+bool partition_owns(const char *url);
+void partition_route(STACK *urls, int lane);
+int partition_stop(PARTITION_STATS *stats);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Reader for binary crawl records (findpng2 --records=FILE --records-format=binary)
+- prints every record as a line of json, the same as --records-format=jsonl writes
+- or, with -s, a summary: records by kind and by status class, bytes, depths and fetch times
+*/
+
+#include <getopt.h>
+#include "crawl_records.h"
+
+#define MAX_DEPTH_PRINTED 32 /* deeper records are counted together in the summary */
+
+/**
+ * @brief print a summary of the records read
+ * @param kinds size_t*: records by RECORD_*
+ * @param statuses size_t*: records by status / 100 (0: no response)
+ * @param depths size_t*: records by depth (the last entry counts all deeper records and unknown depths)
+ * @param records size_t: number of records
+ * @param bytes uint64_t: bytes downloaded
+ * @param total_us uint64_t: sum of the total fetch times
+ */
+static void print_summary(size_t *kinds, size_t *statuses, size_t *depths, size_t records, uint64_t bytes, uint64_t total_us)
+{
+    printf("records: %zu, bytes: %lu, mean total time: %.3f ms\n", records, (unsigned long)bytes,
+           records > 0 ? total_us / 1000. / records : 0.);
+    for (int k = 0; k < NUM_RECORD_KINDS; ++k)
+    {
+        if (kinds[k] > 0)
+        {
+            printf("kind %-14s %zu\n", crawl_record_kind_name(k), kinds[k]);
+        }
+    }
+    for (int s = 0; s < 6; ++s)
+    {
+        if (statuses[s] > 0)
+        {
+            if (s == 0)
+            {
+                printf("status none        %zu\n", statuses[s]);
+            }
+            else
+            {
+                printf("status %dxx        %zu\n", s, statuses[s]);
+            }
+        }
+    }
+    for (int d = 0; d <= MAX_DEPTH_PRINTED; ++d)
+    {
+        if (depths[d] > 0)
+        {
+            if (d == MAX_DEPTH_PRINTED)
+            {
+                printf("depth >=%-2d/unknown %zu\n", MAX_DEPTH_PRINTED, depths[d]);
+            }
+            else
+            {
+                printf("depth %-12d %zu\n", d, depths[d]);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool summary = false;
+    int c;
+    while ((c = getopt(argc, argv, "s")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            summary = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s] RECORDS_FILE\n", argv[0]);
+            return -1;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-s] RECORDS_FILE\n", argv[0]);
+        return -1;
+    }
+
+    FILE *f = fopen(argv[optind], "r");
+    if (f == NULL)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    char magic[RECORDS_MAGIC_LEN];
+    if (fread(magic, 1, RECORDS_MAGIC_LEN, f) != RECORDS_MAGIC_LEN || memcmp(magic, RECORDS_MAGIC, RECORDS_MAGIC_LEN) != 0)
+    {
+        fprintf(stderr, "%s: not a binary records file\n", argv[optind]);
+        fclose(f);
+        return 1;
+    }
+
+    CRAWL_RECORD r;
+    char *strings = NULL;
+    size_t strings_size = 0;
+    size_t kinds[NUM_RECORD_KINDS] = {0};
+    size_t statuses[6] = {0};
+    size_t depths[MAX_DEPTH_PRINTED + 1] = {0};
+    size_t records = 0;
+    uint64_t bytes = 0, total_us = 0;
+    int ret;
+    while ((ret = crawl_record_read(f, &r, &strings, &strings_size)) == 0)
+    {
+        ++records;
+        if (!summary)
+        {
+            crawl_record_print_json(stdout, &r, strings, strings + r.url_len, strings + r.url_len + r.parent_len);
+            continue;
+        }
+        if (r.kind < NUM_RECORD_KINDS)
+        {
+            ++kinds[r.kind];
+        }
+        if (r.status >= 0 && r.status < 600)
+        {
+            ++statuses[r.status / 100];
+        }
+        ++depths[(r.depth < 0 || r.depth > MAX_DEPTH_PRINTED) ? MAX_DEPTH_PRINTED : r.depth];
+        bytes += r.bytes;
+        total_us += r.total_us;
+    }
+    if (ret == 2)
+    {
+        // e.g. the crawl was killed while the record was written
+        fprintf(stderr, "%s: record %zu is cut short; stopped reading\n", argv[optind], records + 1);
+    }
+    if (summary)
+    {
+        print_summary(kinds, statuses, depths, records, bytes, total_us);
+    }
+
+    free(strings);
+    fclose(f);
+    return ret == 2 ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/*
+Change-rate-aware recrawl (--recrawl)
+- time is counted in crawls made with the cache file: recrawls are assumed to run at a
+  regular interval (e.g. from cron), so a url last fetched k crawls ago is k intervals old
+- each url's changes are modeled as a Poisson process with its own rate. A url checked n
+  times after its first fetch, found changed X times (a 304 or the same body hash is
+  unchanged), over crawls first_crawl to last_crawl, gets the estimate
+      rate = -ln((n - X + 0.5) / (n + 0.5)) / I,  I = (last_crawl - first_crawl) / n
+  which accounts for several changes between two checks looking like one
+- urls fetched in a single crawl have no history and get the rate of all the others taken
+  together (the same estimate over their summed n, X and spans, plus a prior of half a change
+  over n + 1 intervals, so a cache never seen to change still has a rate above 0); a url never
+  seen to change still gets that rate divided by n + 1, so it ages instead of never being
+  fetched again
+- fetching a url now gains the probability it changed since last_crawl:
+      gain = 1 - exp(-rate * (crawl - last_crawl))
+  and the budget goes to the cached urls with the highest gains, which are pushed onto the
+  frontier's page lane lowest first, so the runners pop them highest first
+- a recrawl fetches its schedule only: links found on the pages fetched are not followed (nor
+  is the seed url), so the budget goes to the urls in gain order. Known urls are either
+  scheduled or not worth their fetch yet; new urls are found by crawls without --recrawl.
+  With an empty cache there is no schedule, and the recrawl crawls from the seed url
+- fetches are counted against the budget as runners take them off the frontier or start them
+  speculatively (a same-host batch counts each of its urls), so no fetch starts once the
+  budget is spent: the runners
+  busy then finish theirs, and the crawl ends. It also ends at -m pngs
+*/
+
+#include <math.h>
+#include "recrawl.h"
+
+static bool enabled = false;
+static RECRAWL_STATS stats;
+
+/**
+ * @brief estimate a change rate from checks
+ * @param n double: checks after the first fetch (> 0)
+ * @param x double: checks that found a change (<= n)
+ * @param interval double: crawls between two checks, on average (> 0)
+ * @return changes per crawl (>= 0; 0 if no change was found)
+ */
+static double estimate_rate(double n, double x, double interval)
+{
+    // -ln(1) is -0 when no change was found
+    double rate = -log((n - x + 0.5) / (n + 0.5)) / interval;
+    return rate > 0 ? rate : 0;
+}
+
+/**
+ * @brief estimated change rate of a url
+ * @param r const HTTP_CACHE_RECORD*: the url's cached record
+ * @param mean_rate double: change rate of all urls with a history taken together
+ * @return changes per crawl
+ */
+static double change_rate(const HTTP_CACHE_RECORD *r, double mean_rate)
+{
+    // fetched in a single crawl: no history yet
+    if (r->checks < 2 || r->last_crawl <= r->first_crawl)
+    {
+        return mean_rate;
+    }
+    double n = r->checks - 1;
+    double x = r->changes < n ? r->changes : n;
+    double rate = estimate_rate(n, x, (r->last_crawl - r->first_crawl) / n);
+    double floor = mean_rate / (n + 1);
+    return rate > floor ? rate : floor;
+}
+
+/**
+ * @brief order entries by decreasing gain, then least recently fetched first
+ * @param a const void*: (pointer to) an entry
+ * @param b const void*: (pointer to) an entry
+ * @return qsort's comparison result
+ */
+static int compare_gain(const void *a, const void *b)
+{
+    const RECRAWL_ENTRY *x = a;
+    const RECRAWL_ENTRY *y = b;
+    if (x->gain != y->gain)
+    {
+        return x->gain < y->gain ? 1 : -1;
+    }
+    return (x->record->last_crawl > y->record->last_crawl) - (x->record->last_crawl < y->record->last_crawl);
+}
+
+/**
+ * @brief schedule the cached urls most likely to have changed, and follow no links from now on
+ * @param budget size_t: most fetches the recrawl may make
+ * @param urls STACK*: (pointer to) stack the scheduled urls are pushed onto, least likely to have changed first
+ * @return 0 on success; 1 otherwise
+ * @note call after http_cache_open
+ */
+int recrawl_enable(size_t budget, STACK *urls)
+{
+    memset(&stats, 0, sizeof(RECRAWL_STATS));
+    stats.budget = budget;
+    uint32_t crawl = http_cache_crawl();
+    size_t num_slots = http_cache_num_slots();
+
+    // the change rate of all urls with a history taken together, for those without one
+    double n = 0;
+    double x = 0;
+    double span = 0;
+    for (size_t i = 0; i < num_slots; ++i)
+    {
+        const HTTP_CACHE_RECORD *r = http_cache_slot(i);
+        if (r == NULL)
+        {
+            continue;
+        }
+        ++stats.known;
+        if (r->checks >= 2 && r->last_crawl > r->first_crawl)
+        {
+            ++stats.rated;
+            n += r->checks - 1;
+            x += r->changes < r->checks - 1 ? r->changes : r->checks - 1;
+            span += r->last_crawl - r->first_crawl;
+        }
+    }
+    // with a prior of half a change over n + 1 intervals, so a cache never seen to change still ages
+    stats.mean_rate = stats.rated > 0 ? estimate_rate(n, x, span / n) + 0.5 / ((n + 1) * (span / n)) : RECRAWL_UNKNOWN_RATE;
+
+    RECRAWL_ENTRY *entries = malloc((stats.known > 0 ? stats.known : 1) * sizeof(RECRAWL_ENTRY));
+    if (entries == NULL)
+    {
+        return 1;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < num_slots; ++i)
+    {
+        const HTTP_CACHE_RECORD *r = http_cache_slot(i);
+        if (r == NULL)
+        {
+            continue;
+        }
+        entries[count].record = r;
+        entries[count].gain = 1 - exp(-change_rate(r, stats.mean_rate) * (double)(crawl - r->last_crawl));
+        stats.expected_all += entries[count].gain;
+        ++count;
+    }
+    qsort(entries, count, sizeof(RECRAWL_ENTRY), compare_gain);
+
+    stats.scheduled = count < budget ? count : budget;
+    for (size_t i = stats.scheduled; i > 0; --i)
+    {
+        stats.expected += entries[i - 1].gain;
+        push_stack(urls, (char *)http_cache_record_url(entries[i - 1].record));
+    }
+    free(entries);
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief check if the crawl is a recrawl
+ * @return true if recrawl_enable succeeded
+ */
+bool recrawl_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief check if the crawl follows links (and starts from the seed url)
+ * @return false in a recrawl with a schedule; true otherwise
+ */
+bool recrawl_follows_links()
+{
+    return !enabled || stats.known == 0;
+}
+
+/**
+ * @brief drop the links found on a page: a recrawl fetches its schedule only (if --recrawl)
+ * @param urls STACK*: (pointer to) the links; emptied unless recrawl_follows_links
+ */
+void recrawl_filter(STACK *urls)
+{
+    if (recrawl_follows_links())
+    {
+        return;
+    }
+    // from the top down, so removing a link moves nothing
+    for (size_t i = num_elements_stack(urls); i > 0; --i)
+    {
+        char *url;
+        if (remove_stack(urls, i - 1, &url) == 0)
+        {
+            free(url);
+            __atomic_add_fetch(&stats.skipped, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief number of fetches the budget has left (if --recrawl)
+ * @return the fetches left; SIZE_MAX if the crawl is not a recrawl
+ * @note the caller serializes this with recrawl_count_fetches (findpng2 holds frontier_mutex)
+ */
+size_t recrawl_fetches_left()
+{
+    if (!enabled)
+    {
+        return SIZE_MAX;
+    }
+    size_t fetched = __atomic_load_n(&stats.fetched, __ATOMIC_RELAXED);
+    return fetched < stats.budget ? stats.budget - fetched : 0;
+}
+
+/**
+ * @brief count fetches against the budget before they start (if --recrawl)
+ * @param n size_t: number of fetches, at most recrawl_fetches_left()
+ */
+void recrawl_count_fetches(size_t n)
+{
+    if (enabled)
+    {
+        __atomic_add_fetch(&stats.fetched, n, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief get the schedule and what the recrawl fetched
+ * @param out RECRAWL_STATS*: (pointer to) where to put the statistics
+ */
+void recrawl_get_stats(RECRAWL_STATS *out)
+{
+    *out = stats;
+    out->fetched = __atomic_load_n(&stats.fetched, __ATOMIC_RELAXED);
+    out->skipped = __atomic_load_n(&stats.skipped, __ATOMIC_RELAXED);
+}
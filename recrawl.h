@@ -0,0 +1,52 @@
+/*
+Change-rate-aware recrawl: estimates how often each cached url changes from its history in the
+conditional-GET cache, and schedules the urls most likely to have changed since they were last fetched
+*/
+
+#ifndef RECRAWL_H
+#define RECRAWL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "stack.h"
+#include "http_cache.h"
+
+#define RECRAWL_UNKNOWN_RATE 1.0 /* change rate assumed when no url has a history yet (changes per crawl) */
+
+// a cached url and the freshness fetching it now is expected to gain
+typedef struct recrawl_entry
+{
+    // probability that the url changed since it was last fetched
+    double gain;
+    const HTTP_CACHE_RECORD *record;
+} RECRAWL_ENTRY;
+
+typedef struct recrawl_stats
+{
+    // the fetch budget, urls in the cache, and urls scheduled
+    size_t budget;
+    size_t known;
+    size_t scheduled;
+    // expected number of changed urls among those scheduled, and among all cached urls
+    double expected;
+    double expected_all;
+    // urls fetched in at least two crawls, and their change rate taken together (changes per crawl)
+    size_t rated;
+    double mean_rate;
+    // fetches made, and links not followed
+    size_t fetched;
+    size_t skipped;
+} RECRAWL_STATS;
+
+int recrawl_enable(size_t budget, STACK *urls);
+bool recrawl_enabled();
+bool recrawl_follows_links();
+void recrawl_filter(STACK *urls);
+size_t recrawl_fetches_left();
+void recrawl_count_fetches(size_t n);
+void recrawl_get_stats(RECRAWL_STATS *stats);
+
+#endif
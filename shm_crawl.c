@@ -0,0 +1,664 @@
+/*
+Multi-process crawl state in a shared-memory segment, and the supervisor of the worker processes
+- the segment is one anonymous MAP_SHARED mapping made before the workers are forked, so
+  every worker (and every restarted worker) sees the same frontier, visited table and counters
+- each frontier lane is a bounded lock-free ring (Vyukov's multi-producer multi-consumer queue)
+  of offsets into an append-only url arena in the same segment
+- the visited table is open addressing over url hashes (XXH64), claimed with a compare-and-swap;
+  a url is marked visited when it is pushed, so each url is in a lane at most once
+- idle workers park on a futex (not FUTEX_PRIVATE, so it works across processes) that every
+  push bumps; parking also times out every SHM_PARK_MS in case a waker crashed
+- each worker publishes the url it is crawling in its slot, so when a worker crashes the
+  supervisor puts that url back on the frontier (once: a url that crashes a worker twice is
+  given up on) and forks a new worker; no other state lives in the worker
+- a pop publishes the lane position it claims before claiming it, and the entry before freeing
+  the cell, so a worker that crashes mid-pop doesn't lose the url: the supervisor finds it in the
+  claimed cell (once the other workers that tried the position have moved on)
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "content_hash.h"
+#include "shm_crawl.h"
+
+/* -- Frontier lanes -- */
+/**
+ * @brief initialize a ring: cell i is ready for the push at position i
+ * @param ring SHM_RING*: (pointer to) the ring
+ */
+static void init_ring(SHM_RING *ring)
+{
+    for (uint64_t i = 0; i < SHM_RING_SIZE; ++i)
+    {
+        ring->cells[i].seq = i;
+    }
+}
+
+/**
+ * @brief push an entry onto a ring
+ * @param ring SHM_RING*: (pointer to) the ring
+ * @param entry uint64_t: the entry
+ * @return 0 on success; 1 if the ring is full
+ */
+static int ring_push(SHM_RING *ring, uint64_t entry)
+{
+    uint64_t pos = __atomic_load_n(&ring->push_pos, __ATOMIC_RELAXED);
+    SHM_CELL *cell;
+    while (true)
+    {
+        cell = &ring->cells[pos & (SHM_RING_SIZE - 1)];
+        int64_t dif = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0)
+        {
+            // the cell is free for this lap: claim the position
+            if (__atomic_compare_exchange_n(&ring->push_pos, &pos, pos + 1, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (dif < 0)
+        {
+            // the cell still holds an entry from the previous lap
+            return 1;
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->push_pos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->entry = entry;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief pop an entry off a ring, publishing each step in a worker's slot
+ * @param ring SHM_RING*: (pointer to) the ring
+ * @param claim uint64_t*: (pointer to) the worker's claim, set while a position is claimed
+ * @param tag uint64_t: SHM_CLAIM_IMAGE for the image lane; 0 otherwise
+ * @param entry uint64_t*: (pointer to) the worker's entry, set before the cell is freed
+ * @return 0 on success; 1 if the ring is empty (or the next entry is not published yet)
+ */
+static int ring_pop(SHM_RING *ring, uint64_t *claim, uint64_t tag, uint64_t *entry)
+{
+    uint64_t pos = __atomic_load_n(&ring->pop_pos, __ATOMIC_RELAXED);
+    SHM_CELL *cell;
+    while (true)
+    {
+        cell = &ring->cells[pos & (SHM_RING_SIZE - 1)];
+        int64_t dif = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (dif == 0)
+        {
+            // published first, so a worker that crashes once the position is its own is found out
+            __atomic_store_n(claim, tag | (pos + 1), __ATOMIC_SEQ_CST);
+            if (__atomic_compare_exchange_n(&ring->pop_pos, &pos, pos + 1, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+            __atomic_store_n(claim, 0, __ATOMIC_SEQ_CST);
+        }
+        else if (dif < 0)
+        {
+            return 1;
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->pop_pos, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(entry, cell->entry, __ATOMIC_SEQ_CST);
+    // free the cell for the next lap
+    __atomic_store_n(&cell->seq, pos + SHM_RING_SIZE, __ATOMIC_RELEASE);
+    __atomic_store_n(claim, 0, __ATOMIC_SEQ_CST);
+    return 0;
+}
+/* ----------------- */
+
+/* -- Parking -- */
+/**
+ * @brief wake the workers parked waiting for urls
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ */
+static void wake_parked(SHM_CRAWL *shm)
+{
+    __atomic_add_fetch(&shm->push_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->num_parked, __ATOMIC_SEQ_CST) > 0)
+    {
+        syscall(SYS_futex, &shm->push_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/**
+ * @brief mark the crawl finished and wake every parked worker so it can exit
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ */
+static void finish_crawl(SHM_CRAWL *shm)
+{
+    __atomic_store_n(&shm->done, 1, __ATOMIC_SEQ_CST);
+    wake_parked(shm);
+}
+/* ----------------- */
+
+/**
+ * @brief create the shared segment and open the output files
+ * @param num_workers int: number of worker processes (at most SHM_MAX_WORKERS)
+ * @param num_pngs_to_find int: number of pngs to find before stopping
+ * @param pngs_path const char*: path of png_urls.txt
+ * @param visited_path const char*: path of the -v log (NULL if not written)
+ * @return (pointer to) the segment; NULL on error
+ * @details
+ * Must be called before the workers are forked. The arena and the tables are
+ *  MAP_NORESERVE, so only the pages the crawl touches take memory.
+ */
+SHM_CRAWL *shm_crawl_create(int num_workers, int num_pngs_to_find, const char *pngs_path, const char *visited_path)
+{
+    if (num_workers <= 0 || num_workers > SHM_MAX_WORKERS)
+    {
+        return NULL;
+    }
+    SHM_CRAWL *shm = mmap(NULL, sizeof(SHM_CRAWL) + SHM_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (shm == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    // the mapping is zero filled
+    shm->num_workers = num_workers;
+    shm->num_pngs_to_find = num_pngs_to_find;
+    // offset 0 is not used, so no entry is 0
+    shm->arena_used = 1;
+    for (int l = 0; l < SHM_NUM_LANES; ++l)
+    {
+        init_ring(&shm->lanes[l]);
+    }
+
+    const char *paths[SHM_NUM_FILES] = {pngs_path, visited_path};
+    for (int f = 0; f < SHM_NUM_FILES; ++f)
+    {
+        shm->fds[f] = -1;
+    }
+    for (int f = 0; f < SHM_NUM_FILES; ++f)
+    {
+        if (paths[f] == NULL)
+        {
+            continue;
+        }
+        // O_APPEND: each line is one write, which the workers can't interleave
+        shm->fds[f] = open(paths[f], O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (shm->fds[f] < 0)
+        {
+            fprintf(stderr, "shm_crawl: opening %s failed: %s\n", paths[f], strerror(errno));
+            shm_crawl_destroy(shm);
+            return NULL;
+        }
+    }
+    return shm;
+}
+
+/**
+ * @brief push a url onto a lane of the frontier, unless it was pushed before
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param url const char*: the url
+ * @param lane int: SHM_LANE_PAGE or SHM_LANE_IMAGE
+ * @return SHM_PUSHED, SHM_SEEN or SHM_DROPPED
+ */
+int shm_push_url(SHM_CRAWL *shm, const char *url, int lane)
+{
+    size_t len = strlen(url);
+    uint64_t key = xxh64(url, len, 0);
+    if (key == 0)
+    {
+        key = 1;
+    }
+
+    /* -- Mark the url visited -- */
+    uint64_t i = key & (SHM_VISITED_SIZE - 1);
+    while (true)
+    {
+        uint64_t cur = __atomic_load_n(&shm->visited[i], __ATOMIC_ACQUIRE);
+        if (cur == key)
+        {
+            return SHM_SEEN;
+        }
+        if (cur == 0)
+        {
+            if (__atomic_fetch_add(&shm->visited_used, 1, __ATOMIC_RELAXED) >= SHM_VISITED_SIZE / 4 * 3)
+            {
+                __atomic_sub_fetch(&shm->visited_used, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&shm->dropped, 1, __ATOMIC_RELAXED);
+                return SHM_DROPPED;
+            }
+            if (__atomic_compare_exchange_n(&shm->visited[i], &cur, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                break;
+            }
+            __atomic_sub_fetch(&shm->visited_used, 1, __ATOMIC_RELAXED);
+            // another worker took the slot: it may have claimed the same url
+            if (cur == key)
+            {
+                return SHM_SEEN;
+            }
+        }
+        i = (i + 1) & (SHM_VISITED_SIZE - 1);
+    }
+    /* ----------------- */
+
+    /* -- Copy the url into the arena and push its offset -- */
+    uint64_t offset = __atomic_fetch_add(&shm->arena_used, len + 1, __ATOMIC_RELAXED);
+    if (offset + len + 1 > SHM_ARENA_SIZE)
+    {
+        __atomic_add_fetch(&shm->dropped, 1, __ATOMIC_RELAXED);
+        return SHM_DROPPED;
+    }
+    char *arena = (char *)(shm + 1);
+    memcpy(arena + offset, url, len + 1);
+
+    uint64_t entry = offset | (lane == SHM_LANE_IMAGE ? SHM_IMAGE : 0);
+    if (ring_push(&shm->lanes[lane], entry) != 0)
+    {
+        __atomic_add_fetch(&shm->dropped, 1, __ATOMIC_RELAXED);
+        return SHM_DROPPED;
+    }
+    wake_parked(shm);
+    /* ----------------- */
+    return SHM_PUSHED;
+}
+
+/**
+ * @brief take the next url to crawl (embedded images first)
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param worker int: slot of the calling worker
+ * @return the url (in the arena; not to be freed); NULL if the crawl is done or no url is ready
+ * @details
+ * On success the worker is in flight until shm_finish_url.
+ */
+const char *shm_pop_url(SHM_CRAWL *shm, int worker)
+{
+    SHM_WORKER *self = &shm->workers[worker];
+    if (shm_done(shm))
+    {
+        return NULL;
+    }
+    // in flight before the pop, so the crawl can't look finished while the url is out of the lanes
+    __atomic_store_n(&self->in_flight, 1, __ATOMIC_SEQ_CST);
+    if (ring_pop(&shm->lanes[SHM_LANE_IMAGE], &self->claim, SHM_CLAIM_IMAGE, &self->entry) != 0 &&
+        ring_pop(&shm->lanes[SHM_LANE_PAGE], &self->claim, 0, &self->entry) != 0)
+    {
+        __atomic_store_n(&self->in_flight, 0, __ATOMIC_SEQ_CST);
+        return NULL;
+    }
+    return (char *)(shm + 1) + (self->entry & SHM_OFFSET_MASK);
+}
+
+/**
+ * @brief mark that the calling worker is done with its url
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param worker int: slot of the calling worker
+ * @details
+ * The urls found on the page must be pushed before this is called.
+ */
+void shm_finish_url(SHM_CRAWL *shm, int worker)
+{
+    SHM_WORKER *self = &shm->workers[worker];
+    __atomic_add_fetch(&shm->crawled, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->entry, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&self->in_flight, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief after shm_pop_url found no url: finish the crawl if nothing is left, or park until a push
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @return true if the worker should try to pop again; false if the crawl is done
+ * @details
+ * The crawl is finished when both lanes are empty and no worker is in flight. The pop
+ *  positions are read before the workers and the push positions after them: a url
+ *  popped or pushed in between moves a push position past the pop position read.
+ */
+bool shm_wait_for_url(SHM_CRAWL *shm)
+{
+    uint32_t seq = __atomic_load_n(&shm->push_seq, __ATOMIC_SEQ_CST);
+    if (shm_done(shm))
+    {
+        return false;
+    }
+
+    /* -- Check whether the crawl is finished -- */
+    uint64_t popped[SHM_NUM_LANES];
+    for (int l = 0; l < SHM_NUM_LANES; ++l)
+    {
+        popped[l] = __atomic_load_n(&shm->lanes[l].pop_pos, __ATOMIC_SEQ_CST);
+    }
+    bool idle = true;
+    for (int w = 0; w < shm->num_workers && idle; ++w)
+    {
+        idle = __atomic_load_n(&shm->workers[w].in_flight, __ATOMIC_SEQ_CST) == 0;
+    }
+    for (int l = 0; l < SHM_NUM_LANES && idle; ++l)
+    {
+        idle = __atomic_load_n(&shm->lanes[l].push_pos, __ATOMIC_SEQ_CST) == popped[l];
+    }
+    if (idle)
+    {
+        finish_crawl(shm);
+        return false;
+    }
+    /* ----------------- */
+
+    /* -- Park until the next push (or for at most SHM_PARK_MS) -- */
+    struct timespec timeout = {0, SHM_PARK_MS * 1000000L};
+    __atomic_add_fetch(&shm->num_parked, 1, __ATOMIC_SEQ_CST);
+    // returns at once if a push bumped push_seq since it was read
+    syscall(SYS_futex, &shm->push_seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+    __atomic_sub_fetch(&shm->num_parked, 1, __ATOMIC_SEQ_CST);
+    /* ----------------- */
+    return !shm_done(shm);
+}
+
+/**
+ * @brief count a valid png found
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @return true if the png is one of the first num_pngs_to_find (and should be written out)
+ * @details
+ * Finishes the crawl once num_pngs_to_find pngs were found.
+ */
+bool shm_found_png(SHM_CRAWL *shm)
+{
+    int n = __atomic_add_fetch(&shm->num_pngs, 1, __ATOMIC_SEQ_CST);
+    if (n >= shm->num_pngs_to_find)
+    {
+        finish_crawl(shm);
+    }
+    return n <= shm->num_pngs_to_find;
+}
+
+/**
+ * @brief whether the crawl is finished
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @return true if the crawl is finished
+ */
+bool shm_done(SHM_CRAWL *shm)
+{
+    return __atomic_load_n(&shm->done, __ATOMIC_SEQ_CST) != 0;
+}
+
+/**
+ * @brief append a line to png_urls.txt or the -v log
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param file int: SHM_PNGS or SHM_VISITED
+ * @param line const char*: the line (without '\n')
+ * @details
+ * One writev to a file opened O_APPEND, so lines of different workers don't interleave
+ *  and a line is in the file as soon as it is found (a crash can't lose it).
+ */
+void shm_write_line(SHM_CRAWL *shm, int file, const char *line)
+{
+    int fd = shm->fds[file];
+    if (fd < 0)
+    {
+        return;
+    }
+    struct iovec iov[2] = {{(void *)line, strlen(line)}, {"\n", 1}};
+    if (writev(fd, iov, 2) < 0)
+    {
+        perror("writev");
+    }
+}
+
+/* -- Supervisor -- */
+/**
+ * @brief fork a worker process into a slot
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param id int: slot of the worker
+ * @param worker void (*)(SHM_CRAWL *, int): function the worker process runs
+ * @return 0 on success; 1 if fork failed
+ */
+static int start_worker(SHM_CRAWL *shm, int id, void (*worker)(SHM_CRAWL *shm, int id))
+{
+    // what is buffered would otherwise be printed again by the child
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        // whole lines, so the output of the workers doesn't interleave mid-line
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        worker(shm, id);
+        exit(0);
+    }
+    shm->workers[id].pid = pid;
+    return 0;
+}
+
+/**
+ * @brief whether a worker other than a crashed one claims a lane position
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param id int: slot of the crashed worker
+ * @param claim uint64_t: the crashed worker's claim
+ * @return true if another worker's slot holds the same claim
+ */
+static bool claimed_by_other(SHM_CRAWL *shm, int id, uint64_t claim)
+{
+    for (int w = 0; w < shm->num_workers; ++w)
+    {
+        if (w != id && __atomic_load_n(&shm->workers[w].claim, __ATOMIC_SEQ_CST) == claim)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief settle the lane position a crashed worker was popping
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param id int: slot of the crashed worker
+ * @param claim uint64_t: the worker's claim (not 0)
+ * @param entry uint64_t: the worker's entry (0 if it didn't publish one)
+ * @return the entry the worker took off the lane; 0 if it took none
+ * @details
+ * Every worker that tries a position claims it first, and the one whose compare-and-swap
+ *  takes it frees the cell before it clears its claim; the others clear theirs at once. So
+ *  once no other worker claims the position (waiting at most SHM_PARK_MS), a cell still
+ *  not freed was taken by the crashed worker. Its cell is freed here.
+ */
+static uint64_t settle_claim(SHM_CRAWL *shm, int id, uint64_t claim, uint64_t entry)
+{
+    SHM_RING *ring = &shm->lanes[(claim & SHM_CLAIM_IMAGE) ? SHM_LANE_IMAGE : SHM_LANE_PAGE];
+    uint64_t pos = (claim & ~SHM_CLAIM_IMAGE) - 1;
+    SHM_CELL *cell = &ring->cells[pos & (SHM_RING_SIZE - 1)];
+    if (entry == 0)
+    {
+        // the position was not taken: the worker crashed before its compare-and-swap
+        if (__atomic_load_n(&ring->pop_pos, __ATOMIC_SEQ_CST) <= pos)
+        {
+            return 0;
+        }
+        struct timespec ms = {0, 1000000L};
+        for (int waited = 0; waited < SHM_PARK_MS && claimed_by_other(shm, id, claim); ++waited)
+        {
+            nanosleep(&ms, NULL);
+        }
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        {
+            return 0;
+        }
+        entry = cell->entry;
+    }
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1)
+    {
+        __atomic_store_n(&cell->seq, pos + SHM_RING_SIZE, __ATOMIC_RELEASE);
+    }
+    return entry;
+}
+
+/**
+ * @brief put back the url a crashed worker was crawling
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ * @param id int: slot of the crashed worker
+ * @details
+ * A url is put back once; if it crashes a worker again it is given up on. A url the
+ *  worker was still popping is put back too.
+ */
+static void recover_url(SHM_CRAWL *shm, int id)
+{
+    SHM_WORKER *w = &shm->workers[id];
+    if (__atomic_load_n(&w->in_flight, __ATOMIC_SEQ_CST) == 0)
+    {
+        return;
+    }
+    uint64_t entry = __atomic_load_n(&w->entry, __ATOMIC_SEQ_CST);
+    uint64_t claim = __atomic_load_n(&w->claim, __ATOMIC_SEQ_CST);
+    if (claim != 0)
+    {
+        entry = settle_claim(shm, id, claim, entry);
+    }
+    if (entry != 0)
+    {
+        const char *url = (char *)(shm + 1) + (entry & SHM_OFFSET_MASK);
+        if (entry & SHM_RETRIED)
+        {
+            fprintf(stderr, "shm_crawl: giving up on %s (crashed a worker twice)\n", url);
+            __atomic_add_fetch(&shm->abandoned, 1, __ATOMIC_RELAXED);
+        }
+        else if (ring_push(&shm->lanes[(entry & SHM_IMAGE) ? SHM_LANE_IMAGE : SHM_LANE_PAGE], entry | SHM_RETRIED) != 0)
+        {
+            __atomic_add_fetch(&shm->dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    // pushed back before the worker stops counting as in flight
+    __atomic_store_n(&w->claim, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&w->entry, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&w->in_flight, 0, __ATOMIC_SEQ_CST);
+    wake_parked(shm);
+}
+
+/**
+ * @brief fork the worker processes and restart the ones that crash, until all of them exit
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment, with the seed url pushed
+ * @param worker void (*)(SHM_CRAWL *, int): function each worker process runs; it returns once shm_wait_for_url returns false
+ * @return 0 on success; 1 if a worker could not be forked
+ * @details
+ * A worker that exits with status 0 is done. Any other exit (a signal, or a non-zero
+ *  status) is a crash: its url is put back and a new worker is forked into its slot,
+ *  unless the crawl is finished or the slot crashed SHM_MAX_RESTARTS_PER_WORKER times.
+ */
+int shm_supervise(SHM_CRAWL *shm, void (*worker)(SHM_CRAWL *shm, int id))
+{
+    int ret = 0;
+    int alive = 0;
+    for (int id = 0; id < shm->num_workers; ++id)
+    {
+        if (start_worker(shm, id, worker) != 0)
+        {
+            ret = 1;
+            break;
+        }
+        ++alive;
+    }
+    if (ret != 0)
+    {
+        finish_crawl(shm);
+    }
+
+    while (alive > 0)
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("waitpid");
+            return 1;
+        }
+        int id = 0;
+        while (id < shm->num_workers && shm->workers[id].pid != pid)
+        {
+            ++id;
+        }
+        if (id == shm->num_workers)
+        {
+            continue;
+        }
+        --alive;
+        shm->workers[id].pid = 0;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        {
+            continue;
+        }
+
+        /* -- The worker crashed: put back its url and replace it -- */
+        __atomic_add_fetch(&shm->crashes, 1, __ATOMIC_RELAXED);
+        if (WIFSIGNALED(status))
+        {
+            fprintf(stderr, "shm_crawl: worker %d (pid %d) killed by signal %d (%s)\n", id, pid,
+                    WTERMSIG(status), strsignal(WTERMSIG(status)));
+        }
+        else
+        {
+            fprintf(stderr, "shm_crawl: worker %d (pid %d) exited with status %d\n", id, pid, WEXITSTATUS(status));
+        }
+        recover_url(shm, id);
+        if (shm_done(shm))
+        {
+            continue;
+        }
+        if (++shm->workers[id].restarts > SHM_MAX_RESTARTS_PER_WORKER)
+        {
+            fprintf(stderr, "shm_crawl: worker %d crashed %d times; not restarting it\n", id, SHM_MAX_RESTARTS_PER_WORKER);
+        }
+        else if (start_worker(shm, id, worker) == 0)
+        {
+            ++alive;
+        }
+        else
+        {
+            ret = 1;
+        }
+        // the crawl can't finish if every worker is gone
+        if (alive == 0)
+        {
+            finish_crawl(shm);
+        }
+        /* ----------------- */
+    }
+    return ret;
+}
+/* ----------------- */
+
+/**
+ * @brief close the output files and unmap the shared segment
+ * @param shm SHM_CRAWL*: (pointer to) the shared segment
+ */
+void shm_crawl_destroy(SHM_CRAWL *shm)
+{
+    if (shm == NULL)
+    {
+        return;
+    }
+    for (int f = 0; f < SHM_NUM_FILES; ++f)
+    {
+        if (shm->fds[f] >= 0)
+        {
+            close(shm->fds[f]);
+        }
+    }
+    munmap(shm, sizeof(SHM_CRAWL) + SHM_ARENA_SIZE);
+}
@@ -0,0 +1,116 @@
+/*
+Multi-process crawl state in a shared-memory segment, and the supervisor of the worker processes
+*/
+
+#ifndef SHM_CRAWL_H
+#define SHM_CRAWL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHM_RING_SIZE (1 << 20)         /* urls each frontier lane holds (a power of 2) */
+#define SHM_VISITED_SIZE (1 << 23)      /* slots of the visited table (a power of 2); kept at most 3/4 full */
+#define SHM_ARENA_SIZE (1ULL << 30)     /* bytes for url strings; only the pages used take memory */
+#define SHM_MAX_WORKERS 256
+#define SHM_PARK_MS 100                 /* a parked worker rechecks whether the crawl is finished this often */
+#define SHM_MAX_RESTARTS_PER_WORKER 100 /* a worker slot that crashes more often than this is not restarted */
+#define SHM_RETRIED (1ULL << 63)        /* frontier entry of a url a crashed worker was crawling */
+#define SHM_IMAGE (1ULL << 62)          /* frontier entry of the image lane */
+#define SHM_OFFSET_MASK (SHM_IMAGE - 1) /* arena offset of a frontier entry */
+#define SHM_CLAIM_IMAGE (1ULL << 63)    /* claim of a position of the image lane */
+
+#define SHM_LANE_PAGE 0
+#define SHM_LANE_IMAGE 1
+#define SHM_NUM_LANES 2
+
+// results of shm_push_url
+#define SHM_PUSHED 0
+#define SHM_SEEN 1    /* the url was pushed before */
+#define SHM_DROPPED 2 /* a lane, the visited table or the arena is full */
+
+// files workers append lines to
+#define SHM_PNGS 0    /* png_urls.txt */
+#define SHM_VISITED 1 /* the -v log */
+#define SHM_NUM_FILES 2
+
+// a slot of a bounded lock-free ring
+typedef struct shm_cell
+{
+    // which lap of the ring the cell is ready for (written last, with release order)
+    uint64_t seq;
+    // arena offset of the url (| SHM_IMAGE, SHM_RETRIED)
+    uint64_t entry;
+} SHM_CELL;
+
+// a bounded lock-free multi-producer multi-consumer ring (Vyukov) of urls
+typedef struct shm_ring
+{
+    // next position to push to and to pop from; on separate cache lines
+    uint64_t push_pos;
+    char pad0[56];
+    uint64_t pop_pos;
+    char pad1[56];
+    SHM_CELL cells[SHM_RING_SIZE];
+} SHM_RING;
+
+// what a worker process is doing; read by the supervisor when the worker crashes
+typedef struct shm_worker
+{
+    pid_t pid;
+    // 1 from before the worker pops a url until it is done with it
+    uint32_t in_flight;
+    // lane position the worker is popping (position + 1, | SHM_CLAIM_IMAGE; 0 if none), from before
+    //  it claims the position until its entry is published and the cell freed
+    uint64_t claim;
+    // frontier entry of the url being crawled (0 if none)
+    uint64_t entry;
+    uint32_t restarts;
+} SHM_WORKER;
+
+// the shared segment; followed by the url arena
+typedef struct shm_crawl
+{
+    // 1 once the crawl is finished
+    uint32_t done;
+    // futex word of parked workers: bumped on every push
+    uint32_t push_seq;
+    uint32_t num_parked;
+    int num_workers;
+    int num_pngs_to_find;
+    // png_urls.txt and the -v log (-1 if not written), opened O_APPEND before the workers are forked
+    int fds[SHM_NUM_FILES];
+    // valid pngs found
+    int num_pngs;
+    // bytes of the arena used
+    uint64_t arena_used;
+    // slots of the visited table used
+    uint64_t visited_used;
+    // urls dropped because a lane, the visited table or the arena was full
+    uint64_t dropped;
+    // urls crawled, and urls given up on because a worker crashed on them twice
+    uint64_t crawled;
+    uint64_t abandoned;
+    // worker processes that crashed (and were restarted)
+    uint64_t crashes;
+    SHM_WORKER workers[SHM_MAX_WORKERS];
+    SHM_RING lanes[SHM_NUM_LANES];
+    // hashes of the urls pushed so far (0 marks an empty slot)
+    uint64_t visited[SHM_VISITED_SIZE];
+} SHM_CRAWL;
+
+SHM_CRAWL *shm_crawl_create(int num_workers, int num_pngs_to_find, const char *pngs_path, const char *visited_path);
+int shm_push_url(SHM_CRAWL *shm, const char *url, int lane);
+const char *shm_pop_url(SHM_CRAWL *shm, int worker);
+void shm_finish_url(SHM_CRAWL *shm, int worker);
+bool shm_wait_for_url(SHM_CRAWL *shm);
+bool shm_found_png(SHM_CRAWL *shm);
+bool shm_done(SHM_CRAWL *shm);
+void shm_write_line(SHM_CRAWL *shm, int file, const char *line);
+int shm_supervise(SHM_CRAWL *shm, void (*worker)(SHM_CRAWL *shm, int id));
+void shm_crawl_destroy(SHM_CRAWL *shm);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+Speculative fetching (--speculate)
+- after a runner parses a page, it claims the first unvisited links it found (embedded
+  images first, then pages; up to its budget of fetches in flight) in `visited`, counts
+  them as running, and starts fetching them on its curl multi handle; the other links
+  are pushed onto the frontier as usual
+- the runner then crawls its speculative fetches, oldest first, before popping the
+  frontier again, so the transfers overlap with pushing, the frontier and the runner's
+  own bookkeeping instead of starting after them
+- links already visited are never started; fetches still in flight when the crawl ends
+  (e.g. -m was reached) are cancelled
+- each runner has its own multi handle, so speculative fetches share its connections
+  (not those of the runner's easy handle)
+- with --http2, the multi handle multiplexes fetches on a host as streams of one HTTP/2
+  connection (at most --http2 streams at a time), and the runner fetches every url it
+  takes from the frontier there, together with the urls on the same host it finds near
+  the top of the frontier: a same-host batch. Fetches wait for the host's connection
+  (CURLOPT_PIPEWAIT) rather than open their own; a server that only speaks HTTP/1.1
+  gets one connection per fetch in flight instead
+- a fetch that fails in the HTTP/2 framing layer (libcurl 7.88.1 fails every stream after
+  the first on an h2c connection so) is fetched again without multiplexing when it is crawled:
+  over HTTP/1.1, or with --h2c over h2c on a connection of its own; the runner's later fetches
+  go the same way right away
+*/
+
+#include "speculate.h"
+
+// totals over all runners
+static SPECULATE_STATS stats;
+
+/**
+ * @brief initialize a runner's speculator
+ * @param p SPECULATOR*: a pointer to uninitialized memory
+ * @param budget int: most fetches in flight (1 to SPECULATE_SLOTS)
+ * @param max_streams int: most streams multiplexed on a connection (0: no multiplexing)
+ * @return 0 on success; 1 otherwise
+ */
+int speculator_init(SPECULATOR *p, int budget, int max_streams)
+{
+    if (budget < 1 || budget > SPECULATE_SLOTS)
+    {
+        return 1;
+    }
+    memset(p, 0, sizeof(SPECULATOR));
+    p->multi_handle = curl_multi_init();
+    if (p->multi_handle == NULL)
+    {
+        return 1;
+    }
+    if (max_streams > 0)
+    {
+        curl_multi_setopt(p->multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(p->multi_handle, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)max_streams);
+    }
+    p->budget = budget;
+    for (int i = 0; i < budget; ++i)
+    {
+        p->fetches[i].curl_handle = curl_easy_init();
+        if (p->fetches[i].curl_handle == NULL)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief whether a speculative fetch is waiting to be crawled
+ * @param p SPECULATOR*: (pointer to) the speculator (may be NULL)
+ * @return true if a fetch is in flight (or finished and not taken)
+ */
+bool speculator_pending(SPECULATOR *p)
+{
+    return p != NULL && p->count > 0;
+}
+
+/**
+ * @brief start fetching a url claimed by the runner
+ * @param p SPECULATOR*: (pointer to) the speculator, with room
+ * @param url char*: the url (the speculator takes it over)
+ * @param speculative bool: whether the url was claimed from a page's links (rather than in a batch)
+ */
+void speculator_start(SPECULATOR *p, char *url, bool speculative)
+{
+    SPEC_FETCH *f = NULL;
+    for (int i = 0; i < p->budget && f == NULL; ++i)
+    {
+        if (p->fetches[i].url == NULL)
+        {
+            f = &p->fetches[i];
+        }
+    }
+    f->url = url;
+    f->done = false;
+    f->seq = p->next_seq++;
+    f->speculative = speculative;
+    f->unshared = p->unshared;
+    fetch_begin(f->curl_handle, url, &f->recv_buf);
+    if (f->unshared)
+    {
+        fetch_without_multiplexing(f->curl_handle);
+    }
+    curl_multi_add_handle(p->multi_handle, f->curl_handle);
+    ++p->count;
+    if (speculative)
+    {
+        __atomic_add_fetch(&stats.started, 1, __ATOMIC_RELAXED);
+    }
+
+    // get the transfer going (resolve, connect, or send the request on a connection kept alive);
+    //  libcurl also reads the --dns-prefetch entry then, before the next fetch_begin replaces it
+    int running;
+    curl_multi_perform(p->multi_handle, &running);
+}
+
+/**
+ * @brief count a link that was not fetched speculatively because it was already visited
+ */
+void speculator_count_visited()
+{
+    __atomic_add_fetch(&stats.visited, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief count a same-host batch started (--http2)
+ * @param urls size_t: number of urls in the batch
+ */
+void speculator_count_batch(size_t urls)
+{
+    __atomic_add_fetch(&stats.batches, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.batched, urls, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief mark the transfers that finished
+ * @param p SPECULATOR*: (pointer to) the speculator
+ */
+static void collect_done(SPECULATOR *p)
+{
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(p->multi_handle, &left)) != NULL)
+    {
+        if (msg->msg != CURLMSG_DONE)
+        {
+            continue;
+        }
+        for (int i = 0; i < p->budget; ++i)
+        {
+            if (p->fetches[i].url != NULL && p->fetches[i].curl_handle == msg->easy_handle)
+            {
+                p->fetches[i].done = true;
+                p->fetches[i].res = msg->data.result;
+            }
+        }
+    }
+}
+
+/**
+ * @brief whether a fetch failed in the HTTP/2 framing layer, and can be retried without multiplexing
+ * @param f SPEC_FETCH*: (pointer to) the fetch
+ * @return true if it should be fetched again
+ */
+static bool framing_failed(SPEC_FETCH *f)
+{
+    return f->done && !f->unshared && (f->res == CURLE_HTTP2 || f->res == CURLE_HTTP2_STREAM);
+}
+
+/**
+ * @brief fetch a url again without multiplexing, after it failed in the HTTP/2 framing layer
+ * @param p SPECULATOR*: (pointer to) the speculator
+ * @param f SPEC_FETCH*: (pointer to) the fetch, finished and off the multi handle
+ */
+static void retry_unshared(SPECULATOR *p, SPEC_FETCH *f)
+{
+    if (!p->unshared)
+    {
+        p->unshared = true;
+        __atomic_add_fetch(&stats.fallbacks, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&stats.retries, 1, __ATOMIC_RELAXED);
+    recv_buf_cleanup(&f->recv_buf);
+    f->done = false;
+    f->unshared = true;
+    fetch_begin(f->curl_handle, f->url, &f->recv_buf);
+    fetch_without_multiplexing(f->curl_handle);
+    curl_multi_add_handle(p->multi_handle, f->curl_handle);
+}
+
+/**
+ * @brief crawl the oldest speculative fetch: wait for it to finish, then classify it
+ * @param p SPECULATOR*: (pointer to) the speculator, with a fetch pending
+ * @param p_url char**: pointer that will be populated with the url fetched
+ * @param p_recv_buf RECV_BUF*: (pointer to) buffer to be populated with the downloaded data
+ * @param eurl_p char**: (pointer to) string to be set with a copy of the effective url
+ * @param content_type int*: (pointer to) int to be set with content type code
+ * @param response_code_p long*: (pointer to) int to be set with the response code
+ * @return as fetch_end
+ * @note the caller is responsible for deallocating *p_url, and (on success) for
+ *  cleaning p_recv_buf and deallocating *eurl_p
+ */
+int speculator_take(SPECULATOR *p, char **p_url, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p)
+{
+    SPEC_FETCH *f = NULL;
+    for (int i = 0; i < p->budget; ++i)
+    {
+        if (p->fetches[i].url != NULL && (f == NULL || p->fetches[i].seq < f->seq))
+        {
+            f = &p->fetches[i];
+        }
+    }
+
+    uint64_t wait_start = trace_begin();
+    while (!f->done || framing_failed(f))
+    {
+        if (framing_failed(f))
+        {
+            curl_multi_remove_handle(p->multi_handle, f->curl_handle);
+            retry_unshared(p, f);
+        }
+        int running;
+        curl_multi_perform(p->multi_handle, &running);
+        collect_done(p);
+        if (!f->done)
+        {
+            curl_multi_poll(p->multi_handle, NULL, 0, SPECULATE_POLL_MS, NULL);
+        }
+    }
+    trace_end("wait speculative fetch", wait_start, f->url);
+    curl_multi_remove_handle(p->multi_handle, f->curl_handle);
+
+    *p_url = f->url;
+    *p_recv_buf = f->recv_buf;
+    f->url = NULL;
+    memset(&f->recv_buf, 0, sizeof(RECV_BUF));
+    --p->count;
+    if (f->speculative)
+    {
+        __atomic_add_fetch(&stats.used, 1, __ATOMIC_RELAXED);
+    }
+    long version = 0;
+    long connects = 0;
+    curl_easy_getinfo(f->curl_handle, CURLINFO_HTTP_VERSION, &version);
+    curl_easy_getinfo(f->curl_handle, CURLINFO_NUM_CONNECTS, &connects);
+    __atomic_add_fetch(&stats.fetches, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.http2, version == CURL_HTTP_VERSION_2_0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.connects, connects, __ATOMIC_RELAXED);
+    return fetch_end(f->curl_handle, *p_url, f->res, p_recv_buf, eurl_p, content_type, response_code_p);
+}
+
+/**
+ * @brief cancel the fetches in flight and free the speculator
+ * @param p SPECULATOR*: (pointer to) the speculator (may be NULL)
+ */
+void speculator_cleanup(SPECULATOR *p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < p->budget; ++i)
+    {
+        SPEC_FETCH *f = &p->fetches[i];
+        if (f->url != NULL)
+        {
+            curl_multi_remove_handle(p->multi_handle, f->curl_handle);
+            recv_buf_cleanup(&f->recv_buf);
+            free(f->url);
+            f->url = NULL;
+            if (f->speculative)
+            {
+                __atomic_add_fetch(&stats.cancelled, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if (f->curl_handle != NULL)
+        {
+            curl_easy_cleanup(f->curl_handle);
+            f->curl_handle = NULL;
+        }
+    }
+    curl_multi_cleanup(p->multi_handle);
+    p->multi_handle = NULL;
+    p->count = 0;
+}
+
+/**
+ * @brief get the totals over all runners
+ * @param out SPECULATE_STATS*: (pointer to) where to put the statistics
+ */
+void speculate_get_stats(SPECULATE_STATS *out)
+{
+    out->started = __atomic_load_n(&stats.started, __ATOMIC_RELAXED);
+    out->visited = __atomic_load_n(&stats.visited, __ATOMIC_RELAXED);
+    out->used = __atomic_load_n(&stats.used, __ATOMIC_RELAXED);
+    out->cancelled = __atomic_load_n(&stats.cancelled, __ATOMIC_RELAXED);
+    out->batches = __atomic_load_n(&stats.batches, __ATOMIC_RELAXED);
+    out->batched = __atomic_load_n(&stats.batched, __ATOMIC_RELAXED);
+    out->fetches = __atomic_load_n(&stats.fetches, __ATOMIC_RELAXED);
+    out->http2 = __atomic_load_n(&stats.http2, __ATOMIC_RELAXED);
+    out->connects = __atomic_load_n(&stats.connects, __ATOMIC_RELAXED);
+    out->retries = __atomic_load_n(&stats.retries, __ATOMIC_RELAXED);
+    out->fallbacks = __atomic_load_n(&stats.fallbacks, __ATOMIC_RELAXED);
+}
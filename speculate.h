@@ -0,0 +1,84 @@
+/*
+Fetches run on a runner's curl multi handle, crawled next by the runner: speculative fetches of the
+first links of a page it just parsed (--speculate), and batches of urls on one host (--http2)
+*/
+
+#ifndef SPECULATE_H
+#define SPECULATE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <curl/curl.h>
+#include "curl_xml.h"
+
+#define SPECULATE_MAX 16         /* most speculative fetches a runner may have in flight */
+#define SPECULATE_MAX_STREAMS 64 /* most urls in a same-host batch (--http2) */
+#define SPECULATE_SLOTS 64       /* most fetches on a multi handle: the larger of the two */
+#define SPECULATE_POLL_MS 100    /* longest curl_multi_poll while waiting for a speculative fetch */
+#define SPECULATE_SCAN 64        /* most links of a page looked at for speculative fetches, per lane */
+
+// a speculative fetch
+typedef struct spec_fetch
+{
+    CURL *curl_handle;
+    // url being fetched (NULL if the slot is free)
+    char *url;
+    RECV_BUF recv_buf;
+    // whether the transfer finished, and its result
+    bool done;
+    CURLcode res;
+    // order the fetch was started in
+    uint64_t seq;
+    // whether the url was claimed from a page's links (otherwise from the frontier, in a batch)
+    bool speculative;
+    // whether the fetch doesn't share its connection (after an HTTP/2 framing error)
+    bool unshared;
+} SPEC_FETCH;
+
+// a runner's speculative fetches
+typedef struct speculator
+{
+    CURLM *multi_handle;
+    // most fetches in flight (the per-runner budget)
+    int budget;
+    int count;
+    uint64_t next_seq;
+    // whether a fetch failed in the HTTP/2 framing layer, so new fetches don't share connections
+    bool unshared;
+    SPEC_FETCH fetches[SPECULATE_SLOTS];
+} SPECULATOR;
+
+typedef struct speculate_stats
+{
+    // fetches started, links not started because they were already visited,
+    //  fetches crawled, and fetches cancelled when the crawl ended
+    size_t started;
+    size_t visited;
+    size_t used;
+    size_t cancelled;
+    // same-host batches started and the urls in them (--http2)
+    size_t batches;
+    size_t batched;
+    // fetches on the multi handles crawled, how many of them were answered over HTTP/2,
+    //  and the connections they opened
+    size_t fetches;
+    size_t http2;
+    size_t connects;
+    // fetches retried without multiplexing after an HTTP/2 framing error, and runners that fell back
+    size_t retries;
+    size_t fallbacks;
+} SPECULATE_STATS;
+
+int speculator_init(SPECULATOR *p, int budget, int max_streams);
+bool speculator_pending(SPECULATOR *p);
+void speculator_start(SPECULATOR *p, char *url, bool speculative);
+void speculator_count_visited();
+void speculator_count_batch(size_t urls);
+int speculator_take(SPECULATOR *p, char **p_url, RECV_BUF *p_recv_buf, char **eurl_p, int *content_type, long *response_code_p);
+void speculator_cleanup(SPECULATOR *p);
+void speculate_get_stats(SPECULATE_STATS *stats);
+
+#endif
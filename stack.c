@@ -77,6 +77,31 @@ int pop_stack(STACK *p, char **p_item)
     return 0;
 }
 
+/**
+ * @brief remove the item at a position of the stack (0 is the bottom), moving the items above it down
+ * @param p STACK*: (pointer to) the stack the function will remove from
+ * @param i size_t: position of the item
+ * @param p_item char**: pointer that will be populated with the removed item
+ * @return 0 on success; 1 otherwise
+ * @note the caller is responsible for deallocating memory assigned to p_item
+ */
+int remove_stack(STACK *p, size_t i, char **p_item)
+{
+    if ((p == NULL) || i >= num_elements_stack(p))
+    {
+        return 1;
+    }
+
+    *p_item = p->items[i];
+    for (size_t j = i; j < p->pos; ++j)
+    {
+        p->items[j] = p->items[j + 1];
+    }
+    p->items[p->pos] = NULL;
+    (p->pos)--;
+    return 0;
+}
+
 /**
  * @brief check if the stack is full
  * @param p STACK*: (pointer to) the stack to check
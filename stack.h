@@ -2,6 +2,9 @@
 A dynamic stack holding strings
 */
 
+#ifndef STACK_H
+#define STACK_H
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -24,6 +27,9 @@ bool is_full_stack(STACK *p);
 bool is_empty_stack(STACK *p);
 int push_stack(STACK *p, char *item);
 int pop_stack(STACK *p, char **p_item);
+int remove_stack(STACK *p, size_t i, char **p_item);
 int resize_stack(STACK *p);
 size_t num_elements_stack(STACK *p);
-int cleanup_stack(STACK *p);
\ No newline at end of file
+int cleanup_stack(STACK *p);
+
+#endif
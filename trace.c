@@ -0,0 +1,232 @@
+/*
+Per-thread timelines of crawl activity, exported as Chrome Trace Event json
+- a thread marks the start of a span with trace_begin and records it with trace_end;
+  both are a flag check when tracing is off
+- each thread records into its own ring buffer, so recording takes no lock; when a
+  ring is full the oldest spans are overwritten
+- trace_write flushes every ring as complete ("X") events, plus a name for each thread,
+  in the json format loaded by Perfetto (ui.perfetto.dev) and chrome://tracing
+*/
+
+#include <pthread.h>
+#include <time.h>
+#include "trace.h"
+
+// whether trace_enable was called
+static bool enabled = false;
+// when tracing was enabled (ns of the monotonic clock)
+static uint64_t start_ns = 0;
+// the calling thread's spans (NULL until it registers)
+static __thread TRACE_THREAD *thread_trace = NULL;
+// spans of every registered thread
+static TRACE_THREAD *threads = NULL;
+static int num_threads = 0;
+// lock for the list of threads (only taken when a thread registers)
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief current time of the monotonic clock
+ * @return time in ns
+ */
+static uint64_t clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief turn on tracing
+ * @return 0 on success; 1 otherwise
+ */
+int trace_enable()
+{
+    start_ns = clock_ns();
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief check if tracing is turned on
+ * @return true if on; false otherwise
+ */
+bool trace_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief give the calling thread a ring buffer for its spans
+ * @param role const char*: what the thread is (e.g. "runner")
+ * @note a thread that fails to get a ring buffer records no spans
+ */
+void trace_register_thread(const char *role)
+{
+    if (!enabled || thread_trace != NULL)
+    {
+        return;
+    }
+
+    TRACE_THREAD *t = calloc(1, sizeof(TRACE_THREAD));
+    if (t == NULL)
+    {
+        return;
+    }
+    t->events = malloc(TRACE_RING_SIZE * sizeof(TRACE_EVENT));
+    if (t->events == NULL)
+    {
+        free(t);
+        return;
+    }
+    t->role = role;
+
+    pthread_mutex_lock(&threads_mutex);
+    {
+        t->tid = ++num_threads;
+        t->next = threads;
+        threads = t;
+    }
+    pthread_mutex_unlock(&threads_mutex);
+    thread_trace = t;
+}
+
+/**
+ * @brief mark the start of a span
+ * @return start of the span to pass to trace_end; 0 if the calling thread does not trace
+ */
+uint64_t trace_begin()
+{
+    if (thread_trace == NULL)
+    {
+        return 0;
+    }
+    return clock_ns() - start_ns;
+}
+
+/**
+ * @brief record a span of the calling thread, ending now
+ * @param name const char*: what the thread was doing; must outlive the trace (e.g. a string literal)
+ * @param start uint64_t: start of the span, as returned by trace_begin
+ * @param detail const char*: e.g. the url being fetched (truncated to TRACE_DETAIL_SIZE - 1 bytes); may be NULL
+ */
+void trace_end(const char *name, uint64_t start, const char *detail)
+{
+    TRACE_THREAD *t = thread_trace;
+    if (t == NULL)
+    {
+        return;
+    }
+
+    uint64_t end = clock_ns() - start_ns;
+    TRACE_EVENT *e = &t->events[t->num_events % TRACE_RING_SIZE];
+    e->name = name;
+    e->start_ns = start;
+    e->dur_ns = end > start ? end - start : 0;
+    e->detail[0] = '\0';
+    if (detail != NULL)
+    {
+        strncat(e->detail, detail, TRACE_DETAIL_SIZE - 1);
+    }
+    ++t->num_events;
+}
+
+/**
+ * @brief write a json string, escaped
+ * @param f FILE*: file to write to
+ * @param str const char*: string to write
+ */
+static void write_json_string(FILE *f, const char *str)
+{
+    fputc('"', f);
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; ++p)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            fprintf(f, "\\%c", *p);
+        }
+        else if (*p < 0x20 || *p >= 0x80)
+        {
+            // a truncated url may end in part of a multi-byte character
+            fprintf(f, "\\u%04x", *p);
+        }
+        else
+        {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/**
+ * @brief write the spans of all threads as Chrome Trace Event json
+ * @param path const char*: path of the file to write
+ * @param num_written size_t*: populated with the number of spans written
+ * @param num_dropped size_t*: populated with the number of spans overwritten in full rings
+ * @return 0 on success; 1 otherwise
+ * @note only call once the traced threads have exited
+ */
+int trace_write(const char *path, size_t *num_written, size_t *num_dropped)
+{
+    *num_written = 0;
+    *num_dropped = 0;
+
+    FILE *f = fopen(path, "w+");
+    if (f == NULL)
+    {
+        return 1;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"findpng2\"}}");
+
+    pthread_mutex_lock(&threads_mutex);
+    for (TRACE_THREAD *t = threads; t != NULL; t = t->next)
+    {
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+                t->tid, t->role, t->tid);
+        fprintf(f, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"sort_index\": %d}}",
+                t->tid, t->tid);
+
+        size_t first = t->num_events > TRACE_RING_SIZE ? t->num_events - TRACE_RING_SIZE : 0;
+        for (size_t i = first; i < t->num_events; ++i)
+        {
+            TRACE_EVENT *e = &t->events[i % TRACE_RING_SIZE];
+            // timestamps are in us
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    e->name, t->tid, e->start_ns / 1000., e->dur_ns / 1000.);
+            if (e->detail[0] != '\0')
+            {
+                fprintf(f, ", \"args\": {\"detail\": ");
+                write_json_string(f, e->detail);
+                fprintf(f, "}");
+            }
+            fprintf(f, "}");
+        }
+        *num_written += t->num_events - first;
+        *num_dropped += first;
+    }
+    pthread_mutex_unlock(&threads_mutex);
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief free the spans of all threads
+ * @note only call once the traced threads have exited
+ */
+void trace_cleanup()
+{
+    TRACE_THREAD *t = threads;
+    while (t != NULL)
+    {
+        TRACE_THREAD *next = t->next;
+        free(t->events);
+        free(t);
+        t = next;
+    }
+    threads = NULL;
+    num_threads = 0;
+    enabled = false;
+}
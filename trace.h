@@ -0,0 +1,53 @@
+/*
+Per-thread timelines of crawl activity, exported as Chrome Trace Event json
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_RING_SIZE 32768 /* spans kept per thread; older spans are overwritten */
+#define TRACE_DETAIL_SIZE 40  /* bytes of detail (e.g. the url) kept per span, including the terminating 0 */
+
+// one span of a thread's activity
+typedef struct trace_event
+{
+    // what the thread was doing (a string literal)
+    const char *name;
+    // start of the span (ns since tracing was enabled)
+    uint64_t start_ns;
+    // length of the span (ns)
+    uint64_t dur_ns;
+    // e.g. the url being fetched (truncated; may be empty)
+    char detail[TRACE_DETAIL_SIZE];
+} TRACE_EVENT;
+
+// the spans recorded by one thread
+typedef struct trace_thread
+{
+    // thread id in the trace
+    int tid;
+    // what the thread is (e.g. "runner")
+    const char *role;
+    // ring of the last TRACE_RING_SIZE spans
+    TRACE_EVENT *events;
+    // number of spans recorded (the ring holds the last TRACE_RING_SIZE)
+    size_t num_events;
+    // next thread that recorded spans
+    struct trace_thread *next;
+} TRACE_THREAD;
+
+int trace_enable();
+bool trace_enabled();
+void trace_register_thread(const char *role);
+uint64_t trace_begin();
+void trace_end(const char *name, uint64_t start_ns, const char *detail);
+int trace_write(const char *path, size_t *num_written, size_t *num_dropped);
+void trace_cleanup();
+
+#endif
@@ -0,0 +1,504 @@
+/*
+Crawler-trap heuristics for urls and near-duplicate detection for pages
+- trap_check_url rejects urls that look generated rather than authored:
+  very deep paths, paths that repeat a segment (/a/b/a/b/...), queries with many
+  parameters, and paths that have been crawled with many distinct queries
+  (calendars, session ids, sort orders)
+- trap_is_near_duplicate fingerprints the text of a page with SimHash and
+  reports pages that are within SIMHASH_MAX_DISTANCE bits of an earlier page,
+  so that mirrored pages don't have their links expanded again; the code in
+  <script> and <style> elements is not page text, so pages that only share a
+  template (e.g. the same inline analytics script) are not taken for mirrors
+- both are cheap enough to run inline for every url and page
+*/
+
+#include <ctype.h>
+#include <strings.h>
+#include <pthread.h>
+#include "trap.h"
+
+#define VARIANTS_INITIAL_SIZE 1024
+#define FINGERPRINTS_INITIAL_SIZE 1024
+#define SIMHASH_BANDS 4
+#define SIMHASH_BAND_BITS 16
+
+// whether trap_enable was called
+static bool enabled = false;
+
+// number of distinct queries crawled per host and path,
+//  as an open addressing table keyed by a hash of the host and path (0 marks an empty slot)
+static uint64_t *variant_keys = NULL;
+static uint32_t *variant_counts = NULL;
+static size_t variants_size = 0;
+static size_t variants_used = 0;
+// lock for the variant table
+static pthread_mutex_t variants_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// fingerprints of the pages seen so far; a fingerprint is filed under each of its
+//  16-bit bands, since fingerprints within 3 bits of each other share at least one band
+static uint64_t *fingerprints = NULL;
+static size_t fingerprints_size = 0;
+static size_t fingerprints_used = 0;
+// first fingerprint (index + 1) filed under each band value
+static uint32_t *band_heads[SIMHASH_BANDS];
+// next fingerprint (index + 1) filed under the same band value
+static uint32_t *band_next[SIMHASH_BANDS];
+// lock for the fingerprints
+static pthread_mutex_t fingerprints_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static TRAP_STATS stats;
+
+/**
+ * @brief 64-bit FNV-1a hash of a byte string, optionally lowercased
+ * @param p const char*: bytes to hash
+ * @param len size_t: number of bytes
+ * @param h uint64_t: hash to continue from (0 to start a new hash)
+ * @return hash
+ */
+static uint64_t fnv1a(const char *p, size_t len, uint64_t h)
+{
+    if (h == 0)
+    {
+        h = 14695981039346656037ULL;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)tolower((unsigned char)p[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief finalize a hash so that all of its bits depend on all of the input (splitmix64)
+ * @param x uint64_t: value to mix
+ * @return mixed value
+ */
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * @brief turn on trap and near-duplicate detection
+ * @return 0 on success; non-zero otherwise
+ */
+int trap_enable()
+{
+    variant_keys = calloc(VARIANTS_INITIAL_SIZE, sizeof(uint64_t));
+    variant_counts = calloc(VARIANTS_INITIAL_SIZE, sizeof(uint32_t));
+    variants_size = VARIANTS_INITIAL_SIZE;
+    variants_used = 0;
+
+    fingerprints = calloc(FINGERPRINTS_INITIAL_SIZE, sizeof(uint64_t));
+    fingerprints_size = FINGERPRINTS_INITIAL_SIZE;
+    fingerprints_used = 0;
+    for (int b = 0; b < SIMHASH_BANDS; ++b)
+    {
+        band_heads[b] = calloc((size_t)1 << SIMHASH_BAND_BITS, sizeof(uint32_t));
+        band_next[b] = calloc(FINGERPRINTS_INITIAL_SIZE, sizeof(uint32_t));
+        if (band_heads[b] == NULL || band_next[b] == NULL)
+        {
+            return 1;
+        }
+    }
+
+    if (variant_keys == NULL || variant_counts == NULL || fingerprints == NULL)
+    {
+        return 1;
+    }
+
+    enabled = true;
+    return 0;
+}
+
+/**
+ * @brief returns whether trap_enable was called
+ * @return true if trap and near-duplicate detection is on
+ */
+bool trap_enabled()
+{
+    return enabled;
+}
+
+/**
+ * @brief count one more distinct query for a host and path
+ * @param key uint64_t: hash of the host and path
+ * @return number of distinct queries counted for the host and path so far
+ * @note the caller holds variants_mutex
+ */
+static uint32_t count_variant(uint64_t key)
+{
+    if (key == 0)
+    {
+        key = 1;
+    }
+
+    // keep the table at most half full
+    if (2 * (variants_used + 1) > variants_size)
+    {
+        size_t old_size = variants_size;
+        uint64_t *old_keys = variant_keys;
+        uint32_t *old_counts = variant_counts;
+        variants_size *= 2;
+        variant_keys = calloc(variants_size, sizeof(uint64_t));
+        variant_counts = calloc(variants_size, sizeof(uint32_t));
+        for (size_t i = 0; i < old_size; ++i)
+        {
+            if (old_keys[i] != 0)
+            {
+                size_t j = old_keys[i] & (variants_size - 1);
+                while (variant_keys[j] != 0)
+                {
+                    j = (j + 1) & (variants_size - 1);
+                }
+                variant_keys[j] = old_keys[i];
+                variant_counts[j] = old_counts[i];
+            }
+        }
+        free(old_keys);
+        free(old_counts);
+    }
+
+    size_t i = key & (variants_size - 1);
+    while (variant_keys[i] != 0 && variant_keys[i] != key)
+    {
+        i = (i + 1) & (variants_size - 1);
+    }
+    if (variant_keys[i] == 0)
+    {
+        variant_keys[i] = key;
+        ++variants_used;
+    }
+    return ++variant_counts[i];
+}
+
+/**
+ * @brief check whether a url looks like part of a crawler trap
+ * @param url const char*: url about to be crawled (not crawled before)
+ * @return TRAP_NONE if the url should be crawled; the TRAP_* reason otherwise
+ * @details
+ * Each url should be checked once (e.g. right after it is added to the visited set),
+ *  since the query-variant limit counts every call as a distinct query.
+ */
+int trap_check_url(const char *url)
+{
+    if (!enabled || url == NULL)
+    {
+        return TRAP_NONE;
+    }
+
+    // split the url into host, path and query
+    const char *host = strstr(url, "://");
+    host = (host == NULL) ? url : host + 3;
+    const char *path = host + strcspn(host, "/?#");
+    const char *query = path + strcspn(path, "?#");
+    const char *query_end = (*query == '?') ? query + 1 + strcspn(query + 1, "#") : query;
+    int reason = TRAP_NONE;
+
+    // path depth and repeated segments
+    const char *segments[TRAP_MAX_PATH_DEPTH + 1];
+    size_t lengths[TRAP_MAX_PATH_DEPTH + 1];
+    size_t depth = 0;
+    const char *p = path;
+    while (p < query && reason == TRAP_NONE)
+    {
+        while (p < query && *p == '/')
+        {
+            ++p;
+        }
+        if (p >= query)
+        {
+            break;
+        }
+        const char *end = p;
+        while (end < query && *end != '/')
+        {
+            ++end;
+        }
+        if (depth == TRAP_MAX_PATH_DEPTH)
+        {
+            reason = TRAP_PATH_DEPTH;
+            break;
+        }
+        segments[depth] = p;
+        lengths[depth] = end - p;
+        size_t repeats = 0;
+        for (size_t i = 0; i < depth; ++i)
+        {
+            if (lengths[i] == lengths[depth] && strncmp(segments[i], p, lengths[depth]) == 0)
+            {
+                ++repeats;
+            }
+        }
+        if (repeats >= TRAP_MAX_SEGMENT_REPEATS)
+        {
+            reason = TRAP_SEGMENT_REPEAT;
+        }
+        ++depth;
+        p = end;
+    }
+
+    // query parameters, and distinct queries on the same host and path
+    if (reason == TRAP_NONE && *query == '?')
+    {
+        size_t params = 1;
+        for (p = query + 1; p < query_end; ++p)
+        {
+            if (*p == '&' || *p == ';')
+            {
+                ++params;
+            }
+        }
+        if (params > TRAP_MAX_QUERY_PARAMS)
+        {
+            reason = TRAP_QUERY_PARAMS;
+        }
+        else
+        {
+            uint64_t key = fnv1a(host, query - host, 0);
+            pthread_mutex_lock(&variants_mutex);
+            {
+                if (count_variant(key) > TRAP_MAX_QUERY_VARIANTS)
+                {
+                    reason = TRAP_QUERY_VARIANTS;
+                }
+            }
+            pthread_mutex_unlock(&variants_mutex);
+        }
+    }
+
+    if (reason != TRAP_NONE)
+    {
+        __atomic_add_fetch(&stats.urls[reason], 1, __ATOMIC_RELAXED);
+    }
+    return reason;
+}
+
+/**
+ * @brief skip the text of a <script> or <style> element, as the link scanner does with raw text
+ * @param p const char*: (pointer to) the '<' of a tag
+ * @param end const char*: end of the page
+ * @return (pointer to) the '<' of the element's end tag (end if it has none); NULL if the tag
+ *  is not a <script> or <style> start tag
+ */
+static const char *skip_raw_text(const char *p, const char *end)
+{
+    static const char *raw[] = {"script", "style"};
+    for (size_t i = 0; i < sizeof(raw) / sizeof(raw[0]); ++i)
+    {
+        size_t len = strlen(raw[i]);
+        if ((size_t)(end - p) <= len + 1 || strncasecmp(p + 1, raw[i], len) != 0 ||
+            !(isspace((unsigned char)p[len + 1]) || p[len + 1] == '/' || p[len + 1] == '>'))
+        {
+            continue;
+        }
+        // the text ends at the element's own end tag only
+        const char *q = memchr(p, '>', end - p);
+        while (q != NULL && (q = memchr(q, '<', end - q)) != NULL)
+        {
+            if ((size_t)(end - q) > len + 2 && q[1] == '/' && strncasecmp(q + 2, raw[i], len) == 0 &&
+                (isspace((unsigned char)q[len + 2]) || q[len + 2] == '/' || q[len + 2] == '>'))
+            {
+                return q;
+            }
+            ++q;
+        }
+        return end;
+    }
+    return NULL;
+}
+
+/**
+ * @brief compute the SimHash fingerprint of the text of a html page
+ * @param buf const char*: (pointer to) the page
+ * @param size size_t: size of the page
+ * @param num_tokens size_t*: (pointer to) number to be set with the number of words on the page
+ * @return 64-bit fingerprint
+ * @details
+ * Markup between '<' and '>', and the text of <script> and <style> elements, is
+ *  skipped; the remaining text is split into words
+ *  (runs of letters and digits, case-insensitive) and every run of 3 consecutive
+ *  words votes on each bit of the fingerprint.
+ */
+uint64_t simhash(const char *buf, size_t size, size_t *num_tokens)
+{
+    int votes[64];
+    uint64_t window[3] = {0, 0, 0};
+    size_t tokens = 0;
+    const char *p = buf;
+    const char *end = buf + size;
+
+    memset(votes, 0, sizeof(votes));
+
+    while (p < end)
+    {
+        if (*p == '<')
+        {
+            const char *raw_end = skip_raw_text(p, end);
+            if (raw_end != NULL)
+            {
+                p = raw_end;
+                continue;
+            }
+            const char *close = memchr(p, '>', end - p);
+            p = (close == NULL) ? end : close + 1;
+            continue;
+        }
+        if (!isalnum((unsigned char)*p))
+        {
+            ++p;
+            continue;
+        }
+
+        const char *word = p;
+        while (p < end && isalnum((unsigned char)*p))
+        {
+            ++p;
+        }
+        window[0] = window[1];
+        window[1] = window[2];
+        window[2] = fnv1a(word, p - word, 0);
+        ++tokens;
+        if (tokens < 3)
+        {
+            continue;
+        }
+
+        uint64_t shingle = mix64(window[0] ^ mix64(window[1] ^ mix64(window[2])));
+        for (int bit = 0; bit < 64; ++bit)
+        {
+            votes[bit] += ((shingle >> bit) & 1) ? 1 : -1;
+        }
+    }
+
+    uint64_t fingerprint = 0;
+    for (int bit = 0; bit < 64; ++bit)
+    {
+        if (votes[bit] > 0)
+        {
+            fingerprint |= (uint64_t)1 << bit;
+        }
+    }
+    *num_tokens = tokens;
+    return fingerprint;
+}
+
+/**
+ * @brief get the band of a fingerprint
+ * @param fingerprint uint64_t: fingerprint
+ * @param band int: which band (0 to SIMHASH_BANDS - 1)
+ * @return value of the band
+ */
+static uint32_t band_of(uint64_t fingerprint, int band)
+{
+    return (fingerprint >> (band * SIMHASH_BAND_BITS)) & (((uint64_t)1 << SIMHASH_BAND_BITS) - 1);
+}
+
+/**
+ * @brief check whether a page nearly duplicates a page seen earlier; remember it if not
+ * @param buf const char*: (pointer to) the page
+ * @param size size_t: size of the page
+ * @return true if the page's links should not be expanded
+ */
+bool trap_is_near_duplicate(const char *buf, size_t size)
+{
+    if (!enabled || buf == NULL)
+    {
+        return false;
+    }
+
+    size_t tokens;
+    uint64_t fingerprint = simhash(buf, size, &tokens);
+    if (tokens < SIMHASH_MIN_TOKENS)
+    {
+        return false;
+    }
+
+    bool duplicate = false;
+    pthread_mutex_lock(&fingerprints_mutex);
+    {
+        for (int b = 0; b < SIMHASH_BANDS && !duplicate; ++b)
+        {
+            uint32_t i = band_heads[b][band_of(fingerprint, b)];
+            while (i != 0)
+            {
+                if (__builtin_popcountll(fingerprints[i - 1] ^ fingerprint) <= SIMHASH_MAX_DISTANCE)
+                {
+                    duplicate = true;
+                    break;
+                }
+                i = band_next[b][i - 1];
+            }
+        }
+
+        if (!duplicate)
+        {
+            if (fingerprints_used == fingerprints_size)
+            {
+                fingerprints_size *= 2;
+                fingerprints = realloc(fingerprints, fingerprints_size * sizeof(uint64_t));
+                for (int b = 0; b < SIMHASH_BANDS; ++b)
+                {
+                    band_next[b] = realloc(band_next[b], fingerprints_size * sizeof(uint32_t));
+                }
+            }
+            size_t i = fingerprints_used++;
+            fingerprints[i] = fingerprint;
+            for (int b = 0; b < SIMHASH_BANDS; ++b)
+            {
+                uint32_t band = band_of(fingerprint, b);
+                band_next[b][i] = band_heads[b][band];
+                band_heads[b][band] = i + 1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&fingerprints_mutex);
+
+    __atomic_add_fetch(&stats.pages, 1, __ATOMIC_RELAXED);
+    if (duplicate)
+    {
+        __atomic_add_fetch(&stats.near_duplicates, 1, __ATOMIC_RELAXED);
+    }
+    return duplicate;
+}
+
+/**
+ * @brief get the number of urls and pages skipped so far
+ * @param out TRAP_STATS*: (pointer to) stats to be populated
+ */
+void trap_get_stats(TRAP_STATS *out)
+{
+    for (int i = 0; i < NUM_TRAP_REASONS; ++i)
+    {
+        out->urls[i] = __atomic_load_n(&stats.urls[i], __ATOMIC_RELAXED);
+    }
+    out->pages = __atomic_load_n(&stats.pages, __ATOMIC_RELAXED);
+    out->near_duplicates = __atomic_load_n(&stats.near_duplicates, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief free all memory used for trap and near-duplicate detection
+ */
+void trap_cleanup()
+{
+    free(variant_keys);
+    variant_keys = NULL;
+    free(variant_counts);
+    variant_counts = NULL;
+    free(fingerprints);
+    fingerprints = NULL;
+    for (int b = 0; b < SIMHASH_BANDS; ++b)
+    {
+        free(band_heads[b]);
+        band_heads[b] = NULL;
+        free(band_next[b]);
+        band_next[b] = NULL;
+    }
+    enabled = false;
+}
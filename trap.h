@@ -0,0 +1,46 @@
+/*
+Crawler-trap heuristics for urls and near-duplicate detection for pages
+*/
+
+#ifndef TRAP_H
+#define TRAP_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRAP_MAX_PATH_DEPTH 12      /* more path segments than this is a trap */
+#define TRAP_MAX_SEGMENT_REPEATS 2  /* a path segment appearing more often than this is a trap */
+#define TRAP_MAX_QUERY_PARAMS 10    /* more query parameters than this is a trap */
+#define TRAP_MAX_QUERY_VARIANTS 50  /* more distinct queries than this on one host and path is a trap */
+#define SIMHASH_MAX_DISTANCE 3      /* pages whose fingerprints differ in at most this many bits are near-duplicates */
+#define SIMHASH_MIN_TOKENS 16       /* pages with fewer words than this are not fingerprinted */
+
+#define TRAP_NONE 0
+#define TRAP_PATH_DEPTH 1
+#define TRAP_SEGMENT_REPEAT 2
+#define TRAP_QUERY_PARAMS 3
+#define TRAP_QUERY_VARIANTS 4
+#define NUM_TRAP_REASONS 5
+
+typedef struct trap_stats
+{
+    // urls skipped, by TRAP_* reason
+    size_t urls[NUM_TRAP_REASONS];
+    // pages fingerprinted
+    size_t pages;
+    // pages whose links were not expanded because they were near-duplicates of earlier pages
+    size_t near_duplicates;
+} TRAP_STATS;
+
+int trap_enable();
+bool trap_enabled();
+int trap_check_url(const char *url);
+uint64_t simhash(const char *buf, size_t size, size_t *num_tokens);
+bool trap_is_near_duplicate(const char *buf, size_t size);
+void trap_get_stats(TRAP_STATS *stats);
+void trap_cleanup();
+
+#endif
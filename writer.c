@@ -0,0 +1,337 @@
+/*
+Streaming output: a writer thread that appends found pngs, visited urls and crawl records to their files as the crawl runs
+- crawl threads push lines onto a lock-free queue (a compare-and-swap on its head),
+  so producing a line never takes a lock or waits on the disk
+- every WRITER_FLUSH_MS the writer thread takes the whole queue in one exchange,
+  puts it back in the order the lines were produced, and writes each file's lines
+  with writev (WRITER_IOV_MAX lines per call)
+- the files are fsynced never (the default), after every batch, or at most every N ms,
+  so a crash loses at most the last batch (or the last N ms) of output
+- the files can be tailed while the crawl runs
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "writer.h"
+
+// whether writer_start was called
+static bool started = false;
+// queued lines, newest first; only accessed atomically
+static WRITER_LINE *queue = NULL;
+// files appended to (-1 if not written)
+static int fds[NUM_WRITER_FILES] = {-1, -1, -1};
+static long fsync_policy = WRITER_FSYNC_NEVER;
+static pthread_t writer_thread;
+// posted by writer_stop to wake the writer thread before its next tick
+static sem_t wake;
+static bool stopping = false;
+// only accessed by the writer thread until it is joined
+static WRITER_STATS stats;
+static bool dirty[NUM_WRITER_FILES];
+static bool failed = false;
+
+/**
+ * @brief current time of the monotonic clock
+ * @return time in ms
+ */
+static uint64_t clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief write all of the buffers to a file, continuing after partial writes
+ * @param fd int: file to write to
+ * @param iov struct iovec*: buffers to write; modified
+ * @param n int: number of buffers
+ * @return 0 on success; 1 otherwise
+ */
+static int write_all(int fd, struct iovec *iov, int n)
+{
+    while (n > 0)
+    {
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 1;
+        }
+        ++stats.writevs;
+
+        // skip what was written; a partial write leaves the rest for the next writev
+        while (n > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            ++iov;
+            --n;
+        }
+        if (n > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief write every queued line to its file
+ */
+static void write_batch()
+{
+    WRITER_LINE *lines = __atomic_exchange_n(&queue, NULL, __ATOMIC_ACQUIRE);
+    if (lines == NULL)
+    {
+        return;
+    }
+
+    // the queue is newest first: reverse it into the order the lines were produced
+    WRITER_LINE *ordered = NULL;
+    while (lines != NULL)
+    {
+        WRITER_LINE *next = lines->next;
+        lines->next = ordered;
+        ordered = lines;
+        lines = next;
+    }
+
+    struct iovec iov[WRITER_IOV_MAX];
+    for (int f = 0; f < NUM_WRITER_FILES; ++f)
+    {
+        int n = 0;
+        for (WRITER_LINE *line = ordered; line != NULL; line = line->next)
+        {
+            if (line->file != f)
+            {
+                continue;
+            }
+            iov[n].iov_base = line->text;
+            iov[n].iov_len = line->len;
+            ++n;
+            ++stats.lines[f];
+            dirty[f] = true;
+            if (n == WRITER_IOV_MAX)
+            {
+                failed |= write_all(fds[f], iov, n) != 0;
+                n = 0;
+            }
+        }
+        if (n > 0)
+        {
+            failed |= write_all(fds[f], iov, n) != 0;
+        }
+    }
+    ++stats.batches;
+
+    while (ordered != NULL)
+    {
+        WRITER_LINE *next = ordered->next;
+        free(ordered);
+        ordered = next;
+    }
+}
+
+/**
+ * @brief fsync the files written since the last fsync
+ */
+static void sync_files()
+{
+    for (int f = 0; f < NUM_WRITER_FILES; ++f)
+    {
+        if (dirty[f] && fds[f] >= 0)
+        {
+            fdatasync(fds[f]);
+            ++stats.fsyncs;
+            dirty[f] = false;
+        }
+    }
+}
+
+/**
+ * @brief writer thread: writes the queued lines every WRITER_FLUSH_MS until writer_stop
+ * @param _ void*: not used; only defined to satisfy thread API
+ * @return NULL
+ */
+static void *writer_main(void *_)
+{
+    uint64_t last_sync = clock_ms();
+    bool stop = false;
+    while (!stop)
+    {
+        // wait for the next tick, or for writer_stop
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WRITER_FLUSH_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (sem_timedwait(&wake, &deadline) != 0 && errno == EINTR)
+        {
+        }
+        // lines produced before writer_stop was called are in the queue by now
+        stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+
+        write_batch();
+        if (fsync_policy == WRITER_FSYNC_BATCH ||
+            (fsync_policy > 0 && (stop || clock_ms() - last_sync >= fsync_policy)))
+        {
+            sync_files();
+            last_sync = clock_ms();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief open (truncate) the output files and start the writer thread
+ * @param pngs_path const char*: file for png urls
+ * @param visited_path const char*: file for visited urls; NULL to not log them
+ * @param records_path const char*: file for crawl records; NULL to not write them
+ * @param policy long: WRITER_FSYNC_NEVER, WRITER_FSYNC_BATCH or the most ms between fsyncs
+ * @return 0 on success; 1 otherwise
+ */
+int writer_start(const char *pngs_path, const char *visited_path, const char *records_path, long policy)
+{
+    const char *paths[NUM_WRITER_FILES] = {pngs_path, visited_path, records_path};
+    for (int f = 0; f < NUM_WRITER_FILES; ++f)
+    {
+        if (paths[f] == NULL)
+        {
+            continue;
+        }
+        fds[f] = open(paths[f], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fds[f] < 0)
+        {
+            fprintf(stderr, "writer: opening %s failed: %s\n", paths[f], strerror(errno));
+            return 1;
+        }
+    }
+
+    memset(&stats, 0, sizeof(WRITER_STATS));
+    fsync_policy = policy;
+    stopping = false;
+    failed = false;
+    sem_init(&wake, 0, 0);
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0)
+    {
+        return 1;
+    }
+    started = true;
+    return 0;
+}
+
+/**
+ * @brief allocate a queued line for a file
+ * @param file int: WRITER_PNGS, WRITER_VISITED or WRITER_RECORDS
+ * @param len size_t: bytes of text
+ * @return the line (its text is to be filled in); NULL if the file isn't written or on error
+ */
+static WRITER_LINE *new_line(int file, size_t len)
+{
+    if (!started || fds[file] < 0)
+    {
+        return NULL;
+    }
+
+    WRITER_LINE *node = malloc(sizeof(WRITER_LINE) + len);
+    if (node == NULL)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    node->file = file;
+    node->len = len;
+    return node;
+}
+
+/**
+ * @brief push a filled in line onto the queue
+ * @param node WRITER_LINE*: line allocated by new_line
+ */
+static void push_line(WRITER_LINE *node)
+{
+    node->next = __atomic_load_n(&queue, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&queue, &node->next, node, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/**
+ * @brief queue a line for a file; the writer thread appends it (with a '\n') at its next tick
+ * @param file int: WRITER_PNGS, WRITER_VISITED or WRITER_RECORDS
+ * @param line const char*: line to append
+ * @note does nothing unless the writer was started with that file
+ */
+void writer_append(int file, const char *line)
+{
+    size_t len = strlen(line);
+    WRITER_LINE *node = new_line(file, len + 1);
+    if (node == NULL)
+    {
+        return;
+    }
+    memcpy(node->text, line, len);
+    node->text[len] = '\n';
+    push_line(node);
+}
+
+/**
+ * @brief queue bytes for a file; the writer thread appends them as they are at its next tick
+ * @param file int: WRITER_PNGS, WRITER_VISITED or WRITER_RECORDS
+ * @param data const void*: bytes to append
+ * @param len size_t: number of bytes
+ * @note does nothing unless the writer was started with that file
+ */
+void writer_append_data(int file, const void *data, size_t len)
+{
+    WRITER_LINE *node = new_line(file, len);
+    if (node == NULL)
+    {
+        return;
+    }
+    memcpy(node->text, data, len);
+    push_line(node);
+}
+
+/**
+ * @brief write the remaining lines, stop the writer thread and close the files
+ * @param stats_out WRITER_STATS*: populated with what the writer did; may be NULL
+ * @return 0 if every line was written; 1 otherwise
+ * @note only call once the threads producing lines have exited
+ */
+int writer_stop(WRITER_STATS *stats_out)
+{
+    if (!started)
+    {
+        return 0;
+    }
+
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    sem_post(&wake);
+    pthread_join(writer_thread, NULL);
+    sem_destroy(&wake);
+    started = false;
+
+    for (int f = 0; f < NUM_WRITER_FILES; ++f)
+    {
+        if (fds[f] >= 0)
+        {
+            close(fds[f]);
+            fds[f] = -1;
+        }
+    }
+    if (stats_out != NULL)
+    {
+        *stats_out = stats;
+    }
+    return failed ? 1 : 0;
+}
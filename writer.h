@@ -0,0 +1,55 @@
+/*
+Streaming output: a writer thread that appends found pngs, visited urls and crawl records to their files as the crawl runs
+*/
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PNG_URLS_FILE "./png_urls.txt"
+#define WRITER_FLUSH_MS 20   /* queued lines are written at least this often */
+#define WRITER_IOV_MAX 1024  /* lines per writev */
+
+// files the writer appends to
+#define WRITER_PNGS 0    /* png_urls.txt */
+#define WRITER_VISITED 1 /* the -v log */
+#define WRITER_RECORDS 2 /* --records */
+#define NUM_WRITER_FILES 3
+
+// fsync policies (a positive policy is the most ms between fsyncs)
+#define WRITER_FSYNC_NEVER -1 /* leave it to the kernel */
+#define WRITER_FSYNC_BATCH 0  /* after every batch written */
+
+// one queued line
+typedef struct writer_line
+{
+    // next line in the queue
+    struct writer_line *next;
+    // WRITER_PNGS, WRITER_VISITED or WRITER_RECORDS
+    int file;
+    // bytes of text (a line includes its '\n')
+    size_t len;
+    char text[];
+} WRITER_LINE;
+
+typedef struct writer_stats
+{
+    // lines written, by file
+    size_t lines[NUM_WRITER_FILES];
+    // batches the writer thread wrote, and the writev and fsync calls it made
+    size_t batches;
+    size_t writevs;
+    size_t fsyncs;
+} WRITER_STATS;
+
+int writer_start(const char *pngs_path, const char *visited_path, const char *records_path, long fsync_policy);
+void writer_append(int file, const char *line);
+void writer_append_data(int file, const void *data, size_t len);
+int writer_stop(WRITER_STATS *stats);
+
+#endif